@@ -0,0 +1,148 @@
+# Builds the filesystem image from a compressed copy of data/.
+#
+# Run by PlatformIO before buildfs/uploadfs (see extra_scripts). Each asset
+# is gzipped when that makes it smaller, pages get their asset references
+# versioned with the asset's ETag, and etags.txt lists every stored file
+# with its strong ETag and caching class for the asset handler. With
+# custom_data_trim enabled, files no page references are left out, except
+# animations, which the firmware reads itself.
+#
+# Also runs standalone to print the size report:
+#   python3 scripts/compress_data.py data .pio/data
+import gzip
+import hashlib
+import os
+import re
+import shutil
+import sys
+
+PAGES = ("index.html", "configuration.html")
+COMPRESSIBLE = (".html", ".css", ".js", ".json", ".svg", ".txt")
+MANIFEST = "etags.txt"
+ANIMATIONS = (".pba",)
+REFERENCE = re.compile(r'(src|href)="([^"?#:]+)"')
+
+# Estimate only: a typical rate for ESP8266 serving from SPIFFS over WiFi.
+ESTIMATE_BYTES_PER_SECOND = 60 * 1024
+RESPONSE_304_BYTES = 200
+
+
+def etag_of(content):
+    return hashlib.sha256(content).hexdigest()[:16]
+
+
+def references(text):
+    return [match.group(2) for match in REFERENCE.finditer(text)]
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def select_files(source, trim):
+    if not trim:
+        return sorted(name for name in os.listdir(source)
+                      if not name.startswith(".") and os.path.isfile(os.path.join(source, name)))
+
+    selected = set(name for name in os.listdir(source) if name.endswith(ANIMATIONS))
+    for page in PAGES:
+        selected.add(page)
+        text = read(os.path.join(source, page)).decode("utf-8")
+        selected.update(name for name in references(text) if os.path.isfile(os.path.join(source, name)))
+    return sorted(selected)
+
+
+def store(target, name, content):
+    # mtime=0 keeps the output, and so the ETags, identical across builds.
+    if name.endswith(COMPRESSIBLE):
+        packed = gzip.compress(content, 9, mtime=0)
+        if len(packed) < len(content):
+            name += ".gz"
+            content = packed
+
+    with open(os.path.join(target, name), "wb") as f:
+        f.write(content)
+    return name, content
+
+
+def build(source, target, trim=True):
+    if os.path.isdir(target):
+        shutil.rmtree(target)
+    os.makedirs(target)
+
+    names = select_files(source, trim)
+    assets = [name for name in names if name not in PAGES]
+    pages = [name for name in names if name in PAGES]
+
+    stored = {}
+    etags = {}
+    for name in assets:
+        stored[name], content = store(target, name, read(os.path.join(source, name)))
+        etags[name] = etag_of(content)
+
+    # Assets are cached for good, so a page points at the version it was
+    # built with; pages themselves are revalidated on every load.
+    for name in pages:
+        text = read(os.path.join(source, name)).decode("utf-8")
+        text = REFERENCE.sub(lambda m: '%s="%s?v=%s"' % (m.group(1), m.group(2), etags[m.group(2)])
+                             if m.group(2) in etags else m.group(0), text)
+        stored[name], content = store(target, name, text.encode("utf-8"))
+        etags[name] = etag_of(content)
+
+    with open(os.path.join(target, MANIFEST), "w") as f:
+        for name in names:
+            # POST /animation replaces these at runtime, so they are never served as cached assets.
+            if name.endswith(ANIMATIONS):
+                continue
+            kind = "revalidate" if name in pages else "immutable"
+            f.write("/%s %s %s\n" % (stored[name], etags[name], kind))
+
+    report(source, target, pages, stored)
+
+
+def report(source, target, pages, stored):
+    def size(directory, name):
+        return os.path.getsize(os.path.join(directory, name))
+
+    print("%-26s %9s %9s" % ("asset", "raw B", "stored B"))
+    for name in sorted(stored):
+        print("%-26s %9d %9d" % (name, size(source, name), size(target, stored[name])))
+
+    everything = [name for name in os.listdir(source) if os.path.isfile(os.path.join(source, name))]
+    print("image contents %d -> %d B" % (sum(size(source, name) for name in everything),
+                                          sum(size(target, name) for name in os.listdir(target))))
+
+    for page in pages:
+        text = read(os.path.join(source, page)).decode("utf-8")
+        loaded = [page] + [name for name in references(text) if name in stored]
+        blocking = [page] + [name for name in loaded if name.endswith(".css")]
+
+        before = sum(size(source, name) for name in loaded)
+        after = sum(size(target, stored[name]) for name in loaded)
+        paint_before = sum(size(source, name) for name in blocking)
+        paint_after = sum(size(target, stored[name]) for name in blocking)
+        print("%s: %d requests, %d -> %d B on a first load; a repeat load revalidates only the page, ~%d B"
+              % (page, len(loaded), before, after, RESPONSE_304_BYTES))
+        print("  before first paint %d -> %d B, est. %.0f -> %.0f ms at %d KB/s"
+              % (paint_before, paint_after, 1000.0 * paint_before / ESTIMATE_BYTES_PER_SECOND,
+                 1000.0 * paint_after / ESTIMATE_BYTES_PER_SECOND, ESTIMATE_BYTES_PER_SECOND // 1024))
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    from SCons.Script import COMMAND_LINE_TARGETS
+
+    if {"buildfs", "uploadfs", "uploadfsota"} & set(COMMAND_LINE_TARGETS):
+        source = env.subst("$PROJECT_DATA_DIR")
+        target = os.path.join(env.subst("$PROJECT_WORKSPACE_DIR"), "data", env.subst("$PIOENV"))
+        trim = env.GetProjectOption("custom_data_trim", "yes") == "yes"
+
+        build(source, target, trim)
+        env.Replace(PROJECT_DATA_DIR=target)
+elif __name__ == "__main__":
+    build(sys.argv[1], sys.argv[2], len(sys.argv) < 4 or sys.argv[3] != "--no-trim")
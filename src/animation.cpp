@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "animation.h"
+#include "preview.h"
+
+static const uint32_t SECOND = 1000000;
+
+static uint16_t read16(const uint8_t* in) {
+  return (in[0] << 8) | in[1];
+}
+
+static void write16(uint8_t* out, uint16_t value) {
+  out[0] = value >> 8;
+  out[1] = value & 0xff;
+}
+
+bool parseAnimationHeader(const uint8_t* data, size_t length, AnimationHeader& header) {
+  if (length < ANIMATION_HEADER_SIZE || memcmp(data, "PBA", 3) != 0 || data[3] != ANIMATION_VERSION) return false;
+
+  header.pixels = read16(data + 4);
+  header.fps88 = read16(data + 6);
+  header.frames = ((uint32_t) read16(data + 8) << 16) | read16(data + 10);
+  header.keyframeInterval = read16(data + 12);
+  return header.pixels > 0 && header.fps88 > 0 && header.frames > 0;
+}
+
+void writeAnimationHeader(const AnimationHeader& header, uint8_t* out) {
+  memcpy(out, "PBA", 3);
+  out[3] = ANIMATION_VERSION;
+  write16(out + 4, header.pixels);
+  write16(out + 6, header.fps88);
+  write16(out + 8, header.frames >> 16);
+  write16(out + 10, header.frames & 0xffff);
+  write16(out + 12, header.keyframeInterval);
+  write16(out + 14, 0);
+}
+
+size_t animationRecordSize(uint16_t pixels) {
+  return ANIMATION_FRAME_HEADER_SIZE + previewFrameSize(pixels);
+}
+
+size_t encodeAnimationFrame(const CRGB* frame, CRGB* last, uint16_t pixels, bool keyframe, uint8_t* out, size_t size) {
+  if (size < animationRecordSize(pixels)) return 0;
+
+  uint8_t* payload = out + ANIMATION_FRAME_HEADER_SIZE;
+  size_t length = encodePreview(frame, last, pixels, keyframe, payload, size - ANIMATION_FRAME_HEADER_SIZE);
+  if (length == 0) {
+    // Nothing changed: a delta without runs still takes up its frame.
+    payload[0] = PREVIEW_DELTA;
+    write16(payload + 1, pixels);
+    length = PREVIEW_HEADER_SIZE;
+  }
+
+  write16(out, length);
+  return ANIMATION_FRAME_HEADER_SIZE + length;
+}
+
+AnimationPlayer::AnimationPlayer() : source(nullptr), capacity(0), head(0), queued(0), nextRead(0), interval(0),
+    nextFrame(0), secondStart(0), secondFrames(0), active(false) {
+  memset(&header, 0, sizeof(header));
+  memset(&stats, 0, sizeof(stats));
+  memset(buffers, 0, sizeof(buffers));
+  memset(lengths, 0, sizeof(lengths));
+}
+
+AnimationPlayer::~AnimationPlayer() {
+  for (uint8_t i = 0; i < ANIMATION_SLOTS; i++) free(buffers[i]);
+}
+
+// The read-ahead buffers only ever grow, like the compositor's scratch
+// layer, so switching between files does not fragment the heap.
+bool AnimationPlayer::begin(AnimationSource* from, uint16_t maxPixels, uint32_t now) {
+  active = false;
+  source = from;
+  memset(&stats, 0, sizeof(stats));
+
+  uint8_t data[ANIMATION_HEADER_SIZE];
+  if (!source->seek(0) || source->read(data, sizeof(data)) != sizeof(data) ||
+      !parseAnimationHeader(data, sizeof(data), header) || header.pixels > maxPixels) {
+    stats.errors++;
+    return false;
+  }
+
+  size_t size = animationRecordSize(header.pixels);
+  if (size > capacity) {
+    for (uint8_t i = 0; i < ANIMATION_SLOTS; i++) {
+      free(buffers[i]);
+      buffers[i] = (uint8_t*) malloc(size);
+    }
+    capacity = size;
+    for (uint8_t i = 0; i < ANIMATION_SLOTS; i++) {
+      if (!buffers[i]) capacity = 0;
+    }
+    if (capacity == 0) {
+      stats.errors++;
+      return false;
+    }
+  }
+
+  head = 0;
+  queued = 0;
+  nextRead = 0;
+  interval = (256 * SECOND) / header.fps88;
+  nextFrame = now;
+  secondStart = now;
+  secondFrames = 0;
+  active = true;
+
+  // The first frame is due straight away, so it is read now.
+  return prefetch();
+}
+
+void AnimationPlayer::stop() {
+  active = false;
+  source = nullptr;
+}
+
+bool AnimationPlayer::playing() const {
+  return active;
+}
+
+void AnimationPlayer::fail() {
+  stats.errors++;
+  active = false;
+}
+
+// Reads the next record into slot, going back to the first frame after
+// the last.
+bool AnimationPlayer::readRecord(uint8_t slot) {
+  if (nextRead == header.frames) {
+    if (!source->seek(ANIMATION_HEADER_SIZE)) {
+      fail();
+      return false;
+    }
+    nextRead = 0;
+    stats.loops++;
+  }
+
+  uint8_t size[ANIMATION_FRAME_HEADER_SIZE];
+  if (source->read(size, sizeof(size)) != sizeof(size)) {
+    fail();
+    return false;
+  }
+
+  uint16_t length = read16(size);
+  if (length < PREVIEW_HEADER_SIZE || length > capacity || source->read(buffers[slot], length) != length) {
+    fail();
+    return false;
+  }
+
+  lengths[slot] = length;
+  nextRead++;
+  return true;
+}
+
+// Reads one record ahead if a slot is free; returns whether it did, so the
+// caller can keep going while it has time to spare.
+bool AnimationPlayer::prefetch() {
+  if (!active || queued == ANIMATION_SLOTS) return false;
+
+  if (!readRecord((head + queued) % ANIMATION_SLOTS)) return false;
+  queued++;
+  stats.prefetched++;
+  return true;
+}
+
+// Decodes the next frame into leds once it is due; returns whether it did.
+bool AnimationPlayer::advance(CRGB* leds, uint32_t now) {
+  if (!active || (int32_t) (now - nextFrame) < 0) return false;
+
+  if (queued == 0) {
+    stats.stalls++;
+    if (!readRecord(head)) return false;
+    queued = 1;
+  }
+
+  if (!decodePreview(buffers[head], lengths[head], leds, header.pixels)) {
+    fail();
+    return false;
+  }
+  head = (head + 1) % ANIMATION_SLOTS;
+  queued--;
+  stats.frames++;
+
+  nextFrame += interval;
+  if ((int32_t) (now - nextFrame) >= 0) {
+    stats.late++;
+    nextFrame = now + interval;
+  }
+
+  if (now - secondStart >= SECOND) {
+    stats.fps = secondFrames;
+    secondFrames = 0;
+    secondStart = now - secondStart < 2 * SECOND ? secondStart + SECOND : now;
+  }
+  secondFrames++;
+  return true;
+}
+
+const AnimationHeader& AnimationPlayer::getHeader() const {
+  return header;
+}
+
+const AnimationStats& AnimationPlayer::getStats() const {
+  return stats;
+}
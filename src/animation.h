@@ -0,0 +1,93 @@
+#pragma once
+
+#include <FastLED.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ANIMATION_FILE "/animation.pba"
+
+const uint8_t ANIMATION_VERSION = 1;
+const size_t ANIMATION_HEADER_SIZE = 16;
+const size_t ANIMATION_FRAME_HEADER_SIZE = 2;
+const uint8_t ANIMATION_SLOTS = 2;
+
+// A .pba file is a header followed by one record per frame, big-endian
+// like the preview frames it reuses:
+//   header  "PBA" version:8 pixels:16 fps88:16 frames:32 keyframeInterval:16 reserved:16
+//   frame   [size:16][preview keyframe or delta of size bytes]
+// The first frame is a keyframe so playback can loop back to it; a delta
+// with no runs repeats the previous frame.
+struct AnimationHeader {
+  uint16_t pixels;
+  uint16_t fps88;
+  uint32_t frames;
+  uint16_t keyframeInterval;
+};
+
+bool parseAnimationHeader(const uint8_t* data, size_t length, AnimationHeader& header);
+void writeAnimationHeader(const AnimationHeader& header, uint8_t* out);
+size_t animationRecordSize(uint16_t pixels);
+
+// Encodes frame as its record, keeping last as the previous frame for
+// deltas. Returns the record size, or 0 when out is too small.
+size_t encodeAnimationFrame(const CRGB* frame, CRGB* last, uint16_t pixels, bool keyframe, uint8_t* out, size_t size);
+
+// Where frames are read from: a file on the device, memory on the host.
+class AnimationSource {
+public:
+  virtual ~AnimationSource() {}
+
+  virtual size_t read(uint8_t* data, size_t length) = 0;
+  virtual bool seek(uint32_t position) = 0;
+};
+
+struct AnimationStats {
+  uint32_t frames;
+  uint32_t loops;
+  uint32_t prefetched;
+  uint32_t stalls;
+  uint32_t late;
+  uint32_t errors;
+  uint16_t fps;
+};
+
+// Plays a file a frame at a time into leds[]. Up to ANIMATION_SLOTS frame
+// records are read ahead with prefetch() in the time between frames, so a
+// slow read does not hold up a frame; a frame that falls due before its
+// record was read ahead is read on the spot and counted as a stall. Frames
+// are never skipped, since a delta needs the frame before it: a frame more
+// than one interval late resets the schedule instead and counts as late.
+class AnimationPlayer {
+public:
+  AnimationPlayer();
+  ~AnimationPlayer();
+
+  bool begin(AnimationSource* from, uint16_t maxPixels, uint32_t now);
+  void stop();
+  bool playing() const;
+
+  bool prefetch();
+  bool advance(CRGB* leds, uint32_t now);
+
+  const AnimationHeader& getHeader() const;
+  const AnimationStats& getStats() const;
+
+private:
+  bool readRecord(uint8_t slot);
+  void fail();
+
+  AnimationSource* source;
+  AnimationHeader header;
+  AnimationStats stats;
+  uint8_t* buffers[ANIMATION_SLOTS];
+  uint16_t lengths[ANIMATION_SLOTS];
+  size_t capacity;
+  uint8_t head;
+  uint8_t queued;
+  uint32_t nextRead;
+  uint32_t interval;
+  uint32_t nextFrame;
+  uint32_t secondStart;
+  uint16_t secondFrames;
+  bool active;
+};
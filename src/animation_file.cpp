@@ -0,0 +1,22 @@
+#include "animation_file.h"
+
+AnimationFile::AnimationFile(FS& fs) : fs(fs) {
+}
+
+bool AnimationFile::open(const char* path) {
+  file.close();
+  file = fs.open(path, "r");
+  return (bool) file;
+}
+
+void AnimationFile::close() {
+  file.close();
+}
+
+size_t AnimationFile::read(uint8_t* data, size_t length) {
+  return file ? file.read(data, length) : 0;
+}
+
+bool AnimationFile::seek(uint32_t position) {
+  return file && file.seek(position, SeekSet);
+}
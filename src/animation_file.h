@@ -0,0 +1,21 @@
+#pragma once
+
+#include <FS.h>
+
+#include "animation.h"
+
+// An animation stored on the filesystem, read a record at a time.
+class AnimationFile : public AnimationSource {
+public:
+  AnimationFile(FS& fs);
+
+  bool open(const char* path);
+  void close();
+
+  size_t read(uint8_t* data, size_t length) override;
+  bool seek(uint32_t position) override;
+
+private:
+  FS& fs;
+  File file;
+};
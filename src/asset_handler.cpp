@@ -0,0 +1,71 @@
+#include "asset_handler.h"
+
+static const char* IMMUTABLE_CACHE = "public, max-age=31536000, immutable";
+static const char* REVALIDATE_CACHE = "no-cache";
+
+AssetHandler::AssetHandler(FS& fs) : fs(fs), defaultFile("index.html") {
+}
+
+bool AssetHandler::begin() {
+  File manifest = fs.open(ASSET_MANIFEST, "r");
+  if (!manifest) return false;
+
+  static char text[ASSET_MANIFEST_SIZE];
+  size_t length = manifest.readBytes(text, sizeof(text));
+  manifest.close();
+
+  return index.load(text, length) > 0;
+}
+
+void AssetHandler::setDefaultFile(const char* file) {
+  defaultFile = file;
+}
+
+const AssetEntry* AssetHandler::lookup(AsyncWebServerRequest *request) const {
+  const String& url = request -> url();
+  if (!url.endsWith("/")) return index.find(url.c_str());
+
+  char path[ASSET_PATH_SIZE];
+  int length = snprintf(path, sizeof(path), "%s%s", url.c_str(), defaultFile);
+  if (length < 0 || length >= (int) sizeof(path)) return nullptr;
+  return index.find(path);
+}
+
+bool AssetHandler::canHandle(AsyncWebServerRequest *request) {
+  if (request -> method() != HTTP_GET || !lookup(request)) return false;
+
+  request -> addInterestingHeader("If-None-Match");
+  return true;
+}
+
+void AssetHandler::handleRequest(AsyncWebServerRequest *request) {
+  const AssetEntry *asset = lookup(request);
+  if (!asset) {
+    request -> send(404);
+    return;
+  }
+
+  char etag[ASSET_ETAG_SIZE + 2];
+  snprintf(etag, sizeof(etag), "\"%s\"", asset -> etag);
+
+  AsyncWebServerResponse *response;
+  AsyncWebHeader *ifNoneMatch = request -> getHeader("If-None-Match");
+  if (ifNoneMatch && etagMatches(ifNoneMatch -> value().c_str(), asset -> etag)) {
+    response = request -> beginResponse(304);
+  } else {
+    // Opening the stored file directly skips the exists() probes a plain
+    // path would cost; a ".gz" name makes the response add Content-Encoding.
+    String stored = asset -> path;
+    if (asset -> gzip) stored += ".gz";
+    File file = fs.open(stored, "r");
+    if (!file) {
+      request -> send(404);
+      return;
+    }
+    response = request -> beginResponse(file, asset -> path);
+  }
+
+  response -> addHeader("ETag", etag);
+  response -> addHeader("Cache-Control", asset -> immutable ? IMMUTABLE_CACHE : REVALIDATE_CACHE);
+  request -> send(response);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <FS.h>
+#include <ESPAsyncWebServer.h>
+
+#include "asset_index.h"
+
+// Serves the files listed in ASSET_MANIFEST, gzipped when stored that way,
+// with strong ETags. Pages are revalidated on every load and answered with
+// 304 while unchanged; the assets they reference carry their ETag in the
+// URL and are cached for good.
+class AssetHandler : public AsyncWebHandler {
+public:
+  AssetHandler(FS& fs);
+
+  bool begin();
+  void setDefaultFile(const char* file);
+
+  bool canHandle(AsyncWebServerRequest *request) override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+  bool isRequestHandlerTrivial() override { return false; }
+
+private:
+  const AssetEntry* lookup(AsyncWebServerRequest *request) const;
+
+  FS& fs;
+  AssetIndex index;
+  const char* defaultFile;
+};
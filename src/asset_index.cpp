@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "asset_index.h"
+
+static const char GZIP_SUFFIX[] = ".gz";
+static const size_t GZIP_SUFFIX_LENGTH = sizeof(GZIP_SUFFIX) - 1;
+
+AssetIndex::AssetIndex() : entryCount(0) {
+}
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Splits the next whitespace-separated token off the line [*cursor, end).
+static size_t nextToken(const char*& cursor, const char* end, const char*& token) {
+  while (cursor < end && isSpace(*cursor)) cursor++;
+  token = cursor;
+  while (cursor < end && !isSpace(*cursor)) cursor++;
+  return cursor - token;
+}
+
+uint8_t AssetIndex::load(const char* text, size_t length) {
+  entryCount = 0;
+  const char* end = text + length;
+
+  while (text < end && entryCount < MAX_ASSETS) {
+    const char* lineEnd = (const char*) memchr(text, '\n', end - text);
+    if (!lineEnd) lineEnd = end;
+
+    const char* cursor = text;
+    const char* path;
+    const char* etag;
+    const char* kind;
+    size_t pathLength = nextToken(cursor, lineEnd, path);
+    size_t etagLength = nextToken(cursor, lineEnd, etag);
+    size_t kindLength = nextToken(cursor, lineEnd, kind);
+    text = lineEnd + 1;
+
+    if (pathLength == 0 || pathLength >= ASSET_PATH_SIZE || path[0] != '/') continue;
+    if (etagLength == 0 || etagLength >= ASSET_ETAG_SIZE || kindLength == 0) continue;
+
+    AssetEntry& entry = entries[entryCount++];
+    entry.gzip = pathLength > GZIP_SUFFIX_LENGTH &&
+      memcmp(path + pathLength - GZIP_SUFFIX_LENGTH, GZIP_SUFFIX, GZIP_SUFFIX_LENGTH) == 0;
+    if (entry.gzip) pathLength -= GZIP_SUFFIX_LENGTH;
+
+    memcpy(entry.path, path, pathLength);
+    entry.path[pathLength] = '\0';
+    memcpy(entry.etag, etag, etagLength);
+    entry.etag[etagLength] = '\0';
+    entry.immutable = kindLength == 9 && memcmp(kind, "immutable", 9) == 0;
+  }
+
+  return entryCount;
+}
+
+const AssetEntry* AssetIndex::find(const char* path) const {
+  for (uint8_t i = 0; i < entryCount; i++) {
+    if (strcmp(entries[i].path, path) == 0) return &entries[i];
+  }
+  return nullptr;
+}
+
+uint8_t AssetIndex::count() const {
+  return entryCount;
+}
+
+bool etagMatches(const char* ifNoneMatch, const char* etag) {
+  size_t etagLength = strlen(etag);
+  const char* cursor = ifNoneMatch;
+
+  while (*cursor) {
+    while (*cursor == ' ' || *cursor == ',') cursor++;
+    if (*cursor == '*') return true;
+    if (cursor[0] == 'W' && cursor[1] == '/') cursor += 2;
+    if (*cursor != '"') return false;
+
+    const char* tag = ++cursor;
+    while (*cursor && *cursor != '"') cursor++;
+    if (*cursor != '"') return false;
+
+    if ((size_t) (cursor - tag) == etagLength && memcmp(tag, etag, etagLength) == 0) return true;
+    cursor++;
+  }
+
+  return false;
+}
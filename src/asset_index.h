@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t MAX_ASSETS = 16;
+const size_t ASSET_PATH_SIZE = 32;
+const size_t ASSET_ETAG_SIZE = 17;
+const size_t ASSET_MANIFEST_SIZE = 1024;
+#define ASSET_MANIFEST "/etags.txt"
+
+struct AssetEntry {
+  char path[ASSET_PATH_SIZE];
+  char etag[ASSET_ETAG_SIZE];
+  bool gzip;
+  bool immutable;
+};
+
+// The files of the filesystem image as listed in ASSET_MANIFEST by
+// scripts/compress_data.py, one "<stored path> <etag> <immutable|revalidate>"
+// line each. Compressed files are stored with ".gz" appended and looked up
+// by the path they are requested under.
+class AssetIndex {
+public:
+  AssetIndex();
+
+  uint8_t load(const char* text, size_t length);
+  const AssetEntry* find(const char* path) const;
+  uint8_t count() const;
+
+private:
+  AssetEntry entries[MAX_ASSETS];
+  uint8_t entryCount;
+};
+
+// If-None-Match is "*" or a list of entity tags, each possibly weak; they
+// are compared by opaque tag only, as RFC 7232 asks for this header.
+bool etagMatches(const char* ifNoneMatch, const char* etag);
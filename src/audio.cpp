@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <FastLED.h>
+
+#ifndef ARDUINO
+#define IRAM_ATTR
+#endif
+
+#include "audio.h"
+
+AudioFeatures audioFeatures;
+
+// Band edges in FFT bins, roughly even on a log scale from 31 Hz up.
+static const uint8_t bandEdges[AUDIO_BANDS + 1] = {1, 2, 3, 5, 8, 13, 21, 34, AUDIO_WINDOW / 2};
+// Kicks and bass carry the beat, so rises there count double.
+static const uint8_t bandWeights[AUDIO_BANDS] = {2, 2, 2, 1, 1, 1, 1, 1};
+
+// Windows per minute in 8.8, the unit tempo is measured in.
+static const uint32_t WINDOWS_PER_MINUTE_88 = 60UL * AUDIO_SAMPLE_RATE * 256 / AUDIO_WINDOW;
+// Flux needed on top of the adaptive threshold, about a 1.7x rise in one band.
+static const uint16_t MIN_FLUX = 192;
+// Band energy a few counts of ADC noise reach; changes below it are not flux.
+static const uint16_t NOISE_FLOOR = 64;
+
+static int16_t hann[AUDIO_WINDOW];
+
+SampleBuffer::SampleBuffer() : filling(0), count(0), ready(false), overruns(0) {
+}
+
+void IRAM_ATTR SampleBuffer::push(uint16_t sample) {
+  windows[filling][count] = sample;
+  if (++count < AUDIO_WINDOW) return;
+
+  count = 0;
+  if (ready) {
+    overruns++;
+    return;
+  }
+
+  ready = true;
+  filling ^= 1;
+}
+
+const int16_t* SampleBuffer::take() {
+  return ready ? windows[filling ^ 1] : nullptr;
+}
+
+void SampleBuffer::release() {
+  ready = false;
+}
+
+uint16_t SampleBuffer::getOverruns() const {
+  return overruns;
+}
+
+SampleClock::SampleClock() : next(0), secondSamples(0), secondHeld(0), stats() {
+}
+
+void SampleClock::start(uint32_t now) {
+  next = now;
+}
+
+uint32_t SampleClock::due(uint32_t now) {
+  const uint32_t interval = 1000000UL / AUDIO_SAMPLE_RATE;
+  if ((int32_t) (now - next) < 0) return 0;
+
+  uint32_t count = 1 + (now - next) / interval;
+  if (count > AUDIO_WINDOW) {
+    count = 1;
+    next = now;
+  }
+  next += count * interval;
+
+  stats.samples += count;
+  stats.held += count - 1;
+  secondSamples += count;
+  secondHeld += count - 1;
+  if (secondSamples >= AUDIO_SAMPLE_RATE) {
+    stats.heldPercent = secondHeld * 100 / secondSamples;
+    secondSamples = 0;
+    secondHeld = 0;
+  }
+  return count;
+}
+
+const SamplingStats& SampleClock::getStats() const {
+  return stats;
+}
+
+// log2(x) in 8.8, with the fraction read linearly off the bits below the top one.
+static uint16_t log2q8(uint32_t x) {
+  if (x == 0) return 0;
+
+  uint8_t top = 31 - __builtin_clz(x);
+  uint32_t fraction = top >= 8 ? (x >> (top - 8)) & 0xff : (x << (8 - top)) & 0xff;
+  return (top << 8) | fraction;
+}
+
+static uint16_t squareRoot(uint32_t x) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > x) bit >>= 2;
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+// In-place radix-2 FFT of 1 << bits points in Q15. Each stage halves its
+// output so nothing overflows; the result is the transform divided by n.
+void fixedFft(int16_t* real, int16_t* imag, uint8_t bits) {
+  uint16_t n = 1 << bits;
+
+  for (uint16_t i = 1, j = 0; i < n; i++) {
+    uint16_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+
+    if (i < j) {
+      int16_t t = real[i];
+      real[i] = real[j];
+      real[j] = t;
+      t = imag[i];
+      imag[i] = imag[j];
+      imag[j] = t;
+    }
+  }
+
+  for (uint8_t stage = 1; stage <= bits; stage++) {
+    uint16_t half = 1 << (stage - 1);
+    uint16_t angleStep = 65536UL >> stage;
+
+    for (uint16_t k = 0; k < half; k++) {
+      int32_t wr = cos16(k * angleStep);
+      int32_t wi = sin16(k * angleStep);
+
+      for (uint16_t a = k; a < n; a += half << 1) {
+        uint16_t b = a + half;
+        int32_t tr = (wr * real[b] + wi * imag[b]) >> 15;
+        int32_t ti = (wr * imag[b] - wi * real[b]) >> 15;
+
+        real[b] = (real[a] - tr) >> 1;
+        imag[b] = (imag[a] - ti) >> 1;
+        real[a] = (real[a] + tr) >> 1;
+        imag[a] = (imag[a] + ti) >> 1;
+      }
+    }
+  }
+}
+
+AudioAnalyzer::AudioAnalyzer() {
+  if (hann[AUDIO_WINDOW / 2] == 0) {
+    for (uint16_t i = 0; i < AUDIO_WINDOW; i++) hann[i] = (32767 - cos16(i * (65536UL / AUDIO_WINDOW))) / 2;
+  }
+  reset();
+}
+
+void AudioAnalyzer::reset() {
+  memset(bandLog, 0, sizeof(bandLog));
+  memset(fluxHistory, 0, sizeof(fluxHistory));
+  memset(onsetStrength, 0, sizeof(onsetStrength));
+  frame = 0;
+  sinceOnset = 0;
+  period88 = WINDOWS_PER_MINUTE_88 / 120;
+  pendingPeriod88 = 0;
+  phase = 0;
+  centroid88 = 0;
+  primed = false;
+}
+
+void AudioAnalyzer::analyze(const int16_t* samples, AudioFeatures& features) {
+  static int16_t real[AUDIO_WINDOW];
+  static int16_t imag[AUDIO_WINDOW];
+
+  int32_t sum = 0;
+  for (uint16_t i = 0; i < AUDIO_WINDOW; i++) sum += samples[i];
+  int16_t mean = sum >> AUDIO_WINDOW_BITS;
+
+  uint32_t power = 0;
+  for (uint16_t i = 0; i < AUDIO_WINDOW; i++) {
+    int32_t sample = samples[i] - mean;
+    if (sample > 1023) sample = 1023;
+    if (sample < -1023) sample = -1023;
+    power += sample * sample;
+    // 10-bit samples scaled up to fill Q15 before windowing.
+    real[i] = (sample * 32 * hann[i]) >> 15;
+    imag[i] = 0;
+  }
+
+  fixedFft(real, imag, AUDIO_WINDOW_BITS);
+
+  uint32_t flux = 0;
+  uint32_t total = 0;
+  uint32_t weighted = 0;
+  for (uint8_t band = 0; band < AUDIO_BANDS; band++) {
+    uint32_t energy = 0;
+    for (uint8_t bin = bandEdges[band]; bin < bandEdges[band + 1]; bin++) {
+      uint16_t re = abs(real[bin]);
+      uint16_t im = abs(imag[bin]);
+      // Alpha max plus beta min, within 4% of the true magnitude.
+      energy += re > im ? re + (im * 3 >> 3) : im + (re * 3 >> 3);
+    }
+
+    uint16_t level = log2q8(energy + NOISE_FLOOR);
+    if (primed && level > bandLog[band]) flux += (level - bandLog[band]) * bandWeights[band];
+    bandLog[band] = level;
+
+    total += energy;
+    weighted += energy * band;
+  }
+
+  uint16_t centroid = total > 0 ? (weighted << 8) / total : 0;
+  centroid88 = (centroid88 * 7 + centroid) >> 3;
+
+  bool onset = primed && detectOnset(flux > 0xffff ? 0xffff : flux);
+  onsetStrength[frame % AUDIO_TEMPO_FRAMES] = flux >> 2 > 255 ? 255 : flux >> 2;
+  frame++;
+  primed = true;
+
+  // Tempo needs a couple of seconds of onsets to go on.
+  if (frame % TEMPO_INTERVAL == 0 && frame >= AUDIO_TEMPO_FRAMES / 2) estimateTempo();
+  trackBeat(onset, features);
+
+  features.windows++;
+  if (onset) features.onsets++;
+  uint16_t rms = squareRoot(power >> AUDIO_WINDOW_BITS);
+  features.level = rms > 255 ? 255 : rms;
+  features.hue = centroid88 >> 3;
+  features.onsetStrength = onsetStrength[(frame - 1) % AUDIO_TEMPO_FRAMES];
+  features.bpm88 = WINDOWS_PER_MINUTE_88 * 256 / period88;
+}
+
+bool AudioAnalyzer::detectOnset(uint16_t flux) {
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < FLUX_HISTORY; i++) sum += fluxHistory[i];
+  uint16_t mean = sum / FLUX_HISTORY;
+
+  uint32_t deviation = 0;
+  for (uint8_t i = 0; i < FLUX_HISTORY; i++) deviation += abs((int32_t) fluxHistory[i] - mean);
+  deviation /= FLUX_HISTORY;
+
+  // Kept no higher than the threshold, so one loud onset does not hide
+  // a quieter one right after it.
+  uint32_t threshold = mean + deviation * 3 / 2 + MIN_FLUX;
+  fluxHistory[frame % FLUX_HISTORY] = flux < threshold ? flux : threshold;
+  if (sinceOnset < 255) sinceOnset++;
+
+  if (flux < threshold || sinceOnset < MIN_ONSET_GAP) return false;
+
+  sinceOnset = 0;
+  return true;
+}
+
+// Picks the lag at which the onset strength best repeats, preferring
+// tempos near 120 BPM so a beat is not read as half or double time.
+void AudioAnalyzer::estimateTempo() {
+  static const uint8_t minLag = WINDOWS_PER_MINUTE_88 / 256 / AUDIO_MAX_BPM;
+  static const uint8_t maxLag = WINDOWS_PER_MINUTE_88 / 256 / AUDIO_MIN_BPM + 1;
+  static int32_t correlation[maxLag + 2];
+  static int16_t strength[AUDIO_TEMPO_FRAMES];
+
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < AUDIO_TEMPO_FRAMES; i++) sum += onsetStrength[i];
+  int16_t mean = sum / AUDIO_TEMPO_FRAMES;
+
+  // Oldest first, spread over the neighbouring windows so a period that
+  // falls between whole windows still lines up with itself.
+  for (uint8_t i = 0; i < AUDIO_TEMPO_FRAMES; i++) {
+    uint8_t before = onsetStrength[(frame + i + AUDIO_TEMPO_FRAMES - 1) % AUDIO_TEMPO_FRAMES];
+    uint8_t after = onsetStrength[(frame + i + 1) % AUDIO_TEMPO_FRAMES];
+    strength[i] = ((before + 2 * onsetStrength[(frame + i) % AUDIO_TEMPO_FRAMES] + after) >> 2) - mean;
+  }
+
+  for (uint8_t lag = minLag - 1; lag <= maxLag + 1; lag++) {
+    int32_t c = 0;
+    for (uint8_t i = lag; i < AUDIO_TEMPO_FRAMES; i++) c += strength[i] * strength[i - lag];
+    correlation[lag] = c / (AUDIO_TEMPO_FRAMES - lag);
+  }
+
+  uint16_t preferredLag88 = WINDOWS_PER_MINUTE_88 / 120;
+  uint8_t best = 0;
+  int32_t bestScore = 0;
+  for (uint8_t lag = minLag; lag <= maxLag; lag++) {
+    if (correlation[lag] <= 0) continue;
+
+    // An octave away from 120 BPM halves the score.
+    int32_t octaves88 = (int32_t) log2q8((uint32_t) lag << 8) - log2q8(preferredLag88);
+    int32_t weight = 256 - (octaves88 * octaves88 >> 9);
+    int32_t score = (correlation[lag] >> 4) * weight;
+    if (score > bestScore) {
+      bestScore = score;
+      best = lag;
+    }
+  }
+  if (best == 0) return;
+
+  // A period that falls between whole windows correlates better at twice
+  // the lag, so a strong peak at half the lag is the real beat.
+  uint8_t half = 0;
+  for (uint8_t lag = (best + 1) / 2 - 1; lag <= (best + 1) / 2 + 1; lag++) {
+    if (lag >= minLag && (half == 0 || correlation[lag] > correlation[half])) half = lag;
+  }
+  if (half != 0 && correlation[half] * 4 >= correlation[best] * 3) best = half;
+
+  // A parabola through the peak and its neighbours places it between lags.
+  int32_t before = correlation[best - 1];
+  int32_t peak = correlation[best];
+  int32_t after = correlation[best + 1];
+  int32_t curve = before - 2 * peak + after;
+  int32_t offset88 = curve < 0 ? (before - after) * 128 / curve : 0;
+  if (offset88 > 128) offset88 = 128;
+  if (offset88 < -128) offset88 = -128;
+  uint32_t candidate88 = ((uint32_t) best << 8) + offset88;
+
+  // Small changes are followed smoothly; a jump has to be seen twice.
+  uint32_t difference = candidate88 > period88 ? candidate88 - period88 : period88 - candidate88;
+  if (difference * 10 <= period88) {
+    period88 = (period88 * 3 + candidate88) / 4;
+    pendingPeriod88 = 0;
+  } else if (pendingPeriod88 != 0 && (candidate88 > pendingPeriod88 ? candidate88 - pendingPeriod88 :
+      pendingPeriod88 - candidate88) * 10 <= pendingPeriod88) {
+    period88 = candidate88;
+    pendingPeriod88 = 0;
+  } else {
+    pendingPeriod88 = candidate88;
+  }
+}
+
+void AudioAnalyzer::trackBeat(bool onset, AudioFeatures& features) {
+  phase += (65536UL << 8) / period88;
+  if (phase >= 65536) {
+    phase -= 65536;
+    features.beats++;
+  }
+
+  // An onset within a quarter beat of where one was expected pulls the
+  // phase halfway onto it; others are off-beat and leave it alone.
+  if (onset) {
+    int16_t error = (int16_t) (uint16_t) phase;
+    if (error > -16384 && error < 16384) phase = (uint16_t) (phase - error / 2);
+  }
+
+  features.beatPhase = phase;
+}
+
+uint16_t extrapolateBeatPhase(const AudioFeatures& features, uint32_t sinceWindowMs) {
+  return features.beatPhase + (uint16_t) ((uint64_t) sinceWindowMs * features.bpm88 * 65536 / (60000UL * 256));
+}
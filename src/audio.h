@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+
+const uint16_t AUDIO_SAMPLE_RATE = 4000;
+const uint8_t AUDIO_WINDOW_BITS = 7;
+const uint16_t AUDIO_WINDOW = 1 << AUDIO_WINDOW_BITS;
+const uint8_t AUDIO_BANDS = 8;
+// Time a WS2812 strip takes to show each pixel, with interrupts and the
+// loop held off throughout, so no samples are read.
+const uint8_t SHOW_MICROS_PER_PIXEL = 30;
+// Longest strip the audio mode is checked to follow the beat on at any
+// frame rate. Showing it holds the last sample for 4.5 ms; past it, beats
+// start to vanish into the held runs, most of all when the frame rate
+// locks to the tempo, and the tempo found drifts or halves.
+const uint16_t AUDIO_MAX_LEDS = 150;
+// Onset strength kept for tempo estimation, about 4 s of windows.
+const uint8_t AUDIO_TEMPO_FRAMES = 128;
+const uint8_t AUDIO_MIN_BPM = 60;
+const uint8_t AUDIO_MAX_BPM = 200;
+
+// What the effects read. bpm88 and beatPhase describe the beat as of the
+// end of the last window, so a renderer can run the phase on between them.
+struct AudioFeatures {
+  uint32_t windows;
+  uint32_t onsets;
+  uint32_t beats;
+  uint16_t bpm88;
+  uint16_t beatPhase;
+  uint8_t level;
+  uint8_t hue;
+  uint8_t onsetStrength;
+};
+
+extern AudioFeatures audioFeatures;
+
+// Two windows of ADC samples: sampling fills one while the loop analyzes
+// the other. A window completed while the loop still holds
+// the other is dropped and counted as an overrun.
+class SampleBuffer {
+public:
+  SampleBuffer();
+
+  void push(uint16_t sample);
+  const int16_t* take();
+  void release();
+  uint16_t getOverruns() const;
+
+private:
+  int16_t windows[2][AUDIO_WINDOW];
+  volatile uint8_t filling;
+  volatile uint16_t count;
+  volatile bool ready;
+  volatile uint16_t overruns;
+};
+
+struct SamplingStats {
+  uint32_t samples;
+  uint32_t held;
+  // Share of the samples in the last full second that repeated a reading.
+  uint8_t heldPercent;
+};
+
+// Paces ADC reads taken from the loop at AUDIO_SAMPLE_RATE. due() gives
+// the number of samples that fell due since the last read; all of them
+// take the one reading, so those after the first are held. A gap longer
+// than a window is not filled in, and sampling restarts from now.
+class SampleClock {
+public:
+  SampleClock();
+
+  void start(uint32_t now);
+  uint32_t due(uint32_t now);
+  const SamplingStats& getStats() const;
+
+private:
+  uint32_t next;
+  uint32_t secondSamples;
+  uint32_t secondHeld;
+  SamplingStats stats;
+};
+
+// Fixed-point analysis of one window at a time: a Hann-windowed radix-2
+// FFT in Q15, band energies on a log scale, spectral flux onsets against
+// an adaptive threshold, tempo from the autocorrelation of the onset
+// strength, and a beat phase pulled towards onsets that land near a beat.
+class AudioAnalyzer {
+public:
+  AudioAnalyzer();
+
+  void reset();
+  void analyze(const int16_t* samples, AudioFeatures& features);
+
+private:
+  static const uint8_t FLUX_HISTORY = 16;
+  static const uint8_t MIN_ONSET_GAP = 3;
+  static const uint8_t TEMPO_INTERVAL = 8;
+
+  bool detectOnset(uint16_t flux);
+  void estimateTempo();
+  void trackBeat(bool onset, AudioFeatures& features);
+
+  uint16_t bandLog[AUDIO_BANDS];
+  uint16_t fluxHistory[FLUX_HISTORY];
+  uint8_t onsetStrength[AUDIO_TEMPO_FRAMES];
+  uint32_t frame;
+  uint8_t sinceOnset;
+  uint32_t period88;
+  uint32_t pendingPeriod88;
+  uint32_t phase;
+  uint16_t centroid88;
+  bool primed;
+};
+
+// Where beatsin-style effects should be now: the analyzer's phase moved on
+// by the time since its last window at the detected tempo.
+uint16_t extrapolateBeatPhase(const AudioFeatures& features, uint32_t sinceWindowMs);
+
+void fixedFft(int16_t* real, int16_t* imag, uint8_t bits);
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "body_pool.h"
+
+BodyPool::BodyPool() {
+  for (uint8_t i = 0; i < BODY_POOL_SLOTS; i++) slots[i].owner = nullptr;
+}
+
+void BodyPool::append(const void* owner, const uint8_t* data, size_t len, size_t index, size_t total) {
+  if (total > MAX_BODY_SIZE) return;
+
+  Slot* slot = find(owner);
+
+  if (index == 0) {
+    if (slot == nullptr) slot = find(nullptr);
+    if (slot == nullptr) return;
+
+    slot->owner = owner;
+    slot->length = 0;
+    slot->total = total;
+    slot->broken = false;
+  }
+
+  if (slot == nullptr || slot->broken) return;
+
+  if (index != slot->length || total != slot->total || index + len > total) {
+    slot->broken = true;
+    return;
+  }
+
+  memcpy(slot->data + index, data, len);
+  slot->length += len;
+}
+
+BodyStatus BodyPool::take(const void* owner, char*& body, size_t& length) {
+  Slot* slot = find(owner);
+  if (slot == nullptr) return BODY_MISSING;
+  if (slot->broken || slot->length != slot->total) return BODY_INCOMPLETE;
+
+  slot->data[slot->length] = '\0';
+  body = slot->data;
+  length = slot->length;
+  return BODY_COMPLETE;
+}
+
+void BodyPool::release(const void* owner) {
+  Slot* slot = find(owner);
+  if (slot != nullptr) slot->owner = nullptr;
+}
+
+uint8_t BodyPool::inUse() const {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < BODY_POOL_SLOTS; i++) {
+    if (slots[i].owner != nullptr) count++;
+  }
+  return count;
+}
+
+BodyPool::Slot* BodyPool::find(const void* owner) {
+  for (uint8_t i = 0; i < BODY_POOL_SLOTS; i++) {
+    if (slots[i].owner == owner) return &slots[i];
+  }
+  return nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t BODY_POOL_SLOTS = 4;
+const size_t MAX_BODY_SIZE = 512;
+
+enum BodyStatus : uint8_t {
+  BODY_COMPLETE,
+  BODY_INCOMPLETE,
+  BODY_MISSING
+};
+
+// Reassembles request bodies that arrive in several chunks into a fixed set
+// of buffers, one per in-flight request. Bodies larger than MAX_BODY_SIZE and
+// requests arriving while every slot is taken are never buffered.
+class BodyPool {
+public:
+  BodyPool();
+
+  void append(const void* owner, const uint8_t* data, size_t len, size_t index, size_t total);
+  BodyStatus take(const void* owner, char*& body, size_t& length);
+  void release(const void* owner);
+
+  uint8_t inUse() const;
+
+private:
+  struct Slot {
+    const void* owner;
+    size_t length;
+    size_t total;
+    bool broken;
+    char data[MAX_BODY_SIZE + 1];
+  };
+
+  Slot* find(const void* owner);
+
+  Slot slots[BODY_POOL_SLOTS];
+};
@@ -0,0 +1,119 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#define IRAM_ATTR
+#endif
+
+#include "button.h"
+
+const char* buttonEventName(ButtonEvent event) {
+  switch (event) {
+    case BUTTON_CLICK: return "click";
+    case BUTTON_DOUBLE_CLICK: return "double-click";
+    case BUTTON_LONG_PRESS: return "long-press";
+    case BUTTON_VERY_LONG_PRESS: return "very-long-press";
+    default: return "none";
+  }
+}
+
+EdgeQueue::EdgeQueue() : head(0), tail(0), dropped(0) {
+}
+
+bool IRAM_ATTR EdgeQueue::push(uint32_t time, uint8_t level) {
+  uint8_t next = (head + 1) % SIZE;
+  if (next == tail) {
+    dropped++;
+    return false;
+  }
+
+  edges[head].time = time;
+  edges[head].level = level;
+  head = next;
+  return true;
+}
+
+bool EdgeQueue::pop(ButtonEdge& edge) {
+  if (tail == head) return false;
+
+  edge = edges[tail];
+  tail = (tail + 1) % SIZE;
+  return true;
+}
+
+uint16_t EdgeQueue::getDropped() const {
+  return dropped;
+}
+
+ButtonClassifier::ButtonClassifier(uint8_t idleLevel) : idleLevel(idleLevel), stable(idleLevel), raw(idleLevel),
+    rawTime(0), pressTime(0), clickTime(0), clickPending(false), eventHead(0), eventCount(0) {
+}
+
+void ButtonClassifier::feed(const ButtonEdge& edge) {
+  // Edges can be drained in bursts; settle against this edge's time first so
+  // a level that held long enough before it still counts.
+  settle(edge.time);
+
+  if (edge.level == raw) return;
+  raw = edge.level;
+  rawTime = edge.time;
+}
+
+ButtonEvent ButtonClassifier::poll(uint32_t now) {
+  settle(now);
+
+  if (clickPending && stable == idleLevel && (int32_t) (now - clickTime) >= (int32_t) DOUBLE_CLICK_GAP) {
+    clickPending = false;
+    emit(BUTTON_CLICK);
+  }
+
+  if (eventCount == 0) return BUTTON_NONE;
+
+  ButtonEvent event = events[eventHead];
+  eventHead = (eventHead + 1) % MAX_EVENTS;
+  eventCount--;
+  return event;
+}
+
+void ButtonClassifier::settle(uint32_t now) {
+  if (raw != stable && (int32_t) (now - rawTime) >= (int32_t) DEBOUNCE_TIME) accept(raw, rawTime);
+}
+
+void ButtonClassifier::accept(uint8_t level, uint32_t time) {
+  stable = level;
+
+  if (level != idleLevel) {
+    pressTime = time;
+    return;
+  }
+
+  uint32_t held = time - pressTime;
+
+  if (held > VERY_LONG_PRESS_TIME) {
+    flushClick();
+    emit(BUTTON_VERY_LONG_PRESS);
+  } else if (held > LONG_PRESS_TIME) {
+    flushClick();
+    emit(BUTTON_LONG_PRESS);
+  } else if (clickPending && pressTime - clickTime < DOUBLE_CLICK_GAP) {
+    clickPending = false;
+    emit(BUTTON_DOUBLE_CLICK);
+  } else {
+    flushClick();
+    clickPending = true;
+    clickTime = time;
+  }
+}
+
+void ButtonClassifier::flushClick() {
+  if (!clickPending) return;
+
+  clickPending = false;
+  emit(BUTTON_CLICK);
+}
+
+void ButtonClassifier::emit(ButtonEvent event) {
+  if (eventCount == MAX_EVENTS) return;
+
+  events[(eventHead + eventCount) % MAX_EVENTS] = event;
+  eventCount++;
+}
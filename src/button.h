@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+const uint32_t DEBOUNCE_TIME = 30;
+const uint32_t DOUBLE_CLICK_GAP = 300;
+const uint32_t LONG_PRESS_TIME = 1000;
+const uint32_t VERY_LONG_PRESS_TIME = 5000;
+
+struct ButtonEdge {
+  uint32_t time;
+  uint8_t level;
+};
+
+enum ButtonEvent : uint8_t {
+  BUTTON_NONE,
+  BUTTON_CLICK,
+  BUTTON_DOUBLE_CLICK,
+  BUTTON_LONG_PRESS,
+  BUTTON_VERY_LONG_PRESS
+};
+
+const char* buttonEventName(ButtonEvent event);
+
+// Single-producer, single-consumer ring of timestamped edges. push() is
+// called from the pin interrupt, pop() from the main loop; each side only
+// writes its own index, so no locking is needed.
+class EdgeQueue {
+public:
+  EdgeQueue();
+
+  bool push(uint32_t time, uint8_t level);
+  bool pop(ButtonEdge& edge);
+  uint16_t getDropped() const;
+
+private:
+  static const uint8_t SIZE = 16;
+
+  ButtonEdge edges[SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  volatile uint16_t dropped;
+};
+
+// Turns raw edges into button events. A level only counts once it has held
+// for DEBOUNCE_TIME, and is timestamped with the edge that started it, so
+// classification does not depend on how late the loop gets around to it.
+class ButtonClassifier {
+public:
+  explicit ButtonClassifier(uint8_t idleLevel);
+
+  void feed(const ButtonEdge& edge);
+  ButtonEvent poll(uint32_t now);
+
+private:
+  static const uint8_t MAX_EVENTS = 4;
+
+  void settle(uint32_t now);
+  void accept(uint8_t level, uint32_t time);
+  void flushClick();
+  void emit(ButtonEvent event);
+
+  uint8_t idleLevel;
+  uint8_t stable;
+  uint8_t raw;
+  uint32_t rawTime;
+  uint32_t pressTime;
+  uint32_t clickTime;
+  bool clickPending;
+
+  ButtonEvent events[MAX_EVENTS];
+  uint8_t eventHead;
+  uint8_t eventCount;
+};
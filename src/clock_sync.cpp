@@ -0,0 +1,285 @@
+#include <string.h>
+
+#include "clock_sync.h"
+
+static const uint32_t MAX_ROUND_TRIP = 1000000;
+
+static uint32_t read32(const uint8_t* in) {
+  return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+static uint64_t read64(const uint8_t* in) {
+  return ((uint64_t) read32(in) << 32) | read32(in + 4);
+}
+
+static void write32(uint8_t* out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+static void write64(uint8_t* out, uint64_t value) {
+  write32(out, value >> 32);
+  write32(out + 4, value);
+}
+
+bool parseClockPacket(const uint8_t* data, size_t length, ClockPacket& packet) {
+  if (length != CLOCK_PACKET_SIZE || memcmp(data, "PBCK", 4) != 0 || data[4] != CLOCK_SYNC_VERSION) return false;
+
+  packet.type = data[5];
+  packet.flags = data[6];
+  packet.from = read32(data + 8);
+  packet.to = read32(data + 12);
+  packet.t1 = read64(data + 16);
+  packet.t2 = read64(data + 24);
+  packet.t3 = read64(data + 32);
+  return packet.type >= CLOCK_BEACON && packet.type <= CLOCK_REPLY && packet.from != 0;
+}
+
+size_t writeClockPacket(const ClockPacket& packet, uint8_t* out) {
+  memcpy(out, "PBCK", 4);
+  out[4] = CLOCK_SYNC_VERSION;
+  out[5] = packet.type;
+  out[6] = packet.flags;
+  out[7] = 0;
+  write32(out + 8, packet.from);
+  write32(out + 12, packet.to);
+  write64(out + 16, packet.t1);
+  write64(out + 24, packet.t2);
+  write64(out + 32, packet.t3);
+  return CLOCK_PACKET_SIZE;
+}
+
+ClockSync::ClockSync(uint32_t id) : id(id), leader(0), isSynced(false), lastNow(0), lastLocal(0), started(0),
+    nextBeacon(0), nextRequest(0), offset(0), anchor(0), driftPpb(0), sampleCount(0), sampleNext(0),
+    lastUsed(0) {
+  memset(peers, 0, sizeof(peers));
+  memset(samples, 0, sizeof(samples));
+  memset(&stats, 0, sizeof(stats));
+}
+
+void ClockSync::begin(uint32_t now) {
+  lastNow = now;
+  lastLocal = now;
+  started = lastLocal;
+  nextBeacon = lastLocal;
+  anchor = lastLocal;
+}
+
+// Extends micros() to 64 bits. A time a little behind the last one seen,
+// taken before it but passed in after, is not mistaken for a wrap.
+uint64_t ClockSync::localMicros(uint32_t now) {
+  int32_t step = now - lastNow;
+  if (step < 0) return lastLocal - (uint32_t) -step;
+
+  lastNow = now;
+  lastLocal += step;
+  return lastLocal;
+}
+
+int64_t ClockSync::modelOffset(uint64_t local) const {
+  return offset + (int64_t) (local - anchor) * driftPpb / 1000000000;
+}
+
+uint64_t ClockSync::sharedMicros(uint32_t now) {
+  uint64_t local = localMicros(now);
+  return local + modelOffset(local);
+}
+
+uint32_t ClockSync::sharedMillis(uint32_t now) {
+  return sharedMicros(now) / 1000;
+}
+
+uint8_t ClockSync::flags() const {
+  if (leading()) return CLOCK_FLAG_LEADER | CLOCK_FLAG_SYNCED;
+  return isSynced ? CLOCK_FLAG_SYNCED : 0;
+}
+
+void ClockSync::hear(uint32_t from, uint8_t flags, uint64_t local) {
+  // A new unit takes a free slot, or the one heard from longest ago.
+  Peer* slot = &peers[0];
+  for (uint8_t i = 0; i < CLOCK_MAX_PEERS; i++) {
+    if (peers[i].id == from) {
+      slot = &peers[i];
+      break;
+    }
+    if (slot->id != 0 && (peers[i].id == 0 || peers[i].heard < slot->heard)) slot = &peers[i];
+  }
+
+  slot->id = from;
+  slot->flags = flags;
+  slot->heard = local;
+}
+
+void ClockSync::follow(uint32_t next) {
+  leader = next;
+  sampleCount = 0;
+  sampleNext = 0;
+  nextRequest = lastLocal;
+  stats.leaderChanges++;
+}
+
+void ClockSync::elect(uint64_t local) {
+  uint32_t lowestLeader = 0;
+  uint32_t lowestSynced = isSynced ? id : 0;
+  uint32_t lowest = id;
+
+  for (uint8_t i = 0; i < CLOCK_MAX_PEERS; i++) {
+    Peer& peer = peers[i];
+    if (peer.id == 0) continue;
+    if ((int64_t) (local - peer.heard) > LEADER_TIMEOUT) {
+      peer.id = 0;
+      continue;
+    }
+
+    if ((peer.flags & CLOCK_FLAG_LEADER) && (lowestLeader == 0 || peer.id < lowestLeader)) lowestLeader = peer.id;
+    if ((peer.flags & CLOCK_FLAG_SYNCED) && (lowestSynced == 0 || peer.id < lowestSynced)) lowestSynced = peer.id;
+    if (peer.id < lowest) lowest = peer.id;
+  }
+
+  if (lowestLeader != 0) {
+    if ((!leading() || lowestLeader < id) && leader != lowestLeader) follow(lowestLeader);
+    return;
+  }
+
+  // Nobody leads: after listening long enough, the lowest synced unit
+  // takes over, or the lowest of all when none has synced yet.
+  if (leading() || local - started < LEADER_TIMEOUT) return;
+  if ((lowestSynced != 0 ? lowestSynced : lowest) != id) return;
+
+  leader = id;
+  isSynced = true;
+  stats.leaderChanges++;
+}
+
+size_t ClockSync::poll(uint32_t now, uint8_t* out) {
+  uint64_t local = localMicros(now);
+  elect(local);
+
+  ClockPacket packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.from = id;
+  packet.flags = flags();
+
+  if (local >= nextBeacon) {
+    nextBeacon = local - nextBeacon < BEACON_INTERVAL ? nextBeacon + BEACON_INTERVAL : local + BEACON_INTERVAL;
+    packet.type = CLOCK_BEACON;
+    packet.t3 = local + modelOffset(local);
+    return writeClockPacket(packet, out);
+  }
+
+  if (leader != 0 && !leading() && local >= nextRequest) {
+    // A burst of samples fills the filter quickly after a leader change.
+    nextRequest = local + (sampleCount < CLOCK_FILTER_SIZE ? FAST_REQUEST_INTERVAL : REQUEST_INTERVAL);
+    packet.type = CLOCK_REQUEST;
+    packet.to = leader;
+    packet.t1 = local;
+    return writeClockPacket(packet, out);
+  }
+
+  return 0;
+}
+
+size_t ClockSync::receive(const uint8_t* data, size_t length, uint32_t now, uint8_t* out) {
+  ClockPacket packet;
+  if (!parseClockPacket(data, length, packet)) {
+    stats.invalid++;
+    return 0;
+  }
+  // Multicast comes back to its sender too.
+  if (packet.from == id) return 0;
+
+  uint64_t local = localMicros(now);
+  hear(packet.from, packet.flags, local);
+
+  if (packet.type == CLOCK_REQUEST && packet.to == id && leading()) {
+    ClockPacket reply;
+    reply.type = CLOCK_REPLY;
+    reply.flags = flags();
+    reply.from = id;
+    reply.to = packet.from;
+    reply.t1 = packet.t1;
+    reply.t2 = local + modelOffset(local);
+    reply.t3 = reply.t2;
+    return writeClockPacket(reply, out);
+  }
+
+  if (packet.type == CLOCK_REPLY && packet.to == id && packet.from == leader && !leading()) {
+    uint64_t sent = packet.t1;
+    if (sent > local || local - sent > MAX_ROUND_TRIP || packet.t3 < packet.t2) {
+      stats.invalid++;
+      return 0;
+    }
+
+    int64_t roundTrip = (int64_t) (local - sent) - (int64_t) (packet.t3 - packet.t2);
+    int64_t measured = ((int64_t) (packet.t2 - sent) + (int64_t) (packet.t3 - local)) / 2;
+    addSample(sent + (local - sent) / 2, measured, roundTrip > 0 ? roundTrip : 0);
+  }
+
+  return 0;
+}
+
+void ClockSync::addSample(uint64_t local, int64_t measured, uint32_t delay) {
+  samples[sampleNext] = {local, measured, delay};
+  sampleNext = (sampleNext + 1) % CLOCK_FILTER_SIZE;
+  if (sampleCount < CLOCK_FILTER_SIZE) sampleCount++;
+  stats.samples++;
+
+  // The first step waits for a few samples to choose from.
+  if (!isSynced && sampleCount < CLOCK_FILTER_SIZE / 2) return;
+
+  const Sample* best = &samples[0];
+  for (uint8_t i = 1; i < sampleCount; i++) {
+    if (samples[i].delay < best->delay) best = &samples[i];
+  }
+
+  // A sample is only acted on once; a stale best waits for a better one.
+  if (best->local <= lastUsed) return;
+  lastUsed = best->local;
+
+  int64_t predicted = modelOffset(best->local);
+  int64_t error = best->offset - predicted;
+  stats.errorMicros = error > INT32_MAX ? INT32_MAX : error < INT32_MIN ? INT32_MIN : error;
+  stats.delayMicros = best->delay;
+
+  if (!isSynced || error > STEP_THRESHOLD || error < -(int64_t) STEP_THRESHOLD) {
+    offset = best->offset;
+    anchor = best->local;
+    isSynced = true;
+    stats.steps++;
+    return;
+  }
+
+  // Half the error is taken out now, and a little of it goes on the
+  // frequency, so drift is learnt over DRIFT_TIME_CONSTANT rather than
+  // from the noise of any one sample.
+  offset = predicted + error / 2;
+  anchor = best->local;
+
+  int64_t drift = driftPpb + error * 1000000000 / DRIFT_TIME_CONSTANT;
+  if (drift > MAX_DRIFT_PPB) drift = MAX_DRIFT_PPB;
+  if (drift < -MAX_DRIFT_PPB) drift = -MAX_DRIFT_PPB;
+  driftPpb = drift;
+  stats.driftPpb = driftPpb;
+}
+
+uint32_t ClockSync::getId() const {
+  return id;
+}
+
+uint32_t ClockSync::getLeader() const {
+  return leader;
+}
+
+bool ClockSync::leading() const {
+  return leader == id;
+}
+
+bool ClockSync::synced() const {
+  return isSynced;
+}
+
+const ClockStats& ClockSync::getStats() const {
+  return stats;
+}
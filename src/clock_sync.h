@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint16_t CLOCK_SYNC_PORT = 4212;
+const uint8_t CLOCK_SYNC_GROUP[4] = {239, 255, 80, 66};
+const size_t CLOCK_PACKET_SIZE = 40;
+
+const uint8_t CLOCK_SYNC_VERSION = 1;
+const uint8_t CLOCK_MAX_PEERS = 8;
+const uint8_t CLOCK_FILTER_SIZE = 8;
+
+enum ClockPacketType : uint8_t {
+  CLOCK_BEACON = 1,
+  CLOCK_REQUEST = 2,
+  CLOCK_REPLY = 3
+};
+
+enum ClockFlags : uint8_t {
+  CLOCK_FLAG_LEADER = 1,
+  CLOCK_FLAG_SYNCED = 2
+};
+
+// Every packet goes to the multicast group, big-endian:
+//   "PBCK" version:8 type:8 flags:8 reserved:8 from:32 to:32 t1:64 t2:64 t3:64
+// A beacon carries the sender's shared clock in t3. A request is addressed
+// to the leader and carries the follower's local send time in t1; the
+// reply echoes it with the leader's shared clock on receipt in t2 and on
+// sending in t3. Times are microseconds.
+struct ClockPacket {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t from;
+  uint32_t to;
+  uint64_t t1;
+  uint64_t t2;
+  uint64_t t3;
+};
+
+bool parseClockPacket(const uint8_t* data, size_t length, ClockPacket& packet);
+size_t writeClockPacket(const ClockPacket& packet, uint8_t* out);
+
+struct ClockStats {
+  uint32_t samples;
+  uint32_t steps;
+  uint32_t leaderChanges;
+  uint32_t invalid;
+  // How far the last sample had the clock from the leader's, before it
+  // was corrected, and the round trip it was measured over; half the
+  // round trip bounds how wrong the sample itself can be.
+  int32_t errorMicros;
+  uint32_t delayMicros;
+  int32_t driftPpb;
+};
+
+// A clock shared by every unit on the network, for animations that must
+// stay in phase across units. Units announce themselves with a beacon
+// every BEACON_INTERVAL. A unit that hears no leader for LEADER_TIMEOUT
+// after boot leads with its own clock; when the leader goes quiet, the
+// synced unit with the lowest id takes over with the clock it already
+// follows, so the shared clock runs on without a jump. Of two leaders,
+// the one with the higher id gives way.
+//
+// Followers time round trips to the leader NTP-style. Of the last
+// CLOCK_FILTER_SIZE samples the one with the shortest round trip is the
+// least disturbed by queueing and loop latency, and only it is used: an
+// error over STEP_THRESHOLD steps the clock, a smaller one is slewed out
+// and trims the frequency, which corrects for crystal drift between
+// samples. Time is passed in as the local micros(), which may wrap.
+class ClockSync {
+public:
+  explicit ClockSync(uint32_t id);
+
+  void begin(uint32_t now);
+
+  // A packet to send now, if one is due; call until it returns 0.
+  size_t poll(uint32_t now, uint8_t* out);
+  // Takes a packet off the network; returns the length of a reply to
+  // send from out, or 0.
+  size_t receive(const uint8_t* data, size_t length, uint32_t now, uint8_t* out);
+
+  uint64_t sharedMicros(uint32_t now);
+  uint32_t sharedMillis(uint32_t now);
+
+  uint32_t getId() const;
+  uint32_t getLeader() const;
+  bool leading() const;
+  bool synced() const;
+  const ClockStats& getStats() const;
+
+private:
+  static const uint32_t BEACON_INTERVAL = 1000000;
+  static const uint32_t LEADER_TIMEOUT = 3500000;
+  static const uint32_t REQUEST_INTERVAL = 1000000;
+  static const uint32_t FAST_REQUEST_INTERVAL = 250000;
+  static const uint32_t STEP_THRESHOLD = 20000;
+  static const int64_t DRIFT_TIME_CONSTANT = 64000000;
+  static const int32_t MAX_DRIFT_PPB = 500000;
+
+  struct Peer {
+    uint32_t id;
+    uint8_t flags;
+    uint64_t heard;
+  };
+
+  struct Sample {
+    uint64_t local;
+    int64_t offset;
+    uint32_t delay;
+  };
+
+  uint64_t localMicros(uint32_t now);
+  int64_t modelOffset(uint64_t local) const;
+  void hear(uint32_t from, uint8_t flags, uint64_t local);
+  void elect(uint64_t local);
+  void follow(uint32_t leader);
+  void addSample(uint64_t local, int64_t offset, uint32_t delay);
+  uint8_t flags() const;
+
+  uint32_t id;
+  uint32_t leader;
+  bool isSynced;
+
+  uint32_t lastNow;
+  uint64_t lastLocal;
+  uint64_t started;
+  uint64_t nextBeacon;
+  uint64_t nextRequest;
+
+  // shared = local + offset + drift * (local - anchor)
+  int64_t offset;
+  uint64_t anchor;
+  int32_t driftPpb;
+
+  Peer peers[CLOCK_MAX_PEERS];
+  Sample samples[CLOCK_FILTER_SIZE];
+  uint8_t sampleCount;
+  uint8_t sampleNext;
+  uint64_t lastUsed;
+
+  ClockStats stats;
+};
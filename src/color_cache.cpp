@@ -0,0 +1,75 @@
+#include "color_cache.h"
+
+struct PaletteTable {
+  CRGBPalette16 source;
+  CRGB colors[256];
+  bool valid;
+};
+
+// Effects use at most two palettes at a time (cyan and, while unconfigured,
+// the config palette), so two slots avoid rebuilding on every switch.
+static const uint8_t PALETTE_SLOTS = 2;
+
+static CRGB rainbow[256];
+static CRGB heat[256];
+static bool rainbowValid = false;
+static bool heatValid = false;
+
+static PaletteTable palettes[PALETTE_SLOTS];
+static uint8_t nextSlot = 0;
+
+const CRGB* rainbowColors() {
+  if (!rainbowValid) {
+    for (uint16_t hue = 0; hue < 256; hue++) rainbow[hue] = CHSV(hue, 255, 255);
+    rainbowValid = true;
+  }
+  return rainbow;
+}
+
+const CRGB* heatColors() {
+  if (!heatValid) {
+    for (uint16_t temperature = 0; temperature < 256; temperature++) heat[temperature] = HeatColor(temperature);
+    heatValid = true;
+  }
+  return heat;
+}
+
+const CRGB* paletteColors(const CRGBPalette16& palette) {
+  for (uint8_t i = 0; i < PALETTE_SLOTS; i++) {
+    if (palettes[i].valid && palettes[i].source == palette) {
+      return palettes[i].colors;
+    }
+  }
+
+  PaletteTable& table = palettes[nextSlot];
+  nextSlot = (nextSlot + 1) % PALETTE_SLOTS;
+
+  table.source = palette;
+  for (uint16_t index = 0; index < 256; index++) {
+    table.colors[index] = ColorFromPalette(palette, index, 255, LINEARBLEND);
+  }
+  table.valid = true;
+  return table.colors;
+}
+
+void fillPaletteColors(CRGB* target, uint16_t count, uint8_t start, uint8_t increment, const CRGB* colors) {
+  uint8_t index = start;
+  for (uint16_t i = 0; i < count; i++) {
+    target[i] = colors[index];
+    index += increment;
+  }
+}
+
+void fillPaletteSpread(CRGB* target, uint16_t count, uint16_t start, uint16_t increment, const CRGB* colors) {
+  uint16_t index = start;
+  for (uint16_t i = 0; i < count; i++) {
+    target[i] = colors[index >> 8];
+    index += increment;
+  }
+}
+
+void fillPaletteMapped(CRGB* target, uint16_t count, uint8_t start, const uint8_t* phase, const CRGB* colors) {
+  for (uint16_t i = 0; i < count; i++) {
+    target[i] = colors[(uint8_t) (start + phase[i])];
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <FastLED.h>
+#include <stdint.h>
+
+// Lookup tables for the per-pixel color math the effects repeat every
+// frame. Each table is built on first use and holds exactly what the
+// FastLED call it replaces would return, so output is unchanged.
+//   rainbowColors()[h]  == CRGB(CHSV(h, 255, 255))
+//   heatColors()[t]     == HeatColor(t)
+//   paletteColors(p)[i] == ColorFromPalette(p, i, 255, LINEARBLEND)
+const CRGB* rainbowColors();
+const CRGB* heatColors();
+const CRGB* paletteColors(const CRGBPalette16& palette);
+
+// fill_palette() at full brightness with LINEARBLEND, from an expanded table.
+void fillPaletteColors(CRGB* target, uint16_t count, uint8_t start, uint8_t increment, const CRGB* colors);
+
+// The same with start and increment in 8.8 fixed point, for canvases too
+// long for a whole-step increment. Whole steps give fillPaletteColors().
+void fillPaletteSpread(CRGB* target, uint16_t count, uint16_t start, uint16_t increment, const CRGB* colors);
+
+// The same with each pixel's index given by a table, as a PixelMap's phase.
+void fillPaletteMapped(CRGB* target, uint16_t count, uint8_t start, const uint8_t* phase, const CRGB* colors);
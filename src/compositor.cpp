@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+#include "layout.h"
+#include "pixel_kernels.h"
+#include "registry.h"
+
+Compositor::Compositor() : base(nullptr), scratch(nullptr), overlayHeat(nullptr), capacity(0), currentMode(-1), fading(false),
+    overlayFresh(true), transitionElapsed(0), transitionLength(0) {
+  memset(&overlayState, 0, sizeof(overlayState));
+  memset(&stats, 0, sizeof(stats));
+}
+
+Compositor::~Compositor() {
+  free(base);
+  free(scratch);
+  free(overlayHeat);
+}
+
+// Sizes the base and scratch layers for the strip; like leds, once at boot.
+// A failed attempt leaves no capacity, so the next call frees what it got.
+bool Compositor::begin(uint16_t length) {
+  if (length > capacity) {
+    free(base);
+    free(scratch);
+    free(overlayHeat);
+    base = (CRGB*) calloc(length, sizeof(CRGB));
+    scratch = (CRGB*) calloc(length, sizeof(CRGB));
+    overlayHeat = (uint8_t*) calloc(length, 1);
+    capacity = base && scratch && overlayHeat ? length : 0;
+    if (capacity == 0) return false;
+  }
+
+  overlayFresh = true;
+  return true;
+}
+
+void Compositor::render(uint32_t dt) {
+  uint8_t mode = settings.mode;
+  if (mode != currentMode) beginTransition(mode);
+
+  if (fading) {
+    renderBase(mode, dt);
+
+    transitionElapsed += dt;
+    if (transitionElapsed >= transitionLength) {
+      fading = false;
+      overlayFresh = true;
+    } else {
+      // Weight the outgoing frame by what is left of the crossfade.
+      uint8_t progress = transitionElapsed * 255 / transitionLength;
+      blendPixels(leds, scratch, numLeds, 255 - progress);
+    }
+    return;
+  }
+
+  bool overlay = settings.overlayEnabled && settings.overlayMode != mode && settings.overlayMode < STREAM_MODE;
+  if (!overlay || settings.overlayAlpha == 0) {
+    if (settings.overlayEnabled) stats.layersSkipped++;
+    renderBase(mode, dt);
+    return;
+  }
+
+  renderOverlay(dt);
+
+  if (settings.overlayBlend == BLEND_NORMAL && settings.overlayAlpha == 255) {
+    memcpy(leds, scratch, numLeds * sizeof(CRGB));
+    stats.layersSkipped++;
+    return;
+  }
+
+  renderBase(mode, dt);
+
+  if (settings.overlayBlend == BLEND_ADD) addScaledPixels(leds, scratch, numLeds, settings.overlayAlpha);
+  else blendPixels(leds, scratch, numLeds, settings.overlayAlpha);
+}
+
+void Compositor::bypass(uint8_t mode) {
+  currentMode = mode;
+  fading = false;
+}
+
+bool Compositor::transitioning() const {
+  return fading;
+}
+
+const CompositorStats& Compositor::getStats() const {
+  return stats;
+}
+
+// The last frame shown is still in leds; keep it as the outgoing layer.
+// Stream and playback frames arrive on their own schedule and bypass the
+// compositor, so coming back from those modes cuts straight over.
+void Compositor::beginTransition(uint8_t mode) {
+  bool fade = currentMode >= 0 && settings.transitionTime > 0 && mode < STREAM_MODE && currentMode < STREAM_MODE;
+  currentMode = mode;
+
+  // The new mode starts afresh rather than from the old one's timers or,
+  // for effects that build on their last frame, the old one's frame.
+  Segment& first = layout.segments[0];
+  resetEffectState(first.state, first.state.heat, first.length);
+  fill_solid(base + first.start, first.length, CRGB::Black);
+
+  if (!fade) {
+    fading = false;
+    return;
+  }
+
+  memcpy(scratch, leds, numLeds * sizeof(CRGB));
+  fading = true;
+  overlayFresh = true;
+  transitionElapsed = 0;
+  transitionLength = settings.transitionTime;
+  stats.transitions++;
+}
+
+// The first segment runs the base mode with the global parameters, the
+// rest their own. Effects that fade, shift or skip a step build on their
+// last frame, so the base keeps its own and leds only gets a copy for the
+// other layers to be composited onto.
+void Compositor::renderBase(uint8_t mode, uint32_t dt) {
+  for (uint8_t i = 0; i < layout.segmentCount; i++) {
+    Segment& segment = layout.segments[i];
+    selectCanvas(base + segment.start, segment.length, &segment.state);
+
+    if (i == 0) renderMode(mode, effectParams, dt);
+    else renderMode(segment.mode, segment.params, dt);
+  }
+
+  resetCanvas();
+  memcpy(leds, base, numLeds * sizeof(CRGB));
+  stats.layersRendered++;
+}
+
+// The overlay keeps its own previous frame in scratch, since effects that
+// fade or shift build on it.
+void Compositor::renderOverlay(uint32_t dt) {
+  if (overlayFresh) {
+    fill_solid(scratch, numLeds, CRGB::Black);
+    resetEffectState(overlayState, overlayHeat, numLeds);
+    overlayFresh = false;
+  }
+
+  selectCanvas(scratch, numLeds, &overlayState);
+  renderMode(settings.overlayMode, effectParams, dt);
+  resetCanvas();
+  stats.layersRendered++;
+}
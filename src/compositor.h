@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "effects.h"
+
+struct CompositorStats {
+  uint32_t layersRendered;
+  uint32_t layersSkipped;
+  uint32_t transitions;
+};
+
+// Builds each frame in leds from the base layer, every segment of the
+// layout with its own effect, and an optional overlay layer across the
+// whole strip, and crossfades from the last frame when the base mode changes.
+// The base layer keeps its own frame, which leds only ever gets a copy of,
+// since effects that fade or shift build on their last frame and must not
+// see the overlay in it. One scratch buffer holds either the overlay layer
+// or, during a crossfade, the outgoing frame; the overlay is paused while a
+// crossfade runs. Layers that cannot be seen are not rendered: a
+// transparent overlay, and the base under an opaque normal-blend overlay.
+// The two frames and the overlay's heat cost 2 x 3 x N + N bytes on top of
+// leds and the renderer's last frame, about 4.2 KB at 600 LEDs; if begin()
+// cannot allocate them the strip falls back to the default layout.
+class Compositor {
+public:
+  Compositor();
+  ~Compositor();
+
+  bool begin(uint16_t length);
+  void render(uint32_t dt);
+  // Stream and playback write leds themselves; the compositor only notes
+  // the mode so that leaving it cuts straight over instead of crossfading.
+  void bypass(uint8_t mode);
+  bool transitioning() const;
+  const CompositorStats& getStats() const;
+
+private:
+  void beginTransition(uint8_t mode);
+  void renderBase(uint8_t mode, uint32_t dt);
+  void renderOverlay(uint32_t dt);
+
+  CRGB* base;
+  CRGB* scratch;
+  uint8_t* overlayHeat;
+  uint16_t capacity;
+  EffectState overlayState;
+
+  int16_t currentMode;
+  bool fading;
+  bool overlayFresh;
+  uint32_t transitionElapsed;
+  uint32_t transitionLength;
+  CompositorStats stats;
+};
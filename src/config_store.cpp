@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include "config_store.h"
+#include "trace.h"
+
+static const uint16_t RECORD_MAGIC = 0xC0F1;
+static const uint16_t BLANK_MAGIC = 0xFFFF;
+
+enum RecordKind : uint8_t {
+  RECORD_SNAPSHOT = 1,
+  RECORD_PATCH = 2
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t padded(uint32_t length) {
+  return (length + 3) & ~3UL;
+}
+
+ConfigStore::ConfigStore(FlashBackend& flash) : flash(flash), activeSector(0), writeOffset(0), sequence(0),
+    valid(false), dirty(false), firstDirty(0), lastDirty(0) {
+  memset(image, 0, sizeof(image));
+  memset(committed, 0, sizeof(committed));
+  memset(&stats, 0, sizeof(stats));
+}
+
+bool ConfigStore::begin() {
+  RecordHeader header;
+  bool found = false;
+
+  for (uint16_t sector = 0; sector < flash.sectorCount(); sector++) {
+    if (!readRecord(sector, 0, header) || header.kind != RECORD_SNAPSHOT) continue;
+    if (found && header.sequence <= sequence) continue;
+
+    found = true;
+    activeSector = sector;
+    sequence = header.sequence;
+  }
+
+  valid = found;
+  if (!found) return false;
+
+  uint8_t* payload = (uint8_t*) record + HEADER_SIZE;
+  readRecord(activeSector, 0, header);
+  memset(image, 0, CONFIG_IMAGE_SIZE);
+  memcpy(image, payload, header.length);
+  writeOffset = HEADER_SIZE + padded(header.length);
+
+  while (writeOffset + HEADER_SIZE <= CONFIG_SECTOR_SIZE) {
+    if (!readRecord(activeSector, writeOffset, header)) {
+      // Anything but erased flash after the last good record is a torn
+      // write; it cannot be overwritten, so the next commit starts over in
+      // a fresh sector.
+      if (header.magic != BLANK_MAGIC) writeOffset = CONFIG_SECTOR_SIZE;
+      break;
+    }
+
+    if (header.kind != RECORD_PATCH || header.sequence != sequence + 1) {
+      writeOffset = CONFIG_SECTOR_SIZE;
+      break;
+    }
+
+    applyPatch(payload, header.length);
+    sequence = header.sequence;
+    writeOffset += HEADER_SIZE + padded(header.length);
+  }
+
+  memcpy(committed, image, CONFIG_IMAGE_SIZE);
+  return true;
+}
+
+uint8_t* ConfigStore::data() {
+  return image;
+}
+
+const uint8_t* ConfigStore::constData() const {
+  return image;
+}
+
+void ConfigStore::markDirty(uint32_t now) {
+  if (!dirty) firstDirty = now;
+  lastDirty = now;
+  dirty = true;
+}
+
+bool ConfigStore::isDirty() const {
+  return dirty;
+}
+
+bool ConfigStore::tick(uint32_t now) {
+  if (!dirty) return false;
+  if (now - lastDirty < CONFIG_DEBOUNCE_MS && now - firstDirty < CONFIG_MAX_DELAY_MS) return false;
+
+  TRACE_BEGIN(TRACK_LOOP, "commit");
+  bool written = commit();
+  TRACE_END(TRACK_LOOP, "commit");
+  return written;
+}
+
+bool ConfigStore::commit() {
+  dirty = false;
+
+  uint8_t* payload = (uint8_t*) record + HEADER_SIZE;
+  uint16_t length = buildPatch(payload);
+
+  if (length == 0 && valid) return true;
+
+  bool written;
+  if (!valid || length > MAX_PATCH_PAYLOAD ||
+      writeOffset + HEADER_SIZE + padded(length) > CONFIG_SECTOR_SIZE) {
+    written = writeSnapshot();
+  } else {
+    written = appendRecord(RECORD_PATCH, payload, length);
+    if (!written) written = writeSnapshot();
+  }
+
+  if (written) {
+    memcpy(committed, image, CONFIG_IMAGE_SIZE);
+    stats.commits++;
+  }
+
+  return written;
+}
+
+const ConfigStoreStats& ConfigStore::getStats() const {
+  return stats;
+}
+
+bool ConfigStore::readRecord(uint16_t sector, uint32_t offset, RecordHeader& header) {
+  uint32_t base = (uint32_t) sector * CONFIG_SECTOR_SIZE + offset;
+
+  if (!flash.read(base, record, HEADER_SIZE)) return false;
+  memcpy(&header, record, HEADER_SIZE);
+
+  if (header.magic != RECORD_MAGIC || header.length > CONFIG_IMAGE_SIZE) return false;
+  if (offset + HEADER_SIZE + padded(header.length) > CONFIG_SECTOR_SIZE) return false;
+
+  if (!flash.read(base + HEADER_SIZE, record + HEADER_SIZE / 4, padded(header.length))) return false;
+
+  uint32_t crc = header.crc;
+  ((RecordHeader*) record)->crc = 0;
+  return crc32(0, (const uint8_t*) record, HEADER_SIZE + header.length) == crc;
+}
+
+uint16_t ConfigStore::buildPatch(uint8_t* payload) {
+  uint16_t length = 0;
+  uint16_t i = 0;
+
+  while (i < CONFIG_IMAGE_SIZE) {
+    if (image[i] == committed[i]) {
+      i++;
+      continue;
+    }
+
+    // Runs absorb unchanged gaps shorter than a run header.
+    uint16_t start = i;
+    uint16_t end = i + 1;
+    for (uint16_t j = end; j < CONFIG_IMAGE_SIZE && j - start < 255 && j - end < 3; j++) {
+      if (image[j] != committed[j]) end = j + 1;
+    }
+
+    uint16_t run = end - start;
+    if (length + 3 + run > MAX_PATCH_PAYLOAD) return MAX_PATCH_PAYLOAD + 1;
+
+    payload[length++] = start >> 8;
+    payload[length++] = start & 0xff;
+    payload[length++] = run;
+    memcpy(payload + length, image + start, run);
+    length += run;
+
+    i = end;
+  }
+
+  return length;
+}
+
+bool ConfigStore::appendRecord(uint8_t kind, const uint8_t* payload, uint16_t length) {
+  RecordHeader header;
+  header.magic = RECORD_MAGIC;
+  header.kind = kind;
+  header.reserved = 0xFF;
+  header.length = length;
+  header.padding = 0xFFFF;
+  header.sequence = sequence + 1;
+  header.crc = 0;
+
+  uint8_t* bytes = (uint8_t*) record;
+  if (payload != bytes + HEADER_SIZE) memcpy(bytes + HEADER_SIZE, payload, length);
+  memset(bytes + HEADER_SIZE + length, 0xFF, padded(length) - length);
+
+  memcpy(bytes, &header, HEADER_SIZE);
+  header.crc = crc32(0, bytes, HEADER_SIZE + length);
+  memcpy(bytes, &header, HEADER_SIZE);
+
+  uint32_t size = HEADER_SIZE + padded(length);
+  uint32_t address = (uint32_t) activeSector * CONFIG_SECTOR_SIZE + writeOffset;
+
+  writeOffset += size;
+  stats.records++;
+  stats.bytesWritten += size;
+
+  if (!flash.write(address, record, size)) return false;
+
+  RecordHeader check;
+  if (!readRecord(activeSector, writeOffset - size, check) || check.sequence != header.sequence) return false;
+
+  sequence = header.sequence;
+  valid = true;
+  return true;
+}
+
+bool ConfigStore::writeSnapshot() {
+  for (uint16_t attempt = 0; attempt < flash.sectorCount(); attempt++) {
+    activeSector = valid || attempt > 0 ? (activeSector + 1) % flash.sectorCount() : activeSector;
+    writeOffset = 0;
+
+    stats.erases++;
+    if (!flash.erase(activeSector)) continue;
+
+    memcpy((uint8_t*) record + HEADER_SIZE, image, CONFIG_IMAGE_SIZE);
+    if (appendRecord(RECORD_SNAPSHOT, (uint8_t*) record + HEADER_SIZE, CONFIG_IMAGE_SIZE)) return true;
+  }
+
+  return false;
+}
+
+void ConfigStore::applyPatch(const uint8_t* payload, uint16_t length) {
+  uint16_t i = 0;
+
+  while (i + 3 <= length) {
+    uint16_t offset = (payload[i] << 8) | payload[i + 1];
+    uint8_t run = payload[i + 2];
+    i += 3;
+
+    if (i + run > length || offset + run > CONFIG_IMAGE_SIZE) return;
+
+    memcpy(image + offset, payload + i, run);
+    i += run;
+  }
+}
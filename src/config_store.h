@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint16_t CONFIG_SECTOR_SIZE = 4096;
+const uint16_t CONFIG_IMAGE_SIZE = 480;
+const uint32_t CONFIG_DEBOUNCE_MS = 2000;
+const uint32_t CONFIG_MAX_DELAY_MS = 10000;
+
+// Raw access to the sectors reserved for the config log. Addresses are
+// relative to the first sector; writes and reads are 4-byte aligned and,
+// like NOR flash, writes can only clear bits until the sector is erased.
+class FlashBackend {
+public:
+  virtual ~FlashBackend() {}
+
+  virtual uint16_t sectorCount() const = 0;
+  virtual bool erase(uint16_t sector) = 0;
+  virtual bool write(uint32_t address, const uint32_t* data, size_t len) = 0;
+  virtual bool read(uint32_t address, uint32_t* data, size_t len) = 0;
+};
+
+struct ConfigStoreStats {
+  uint32_t commits;
+  uint32_t records;
+  uint32_t bytesWritten;
+  uint32_t erases;
+};
+
+// Keeps a CONFIG_IMAGE_SIZE byte image in RAM and persists it as an
+// append-only log of CRC'd records. Each sector starts with a full snapshot
+// followed by patches holding only the bytes that changed; when a sector
+// fills up the log moves on to the next one. On boot the newest valid
+// snapshot and the patches after it are replayed, so a commit interrupted
+// at any point leaves either the old or the new image. A snapshot written
+// when the image was smaller loads with the rest of the image zeroed.
+class ConfigStore {
+public:
+  explicit ConfigStore(FlashBackend& flash);
+
+  bool begin();
+
+  uint8_t* data();
+  const uint8_t* constData() const;
+
+  void markDirty(uint32_t now);
+  bool isDirty() const;
+  bool tick(uint32_t now);
+  bool commit();
+
+  const ConfigStoreStats& getStats() const;
+
+private:
+  struct RecordHeader {
+    uint16_t magic;
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t length;
+    uint16_t padding;
+    uint32_t sequence;
+    uint32_t crc;
+  };
+
+  static const uint16_t HEADER_SIZE = sizeof(RecordHeader);
+  static const uint16_t MAX_PATCH_PAYLOAD = CONFIG_IMAGE_SIZE / 2;
+
+  bool readRecord(uint16_t sector, uint32_t offset, RecordHeader& header);
+  uint16_t buildPatch(uint8_t* payload);
+  bool appendRecord(uint8_t kind, const uint8_t* payload, uint16_t length);
+  bool writeSnapshot();
+  void applyPatch(const uint8_t* payload, uint16_t length);
+
+  FlashBackend& flash;
+
+  uint8_t image[CONFIG_IMAGE_SIZE];
+  uint8_t committed[CONFIG_IMAGE_SIZE];
+  uint32_t record[(sizeof(RecordHeader) + CONFIG_IMAGE_SIZE + 3) / 4];
+
+  uint16_t activeSector;
+  uint32_t writeOffset;
+  uint32_t sequence;
+  bool valid;
+
+  bool dirty;
+  uint32_t firstDirty;
+  uint32_t lastDirty;
+
+  ConfigStoreStats stats;
+};
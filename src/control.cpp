@@ -0,0 +1,109 @@
+#include <string.h>
+
+#include "control.h"
+
+static bool parseNumber(const char* text, size_t length, uint16_t& out) {
+  if (length == 0 || length > 5) return false;
+
+  uint32_t value = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9') return false;
+    value = value * 10 + (text[i] - '0');
+  }
+
+  if (value > 65535) return false;
+  out = value;
+  return true;
+}
+
+static bool parseValue(ParamType type, const char* text, size_t length, uint16_t& value, CRGB& color) {
+  if (type == PARAM_BOOL) {
+    if (length == 4 && strncmp(text, "true", 4) == 0) value = 1;
+    else if (length == 5 && strncmp(text, "false", 5) == 0) value = 0;
+    else return parseNumber(text, length, value);
+    return true;
+  }
+
+  if (type != PARAM_RGB) return parseNumber(text, length, value);
+
+  uint16_t channels[3];
+  const char* end = text + length;
+
+  for (uint8_t i = 0; i < 3; i++) {
+    const char* comma = i < 2 ? (const char*) memchr(text, ',', end - text) : end;
+    if (!comma || !parseNumber(text, comma - text, channels[i]) || channels[i] > 255) return false;
+    text = comma + 1;
+  }
+
+  color = CRGB(channels[0], channels[1], channels[2]);
+  return true;
+}
+
+ParamCoalescer::ParamCoalescer() : count(0) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t ParamCoalescer::parse(const char* message, size_t length) {
+  stats.messages++;
+
+  uint8_t queued = 0;
+  const char* end = message + length;
+
+  while (message < end) {
+    const char* next = (const char*) memchr(message, '&', end - message);
+    if (!next) next = end;
+
+    const char* equals = (const char*) memchr(message, '=', next - message);
+    if (equals && queue(message, equals - message, equals + 1, next - equals - 1)) queued++;
+    else stats.rejected++;
+
+    message = next + 1;
+  }
+
+  return queued;
+}
+
+uint8_t ParamCoalescer::apply() {
+  uint8_t applied = count;
+
+  for (uint8_t i = 0; i < count; i++) {
+    PendingParam& slot = slots[i];
+    if (slot.def -> type == PARAM_RGB) setColorParam(*slot.def, slot.base, slot.color);
+    else setParam(*slot.def, slot.base, slot.value);
+  }
+
+  if (settings.mode >= NUM_MODES) settings.mode = 0;
+  count = 0;
+  return applied;
+}
+
+uint8_t ParamCoalescer::pending() const {
+  return count;
+}
+
+const ControlStats& ParamCoalescer::getStats() const {
+  return stats;
+}
+
+bool ParamCoalescer::queue(const char* key, size_t keyLength, const char* value, size_t valueLength) {
+  void* base;
+  const ParamDef* def = findParam(key, keyLength, &base);
+  if (!def) return false;
+
+  PendingParam update = {def, base, 0, CRGB::Black};
+  if (!parseValue(def -> type, value, valueLength, update.value, update.color)) return false;
+
+  stats.updates++;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (slots[i].def != def) continue;
+
+    slots[i] = update;
+    stats.coalesced++;
+    return true;
+  }
+
+  if (count == MAX_PENDING) return false;
+  slots[count++] = update;
+  return true;
+}
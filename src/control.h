@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "registry.h"
+
+struct ControlStats {
+  uint32_t messages;
+  uint32_t updates;
+  uint32_t coalesced;
+  uint32_t rejected;
+};
+
+// Collects parameter updates from control messages and applies them once
+// per frame. Messages are "key=value" pairs joined by '&', keyed by the
+// names /get_settings reports; colors are "r,g,b". A parameter updated
+// several times between frames keeps only its latest value.
+class ParamCoalescer {
+public:
+  ParamCoalescer();
+
+  uint8_t parse(const char* message, size_t length);
+  uint8_t apply();
+  uint8_t pending() const;
+  const ControlStats& getStats() const;
+
+private:
+  static const uint8_t MAX_PENDING = 16;
+
+  struct PendingParam {
+    const ParamDef* def;
+    void* base;
+    uint16_t value;
+    CRGB color;
+  };
+
+  bool queue(const char* key, size_t keyLength, const char* value, size_t valueLength);
+
+  PendingParam slots[MAX_PENDING];
+  uint8_t count;
+  ControlStats stats;
+};
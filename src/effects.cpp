@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "color_cache.h"
+#include "effects.h"
+#include "pixel_kernels.h"
+#include "pixel_map.h"
+
+CRGB* leds = nullptr;
+uint8_t* ledHeat = nullptr;
+uint16_t numLeds = 0;
+
+static EffectState stripState;
+static uint16_t capacity = 0;
+
+CRGB* canvas = nullptr;
+uint16_t canvasLength = 0;
+EffectState* effectState = &stripState;
+
+uint32_t animationMillis = 0;
+
+DEFINE_GRADIENT_PALETTE (cyan_gp) {
+  0, 11, 0, 196,
+  63, 0, 109, 212,
+  127, 0, 153, 252,
+  191, 0, 221, 255,
+  255, 11, 0, 196
+};
+CRGBPalette16 cyanPalette = cyan_gp;
+
+DEFINE_GRADIENT_PALETTE (config_gp) {
+  0, 255, 0, 0,
+  128, 0, 0, 255,
+  255, 255, 0, 0
+};
+CRGBPalette16 configPalette = config_gp;
+
+EffectParams effectParams;
+
+static const uint16_t MAX_FIRE_STEPS = 4;
+
+// Buffers are allocated once for the strip length; a later call only
+// allocates again if it needs more room than the first.
+bool allocateLeds(uint16_t length) {
+  if (length == 0 || length > MAX_LEDS) return false;
+
+  if (length > capacity) {
+    free(leds);
+    free(ledHeat);
+    leds = (CRGB*) calloc(length, sizeof(CRGB));
+    ledHeat = (uint8_t*) calloc(length, 1);
+    capacity = leds && ledHeat ? length : 0;
+    if (capacity == 0) return false;
+  }
+
+  numLeds = length;
+  resetEffectState(stripState, ledHeat, length);
+  resetCanvas();
+  return true;
+}
+
+void selectCanvas(CRGB* pixels, uint16_t length, EffectState* state) {
+  canvas = pixels;
+  canvasLength = length;
+  effectState = state;
+}
+
+void resetCanvas() {
+  selectCanvas(leds, numLeds, &stripState);
+}
+
+void resetEffectState(EffectState& state, uint8_t* heat, uint16_t length) {
+  state.timer = 0;
+  state.position = 0;
+  state.heat = heat;
+  if (heat) memset(heat, 0, length);
+}
+
+static uint16_t randomLed() {
+  if (canvasLength <= 256) return random8(0, canvasLength - 1);
+  return random16(0, canvasLength - 1);
+}
+
+// One pass over the hues or the palette across the canvas, in 8.8 fixed
+// point. Up to 255 pixels this is the whole step the effects always used;
+// longer canvases get a fractional one instead of a step of zero.
+static uint16_t spreadStep() {
+  if (canvasLength <= 255) return (255 / canvasLength) << 8;
+  return (255 << 8) / canvasLength;
+}
+
+// The effects that have a 2D version draw across the panel when the canvas
+// is the whole of a mapped strip, as the base or the overlay; a strip split
+// into segments is drawn along each of them.
+static bool canvasMapped() {
+  return pixelMap.size() > 0 && pixelMap.size() == canvasLength;
+}
+
+static uint16_t stepsDue(uint32_t& timer, uint32_t dt, int period) {
+  if (period <= 0) return 1;
+
+  timer += dt;
+  uint16_t steps = timer / period;
+  timer -= (uint32_t) steps * period;
+  return steps;
+}
+
+// Steps of period since the shared clock's epoch, so every unit shows the
+// same step at once. A period of zero still steps once a frame.
+static uint8_t lockedPosition(const EffectState& state, int period) {
+  if (period <= 0) return state.position + 1;
+  return animationMillis / period;
+}
+
+// FastLED's beatsin16 and beatsin8, run from animationMillis instead of
+// millis().
+static uint16_t lockedBeat16(uint16_t bpm) {
+  uint32_t bpm88 = bpm < 256 ? bpm << 8 : bpm;
+  return (animationMillis * bpm88 * 280) >> 16;
+}
+
+static uint16_t lockedBeatsin16(uint16_t bpm, uint16_t low, uint16_t high) {
+  uint16_t beat = sin16(lockedBeat16(bpm)) + 32768;
+  return low + scale16(beat, high - low);
+}
+
+static uint8_t lockedBeatsin8(uint16_t bpm, uint8_t low, uint8_t high) {
+  uint8_t beat = sin8(lockedBeat16(bpm) >> 8);
+  return low + scale8(beat, high - low);
+}
+
+void staticRGB(CRGB color) {
+  fill_solid(canvas, canvasLength, color);
+}
+
+void staticHSV(CHSV color) {
+  fill_solid(canvas, canvasLength, color);
+}
+
+void staticRainbow() {
+  if (canvasMapped()) {
+    const uint8_t* phase = pixelMap.phase();
+    for (uint16_t i = 0; i < canvasLength; i++) canvas[i] = CHSV(phase[i], 240, 255);
+    return;
+  }
+
+  uint16_t step = spreadStep();
+  uint16_t hue = 0;
+
+  for (uint16_t i = 0; i < canvasLength; i++) {
+    canvas[i] = CHSV(hue >> 8, 240, 255);
+    hue += step;
+  }
+}
+
+void fullRainbow(const EffectParams& p, uint32_t dt) {
+  EffectState& state = *effectState;
+  state.position = lockedPosition(state, p.fullRainbowSpeed);
+
+  fill_solid(canvas, canvasLength, rainbowColors()[state.position]);
+}
+
+void animatedRainbow(const EffectParams& p, uint32_t dt) {
+  EffectState& state = *effectState;
+  state.position = lockedPosition(state, p.animatedRainbowSpeed);
+
+  if (canvasMapped()) fillPaletteMapped(canvas, canvasLength, state.position, pixelMap.phase(), rainbowColors());
+  else fillPaletteColors(canvas, canvasLength, state.position, 1, rainbowColors());
+}
+
+// Each step pushes a new color in at the start, leaving it on the first
+// two pixels. All steps due are applied with a single shift, so the cost
+// stays one pass over the canvas however many steps a frame covers.
+void randomSingleColor(const EffectParams& p, uint32_t dt) {
+  uint16_t steps = stepsDue(effectState->timer, dt, p.randomSColorSpeed);
+  if (steps == 0) return;
+  if (steps > canvasLength) steps = canvasLength;
+
+  memmove(canvas + steps, canvas, (canvasLength - steps) * sizeof(CRGB));
+
+  CRGB color;
+  for (uint16_t s = steps; s > 0; s--) {
+    color = CHSV(p.randomSColor, random8(), random8(100, 255));
+    if (s < canvasLength) canvas[s] = color;
+  }
+  canvas[0] = color;
+}
+
+void staticPalette(const CRGBPalette16& palette) {
+  if (canvasMapped()) fillPaletteMapped(canvas, canvasLength, 0, pixelMap.phase(), paletteColors(palette));
+  else fillPaletteSpread(canvas, canvasLength, 0, spreadStep(), paletteColors(palette));
+}
+
+void animatedPalette(const CRGBPalette16& palette, const EffectParams& p, uint32_t dt) {
+  EffectState& state = *effectState;
+  state.position = lockedPosition(state, p.animatedPaletteSpeed);
+
+  if (canvasMapped()) fillPaletteMapped(canvas, canvasLength, state.position, pixelMap.phase(), paletteColors(palette));
+  else fillPaletteSpread(canvas, canvasLength, state.position << 8, spreadStep(), paletteColors(palette));
+}
+
+void fadeToBlack(const CRGBPalette16& palette, const EffectParams& p, uint32_t dt) {
+  uint16_t steps = stepsDue(effectState->timer, dt, p.fadeToBlackSpeed);
+  if (steps > canvasLength) steps = canvasLength;
+
+  const CRGB* colors = paletteColors(palette);
+  for (uint16_t s = 0; s < steps; s++) {
+    canvas[randomLed()] = colors[random8()];
+  }
+
+  fadePixels(canvas, canvasLength, p.fadeToBlackFadeSpeed);
+}
+
+void beatRGB(const EffectParams& p) {
+  uint16_t sinBeat = lockedBeatsin16(p.bpmColor, 0, canvasLength - 1);
+
+  canvas[sinBeat] = p.rgbColor;
+
+  fadePixels(canvas, canvasLength, p.fadeColorSpeed);
+}
+
+void beatHSV(const EffectParams& p) {
+  uint16_t sinBeat = lockedBeatsin16(p.bpmColor, 0, canvasLength - 1);
+
+  canvas[sinBeat] = p.hsvColor;
+
+  fadePixels(canvas, canvasLength, p.fadeColorSpeed);
+}
+
+void beatPalette(const CRGBPalette16& palette) {
+  uint8_t beatA = lockedBeatsin8(30, 0, 255);
+  uint8_t beatB = lockedBeatsin8(20, 0, 255);
+
+  fillPaletteColors(canvas, canvasLength, (beatA + beatB) / 2, 10, paletteColors(palette));
+}
+
+// beatRGB driven by the microphone: the dot swings in phase with the
+// detected beat, flares on it and takes its hue from the spectrum, moved
+// on by a step each beat. Silence leaves it dark.
+void audioBeat(const EffectParams& p, uint32_t dt) {
+  const AudioFeatures& audio = audioFeatures;
+  EffectState& state = *effectState;
+
+  // position holds the last window seen, timer the time since it arrived.
+  if (state.position != (uint8_t) audio.windows) {
+    state.position = audio.windows;
+    state.timer = 0;
+  } else {
+    state.timer += dt;
+  }
+
+  uint16_t phase = extrapolateBeatPhase(audio, state.timer);
+  uint16_t sinBeat = scale16(sin16(phase) + 32768, canvasLength - 1);
+
+  uint16_t level = audio.level * p.audioGain / 32;
+  uint8_t pulse = 255 - (phase >> 8);
+  uint8_t value = scale8(qadd8(pulse >> 1, 128), level > 255 ? 255 : level);
+
+  fadePixels(canvas, canvasLength, p.audioFade);
+  canvas[sinBeat] = CHSV(audio.hue + audio.beats * 24, 255, value);
+}
+
+// fire() up every column of a panel at once. Heat is kept by rank, and
+// each pixel takes it from the two under it as the strip's pixels do from
+// the two before them; sparks land on the bottom row. It always burns
+// upwards, so reverse is left to the map's flip_y.
+static void firePanel(const EffectParams& p, uint16_t steps) {
+  uint8_t* heat = effectState->heat;
+  const uint16_t* below = pixelMap.below();
+  uint16_t bottom = pixelMap.bottomCount();
+
+  uint8_t cooling = ((p.fireCooling * 10) / pixelMap.rows()) + 2;
+
+  for (uint16_t s = 0; s < steps; s++) {
+    for (uint16_t r = 0; r < canvasLength; r++) {
+      heat[r] = qsub8(heat[r], random8(0, cooling));
+    }
+
+    for (uint16_t r = canvasLength; r-- > bottom; ) {
+      uint16_t under = below[r];
+      uint16_t further = below[under];
+      if (further == MAP_NONE) continue;
+      heat[r] = (heat[under] + heat[further] + heat[further]) / 3;
+    }
+
+    for (uint16_t r = 0; r < bottom; r++) {
+      if (random8() < p.fireSparks) heat[r] = qadd8(heat[r], random8(160, 255));
+    }
+  }
+
+  const CRGB* heatColor = heatColors();
+  const uint16_t* order = pixelMap.order();
+  for (uint16_t r = 0; r < canvasLength; r++) {
+    canvas[order[r]] = heatColor[heat[r]];
+  }
+}
+
+void fire(const EffectParams& p, uint32_t dt) {
+  uint8_t* heat = effectState->heat;
+
+  uint16_t steps = stepsDue(effectState->timer, dt, p.fireSpeed);
+  if (steps == 0) return;
+  if (steps > MAX_FIRE_STEPS) steps = MAX_FIRE_STEPS;
+
+  if (canvasMapped()) {
+    firePanel(p, steps);
+    return;
+  }
+
+  uint8_t cooling = ((p.fireCooling * 10) / canvasLength) + 2;
+
+  for (uint16_t s = 0; s < steps; s++) {
+    for(int i = 0; i < canvasLength; i++) {
+      heat[i] = qsub8(heat[i], random8(0, cooling));
+    }
+
+    for(int k = canvasLength - 1; k >= 2; k--) {
+      heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2]) / 3;
+    }
+
+    if(random8() < p.fireSparks) {
+      int y = random8(7);
+      if (y < canvasLength) heat[y] = qadd8(heat[y], random8(160,255));
+    }
+  }
+
+  const CRGB* heatColor = heatColors();
+  for(int j = 0; j < canvasLength; j++) {
+    CRGB color = heatColor[heat[j]];
+    int pixelnumber;
+    if(p.fireReverse) {
+      pixelnumber = (canvasLength - 1) - j;
+    } else {
+      pixelnumber = j;
+    }
+    canvas[pixelnumber] = color;
+  }
+}
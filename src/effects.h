@@ -0,0 +1,79 @@
+#pragma once
+
+#include <FastLED.h>
+#include <stdint.h>
+
+#define DEFAULT_NUM_LEDS 72
+#ifndef MAX_LEDS
+#define MAX_LEDS 600
+#endif
+
+// What an effect carries from one frame to the next. Each segment and the
+// overlay layer has its own, so one effect can run in several places at
+// once. heat holds a byte per pixel of the canvas it is used with.
+struct EffectState {
+  uint32_t timer;
+  uint8_t position;
+  uint8_t* heat;
+};
+
+// Sized by allocateLeds() for the strip length chosen at boot.
+extern CRGB* leds;
+extern uint8_t* ledHeat;
+extern uint16_t numLeds;
+
+// Where the effects draw: all of leds unless the compositor points them at
+// a segment or a layer.
+extern CRGB* canvas;
+extern uint16_t canvasLength;
+extern EffectState* effectState;
+
+bool allocateLeds(uint16_t length);
+void selectCanvas(CRGB* pixels, uint16_t length, EffectState* state);
+void resetCanvas();
+void resetEffectState(EffectState& state, uint8_t* heat, uint16_t length);
+
+// The time, in milliseconds, that effects which must stay in phase across
+// units run from. The frame loop sets it from the clock the units share.
+extern uint32_t animationMillis;
+
+extern CRGBPalette16 cyanPalette;
+extern CRGBPalette16 configPalette;
+
+struct EffectParams {
+  uint16_t fullRainbowSpeed = 40;
+  uint16_t animatedRainbowSpeed = 5;
+  uint16_t randomSColor = 100;
+  uint16_t randomSColorSpeed = 2;
+  uint16_t animatedPaletteSpeed = 5;
+  uint16_t fadeToBlackSpeed = 10;
+  uint16_t fadeToBlackFadeSpeed = 2;
+  uint16_t bpmColor = 30;
+  uint16_t fadeColorSpeed = 5;
+  CRGB rgbColor = CRGB(33, 150, 243);
+  CHSV hsvColor = CHSV(207, 90, 54);
+  uint16_t fireSpeed = 25;
+  uint16_t fireCooling = 55;
+  uint16_t fireSparks = 120;
+  bool fireReverse = false;
+  CRGB staticRGBColor = CRGB(255, 255, 255);
+  uint8_t audioGain = 64;
+  uint8_t audioFade = 20;
+};
+
+extern EffectParams effectParams;
+
+void staticRGB(CRGB color);
+void staticHSV(CHSV color);
+void staticRainbow();
+void fullRainbow(const EffectParams& p, uint32_t dt);
+void animatedRainbow(const EffectParams& p, uint32_t dt);
+void randomSingleColor(const EffectParams& p, uint32_t dt);
+void staticPalette(const CRGBPalette16& palette);
+void animatedPalette(const CRGBPalette16& palette, const EffectParams& p, uint32_t dt);
+void fadeToBlack(const CRGBPalette16& palette, const EffectParams& p, uint32_t dt);
+void beatRGB(const EffectParams& p);
+void beatHSV(const EffectParams& p);
+void beatPalette(const CRGBPalette16& palette);
+void audioBeat(const EffectParams& p, uint32_t dt);
+void fire(const EffectParams& p, uint32_t dt);
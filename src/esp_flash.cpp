@@ -0,0 +1,48 @@
+#include <Arduino.h>
+
+#include "esp_flash.h"
+
+extern "C" uint32_t _CONFIG_start;
+extern "C" uint32_t _CONFIG_end;
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+
+static const uint32_t FLASH_MAPPED = 0x40200000;
+
+EspFlash::EspFlash(FlashRegion region) {
+  uint32_t end;
+  if (region == FLASH_STAGING) {
+    start = (ESP.getSketchSize() + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    end = (uint32_t) &_FS_start - FLASH_MAPPED;
+  } else if (region == FLASH_FILESYSTEM) {
+    start = (uint32_t) &_FS_start - FLASH_MAPPED;
+    end = (uint32_t) &_FS_end - FLASH_MAPPED;
+  } else {
+    start = (uint32_t) &_CONFIG_start - FLASH_MAPPED;
+    end = (uint32_t) &_CONFIG_end - FLASH_MAPPED;
+  }
+  sectors = (end - start) / SPI_FLASH_SEC_SIZE;
+}
+
+uint16_t EspFlash::sectorCount() const {
+  return sectors;
+}
+
+bool EspFlash::erase(uint16_t sector) {
+  if (sector >= sectors) return false;
+  return ESP.flashEraseSector(start / SPI_FLASH_SEC_SIZE + sector);
+}
+
+bool EspFlash::write(uint32_t address, const uint32_t* data, size_t len) {
+  if (address + len > (uint32_t) sectors * SPI_FLASH_SEC_SIZE) return false;
+  return ESP.flashWrite(start + address, (uint32_t*) data, len);
+}
+
+bool EspFlash::read(uint32_t address, uint32_t* data, size_t len) {
+  if (address + len > (uint32_t) sectors * SPI_FLASH_SEC_SIZE) return false;
+  return ESP.flashRead(start + address, data, len);
+}
+
+uint32_t EspFlash::offset() const {
+  return start;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "config_store.h"
+
+enum FlashRegion : uint8_t {
+  FLASH_CONFIG,
+  FLASH_STAGING,
+  FLASH_FILESYSTEM
+};
+
+// A region of flash as laid out by ld/eagle.flash.4m2m.plumbob.ld: the
+// config log's sectors between _CONFIG_start and _CONFIG_end, carved out of
+// the filesystem; the free sectors between the running sketch and the
+// filesystem, where updates are staged; or the filesystem itself.
+class EspFlash : public FlashBackend {
+public:
+  explicit EspFlash(FlashRegion region = FLASH_CONFIG);
+
+  uint16_t sectorCount() const override;
+  bool erase(uint16_t sector) override;
+  bool write(uint32_t address, const uint32_t* data, size_t len) override;
+  bool read(uint32_t address, uint32_t* data, size_t len) override;
+
+  // Where the region starts, as an offset into flash.
+  uint32_t offset() const;
+
+private:
+  uint32_t start;
+  uint16_t sectors;
+};
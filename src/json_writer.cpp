@@ -0,0 +1,103 @@
+#include "json_writer.h"
+
+JsonWriter::JsonWriter(char* buffer, size_t size) : buffer(buffer), size(size), used(0), overflow(false), first(true) {
+  if (size > 0) buffer[0] = '\0';
+}
+
+void JsonWriter::beginObject() {
+  separate();
+  append('{');
+  first = true;
+}
+
+void JsonWriter::endObject() {
+  append('}');
+  first = false;
+}
+
+void JsonWriter::beginArray() {
+  separate();
+  append('[');
+  first = true;
+}
+
+void JsonWriter::endArray() {
+  append(']');
+  first = false;
+}
+
+void JsonWriter::key(const char* name) {
+  separate();
+  append('"');
+  append(name);
+  append("\": ");
+  first = true;
+}
+
+void JsonWriter::value(uint32_t number) {
+  separate();
+  appendNumber(number);
+}
+
+void JsonWriter::value(const char* text) {
+  separate();
+  append('"');
+  append(text);
+  append('"');
+}
+
+void JsonWriter::signedValue(int32_t number) {
+  separate();
+  if (number < 0) append('-');
+  appendNumber(number < 0 ? 0 - (uint32_t) number : number);
+}
+
+void JsonWriter::rgbValue(uint8_t red, uint8_t green, uint8_t blue) {
+  separate();
+  append('"');
+  appendNumber(red);
+  append(',');
+  appendNumber(green);
+  append(',');
+  appendNumber(blue);
+  append('"');
+}
+
+size_t JsonWriter::length() const {
+  return used;
+}
+
+bool JsonWriter::overflowed() const {
+  return overflow;
+}
+
+void JsonWriter::append(char c) {
+  if (used + 1 >= size) {
+    overflow = true;
+    return;
+  }
+
+  buffer[used++] = c;
+  buffer[used] = '\0';
+}
+
+void JsonWriter::append(const char* text) {
+  while (*text) append(*text++);
+}
+
+void JsonWriter::appendNumber(uint32_t number) {
+  char digits[10];
+  uint8_t count = 0;
+
+  do {
+    digits[count++] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+
+  while (count > 0) append(digits[--count]);
+}
+
+void JsonWriter::separate() {
+  if (!first) append(", ");
+  first = false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Appends JSON into a caller-owned buffer. Nothing is allocated; once the
+// buffer is full further output is dropped and overflowed() reports it.
+class JsonWriter {
+public:
+  JsonWriter(char* buffer, size_t size);
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(const char* name);
+
+  void value(uint32_t number);
+  void value(const char* text);
+  void signedValue(int32_t number);
+  void rgbValue(uint8_t red, uint8_t green, uint8_t blue);
+
+  size_t length() const;
+  bool overflowed() const;
+
+private:
+  void append(char c);
+  void append(const char* text);
+  void appendNumber(uint32_t number);
+  void separate();
+
+  char* buffer;
+  size_t size;
+  size_t used;
+  bool overflow;
+  bool first;
+};
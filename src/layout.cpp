@@ -0,0 +1,273 @@
+#include <string.h>
+
+#include "layout.h"
+#include "registry.h"
+
+StripLayout layout;
+
+// Image layout: [version][outputs][segments], then MAX_OUTPUTS records of
+// [pin][length:16], the first segment's [length:16] and a record of
+// [length:16][mode][params] for each further segment. Multi-byte values are
+// big-endian, as in the settings image.
+static const uint8_t LAYOUT_VERSION = 1;
+static const uint16_t LAYOUT_OUTPUTS = 3;
+static const uint16_t OUTPUT_RECORD_SIZE = 3;
+static const uint16_t LAYOUT_SEGMENTS = LAYOUT_OUTPUTS + MAX_OUTPUTS * OUTPUT_RECORD_SIZE;
+static const uint16_t SEGMENT_RECORD_SIZE = 3 + MODE_PARAMS_SIZE;
+
+const uint16_t LAYOUT_PACKED_SIZE = LAYOUT_SEGMENTS + 2 + (MAX_SEGMENTS - 1) * SEGMENT_RECORD_SIZE;
+
+static_assert(LAYOUT_PACKED_SIZE <= LAYOUT_IMAGE_SIZE, "layout no longer fits LAYOUT_IMAGE_SIZE");
+
+static void writeWord(uint8_t* image, uint16_t value) {
+  image[0] = value >> 8;
+  image[1] = value & 0xff;
+}
+
+static uint16_t readWord(const uint8_t* image) {
+  return (image[0] << 8) + image[1];
+}
+
+static void resetSegment(Segment& segment) {
+  segment.mode = 0;
+  segment.params = EffectParams();
+}
+
+static void assignStarts(StripLayout& strip) {
+  uint16_t start = 0;
+  for (uint8_t i = 0; i < strip.segmentCount; i++) {
+    strip.segments[i].start = start;
+    start += strip.segments[i].length;
+  }
+}
+
+static bool validLayout(const StripLayout& strip) {
+  if (strip.outputCount == 0 || strip.outputCount > MAX_OUTPUTS) return false;
+  if (strip.segmentCount == 0 || strip.segmentCount > MAX_SEGMENTS) return false;
+
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < strip.outputCount; i++) {
+    const OutputDef& output = strip.outputs[i];
+    if (!isOutputPin(output.pin) || output.length == 0) return false;
+
+    for (uint8_t j = 0; j < i; j++) {
+      if (strip.outputs[j].pin == output.pin) return false;
+    }
+    total += output.length;
+  }
+  if (total > MAX_LEDS) return false;
+
+  uint32_t covered = 0;
+  for (uint8_t i = 0; i < strip.segmentCount; i++) {
+    const Segment& segment = strip.segments[i];
+    if (segment.length == 0 || (i > 0 && segment.mode >= STREAM_MODE)) return false;
+    covered += segment.length;
+  }
+
+  return covered == total && validMap(strip.map, total);
+}
+
+void defaultLayout(StripLayout& strip) {
+  strip.outputCount = 1;
+  strip.outputs[0].pin = DEFAULT_LED_PIN;
+  strip.outputs[0].length = DEFAULT_NUM_LEDS;
+
+  strip.segmentCount = 1;
+  for (uint8_t i = 0; i < MAX_SEGMENTS; i++) resetSegment(strip.segments[i]);
+  strip.segments[0].length = DEFAULT_NUM_LEDS;
+  assignStarts(strip);
+  defaultMap(strip.map);
+}
+
+uint16_t layoutLength(const StripLayout& strip) {
+  uint16_t total = 0;
+  for (uint8_t i = 0; i < strip.outputCount; i++) total += strip.outputs[i].length;
+  return total;
+}
+
+bool isOutputPin(uint8_t pin) {
+  for (uint8_t outputPin : OUTPUT_PINS) {
+    if (outputPin == pin) return true;
+  }
+  return false;
+}
+
+void packLayout(const StripLayout& strip, uint8_t* image) {
+  memset(image, 0, LAYOUT_IMAGE_SIZE);
+  image[0] = LAYOUT_VERSION;
+  image[1] = strip.outputCount;
+  image[2] = strip.segmentCount;
+
+  for (uint8_t i = 0; i < strip.outputCount; i++) {
+    uint8_t* out = image + LAYOUT_OUTPUTS + i * OUTPUT_RECORD_SIZE;
+    out[0] = strip.outputs[i].pin;
+    writeWord(out + 1, strip.outputs[i].length);
+  }
+
+  writeWord(image + LAYOUT_SEGMENTS, strip.segments[0].length);
+  for (uint8_t i = 1; i < strip.segmentCount; i++) {
+    const Segment& segment = strip.segments[i];
+    uint8_t* out = image + LAYOUT_SEGMENTS + 2 + (i - 1) * SEGMENT_RECORD_SIZE;
+    writeWord(out, segment.length);
+    out[2] = segment.mode;
+    packModeParams(segment.mode, segment.params, out + 3);
+  }
+}
+
+bool unpackLayout(StripLayout& strip, const uint8_t* image) {
+  if (image[0] != LAYOUT_VERSION) return false;
+
+  StripLayout next;
+  defaultLayout(next);
+  next.outputCount = image[1];
+  next.segmentCount = image[2];
+  if (next.outputCount > MAX_OUTPUTS || next.segmentCount > MAX_SEGMENTS) return false;
+
+  for (uint8_t i = 0; i < next.outputCount; i++) {
+    const uint8_t* in = image + LAYOUT_OUTPUTS + i * OUTPUT_RECORD_SIZE;
+    next.outputs[i].pin = in[0];
+    next.outputs[i].length = readWord(in + 1);
+  }
+
+  next.segments[0].length = readWord(image + LAYOUT_SEGMENTS);
+  for (uint8_t i = 1; i < next.segmentCount; i++) {
+    Segment& segment = next.segments[i];
+    const uint8_t* in = image + LAYOUT_SEGMENTS + 2 + (i - 1) * SEGMENT_RECORD_SIZE;
+    segment.length = readWord(in);
+    segment.mode = in[2];
+    unpackModeParams(segment.mode, segment.params, in + 3);
+  }
+
+  if (!validLayout(next)) return false;
+
+  assignStarts(next);
+  strip = next;
+  return true;
+}
+
+static uint16_t jsonLength(JsonVariantConst value) {
+  long length = value | 0L;
+  return length > 0 && length <= MAX_LEDS ? length : 0;
+}
+
+bool applyLayoutJson(StripLayout& strip, JsonObjectConst json, bool& outputsChanged) {
+  StripLayout next = strip;
+  JsonArrayConst outputs = json["outputs"];
+  JsonArrayConst segments = json["segments"];
+  JsonObjectConst map = json["map"];
+  outputsChanged = false;
+
+  if (outputs.isNull() && segments.isNull() && map.isNull()) return false;
+
+  if (!outputs.isNull()) {
+    if (outputs.size() == 0 || outputs.size() > MAX_OUTPUTS) return false;
+
+    next.outputCount = 0;
+    for (JsonObjectConst output : outputs) {
+      OutputDef& def = next.outputs[next.outputCount++];
+      long pin = output["pin"] | -1L;
+      def.pin = pin >= 0 && pin <= 255 ? pin : 0;
+      def.length = jsonLength(output["leds"]);
+    }
+
+    outputsChanged = next.outputCount != strip.outputCount;
+    for (uint8_t i = 0; i < next.outputCount && !outputsChanged; i++) {
+      outputsChanged = next.outputs[i].pin != strip.outputs[i].pin || next.outputs[i].length != strip.outputs[i].length;
+    }
+
+    // A new length with no segments given gets a single segment again,
+    // and with no map given, a strip again if the map no longer fits.
+    if (segments.isNull() && layoutLength(next) != layoutLength(strip)) {
+      next.segmentCount = 1;
+      next.segments[0].length = layoutLength(next);
+    }
+    if (map.isNull() && !validMap(next.map, layoutLength(next))) defaultMap(next.map);
+  }
+
+  if (!segments.isNull()) {
+    if (segments.size() == 0 || segments.size() > MAX_SEGMENTS) return false;
+
+    next.segmentCount = 0;
+    for (JsonObjectConst segmentJson : segments) {
+      uint8_t index = next.segmentCount++;
+      Segment& segment = next.segments[index];
+      if (index >= strip.segmentCount) resetSegment(segment);
+      segment.length = jsonLength(segmentJson["leds"]);
+
+      // The first segment's mode and parameters are the global settings.
+      if (index == 0) continue;
+
+      JsonVariantConst mode = segmentJson["mode"];
+      if (!mode.isNull()) {
+        long value = mode.as<long>();
+        if (value < 0 || value >= STREAM_MODE) return false;
+        segment.mode = value;
+      }
+
+      const EffectDef& effect = effectRegistry[segment.mode];
+      applyJson(effect.params, effect.paramCount, &segment.params, segmentJson);
+    }
+  }
+
+  if (!map.isNull() && !applyMapJson(next.map, map)) return false;
+
+  if (!validLayout(next)) return false;
+
+  assignStarts(next);
+  strip = next;
+  return true;
+}
+
+size_t writeLayoutJson(const StripLayout& strip, char* buffer, size_t size) {
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  json.key("leds");
+  json.value(layoutLength(strip));
+
+  json.key("outputs");
+  json.beginArray();
+  for (uint8_t i = 0; i < strip.outputCount; i++) {
+    json.beginObject();
+    json.key("pin");
+    json.value(strip.outputs[i].pin);
+    json.key("leds");
+    json.value(strip.outputs[i].length);
+    json.endObject();
+  }
+  json.endArray();
+
+  json.key("segments");
+  json.beginArray();
+  for (uint8_t i = 0; i < strip.segmentCount; i++) {
+    const Segment& segment = strip.segments[i];
+    uint8_t mode = i == 0 ? settings.mode : segment.mode;
+
+    json.beginObject();
+    json.key("start");
+    json.value(segment.start);
+    json.key("leds");
+    json.value(segment.length);
+    json.key("mode");
+    json.value(mode);
+
+    if (i > 0) {
+      const EffectDef& effect = effectRegistry[mode];
+      writeJson(effect.params, effect.paramCount, &segment.params, json);
+    }
+    json.endObject();
+  }
+  json.endArray();
+
+  json.key("map");
+  writeMapJson(strip.map, json);
+
+  json.endObject();
+  return json.overflowed() ? 0 : json.length();
+}
+
+void attachSegments(StripLayout& strip) {
+  for (uint8_t i = 0; i < strip.segmentCount; i++) {
+    Segment& segment = strip.segments[i];
+    resetEffectState(segment.state, ledHeat + segment.start, segment.length);
+  }
+}
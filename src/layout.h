@@ -0,0 +1,67 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "effects.h"
+#include "pixel_map.h"
+
+const uint8_t MAX_OUTPUTS = 4;
+const uint8_t MAX_SEGMENTS = 4;
+const uint8_t DEFAULT_LED_PIN = 15;
+const uint16_t LAYOUT_IMAGE_SIZE = 64;
+// Bytes of the image the largest layout packs into.
+extern const uint16_t LAYOUT_PACKED_SIZE;
+const size_t LAYOUT_JSON_SIZE = 896;
+
+// GPIOs a strip can be driven from; main.cpp instantiates a controller for
+// each. GPIO0, the serial and flash pins and the button's pin are left out.
+const uint8_t OUTPUT_PINS[] = {2, 4, 12, 13, 14, 15};
+
+// A physical strip: its data pin and how many pixels it has. Outputs take
+// consecutive ranges of leds[] in order.
+struct OutputDef {
+  uint8_t pin;
+  uint16_t length;
+};
+
+// A run of pixels rendered by its own effect. Segments tile leds[] in
+// order. The first follows settings.mode and effectParams, so the existing
+// controls drive it; the others carry their own mode and parameters.
+struct Segment {
+  uint16_t start;
+  uint16_t length;
+  uint8_t mode;
+  EffectParams params;
+  EffectState state;
+};
+
+struct StripLayout {
+  uint8_t outputCount;
+  OutputDef outputs[MAX_OUTPUTS];
+  uint8_t segmentCount;
+  Segment segments[MAX_SEGMENTS];
+  MapDef map;
+};
+
+extern StripLayout layout;
+
+void defaultLayout(StripLayout& layout);
+uint16_t layoutLength(const StripLayout& layout);
+bool isOutputPin(uint8_t pin);
+
+// The strip length and outputs only take effect at boot, when buffers and
+// controllers are set up; segments and the map can change while running.
+// The map has an image of its own, packed with packMap().
+void packLayout(const StripLayout& layout, uint8_t* image);
+bool unpackLayout(StripLayout& layout, const uint8_t* image);
+
+// Applies "outputs", "segments" and/or "map" from a /layout body. Nothing changes
+// unless the whole result is valid; outputsChanged reports whether a
+// restart is needed for it to take effect.
+bool applyLayoutJson(StripLayout& layout, JsonObjectConst json, bool& outputsChanged);
+size_t writeLayoutJson(const StripLayout& layout, char* buffer, size_t size);
+
+// Gives every segment its range of ledHeat and a fresh effect state.
+void attachSegments(StripLayout& layout);
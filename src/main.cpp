@@ -2,354 +2,591 @@
 #include <EEPROM.h>
 #include <FS.h>
 #include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
 #include <ESPAsyncWebServer.h>
 #include <AsyncJson.h>
+#include <AsyncMqttClient.h>
 #include <FastLED.h>
+#include <eboot_command.h>
+#include <lwip/tcp.h>
+
+#include "animation.h"
+#include "animation_file.h"
+#include "asset_handler.h"
+#include "audio.h"
+#include "body_pool.h"
+#include "button.h"
+#include "clock_sync.h"
+#include "compositor.h"
+#include "config_store.h"
+#include "control.h"
+#include "effects.h"
+#include "esp_flash.h"
+#include "json_writer.h"
+#include "layout.h"
+#include "metrics.h"
+#include "mqtt_state.h"
+#include "ota.h"
+#include "pixel_map.h"
+#include "preview.h"
+#include "registry.h"
+#include "renderer.h"
+#include "scheduler.h"
+#include "sha256.h"
+#include "stream.h"
+#include "trace.h"
+#include "wifi_link.h"
 
-#define LED_PIN 15
 #define BTN_PIN 5
-#define NUM_LEDS 72
+#define AUDIO_PIN A0
+#define ANIMATION_UPLOAD_FILE "/animation.tmp"
+#define OTA_USER "plumbob"
+#define MAP_POINTS_FILE "/map.bin"
+#define MAP_POINTS_UPLOAD_FILE "/map.tmp"
 
 const int ESIZE = 2048;
 const int E_DATA_START = 128;
-const long LONG_PRESS_TIME = 1000;
-const long VERY_LONG_PRESS_TIME = 5000;
+const int E_EEPROM_END = E_DATA_START + 41;
+const int E_LAYOUT_START = 192;
+const int E_MQTT_START = 256;
+const int E_OTA_START = 416;
+const int E_MAP_START = 448;
+const size_t OTA_PASSWORD_SIZE = 32;
+const size_t OTA_MIN_PASSWORD = 8;
+const uint32_t OTA_RESTART_DELAY = 500;
+const uint8_t MAX_STREAM_PACKETS = 8;
+const uint8_t MAX_CLOCK_PACKETS = 8;
+const size_t MAX_CONTROL_MESSAGE = 128;
+const uint32_t STATE_PUSH_INTERVAL = 50;
+const uint8_t MAX_PREVIEW_CLIENTS = 2;
+const uint8_t DEFAULT_PREVIEW_FPS = 10;
+const uint8_t MAX_PREVIEW_FPS = 30;
+const size_t LAYOUT_DOCUMENT_SIZE = 1024;
+const size_t MQTT_DOCUMENT_SIZE = 512;
 
 AsyncWebServer server(80);
+AssetHandler assets(SPIFFS);
+AsyncWebSocket socket("/ws");
+AsyncWebSocket previewSocket("/preview");
+FrameScheduler scheduler(DEFAULT_FPS);
+Compositor compositor;
+
+BodyPool bodyPool;
+EspFlash configFlash;
+ConfigStore configStore(configFlash);
+
+WifiLink wifiLink;
+WiFiEventHandler gotIpHandler;
+WiFiEventHandler disconnectedHandler;
+char wifiSsid[33];
+char wifiPassword[65];
+char statusJson[1792];
+
+SampleBuffer audioSamples;
+AudioAnalyzer audioAnalyzer;
+SampleClock audioClock;
+bool audioActive = false;
+
+AnimationFile animationFile(SPIFFS);
+AnimationPlayer animationPlayer;
+bool playbackActive = false;
+File animationUpload;
+AsyncWebServerRequest *animationUploader = nullptr;
+bool animationUploadFailed = false;
+bool filesystemMounted = false;
+File pointsUpload;
+AsyncWebServerRequest *pointsUploader = nullptr;
+
+EspFlash stagingFlash(FLASH_STAGING);
+EspFlash filesystemFlash(FLASH_FILESYSTEM);
+OtaWriter ota(stagingFlash, filesystemFlash);
+AsyncWebServerRequest *otaUploader = nullptr;
+AsyncClient *otaClient = nullptr;
+size_t otaUnacked = 0;
+bool otaRunning = false;
+bool otaAwaiting = false;
+uint32_t otaRestartAt = 0;
+char otaPassword[OTA_PASSWORD_SIZE];
+
+AsyncMqttClient mqttClient;
+WifiLink mqttLink;
+MqttConfig mqttConfig;
+StatePublisher mqttState(MQTT_STATE_INTERVAL);
+char mqttBase[MQTT_TOPIC_SIZE];
+char mqttStateTopic[MQTT_TOPIC_SIZE];
+char mqttStatusTopic[MQTT_TOPIC_SIZE];
+char mqttCommandTopic[MQTT_TOPIC_SIZE];
+char mqttClientId[16];
+char mqttJson[SETTINGS_JSON_SIZE + 64];
+uint8_t publishedState[E_LAYOUT_START - E_DATA_START];
+
+Metrics metricsSnapshot;
+bool metricsBusy = false;
+bool traceBusy = false;
+
+WiFiUDP ddpUdp;
+WiFiUDP e131Udp;
+PixelStream pixelStream;
+int16_t streamReturnMode = -1;
+
+WiFiUDP clockUdp;
+ClockSync clockSync(ESP.getChipId());
+bool clockJoined = false;
+
+ParamCoalescer controls;
+char stateJson[SETTINGS_JSON_SIZE];
+uint8_t pushedState[E_LAYOUT_START - E_DATA_START];
+uint32_t lastStatePush = 0;
+
+struct PreviewClient {
+  uint32_t id;
+  uint32_t interval;
+  uint32_t nextSend;
+  bool keyframe;
+  CRGB *last;
+};
 
-CRGB leds[NUM_LEDS];
+PreviewClient previewClients[MAX_PREVIEW_CLIENTS];
+uint8_t *previewFrame = nullptr;
+size_t previewFrameLength = 0;
+uint32_t previewSkipped = 0;
 
-DEFINE_GRADIENT_PALETTE (cyan_gp) {
-  0, 11, 0, 196,
-  63, 0, 109, 212,
-  127, 0, 153, 252,
-  191, 0, 221, 255,
-  255, 11, 0, 196
-};
-CRGBPalette16 cyanPalette = cyan_gp;
+char layoutJson[LAYOUT_JSON_SIZE];
 
-DEFINE_GRADIENT_PALETTE (config_gp) {
-  0, 255, 0, 0,
-  128, 0, 0, 255,
-  255, 255, 0, 0
-};
-CRGBPalette16 configPalette = config_gp;
+char settingsJson[SETTINGS_JSON_SIZE];
+size_t settingsJsonLength = 0;
+uint8_t settingsResponses = 0;
 
 boolean configured = false;
 char* indexFile = "configuration.html";
-int brightness = 5;
-int mode = 0;
-bool ledEnabled = false;
-
-int btnLastState;
-int btnCurrentState;
-long pressMillis = 0;
-
-const int iFullRainbowSpeed = 40;
-int fullRainbowSpeed = iFullRainbowSpeed;
-uint8_t fullRainbowHue = 0;
-
-const int iAnimatedRainbowSpeed = 5;
-int animatedRainbowSpeed = iAnimatedRainbowSpeed;
-uint8_t animatedRainbowHue = 0;
-
-const uint8_t iRandomSColor = 100;
-uint8_t randomSColor = iRandomSColor;
-const int iRandomSColorSpeed = 2;
-int randomSColorSpeed = iRandomSColorSpeed;
-
-const int iAnimatedPaletteSpeed = 5;
-int animatedPaletteSpeed = iAnimatedPaletteSpeed;
-uint8_t animatedPaletteIdx = 0;
-
-const int iFadeToBlackSpeed = 10;
-int fadeToBlackSpeed = iFadeToBlackSpeed;
-const int iFadeToBlackFadeSpeed = 2;
-int fadeToBlackFadeSpeed = iFadeToBlackFadeSpeed;
-
-const int iBpmColor = 30;
-int bpmColor = iBpmColor;
-const int iFadeColorSpeed = 5;
-int fadeColorSpeed = iFadeColorSpeed;
-const CRGB iRgbColor = CRGB(33, 150, 243);
-CRGB rgbColor = iRgbColor;
-const CHSV iHsvColor = CHSV(207, 90, 54);
-CHSV hsvColor = iHsvColor;
-
-const int iFireSpeed = 25;
-int fireSpeed = iFireSpeed;
-const int iFireCooling = 55;
-int fireCooling = iFireCooling;
-const int iFireSparks = 120;
-int fireSparks = iFireSparks;
-const bool iFireReverse = false;
-bool fireReverse = iFireReverse;
-
-CRGB staticRGBColor = CRGB(255, 255, 255);
 
+EdgeQueue buttonEdges;
+ButtonClassifier button(LOW);
+ButtonEvent lastButtonEvent = BUTTON_NONE;
+uint32_t buttonPresses = 0;
+
+typedef bool (*JsonHandler)(AsyncWebServerRequest *request, JsonObjectConst json);
+
+// Records how long the handler it is declared in runs under its endpoint.
+class RequestTimer {
+public:
+  explicit RequestTimer(Endpoint endpoint) : endpoint(endpoint), start(micros()) {
+    TRACE_BEGIN(TRACK_HTTP, endpointName(endpoint));
+  }
+
+  ~RequestTimer() {
+    metrics.requests[endpoint].observe(micros() - start);
+    TRACE_END(TRACK_HTTP, endpointName(endpoint));
+  }
+
+private:
+  Endpoint endpoint;
+  uint32_t start;
+};
+
+static_assert(E_LAYOUT_START + LAYOUT_IMAGE_SIZE <= E_MQTT_START, "layout does not fit the config image");
+static_assert(E_MQTT_START + MQTT_IMAGE_SIZE <= E_OTA_START, "MQTT settings do not fit the config image");
+static_assert(E_OTA_START + OTA_PASSWORD_SIZE <= E_MAP_START, "update password does not fit the config image");
+static_assert(E_MAP_START + MAP_IMAGE_SIZE <= CONFIG_IMAGE_SIZE, "pixel map does not fit the config image");
 
 void startServer();
 
-void writeInt(int address, int i) {
-  EEPROM.write(address, i >> 8);
-  EEPROM.write(address + 1, i & 0xff);
+// A stream only borrows the strip, so the effect it returns to is saved
+// in its place, and a reboot mid-stream comes back to that effect instead
+// of waiting on a sender that may be gone.
+void saveStatus() {
+  TRACE_BEGIN(TRACK_LOOP, "saveStatus");
+  uint8_t mode = settings.mode;
+  if (mode == STREAM_MODE && streamReturnMode >= 0) settings.mode = streamReturnMode;
+  packSettings(configStore.data() + E_DATA_START);
+  settings.mode = mode;
+  configStore.markDirty(millis());
+  TRACE_END(TRACK_LOOP, "saveStatus");
 }
 
-int readInt(int address) {
-  byte b1 = EEPROM.read(address);
-  byte b2 = EEPROM.read(address + 1);
-  return (b1 << 8) + b2;
+void saveLayout() {
+  packLayout(layout, configStore.data() + E_LAYOUT_START);
+  packMap(layout.map, configStore.data() + E_MAP_START);
+  configStore.markDirty(millis());
 }
 
-void writeRGB(int address, CRGB color) {
-  writeInt(address, color.red);
-  writeInt(address + 2, color.green);
-  writeInt(address + 4, color.blue);
+// Compiles the layout's map into the tables the 2D effects draw through.
+// A points map reads its coordinates from MAP_POINTS_FILE; until that has
+// an x and y byte for every pixel, the strip is drawn as a strip.
+void buildPixelMap() {
+  uint8_t *points = nullptr;
+  if (layout.map.shape == MAP_POINTS && filesystemMounted) {
+    File file = SPIFFS.open(MAP_POINTS_FILE, "r");
+    if (file && file.size() == numLeds * 2u) {
+      points = (uint8_t*) malloc(file.size());
+      if (points && file.read(points, file.size()) != file.size()) {
+        free(points);
+        points = nullptr;
+      }
+    }
+    if (file) file.close();
+  }
+
+  if (!pixelMap.build(layout.map, numLeds, points)) Serial.println("Pixel map could not be built, drawing along the strip");
+  free(points);
 }
 
-CRGB readRGB(int address) {
-  int red = readInt(address);
-  int green = readInt(address + 2);
-  int blue = readInt(address + 4);
+// The EEPROM only ever held the WiFi credentials and the first 41 bytes of
+// the settings, up to the static color; everything after those, in the
+// settings and past them, starts from the defaults.
+void importEeprom() {
+  Serial.println("Importing settings from EEPROM...");
+
+  packSettings(configStore.data() + E_DATA_START);
+  EEPROM.begin(ESIZE);
+  memcpy(configStore.data(), EEPROM.getConstDataPtr(), E_EEPROM_END);
+  EEPROM.end();
 
-  return CRGB(red, green, blue);
+  configStore.commit();
 }
 
-void staticRGB(CRGB color) {
-  fill_solid(leds, NUM_LEDS, color);
-  FastLED.show();
+// Updates stay locked until a password is set; erased flash, or anything
+// that is not a terminated string, reads as none.
+void loadUpdatePassword() {
+  memcpy(otaPassword, configStore.constData() + E_OTA_START, OTA_PASSWORD_SIZE);
+  if (!memchr(otaPassword, '\0', OTA_PASSWORD_SIZE)) otaPassword[0] = '\0';
 }
 
-void staticHSV(CHSV color) {
-  fill_solid(leds, NUM_LEDS, color);
-  FastLED.show();
+void stopServer() {
+  server.end();
 }
 
-void staticRainbow() {
-  fill_rainbow(leds, NUM_LEDS, 0, 255 / NUM_LEDS);
-  FastLED.show();
+void stopAP() {
+  WiFi.softAPdisconnect(true);
 }
 
-void fullRainbow() {
-  for (int i = 0; i < NUM_LEDS; i++) {
-    leds[i] = CHSV(fullRainbowHue, 255, 255);
-  }
+void startWiFi() {
+  // Credentials come from the config store; keep the SDK from writing its
+  // own copy to flash on every attempt, and from reconnecting behind our back.
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
 
-  EVERY_N_MILLIS_I(timer, fullRainbowSpeed) {
-    timer.setPeriod(fullRainbowSpeed);
-    fullRainbowHue++;
-  }
+  gotIpHandler = WiFi.onStationModeGotIP([] (const WiFiEventStationModeGotIP &event) {
+    TRACE_INSTANT(TRACK_WIFI, "got IP");
+    wifiLink.linkUp(millis());
 
-  FastLED.show();
-}
+    Serial.println("Connection established!");
+    Serial.print("IP address: ");
+    Serial.println(event.ip);
+  });
 
-void animatedRainbow() {
-  for (int i = 0; i < NUM_LEDS; i++) {
-    leds[i] = CHSV(animatedRainbowHue + (i), 255, 255);
-  }
+  disconnectedHandler = WiFi.onStationModeDisconnected([] (const WiFiEventStationModeDisconnected &event) {
+    // Re-issuing WiFi.begin() leaves the old association first; that is not a failure.
+    if (event.reason == WIFI_DISCONNECT_REASON_ASSOC_LEAVE) return;
 
-  EVERY_N_MILLIS_I(timer, animatedRainbowSpeed) {
-    timer.setPeriod(animatedRainbowSpeed);
-    animatedRainbowHue++;
-  }
+    TRACE_INSTANT(TRACK_WIFI, "disconnected");
+    if (wifiLink.getState() == LINK_UP) Serial.println("WiFi disconnected!");
+    wifiLink.linkDown(millis());
+  });
 
-  FastLED.show();
+  wifiLink.start(millis());
 }
 
-void randomSingleColor() {
-  EVERY_N_MILLIS_I(timer, randomSColorSpeed) {
-    timer.setPeriod(randomSColorSpeed);
-    leds[0] = CHSV(randomSColor, random8(), random8(100, 255));
+void pollWiFi() {
+  if (!wifiLink.poll(millis())) return;
 
-    for (int i = NUM_LEDS - 1; i > 0; i--) {
-      leds[i] = leds[i - 1];
-    }
-
-    FastLED.show();
-  }
+  Serial.print("Connecting to ");
+  Serial.print(wifiSsid);
+  Serial.println(" ...");
+  TRACE_BEGIN(TRACK_WIFI, "reconnect");
+  WiFi.begin(wifiSsid, wifiPassword);
+  TRACE_END(TRACK_WIFI, "reconnect");
 }
 
-void staticPalette(CRGBPalette16 palette) {
-  fill_palette(leds, NUM_LEDS, 0, 255 / NUM_LEDS, palette, 255, LINEARBLEND);
-  FastLED.show();
+size_t writeMqttState() {
+  JsonWriter json(mqttJson, sizeof(mqttJson));
+  json.beginObject();
+  writeSettingsFields(json);
+  json.key("button");
+  json.value(buttonEventName(lastButtonEvent));
+  json.key("button_presses");
+  json.value(buttonPresses);
+  json.endObject();
+  return json.overflowed() ? 0 : json.length();
 }
 
-void animatedPalette(CRGBPalette16 palette) {
-  fill_palette(leds, NUM_LEDS, animatedPaletteIdx, 255 / NUM_LEDS, palette, 255, LINEARBLEND);
-
-  EVERY_N_MILLIS_I(timer, animatedPaletteSpeed) {
-    timer.setPeriod(animatedPaletteSpeed);
-    animatedPaletteIdx++;
+bool onEnable(AsyncWebServerRequest *request, JsonObjectConst json);
+bool onBrightness(AsyncWebServerRequest *request, JsonObjectConst json);
+bool onSettings(AsyncWebServerRequest *request, JsonObjectConst json);
+
+// Commands go through the handlers of the matching HTTP endpoints. They
+// are short, so a payload that arrives in pieces is not one.
+void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index,
+    size_t total) {
+  MqttCommand command = parseMqttTopic(mqttBase, topic);
+  if (command == MQTT_COMMAND_NONE) return;
+
+  // Callbacks run on the small system stack, one at a time.
+  static StaticJsonDocument<MQTT_DOCUMENT_SIZE> document;
+  if (index != 0 || len != total || len > MAX_BODY_SIZE || !parseMqttPayload(command, payload, len, document)) {
+    metrics.mqttRejected++;
+    return;
   }
 
-  FastLED.show();
+  TRACE_INSTANT(TRACK_WIFI, "mqtt command");
+  JsonObjectConst json = document.as<JsonObjectConst>();
+  switch (command) {
+    case MQTT_COMMAND_ENABLE:
+      onEnable(nullptr, json);
+      break;
+    case MQTT_COMMAND_BRIGHTNESS:
+      onBrightness(nullptr, json);
+      break;
+    default:
+      onSettings(nullptr, json);
+      break;
+  }
+  metrics.mqttCommands++;
 }
 
-void fadeToBlack(CRGBPalette16 palette) {
-  EVERY_N_MILLIS_I(timer, fadeToBlackSpeed) {
-    timer.setPeriod(fadeToBlackSpeed);
-    leds[random8(0, NUM_LEDS - 1)] = ColorFromPalette(palette, random8(), 255, LINEARBLEND);
+void startMqtt() {
+  unpackMqttConfig(mqttConfig, configStore.constData() + E_MQTT_START);
+  if (mqttConfig.host[0] == '\0' || mqttBaseTopic(mqttConfig, ESP.getChipId(), mqttBase, sizeof(mqttBase)) == 0) {
+    mqttConfig.host[0] = '\0';
+    return;
   }
 
-  fadeToBlackBy(leds, NUM_LEDS, fadeToBlackFadeSpeed);
+  snprintf(mqttStateTopic, sizeof(mqttStateTopic), "%s/state", mqttBase);
+  snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/status", mqttBase);
+  snprintf(mqttCommandTopic, sizeof(mqttCommandTopic), "%s/+/set", mqttBase);
+  snprintf(mqttClientId, sizeof(mqttClientId), "plumbob-%06x", (unsigned) ESP.getChipId());
 
-  FastLED.show();
-}
+  mqttClient.setServer(mqttConfig.host, mqttConfig.port);
+  mqttClient.setClientId(mqttClientId);
+  if (mqttConfig.user[0] != '\0') {
+    mqttClient.setCredentials(mqttConfig.user, mqttConfig.password[0] != '\0' ? mqttConfig.password : nullptr);
+  }
+  mqttClient.setWill(mqttStatusTopic, 1, true, "offline");
 
-void beatRGB() {
-  uint8_t sinBeat = beatsin8(bpmColor, 0, NUM_LEDS - 1, 0, 0);
+  mqttClient.onConnect([] (bool sessionPresent) {
+    TRACE_INSTANT(TRACK_WIFI, "mqtt up");
+    mqttLink.linkUp(millis());
+    mqttClient.subscribe(mqttCommandTopic, 0);
+    mqttClient.publish(mqttStatusTopic, 1, true, "online");
+    mqttState.connected();
 
-  leds[sinBeat] = rgbColor;
+    Serial.print("MQTT connected to ");
+    Serial.println(mqttConfig.host);
+  });
 
-  fadeToBlackBy(leds, NUM_LEDS, fadeColorSpeed);
+  mqttClient.onDisconnect([] (AsyncMqttClientDisconnectReason reason) {
+    TRACE_INSTANT(TRACK_WIFI, "mqtt down");
+    if (mqttLink.getState() == LINK_UP) Serial.println("MQTT disconnected!");
+    mqttLink.linkDown(millis());
+  });
 
-  FastLED.show();
+  mqttClient.onMessage(onMqttMessage);
+  mqttLink.start(millis());
 }
 
-void beatHSV() {
-  uint8_t sinBeat = beatsin8(bpmColor, 0, NUM_LEDS - 1, 0, 0);
-
-  leds[sinBeat] = hsvColor;
-
-  fadeToBlackBy(leds, NUM_LEDS, fadeColorSpeed);
-
-  FastLED.show();
-}
+// The client resolves and connects in the background and reports back
+// through its callbacks, so nothing here waits on the broker; mqttLink
+// paces the attempts the way wifiLink does the station's. State goes out
+// retained, coalesced to one message per MQTT_STATE_INTERVAL.
+void pollMqtt(uint32_t now) {
+  if (mqttConfig.host[0] == '\0' || wifiLink.getState() != LINK_UP) return;
+
+  if (mqttLink.poll(now)) {
+    TRACE_BEGIN(TRACK_WIFI, "mqtt connect");
+    mqttClient.connect();
+    TRACE_END(TRACK_WIFI, "mqtt connect");
+  }
+  if (mqttLink.getState() != LINK_UP) return;
+
+  uint8_t state[sizeof(publishedState)];
+  memset(state, 0, sizeof(state));
+  packSettings(state);
+  if (memcmp(state, publishedState, sizeof(state)) != 0) {
+    memcpy(publishedState, state, sizeof(state));
+    mqttState.changed();
+  }
 
-void beatPalette(CRGBPalette16 palette) {
-  uint8_t beatA = beatsin8(30, 0, 255);
-  uint8_t beatB = beatsin8(20, 0, 255);
+  if (!mqttState.due(now)) return;
 
-  fill_palette(leds, NUM_LEDS, (beatA + beatB) / 2, 10, palette, 255, LINEARBLEND);
-  FastLED.show();
+  size_t length = writeMqttState();
+  if (length > 0 && mqttClient.publish(mqttStateTopic, 0, true, mqttJson, length) != 0) mqttState.published(now);
+  else mqttState.failed(now);
 }
 
-void fire() {
-  EVERY_N_MILLIS_I(timer, fireSpeed) {
-    timer.setPeriod(fireSpeed);
-    static uint8_t heat[NUM_LEDS];
+void receiveStream(WiFiUDP &udp, bool ddp) {
+  uint8_t header[E131_HEADER_SIZE];
 
-    for(int i = 0; i < NUM_LEDS; i++) {
-      heat[i] = qsub8(heat[i], random8(0, ((fireCooling * 10) / NUM_LEDS) + 2));
-    }
+  for (uint8_t i = 0; i < MAX_STREAM_PACKETS; i++) {
+    int length = udp.parsePacket();
+    if (length <= 0) return;
 
-    for(int k = NUM_LEDS - 1; k >= 2; k--) {
-      heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2]) / 3;
-    }
+    uint32_t now = millis();
+    StreamSpan span;
+    bool accepted;
 
-    if(random8() < fireSparks) {
-      int y = random8(7);
-      heat[y] = qadd8(heat[y], random8(160,255));
+    if (ddp) {
+      size_t headerLength = udp.read(header, DDP_HEADER_SIZE);
+      size_t size = pixelStream.ddpHeaderSize(header, headerLength);
+      if (size > headerLength) headerLength += udp.read(header + headerLength, size - headerLength);
+      accepted = pixelStream.beginDdp(header, headerLength, length, now, span);
+    } else {
+      size_t headerLength = udp.read(header, E131_HEADER_SIZE);
+      accepted = pixelStream.beginE131(header, headerLength, length, now, span);
     }
 
-    for(int j = 0; j < NUM_LEDS; j++) {
-      CRGB color = HeatColor(heat[j]);
-      int pixelnumber;
-      if(reverse) {
-        pixelnumber = (NUM_LEDS - 1) - j;
-      } else {
-        pixelnumber = j;
-      }
-      leds[pixelnumber] = color;
-    }
+    // The rest of a rejected packet is discarded by the next parsePacket().
+    if (!accepted) continue;
 
-    FastLED.show();
+    udp.read(span.target, span.length);
+    pixelStream.endPacket(span);
   }
 }
 
-void saveStatus() {
-  writeInt(E_DATA_START, brightness);
-  EEPROM.write(E_DATA_START + 2, (byte) mode);
-  EEPROM.write(E_DATA_START + 3, (byte) ledEnabled ? 1 : 0);
-  writeInt(E_DATA_START + 4, fullRainbowSpeed);
-  writeInt(E_DATA_START + 6, animatedRainbowSpeed);
-  writeInt(E_DATA_START + 8, randomSColor);
-  writeInt(E_DATA_START + 10, randomSColorSpeed);
-  writeInt(E_DATA_START + 12, animatedPaletteSpeed);
-  writeInt(E_DATA_START + 14, fadeToBlackSpeed);
-  writeInt(E_DATA_START + 16, fadeToBlackFadeSpeed);
-  writeInt(E_DATA_START + 18, bpmColor);
-  writeInt(E_DATA_START + 20, fadeColorSpeed);
-  writeRGB(E_DATA_START + 22, rgbColor);
-  writeInt(E_DATA_START + 28, fireSpeed);
-  writeInt(E_DATA_START + 30, fireCooling);
-  writeInt(E_DATA_START + 32, fireSparks);
-  EEPROM.write(E_DATA_START + 34, (byte) fireReverse ? 1 : 0);
-  writeRGB(E_DATA_START + 35, staticRGBColor);
-  
-  EEPROM.commit();
-  Serial.println("Settings saved");
-}
+void pollStream() {
+  receiveStream(ddpUdp, true);
+  receiveStream(e131Udp, false);
 
-void stopServer() {
-  server.end();
+  if (pixelStream.active(millis())) {
+    if (settings.mode != STREAM_MODE) {
+      streamReturnMode = settings.mode;
+      settings.mode = STREAM_MODE;
+      Serial.println("Stream started");
+    }
+  } else if (streamReturnMode >= 0) {
+    if (settings.mode == STREAM_MODE) settings.mode = streamReturnMode;
+    streamReturnMode = -1;
+    Serial.println("Stream timed out");
+  }
 }
 
-void stopAP() {
-  WiFi.softAPdisconnect(true);
+void sendClockPacket(const uint8_t *data, size_t length) {
+  clockUdp.beginPacketMulticast(IPAddress(CLOCK_SYNC_GROUP), CLOCK_SYNC_PORT, WiFi.localIP());
+  clockUdp.write(data, length);
+  clockUdp.endPacket();
 }
 
-boolean connectToWiFi(char* ssid, char* password) {
-  WiFi.begin(ssid, password);
-  WiFi.setSleepMode(WIFI_NONE_SLEEP);
-  Serial.print("Connecting to ");
-  Serial.print(ssid);
-  Serial.println(" ...");
+// Joins the clock group whenever the station is up, answers and learns
+// from what has arrived, and sends whatever beacon or request is due.
+void pollClock() {
+  if (WiFi.status() != WL_CONNECTED) {
+    if (clockJoined) clockUdp.stop();
+    clockJoined = false;
+    return;
+  }
 
-  int i = 0;
-  while (WiFi.status() != WL_CONNECTED) {
-    Serial.print(".");
+  if (!clockJoined) {
+    clockJoined = clockUdp.beginMulticast(WiFi.localIP(), IPAddress(CLOCK_SYNC_GROUP), CLOCK_SYNC_PORT) == 1;
+    if (!clockJoined) return;
+  }
 
-    i++;
-    if (i > 30) {
-      return false;
-    }
+  uint8_t packet[CLOCK_PACKET_SIZE];
+  uint8_t reply[CLOCK_PACKET_SIZE];
+  for (uint8_t i = 0; i < MAX_CLOCK_PACKETS; i++) {
+    int length = clockUdp.parsePacket();
+    if (length <= 0) break;
 
-    delay(1000);
+    // A longer packet is not ours; receive() counts it as invalid.
+    size_t read = clockUdp.read(packet, sizeof(packet));
+    size_t replyLength = clockSync.receive(packet, (size_t) length == read ? read : 0, micros(), reply);
+    if (replyLength > 0) sendClockPacket(reply, replyLength);
   }
 
-  Serial.println();
+  size_t length;
+  while ((length = clockSync.poll(micros(), packet)) > 0) sendClockPacket(packet, length);
+}
 
-  Serial.println("Connection established!");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  return true;
+void onBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (index == 0) {
+    request -> onDisconnect([request] () {
+      bodyPool.release(request);
+    });
+  }
+
+  bodyPool.append(request, data, len, index, total);
 }
 
-void onConfigure(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-  StaticJsonDocument<200> jsonDocument;
-  DeserializationError error = deserializeJson(jsonDocument, data);
+template <size_t capacity = 200>
+void handleJson(AsyncWebServerRequest *request, JsonHandler handler) {
+  if (request -> contentLength() > MAX_BODY_SIZE) {
+    request -> send(413, "text/plain", "Payload too large");
+    return;
+  }
+
+  char *body;
+  size_t length;
+  BodyStatus status = bodyPool.take(request, body, length);
+
+  if (status == BODY_MISSING && request -> contentLength() > 0) {
+    request -> send(503, "text/plain", "Busy");
+    return;
+  }
+
+  if (status != BODY_COMPLETE) {
+    bodyPool.release(request);
+    request -> send(400, "text/plain", "Incomplete body");
+    return;
+  }
+
+  // body is writable, so ArduinoJson parses it in place without copying strings.
+  StaticJsonDocument<capacity> jsonDocument;
+  DeserializationError error = deserializeJson(jsonDocument, body, length);
 
   if (error) {
+    bodyPool.release(request);
     Serial.println("Json deserialization failed.");
+    request -> send(400, "text/plain", "Invalid JSON");
     return;
   }
 
-  String ssid = jsonDocument["ssid"];
-  String password = jsonDocument["password"];
+  bool handled = handler(request, jsonDocument.as<JsonObjectConst>());
+  bodyPool.release(request);
+
+  if (handled) request -> send(200, "OK");
+  else request -> send(400, "text/plain", "Invalid settings");
+}
+
+bool onConfigure(AsyncWebServerRequest *request, JsonObjectConst json) {
+  const char *ssid = json["ssid"];
+  const char *password = json["password"];
 
-  char s[ssid.length() + 1];
-  char p[password.length() + 1];
-  ssid.toCharArray(s, sizeof(s));
-  password.toCharArray(p, sizeof(p));
+  if (ssid == NULL || password == NULL) return false;
 
-  EEPROM.write(0, 1);
+  size_t ssidSize = strlen(ssid) + 1;
+  size_t passwordSize = strlen(password) + 1;
+  if (ssidSize > 61 || passwordSize > 64) return false;
 
-  EEPROM.write(1, sizeof(s));
-  for (int i = 0; i < sizeof(s); i++) {
-    EEPROM.write(i + 2, s[i]);
+  uint8_t *config = configStore.data();
+  config[0] = 1;
+
+  config[1] = ssidSize;
+  for (int i = 0; i < ssidSize; i++) {
+    config[i + 2] = ssid[i];
   }
 
-  EEPROM.write(63, sizeof(p));
-  for (int i = 0; i < sizeof(p); i++) {
-    EEPROM.write(i + 64, p[i]);
+  config[63] = passwordSize;
+  for (int i = 0; i < passwordSize; i++) {
+    config[i + 64] = password[i];
   }
 
-  EEPROM.commit();
+  configStore.commit();
   FastLED.clear();
   FastLED.show();
 
   ESP.restart();
+  return true;
+}
+
+// Images built without scripts/compress_data.py have no manifest and are
+// served as stored.
+void serveAssets() {
+  if (assets.begin()) {
+    assets.setDefaultFile(indexFile);
+    server.addHandler(&assets);
+  } else {
+    server.serveStatic("/", SPIFFS, "/").setDefaultFile(indexFile);
+  }
 }
 
 void startConfigServer() {
@@ -358,10 +595,11 @@ void startConfigServer() {
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "*");
 
   server.on("/configuration", HTTP_POST, [] (AsyncWebServerRequest *request) {
-      request -> send(200, "OK");
-    }, NULL, onConfigure);
+      RequestTimer timer(ENDPOINT_CONFIGURATION);
+      handleJson(request, onConfigure);
+    }, NULL, onBody);
 
-  server.serveStatic("/", SPIFFS, "/").setDefaultFile(indexFile);
+  serveAssets();
 
   server.onNotFound([](AsyncWebServerRequest *request) {
     if (request -> method() == HTTP_OPTIONS) request -> send(200);
@@ -394,246 +632,671 @@ void startConfiguration() {
   startConfigServer();
 }
 
-void onEnable(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-  StaticJsonDocument<200> jsonDocument;
-  DeserializationError error = deserializeJson(jsonDocument, data);
+// /enable and /brightness, and their MQTT topics, only ever set their own
+// setting; anything else in the body is left to /settings.
+void applyGlobalParam(const char* stateKey, JsonObjectConst json) {
+  void* base;
+  const ParamDef* def = findParam(stateKey, strlen(stateKey), &base);
+  if (def) applyJson(def, 1, base, json);
+}
 
-  if (error) {
-    Serial.println("Json deserialization failed.");
+bool onEnable(AsyncWebServerRequest *request, JsonObjectConst json) {
+  applyGlobalParam("led_enabled", json);
+  Serial.print("LEDs ");
+  if (settings.ledEnabled) Serial.println("enabled");
+  else Serial.println("disabled");
+  return true;
+}
+
+bool onBrightness(AsyncWebServerRequest *request, JsonObjectConst json) {
+  applyGlobalParam("brightness", json);
+  Serial.print("Brightness set to ");
+  Serial.println(settings.brightness);
+  return true;
+}
+
+bool onSettings(AsyncWebServerRequest *request, JsonObjectConst json) {
+  uint8_t changed = applySettingsJson(json);
+
+  Serial.print("Mode set to ");
+  Serial.print(settings.mode);
+  Serial.print(", ");
+  Serial.print(changed);
+  Serial.println(" settings updated");
+  return true;
+}
+
+void onGetSettings(AsyncWebServerRequest *request) {
+  // Responses still being sent read from settingsJson, so it is only
+  // refreshed when none are in flight; overlapping requests share a snapshot.
+  if (settingsResponses == 0) settingsJsonLength = writeSettingsJson(settingsJson, sizeof(settingsJson));
+
+  if (settingsJsonLength == 0) {
+    request -> send(500);
     return;
   }
 
-  ledEnabled = jsonDocument["enabled"];
-  Serial.print("LEDs ");
-  if (ledEnabled) Serial.println("enabled");
-  else Serial.println("disabled");
+  AsyncWebServerResponse *response = request -> beginResponse("application/json", settingsJsonLength,
+    [] (uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      size_t length = settingsJsonLength - index;
+      if (length > maxLen) length = maxLen;
+      memcpy(buffer, settingsJson + index, length);
+      return length;
+    });
+
+  settingsResponses++;
+  request -> onDisconnect([] () {
+    settingsResponses--;
+  });
+  request -> send(response);
 }
 
-void onBrightness(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-  StaticJsonDocument<200> jsonDocument;
-  DeserializationError error = deserializeJson(jsonDocument, data);
+bool onLayout(AsyncWebServerRequest *request, JsonObjectConst json) {
+  static StripLayout next;
+  next = layout;
+
+  bool outputsChanged;
+  if (!applyLayoutJson(next, json, outputsChanged)) return false;
+
+  // Buffers and controllers are sized for the strip at boot, so new
+  // outputs only take effect after a restart.
+  if (outputsChanged) {
+    packLayout(next, configStore.data() + E_LAYOUT_START);
+    packMap(next.map, configStore.data() + E_MAP_START);
+    configStore.commit();
+    Serial.println("Strip layout changed, restarting...");
+    FastLED.clear();
+    FastLED.show();
 
-  if (error) {
-    Serial.println("Json deserialization failed.");
+    ESP.restart();
+    return true;
+  }
+
+  layout = next;
+  attachSegments(layout);
+  if (!json["map"].isNull()) buildPixelMap();
+  saveLayout();
+
+  Serial.print("Layout set to ");
+  Serial.print(layout.segmentCount);
+  Serial.println(" segments");
+  return true;
+}
+
+// Broker settings are read at boot, so a change restarts the device.
+bool onMqtt(AsyncWebServerRequest *request, JsonObjectConst json) {
+  MqttConfig next = mqttConfig;
+  if (!applyMqttConfigJson(next, json)) return false;
+
+  packMqttConfig(next, configStore.data() + E_MQTT_START);
+  configStore.commit();
+  Serial.println("MQTT settings changed, restarting...");
+  FastLED.clear();
+  FastLED.show();
+
+  ESP.restart();
+  return true;
+}
+
+bool onUpdatePassword(AsyncWebServerRequest *request, JsonObjectConst json) {
+  const char *password = json["password"];
+  if (!password) return false;
+
+  size_t length = strlen(password);
+  if (length < OTA_MIN_PASSWORD || length >= OTA_PASSWORD_SIZE) return false;
+
+  memset(otaPassword, 0, OTA_PASSWORD_SIZE);
+  memcpy(otaPassword, password, length);
+  memcpy(configStore.data() + E_OTA_START, otaPassword, OTA_PASSWORD_SIZE);
+  configStore.commit();
+  Serial.println("Update password changed");
+  return true;
+}
+
+void onGetLayout(AsyncWebServerRequest *request) {
+  if (writeLayoutJson(layout, layoutJson, sizeof(layoutJson)) == 0) request -> send(500);
+  else request -> send(200, "application/json", layoutJson);
+}
+
+void onStatus(AsyncWebServerRequest *request) {
+  uint32_t now = millis();
+  const LinkStats &link = wifiLink.getStats();
+
+  JsonWriter json(statusJson, sizeof(statusJson));
+  json.beginObject();
+  json.key("leds");
+  json.value(numLeds);
+  json.key("segments");
+  json.value(layout.segmentCount);
+  json.key("wifi");
+  json.value(wifiLink.stateName());
+  json.key("wifi_attempts");
+  json.value(link.attempts);
+  json.key("wifi_connects");
+  json.value(link.connects);
+  json.key("wifi_drops");
+  json.value(link.drops);
+  json.key("wifi_down_ms");
+  json.value(wifiLink.downMillis(now));
+  json.key("wifi_last_reconnect_ms");
+  json.value(link.lastReconnectMillis);
+  json.key("wifi_max_reconnect_ms");
+  json.value(link.maxReconnectMillis);
+
+  const LinkStats &mqttStats = mqttLink.getStats();
+  const PublishStats &published = mqttState.getStats();
+  json.key("mqtt");
+  json.value(mqttConfig.host[0] == '\0' ? "off" : mqttLink.stateName());
+  json.key("mqtt_connects");
+  json.value(mqttStats.connects);
+  json.key("mqtt_drops");
+  json.value(mqttStats.drops);
+  json.key("mqtt_published");
+  json.value(published.published);
+  json.key("mqtt_coalesced");
+  json.value(published.coalesced);
+  json.key("mqtt_commands");
+  json.value(metrics.mqttCommands);
+
+  const ClockStats &clock = clockSync.getStats();
+  json.key("clock");
+  json.value(clockSync.leading() ? "leader" : clockSync.synced() ? "follower" : "unsynced");
+  json.key("clock_leader");
+  json.value(clockSync.getLeader());
+  json.key("clock_error_us");
+  json.signedValue(clock.errorMicros);
+  json.key("clock_rtt_us");
+  json.value(clock.delayMicros);
+  json.key("clock_drift_ppb");
+  json.signedValue(clock.driftPpb);
+  json.key("clock_steps");
+  json.value(clock.steps);
+
+  json.key("filesystem");
+  json.value(filesystemMounted ? "mounted" : "unmounted");
+  json.key("update");
+  json.value(otaStateName(ota.getState()));
+  json.key("update_error");
+  json.value(otaErrorName(ota.getError()));
+  json.key("update_received");
+  json.value(ota.getStats().received);
+  json.key("update_size");
+  json.value(ota.getSize());
+
+  const ControlStats &control = controls.getStats();
+  json.key("ws_clients");
+  json.value(socket.count());
+  json.key("control_messages");
+  json.value(control.messages);
+  json.key("control_updates");
+  json.value(control.updates);
+  json.key("control_coalesced");
+  json.value(control.coalesced);
+  json.key("control_rejected");
+  json.value(control.rejected);
+
+  const CompositorStats &layers = compositor.getStats();
+  json.key("layers_rendered");
+  json.value(layers.layersRendered);
+  json.key("layers_skipped");
+  json.value(layers.layersSkipped);
+  json.key("transitions");
+  json.value(layers.transitions);
+
+  json.key("preview_clients");
+  json.value(previewSocket.count());
+  json.key("preview_skipped");
+  json.value(previewSkipped);
+
+  const StreamStats &stream = pixelStream.getStats();
+  json.key("stream_packets");
+  json.value(stream.packets);
+  json.key("stream_frames");
+  json.value(stream.frames);
+  json.key("stream_frames_overwritten");
+  json.value(stream.framesOverwritten);
+  json.key("stream_lost");
+  json.value(stream.lost);
+  json.key("stream_out_of_order");
+  json.value(stream.outOfOrder);
+  json.key("stream_invalid");
+  json.value(stream.invalid);
+
+  const SamplingStats &sampling = audioClock.getStats();
+  json.key("audio_samples");
+  json.value(sampling.samples);
+  json.key("audio_held");
+  json.value(sampling.held);
+  json.key("audio_held_percent");
+  json.value(sampling.heldPercent);
+  json.key("audio_overruns");
+  json.value(audioSamples.getOverruns());
+
+  const AnimationStats &playback = animationPlayer.getStats();
+  json.key("playback_frames");
+  json.value(playback.frames);
+  json.key("playback_fps");
+  json.value(playback.fps);
+  json.key("playback_stalls");
+  json.value(playback.stalls);
+  json.key("playback_late");
+  json.value(playback.late);
+  json.key("playback_loops");
+  json.value(playback.loops);
+  json.key("playback_errors");
+  json.value(playback.errors);
+  json.endObject();
+
+  if (json.overflowed()) request -> send(500);
+  else request -> send(200, "application/json", statusJson);
+}
+
+// A scrape renders from a copy taken when it starts, so the text stays the
+// same while it goes out in pieces; one scrape is served at a time.
+void onMetrics(AsyncWebServerRequest *request) {
+  if (metricsBusy) {
+    request -> send(503, "text/plain", "Busy");
     return;
   }
 
-  brightness = jsonDocument["brightness"];
-  Serial.print("Brightness set to ");
-  Serial.println(brightness);
+  metrics.uptimeMillis = millis();
+  metrics.freeHeap = ESP.getFreeHeap();
+  metrics.maxFreeBlock = ESP.getMaxFreeBlockSize();
+  metrics.heapFragmentation = ESP.getHeapFragmentation();
+  metrics.rssi = WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+  metrics.targetFps = scheduler.getTargetFps();
+  metrics.frames = scheduler.getStats();
+  metrics.shown = frameStats;
+  metrics.link = wifiLink.getStats();
+  metrics.mqttLink = mqttLink.getStats();
+  metrics.mqttState = mqttState.getStats();
+  metrics.clock = clockSync.getStats();
+  metrics.clockSynced = clockSync.synced();
+  metrics.clockLeading = clockSync.leading();
+  metrics.playback = animationPlayer.getStats();
+  metrics.audioSampling = audioClock.getStats();
+  metrics.audioOverruns = audioSamples.getOverruns();
+
+  metricsSnapshot = metrics;
+  metricsBusy = true;
+  request -> onDisconnect([] () {
+    metricsBusy = false;
+  });
+
+  size_t length = writeMetrics(metricsSnapshot, nullptr, 0, 0);
+  request -> send(request -> beginResponse("text/plain; version=0.0.4", length,
+    [] (uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return writeMetrics(metricsSnapshot, (char*) buffer, maxLen, index);
+    }));
 }
 
-void onSettings(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-  StaticJsonDocument<200> jsonDocument;
-  DeserializationError error = deserializeJson(jsonDocument, data);
+#ifdef PLUMBOB_TRACE
+// Recording stops while the ring is sent, in one response or over serial,
+// so every piece is cut from the same events.
+void onTrace(AsyncWebServerRequest *request) {
+  if (traceBusy) {
+    request -> send(503, "text/plain", "Busy");
+    return;
+  }
 
-  if (error) {
-    Serial.println("Json deserialization failed.");
+  traceBusy = true;
+  pauseTrace(true);
+  request -> onDisconnect([] () {
+    traceBusy = false;
+    pauseTrace(false);
+  });
+
+  size_t length = writeTraceJson(nullptr, 0, 0);
+  request -> send(request -> beginResponse("application/json", length,
+    [] (uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return writeTraceJson((char*) buffer, maxLen, index);
+    }));
+}
+
+void dumpTrace() {
+  if (traceBusy) return;
+
+  static char chunk[1024];
+  pauseTrace(true);
+
+  size_t sent = 0;
+  size_t length;
+  while ((length = writeTraceJson(chunk, sizeof(chunk), sent)) > 0) {
+    Serial.write((const uint8_t*) chunk, length);
+    sent += length;
+  }
+
+  pauseTrace(false);
+}
+#endif
+
+void stopPlayback() {
+  animationPlayer.stop();
+  animationFile.close();
+  playbackActive = false;
+}
+
+// The file is written next to the one playing and swapped in once whole,
+// so a failed upload leaves the old animation in place. One upload runs
+// at a time.
+void onAnimationUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data,
+    size_t len, bool final) {
+  if (index == 0) {
+    if (animationUploader) return;
+
+    animationUploader = request;
+    request -> onDisconnect([] () {
+      if (animationUpload) animationUpload.close();
+      SPIFFS.remove(ANIMATION_UPLOAD_FILE);
+      animationUploader = nullptr;
+    });
+
+    AnimationHeader header;
+    animationUploadFailed = !parseAnimationHeader(data, len, header) || header.pixels > numLeds;
+    if (!animationUploadFailed) animationUpload = SPIFFS.open(ANIMATION_UPLOAD_FILE, "w");
+    if (!animationUpload) animationUploadFailed = true;
+  }
+
+  if (request != animationUploader || animationUploadFailed) return;
+
+  if (animationUpload.write(data, len) != len) {
+    animationUploadFailed = true;
+    animationUpload.close();
+    return;
+  }
+  if (final) animationUpload.close();
+}
+
+void onAnimation(AsyncWebServerRequest *request) {
+  if (request != animationUploader) {
+    request -> send(503, "text/plain", "Busy");
+    return;
+  }
+  if (animationUploadFailed || animationUpload) {
+    request -> send(400, "text/plain", "Not an animation for this strip, or the filesystem is full");
     return;
   }
 
-  mode = jsonDocument["mode"];
+  stopPlayback();
+  SPIFFS.remove(ANIMATION_FILE);
+  if (!SPIFFS.rename(ANIMATION_UPLOAD_FILE, ANIMATION_FILE)) {
+    request -> send(500);
+    return;
+  }
 
-  Serial.print("Mode set to ");
-  Serial.println(mode);
+  Serial.println("Animation uploaded");
+  request -> send(200, "OK");
+}
 
-  switch (mode) {
-    case 1:
-      if (jsonDocument.containsKey("speed")) {
-        fullRainbowSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(fullRainbowSpeed);
-      }
-      break;
-    case 2:
-      if (jsonDocument.containsKey("speed")) {
-        animatedRainbowSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(animatedRainbowSpeed);
-      }
-      break;
-    case 3:
-      if (jsonDocument.containsKey("color")) {
-        randomSColor = jsonDocument["color"];
-        Serial.print("Hue set to ");
-        Serial.println(randomSColor);
-      }
-      if (jsonDocument.containsKey("speed")) {
-        randomSColorSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(randomSColorSpeed);
-      }
-      break;
-    case 5:
-      if (jsonDocument.containsKey("speed")) {
-        animatedPaletteSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(animatedPaletteSpeed);
-      }
-      break;
-    case 6:
-      if (jsonDocument.containsKey("speed")) {
-        fadeToBlackSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(fadeToBlackSpeed);
-      }
-      if (jsonDocument.containsKey("fade")) {
-        fadeToBlackFadeSpeed = jsonDocument["fade"];
-        Serial.print("Fade speed set to ");
-        Serial.println(fadeToBlackFadeSpeed);
-      }
-      break;
-    case 7:
-      if (jsonDocument.containsKey("bpm")) {
-        bpmColor = jsonDocument["bpm"];
-        Serial.print("BPM set to ");
-        Serial.println(bpmColor);
-      }
-      if (jsonDocument.containsKey("fade")) {
-        fadeColorSpeed = jsonDocument["fade"];
-        Serial.print("Fade speed set to ");
-        Serial.println(fadeColorSpeed);
-      }
-      if (jsonDocument.containsKey("red") && jsonDocument.containsKey("green") && jsonDocument.containsKey("blue")) {
-        rgbColor = CRGB(jsonDocument["red"], jsonDocument["green"], jsonDocument["blue"]);
-        Serial.print("Color set to ");
-        Serial.print(rgbColor.red);
-        Serial.print(" ");
-        Serial.print(rgbColor.red);
-        Serial.print(" ");
-        Serial.println(rgbColor.red);
-      }
-      break;
-    case 9:
-      if (jsonDocument.containsKey("speed")) {
-        fireSpeed = jsonDocument["speed"];
-        Serial.print("Speed set to ");
-        Serial.println(fireSpeed);
-      }
-      if (jsonDocument.containsKey("cooling")) {
-        fireCooling = jsonDocument["cooling"];
-        Serial.print("Cooling set to ");
-        Serial.println(fireCooling);
-      }
-      if (jsonDocument.containsKey("sparks")) {
-        fireSparks = jsonDocument["sparks"];
-        Serial.print("Sparks set to ");
-        Serial.println(fireSparks);
-      }
-      if (jsonDocument.containsKey("reverse")) {
-        fireReverse = jsonDocument["reverse"];
-        Serial.print("Fire reverse set to ");
-        Serial.println(fireReverse);
-      }
-      break;
-    case 10:
-      if (jsonDocument.containsKey("red") && jsonDocument.containsKey("green") && jsonDocument.containsKey("blue")) {
-        uint8_t red = jsonDocument["red"];
-        uint8_t green = jsonDocument["green"];
-        uint8_t blue = jsonDocument["blue"];
-        
-        staticRGBColor = CRGB(red, green, blue);
-        Serial.print("Color set to ");
-        Serial.print(red);
-        Serial.print(" ");
-        Serial.print(green);
-        Serial.print(" ");
-        Serial.println(blue);
-      }
-      break;
+bool updateAuthorized(AsyncWebServerRequest *request) {
+  return otaPassword[0] != '\0' && request -> authenticate(OTA_USER, otaPassword);
+}
+
+// The body goes straight to the staging sectors through the writer's small
+// queue. Its TCP acks are held back and released by serviceOta() as the
+// queue drains, so the sender is paced by the flash instead of the heap.
+void onUpdateBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (index == 0) {
+    if (otaUploader || ota.active() || !updateAuthorized(request)) return;
+
+    uint8_t digest[SHA256_SIZE];
+    AsyncWebHeader *header = request -> getHeader("X-SHA256");
+    if (!header || !parseSha256(header -> value().c_str(), digest)) return;
+
+    OtaImage image = OTA_FIRMWARE;
+    if (request -> hasParam("image")) {
+      const String &name = request -> getParam("image") -> value();
+      if (name == "filesystem") image = OTA_FILESYSTEM;
+      else if (name != "firmware") return;
+    }
+
+    otaUploader = request;
+    otaClient = request -> client();
+    otaUnacked = 0;
+    otaRunning = true;
+    otaAwaiting = false;
+    request -> onDisconnect([request] () {
+      if (request != otaUploader) return;
+      if (ota.getState() == OTA_RECEIVING) ota.abort();
+      otaUploader = nullptr;
+      otaClient = nullptr;
+      otaUnacked = 0;
+    });
+
+    Serial.print("Receiving update, ");
+    Serial.print(total);
+    Serial.println(" bytes");
+    ota.begin(image, total, digest, millis());
   }
+
+  if (request != otaUploader || ota.getState() != OTA_RECEIVING) return;
+
+  request -> client() -> ackLater();
+  otaUnacked += len;
+  ota.write(data, len);
+  if (index + len == total) ota.end();
 }
 
-void onSave(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-  saveStatus();
+// Answered from serviceOta() once the image has been verified or failed.
+void onUpdate(AsyncWebServerRequest *request) {
+  if (request == otaUploader) {
+    otaAwaiting = true;
+    return;
+  }
+
+  if (otaPassword[0] == '\0') request -> send(403, "text/plain", "No update password set");
+  else if (!updateAuthorized(request)) request -> requestAuthentication();
+  else if (otaUploader || ota.active()) request -> send(503, "text/plain", "Busy");
+  else request -> send(400, "text/plain", "Needs an image body and its X-SHA256 header");
 }
 
-void onGetSettings(AsyncWebServerRequest *request) {
-  String response = "{";
+void restartAfterUpdate() {
+  Serial.println("Update installed, restarting...");
+  FastLED.clear();
+  FastLED.show();
 
-  response += "\"brightness\": ";
-  response += brightness;
-  response += ", ";
+  ESP.restart();
+}
+
+// Verified firmware is copied over the running sketch by the boot loader.
+void applyFirmware() {
+  eboot_command command;
+  command.action = ACTION_COPY_RAW;
+  command.args[0] = stagingFlash.offset();
+  command.args[1] = 0;
+  command.args[2] = ota.stagedLength();
+  eboot_command_write(&command);
+}
+
+// Does the update's next paced piece of flash work, acks as much of the
+// upload as the queue has room for, and once the writer is done, answers
+// the upload and restarts into the new image or puts things back.
+void serviceOta(uint32_t now) {
+  if (otaRestartAt != 0) {
+    if ((int32_t) (now - otaRestartAt) >= 0) restartAfterUpdate();
+    return;
+  }
+
+  ota.step(now);
+
+  if (ota.getState() == OTA_INSTALLING && filesystemMounted) {
+    stopPlayback();
+    SPIFFS.end();
+    filesystemMounted = false;
+  }
+
+  if (otaClient && otaUnacked > 0) {
+    size_t ack = ota.getState() == OTA_RECEIVING ? ota.ackable(otaUnacked, TCP_WND) : otaUnacked;
+    if (ack > 0) otaClient -> ack(ack);
+    otaUnacked -= ack;
+  }
+
+  // The request must have finished before it can be answered.
+  if (!otaRunning || ota.active() || (otaUploader && !otaAwaiting)) return;
+  otaRunning = false;
+  otaAwaiting = false;
+
+  if (ota.getState() == OTA_READY) {
+    if (ota.getImage() == OTA_FIRMWARE) applyFirmware();
+    if (otaUploader) otaUploader -> send(200, "OK");
+    otaRestartAt = (now + OTA_RESTART_DELAY) | 1;
+  } else {
+    Serial.print("Update failed: ");
+    Serial.println(otaErrorName(ota.getError()));
+    if (otaUploader) otaUploader -> send(400, "text/plain", otaErrorName(ota.getError()));
+    if (!filesystemMounted) filesystemMounted = SPIFFS.begin();
+  }
+  otaUploader = nullptr;
+  otaClient = nullptr;
+}
+
+// Map points are written next to the ones in use and swapped in once
+// whole, like animations. One upload runs at a time.
+void onMapPointsBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (index == 0) {
+    if (pointsUploader || !filesystemMounted || total != numLeds * 2u) return;
+
+    pointsUploader = request;
+    request -> onDisconnect([request] () {
+      if (request != pointsUploader) return;
+      if (pointsUpload) pointsUpload.close();
+      SPIFFS.remove(MAP_POINTS_UPLOAD_FILE);
+      pointsUploader = nullptr;
+    });
+    pointsUpload = SPIFFS.open(MAP_POINTS_UPLOAD_FILE, "w");
+  }
+
+  if (request != pointsUploader || !pointsUpload) return;
+
+  if (pointsUpload.write(data, len) != len || index + len == total) pointsUpload.close();
+}
+
+void onMapPoints(AsyncWebServerRequest *request) {
+  if (request != pointsUploader) {
+    if (pointsUploader) request -> send(503, "text/plain", "Busy");
+    else request -> send(400, "text/plain", "Needs an x and y byte for every pixel");
+    return;
+  }
+  pointsUploader = nullptr;
 
-  response += "\"mode\": ";
-  response += mode;
-  response += ", ";
+  File staged = SPIFFS.open(MAP_POINTS_UPLOAD_FILE, "r");
+  bool whole = staged && staged.size() == numLeds * 2u;
+  if (staged) staged.close();
 
-  response += "\"led_enabled\": ";
-  response += ledEnabled;
-  response += ", ";
+  if (!whole) {
+    SPIFFS.remove(MAP_POINTS_UPLOAD_FILE);
+    request -> send(500, "text/plain", "Filesystem full");
+    return;
+  }
 
-  response += "\"full_rainbow_speed\": ";
-  response += fullRainbowSpeed;
-  response += ", ";
+  SPIFFS.remove(MAP_POINTS_FILE);
+  if (!SPIFFS.rename(MAP_POINTS_UPLOAD_FILE, MAP_POINTS_FILE)) {
+    request -> send(500);
+    return;
+  }
 
-  response += "\"animated_rainbow_speed\": ";
-  response += animatedRainbowSpeed;
-  response += ", ";
+  if (layout.map.shape == MAP_POINTS) buildPixelMap();
+  Serial.println("Map points uploaded");
+  request -> send(200, "OK");
+}
 
-  response += "\"random_static_color\": ";
-  response += randomSColor;
-  response += ", ";
+void onSocketEvent(AsyncWebSocket *ws, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  if (type == WS_EVT_CONNECT) {
+    size_t length = writeSettingsJson(stateJson, sizeof(stateJson));
+    if (length > 0) client -> text(stateJson, length);
+    return;
+  }
 
-  response += "\"random_static_color_speed\": ";
-  response += randomSColorSpeed;
-  response += ", ";
+  if (type != WS_EVT_DATA) return;
 
-  response += "\"animated_palette_speed\": ";
-  response += animatedPaletteSpeed;
-  response += ", ";
+  // Control messages are short single-frame text; anything else is not one.
+  AwsFrameInfo *info = (AwsFrameInfo*) arg;
+  if (!info -> final || info -> index != 0 || info -> len != len || info -> opcode != WS_TEXT) return;
+  if (len > MAX_CONTROL_MESSAGE) return;
 
-  response += "\"fade_to_black_speed\":";
-  response += fadeToBlackSpeed;
-  response += ", ";
+  controls.parse((const char*) data, len);
+}
 
-  response += "\"fade_to_black_fade_speed\": ";
-  response += fadeToBlackFadeSpeed;
-  response += ", ";
+// Pushes the settings to every client whenever they differ from what was
+// last pushed, whichever path changed them: controls, HTTP, the button or
+// a stream taking over.
+void pushState(uint32_t now) {
+  socket.cleanupClients();
+  if (socket.count() == 0 || now - lastStatePush < STATE_PUSH_INTERVAL) return;
 
-  response += "\"bpm_color\": ";
-  response += bpmColor;
-  response += ", ";
+  uint8_t state[sizeof(pushedState)];
+  memset(state, 0, sizeof(state));
+  packSettings(state);
+  if (memcmp(state, pushedState, sizeof(state)) == 0) return;
 
-  response += "\"fade_color_speed\": ";
-  response += fadeColorSpeed;
-  response += ", ";
+  size_t length = writeSettingsJson(stateJson, sizeof(stateJson));
+  if (length == 0) return;
 
-  response += "\"b_rgb_color\": \"";
-  response += rgbColor.red;
-  response += ",";
-  response += rgbColor.green;
-  response += ",";
-  response += rgbColor.blue;
-  response += "\", ";
+  memcpy(pushedState, state, sizeof(state));
+  lastStatePush = now;
+  socket.textAll(stateJson, length);
+}
 
-  response += "\"fire_speed\": ";
-  response += fireSpeed;
-  response += ", ";
+PreviewClient* findPreviewClient(uint32_t id) {
+  for (uint8_t i = 0; i < MAX_PREVIEW_CLIENTS; i++) {
+    if (previewClients[i].id == id) return &previewClients[i];
+  }
+  return nullptr;
+}
+
+void onPreviewEvent(AsyncWebSocket *ws, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  if (type == WS_EVT_CONNECT) {
+    PreviewClient *preview = findPreviewClient(0);
+    if (!preview) {
+      client -> close();
+      return;
+    }
 
-  response += "\"fire_cooling\": ";
-  response += fireCooling;
-  response += ", ";
+    preview -> id = client -> id();
+    preview -> interval = 1000 / DEFAULT_PREVIEW_FPS;
+    preview -> nextSend = millis();
+    preview -> keyframe = true;
+  } else if (type == WS_EVT_DISCONNECT) {
+    PreviewClient *preview = findPreviewClient(client -> id());
+    if (preview) preview -> id = 0;
+  } else if (type == WS_EVT_DATA) {
+    // Clients pick their rate with a short "fps=<n>" text message.
+    AwsFrameInfo *info = (AwsFrameInfo*) arg;
+    PreviewClient *preview = findPreviewClient(client -> id());
+    if (!preview || !info -> final || info -> opcode != WS_TEXT || len < 5 || len > 7 || strncmp((const char*) data, "fps=", 4) != 0) return;
+
+    int fps = 0;
+    for (size_t i = 4; i < len && data[i] >= '0' && data[i] <= '9'; i++) fps = fps * 10 + data[i] - '0';
+    if (fps < 1) fps = 1;
+    if (fps > MAX_PREVIEW_FPS) fps = MAX_PREVIEW_FPS;
+    preview -> interval = 1000 / fps;
+  }
+}
 
-  response += "\"fire_sparks\": ";
-  response += fireSparks;
-  response += ", ";
+// Sends each preview client the pixels that changed since the last frame
+// it was sent. A client whose queue is still full is skipped for this
+// frame; its reference frame is left alone, so its next delta catches up.
+void sendPreview(uint32_t now) {
+  previewSocket.cleanupClients();
+  if (previewSocket.count() == 0) return;
 
-  response += "\"fire_reverse\": ";
-  response += fireReverse;
-  response += ", ";
+  for (uint8_t i = 0; i < MAX_PREVIEW_CLIENTS; i++) {
+    PreviewClient &preview = previewClients[i];
+    if (preview.id == 0 || (int32_t) (now - preview.nextSend) < 0) continue;
 
-  response += "\"s_rgb_color\": \"";
-  response += rgbColor.red;
-  response += ",";
-  response += rgbColor.green;
-  response += ",";
-  response += rgbColor.blue;
-  response += "\"";
+    AsyncWebSocketClient *client = previewSocket.client(preview.id);
+    if (!client || client -> status() != WS_CONNECTED) continue;
 
-  response += "}";
+    preview.nextSend = now + preview.interval;
+    if (client -> queueIsFull()) {
+      previewSkipped++;
+      continue;
+    }
 
-  request -> send(200, "text/json", response);
+    size_t length = encodePreview(leds, preview.last, numLeds, preview.keyframe, previewFrame, previewFrameLength);
+    preview.keyframe = false;
+    if (length > 0) client -> binary(previewFrame, length);
+  }
 }
 
 void startServer() {
@@ -641,27 +1304,96 @@ void startServer() {
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "GET, POST");
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "*");
 
+  socket.onEvent(onSocketEvent);
+  server.addHandler(&socket);
+  previewSocket.onEvent(onPreviewEvent);
+  server.addHandler(&previewSocket);
+
   server.on("/enable", HTTP_POST, [] (AsyncWebServerRequest *request) {
-      request -> send(200, "OK");
-    }, NULL, onEnable);
+      RequestTimer timer(ENDPOINT_ENABLE);
+      handleJson(request, onEnable);
+    }, NULL, onBody);
 
   server.on("/brightness", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_BRIGHTNESS);
+      handleJson(request, onBrightness);
+    }, NULL, onBody);
+
+  server.on("/settings", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_SETTINGS);
+      handleJson(request, onSettings);
+    }, NULL, onBody);
+
+  server.on("/save", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_SAVE);
+      saveStatus();
       request -> send(200, "OK");
-    }, NULL, onBrightness);
-
-    server.on("/settings", HTTP_POST, [] (AsyncWebServerRequest *request) {
-      request -> send(200, "OK");
-    }, NULL, onSettings);
+    });
 
-    server.on("/save", HTTP_POST, [] (AsyncWebServerRequest *request) {
-      request -> send(200, "OK");
-    }, NULL, onSave);
-
-    server.on("/get_settings", HTTP_GET, [] (AsyncWebServerRequest *request) {
+  server.on("/get_settings", HTTP_GET, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_GET_SETTINGS);
       onGetSettings(request);
-    }, NULL);
+    });
+
+  server.on("/layout", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_LAYOUT);
+      handleJson<LAYOUT_DOCUMENT_SIZE>(request, onLayout);
+    }, NULL, onBody);
+
+  server.on("/layout", HTTP_GET, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_GET_LAYOUT);
+      onGetLayout(request);
+    });
+
+  server.on("/status", HTTP_GET, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_STATUS);
+      onStatus(request);
+    });
+
+  server.on("/metrics", HTTP_GET, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_METRICS);
+      onMetrics(request);
+    });
+
+  server.on("/mqtt", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_MQTT);
+      handleJson(request, onMqtt);
+    }, NULL, onBody);
+
+  server.on("/animation", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_ANIMATION);
+      onAnimation(request);
+    }, onAnimationUpload);
+
+  server.on("/map_points", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_MAP_POINTS);
+      onMapPoints(request);
+    }, NULL, onMapPointsBody);
+
+  server.on("/update", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_UPDATE);
+      onUpdate(request);
+    }, NULL, onUpdateBody);
+
+  server.on("/update_password", HTTP_POST, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_UPDATE_PASSWORD);
+      // A unit without a password takes the first one it is given.
+      if (otaPassword[0] != '\0' && !updateAuthorized(request)) {
+        bodyPool.release(request);
+        request -> requestAuthentication();
+        return;
+      }
+      handleJson(request, onUpdatePassword);
+    }, NULL, onBody);
 
-  server.serveStatic("/", SPIFFS, "/").setDefaultFile(indexFile);
+#ifdef PLUMBOB_TRACE
+  server.on("/trace", HTTP_GET, [] (AsyncWebServerRequest *request) {
+      RequestTimer timer(ENDPOINT_TRACE);
+      onTrace(request);
+    });
+#endif
+
+  serveAssets();
 
   server.onNotFound([](AsyncWebServerRequest *request) {
     if (request -> method() == HTTP_OPTIONS) request -> send(200);
@@ -677,43 +1409,27 @@ void startPlumbob() {
   configured = true;
   indexFile = "index.html";
 
-  int ssidSize = EEPROM.read(1);
-  char ssid[ssidSize];
-  for (int i = 0; i < ssidSize; i++) {
-    ssid[i] = EEPROM.read(i + 2);
-  }
+  const uint8_t *config = configStore.constData();
 
-  int passwordSize = EEPROM.read(63);
-  char password[passwordSize];
-  for (int i = 0; i < passwordSize; i++) {
-    password[i] = EEPROM.read(i + 64);
-  }
+  int ssidSize = min((int) config[1], (int) sizeof(wifiSsid) - 1);
+  memcpy(wifiSsid, config + 2, ssidSize);
+  wifiSsid[ssidSize] = '\0';
 
-  while (!connectToWiFi(ssid, password)) {
-    Serial.print(".");
-    delay(1000);
-  }
+  int passwordSize = min((int) config[63], (int) sizeof(wifiPassword) - 1);
+  memcpy(wifiPassword, config + 64, passwordSize);
+  wifiPassword[passwordSize] = '\0';
 
+  unpackSettings(configStore.constData() + E_DATA_START);
+
+  // The server listens on any address, so it can start before the link is
+  // up and stays registered across reconnects.
   startServer();
+  startWiFi();
+  startMqtt();
 
-  brightness = readInt(E_DATA_START);
-  mode = EEPROM.read(E_DATA_START + 2);
-  ledEnabled = EEPROM.read(E_DATA_START + 3) == 1 ? true : false;
-  fullRainbowSpeed = readInt(E_DATA_START + 4);
-  animatedRainbowSpeed = readInt(E_DATA_START + 6);
-  randomSColor = readInt(E_DATA_START + 8);
-  randomSColorSpeed = readInt(E_DATA_START + 10);
-  animatedPaletteSpeed = readInt(E_DATA_START + 12);
-  fadeToBlackSpeed = readInt(E_DATA_START + 14);
-  fadeToBlackFadeSpeed = readInt(E_DATA_START + 16);
-  bpmColor = readInt(E_DATA_START + 18);
-  fadeColorSpeed = readInt(E_DATA_START + 20);
-  rgbColor = readRGB(E_DATA_START + 22);
-  fireSpeed = readInt(E_DATA_START + 28);
-  fireCooling = readInt(E_DATA_START + 30);
-  fireSparks = readInt(E_DATA_START + 32);
-  fireReverse = EEPROM.read(E_DATA_START + 34) == 1 ? true : false;
-  staticRGBColor = readRGB(E_DATA_START + 35);
+  ddpUdp.begin(DDP_PORT);
+  e131Udp.begin(E131_PORT);
+  clockSync.begin(micros());
 }
 
 void reset() {
@@ -721,121 +1437,338 @@ void reset() {
   FastLED.clear();
   FastLED.show();
 
-  for (int i = 0; i < ESIZE; i++) {
-    EEPROM.write(i, 0);
-  }
-
-  EEPROM.commit();
+  memset(configStore.data(), 0, CONFIG_IMAGE_SIZE);
+  configStore.commit();
 
   Serial.println("Restarting...");
   ESP.restart();
 }
 
+bool audioInUse() {
+  if (!configured || !settings.ledEnabled) return false;
+  if (settings.mode == AUDIO_MODE || (settings.overlayEnabled && settings.overlayMode == AUDIO_MODE)) return true;
+
+  for (uint8_t i = 1; i < layout.segmentCount; i++) {
+    if (layout.segments[i].mode == AUDIO_MODE) return true;
+  }
+  return false;
+}
+
+// A0 can only be read from the loop: the SDK's ADC read is not in IRAM, so
+// a timer interrupt calling it would crash whenever flash is busy. Samples
+// that fell due while a frame was rendered or shown repeat the last value,
+// so the analysis still sees a fixed rate; on strips up to AUDIO_MAX_LEDS
+// those runs are short enough not to hide the beat.
+void sampleAudio(uint32_t now) {
+  uint32_t due = audioClock.due(now);
+  if (due == 0) return;
+
+  uint16_t sample = analogRead(AUDIO_PIN);
+  for (uint32_t i = 0; i < due; i++) audioSamples.push(sample);
+}
+
+void analyzeAudio() {
+  const int16_t* window = audioSamples.take();
+  if (!window) return;
+
+  TRACE_BEGIN(TRACK_LOOP, "audio");
+  uint32_t start = micros();
+  audioAnalyzer.analyze(window, audioFeatures);
+  metrics.audio.observe(micros() - start);
+  TRACE_END(TRACK_LOOP, "audio");
+
+  audioSamples.release();
+}
+
+// Plays ANIMATION_FILE from its first frame. Pixels past the animation's
+// own are left dark rather than holding the last mode's frame.
+void startPlayback(uint32_t now) {
+  FastLED.clear();
+  playbackActive = true;
+
+  if (!animationFile.open(ANIMATION_FILE) || !animationPlayer.begin(&animationFile, numLeds, now)) {
+    Serial.println("No animation to play");
+    animationFile.close();
+  }
+}
+
+bool prefetchAnimation() {
+  TRACE_BEGIN(TRACK_LOOP, "read");
+  uint32_t start = micros();
+  bool read = animationPlayer.prefetch();
+  if (read) metrics.playbackRead.observe(micros() - start);
+  TRACE_END(TRACK_LOOP, "read");
+  return read;
+}
+
+void yieldIdleTime(uint32_t now) {
+  uint32_t budget = scheduler.idleBudget(now);
+
+  // Time before the next frame goes on reading the animation ahead first.
+  while (playbackActive && micros() - now < budget && prefetchAnimation()) {
+  }
+  uint32_t spent = micros() - now;
+
+  if (audioActive) {
+    // Wait out the budget sampling rather than sleeping through it.
+    while (micros() - now < budget) {
+      sampleAudio(micros());
+      yield();
+    }
+  } else if (clockJoined) {
+    // Clock packets are timed when they are read, so they are read every
+    // millisecond rather than after the whole wait.
+    while (micros() - now + 1000 <= budget) {
+      delay(1);
+      pollClock();
+    }
+  } else if (budget >= spent + 1000) {
+    delay((budget - spent) / 1000);
+  } else {
+    yield();
+  }
+
+  scheduler.addIdle(micros() - now);
+}
+
+void IRAM_ATTR onButtonEdge() {
+  TRACE_INSTANT(TRACK_ISR, "button");
+  buttonEdges.push(millis(), digitalRead(BTN_PIN));
+}
+
+// The button only cycles the effects. While a stream has the strip it
+// picks the effect the strip goes back to when the stream stops.
+void stepMode(int8_t step) {
+  bool streaming = settings.mode == STREAM_MODE && streamReturnMode >= 0;
+  uint8_t mode = streaming ? streamReturnMode : settings.mode;
+  if (mode >= STREAM_MODE) mode = step > 0 ? STREAM_MODE - 1 : 0;
+  mode = (mode + STREAM_MODE + step) % STREAM_MODE;
+
+  if (streaming) streamReturnMode = mode;
+  else settings.mode = mode;
+
+  Serial.print("Mode set to ");
+  Serial.println(mode);
+}
+
+void handleButton() {
+  ButtonEdge edge;
+  while (buttonEdges.pop(edge)) button.feed(edge);
+
+  ButtonEvent event;
+  while ((event = button.poll(millis())) != BUTTON_NONE) {
+    lastButtonEvent = event;
+    buttonPresses++;
+    mqttState.changed();
+
+    switch (event) {
+      case BUTTON_CLICK:
+        stepMode(1);
+        break;
+      case BUTTON_DOUBLE_CLICK:
+        stepMode(-1);
+        break;
+      case BUTTON_LONG_PRESS:
+        settings.ledEnabled = !settings.ledEnabled;
+        Serial.print("LEDs ");
+        if (settings.ledEnabled) Serial.println("enabled");
+        else Serial.println("disabled");
+        break;
+      case BUTTON_VERY_LONG_PRESS:
+        reset();
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Pins must match OUTPUT_PINS; FastLED needs each one at compile time.
+void addOutput(uint8_t pin, CRGB *pixels, uint16_t length) {
+  CLEDController *controller;
+
+  switch (pin) {
+    case 2: controller = &FastLED.addLeds<WS2811, 2, GRB>(pixels, length); break;
+    case 4: controller = &FastLED.addLeds<WS2811, 4, GRB>(pixels, length); break;
+    case 12: controller = &FastLED.addLeds<WS2811, 12, GRB>(pixels, length); break;
+    case 13: controller = &FastLED.addLeds<WS2811, 13, GRB>(pixels, length); break;
+    case 14: controller = &FastLED.addLeds<WS2811, 14, GRB>(pixels, length); break;
+    case 15: controller = &FastLED.addLeds<WS2811, 15, GRB>(pixels, length); break;
+    default: return;
+  }
+
+  controller -> setCorrection(TypicalLEDStrip);
+}
+
+bool allocateStrip(uint16_t length) {
+  if (!allocateLeds(length) || !allocateFrame(length) || !compositor.begin(length)) return false;
+
+  free(previewFrame);
+  previewFrameLength = previewFrameSize(length);
+  previewFrame = (uint8_t*) malloc(previewFrameLength);
+  if (!previewFrame) return false;
+
+  for (uint8_t i = 0; i < MAX_PREVIEW_CLIENTS; i++) {
+    free(previewClients[i].last);
+    previewClients[i].last = (CRGB*) calloc(length, sizeof(CRGB));
+    if (!previewClients[i].last) return false;
+  }
+
+  return true;
+}
+
+// Every pixel buffer is sized for the stored layout once, here. A layout
+// that does not fit in memory falls back to the default strip.
+void startStrip() {
+  if (!unpackLayout(layout, configStore.constData() + E_LAYOUT_START)) defaultLayout(layout);
+  if (!unpackMap(layout.map, configStore.constData() + E_MAP_START) || !validMap(layout.map, layoutLength(layout))) {
+    defaultMap(layout.map);
+  }
+
+  if (!allocateStrip(layoutLength(layout))) {
+    Serial.println("Strip layout does not fit in memory, using the default");
+    defaultLayout(layout);
+    allocateStrip(layoutLength(layout));
+  }
+  attachSegments(layout);
+  buildPixelMap();
+
+  CRGB *pixels = leds;
+  for (uint8_t i = 0; i < layout.outputCount; i++) {
+    addOutput(layout.outputs[i].pin, pixels, layout.outputs[i].length);
+    pixels += layout.outputs[i].length;
+  }
+
+  Serial.print("Strip of ");
+  Serial.print(numLeds);
+  Serial.print(" LEDs on ");
+  Serial.print(layout.outputCount);
+  Serial.println(" outputs");
+}
+
+// The config log took the last 16 KB of the filesystem, so an image that
+// was uploaded for the old size no longer fits and will not mount. SPIFFS
+// would otherwise format it and silently lose the web UI and animation;
+// report it instead and leave the filesystem to be uploaded again.
+bool mountFilesystem() {
+  SPIFFSConfig config;
+  config.setAutoFormat(false);
+  SPIFFS.setConfig(config);
+  if (SPIFFS.begin()) return true;
+
+  Serial.println("Filesystem did not mount; upload it again with pio run -t uploadfs or /update");
+  return false;
+}
+
 void setup() {
   delay(3000);
 
   Serial.begin(115200);
   Serial.println();
 
-  EEPROM.begin(ESIZE);
-  SPIFFS.begin();
+  if (!configStore.begin()) importEeprom();
+  loadUpdatePassword();
+  filesystemMounted = mountFilesystem();
 
   pinMode(BTN_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(BTN_PIN), onButtonEdge, CHANGE);
 
-  FastLED.addLeds<WS2811, LED_PIN, GRB>(leds, NUM_LEDS).setCorrection(TypicalLEDStrip);
-  FastLED.setCorrection(TypicalPixelString);
+  startStrip();
+  setFrameCorrection(TypicalPixelString);
+  // Identical frames are no longer re-pushed, so temporal dithering would
+  // freeze on whatever pattern the last push happened to carry.
+  FastLED.setDither(DISABLE_DITHER);
   FastLED.clear();
-  FastLED.show();
+  showFrame();
 
-  if (EEPROM.read(0) == 0) startConfiguration();
+  if (configStore.constData()[0] == 0) startConfiguration();
   else startPlumbob();
 }
 
 void loop() {
-  btnCurrentState = digitalRead(BTN_PIN);
-
-  if (btnLastState == LOW && btnCurrentState == HIGH) {
-    pressMillis = millis();
-    btnLastState = btnCurrentState;
-  } else if (btnLastState == HIGH && btnCurrentState == LOW) {
-    long pressTime = millis() - pressMillis;
-
-    if (pressTime > VERY_LONG_PRESS_TIME) {
-      reset();
-    } else if (pressTime > LONG_PRESS_TIME) {
-      if (ledEnabled) {
-        ledEnabled = false;
-        Serial.println("LEDs disabled");
-      } else {
-        ledEnabled = true;
-        Serial.println("LEDs enabled");
-      }
-    } else {
-      mode++;
-      if (mode > 10) mode = 0;
-      FastLED.clear();
-      FastLED.show();
+  TRACE_BEGIN(TRACK_LOOP, "loop");
+#ifdef PLUMBOB_TRACE
+  if (Serial.available() > 0 && Serial.read() == 't') dumpTrace();
+#endif
+  handleButton();
+
+  if (configured) {
+    pollWiFi();
+    pollMqtt(millis());
+    pollStream();
+    pollClock();
+    serviceOta(millis());
+  }
 
-      Serial.print("Mode set to ");
-      Serial.println(mode);
-    }
+  if (configStore.tick(millis())) Serial.println("Settings saved");
 
-    pressMillis = 0;
-    btnLastState = btnCurrentState;
+  bool playback = configured && filesystemMounted && settings.ledEnabled && settings.mode == PLAYBACK_MODE;
+  if (playback && !playbackActive) startPlayback(micros());
+  else if (!playback && playbackActive) stopPlayback();
+
+  // Animations run at their own frame rate.
+  uint16_t targetFps = settings.targetFps;
+  if (animationPlayer.playing()) targetFps = min((animationPlayer.getHeader().fps88 + 255) >> 8, (int) MAX_FPS);
+  if (scheduler.getTargetFps() != targetFps) scheduler.setTargetFps(targetFps);
+
+  bool audio = audioInUse();
+  if (audio && !audioActive) {
+    audioAnalyzer.reset();
+    audioClock.start(micros());
+    if (numLeds > AUDIO_MAX_LEDS) Serial.println("Strip too long to sample audio reliably between frames");
   }
+  audioActive = audio;
 
-  FastLED.setBrightness(brightness);
+  uint32_t now = micros();
+  if (audioActive) {
+    sampleAudio(now);
+    analyzeAudio();
+  }
 
+  if (!scheduler.beginFrame(now)) {
+    TRACE_END(TRACK_LOOP, "loop");
+    yieldIdleTime(now);
+    return;
+  }
+
+  metrics.lag.observe(scheduler.frameLag());
+  uint32_t dt = scheduler.frameDelta();
+  animationMillis = clockSync.sharedMillis(now);
+  FastLED.setBrightness(settings.brightness);
+
+  if (configured) {
+    controls.apply();
+    pushState(millis());
+  }
+
+  bool show = true;
   if (!configured) {
-    animatedPalette(configPalette);
+    animatedPalette(configPalette, effectParams, dt);
+  } else if (!settings.ledEnabled) {
+    FastLED.clear();
+  } else if (settings.mode == STREAM_MODE) {
+    // Packets land in leds[] as they arrive; only show whole frames.
+    compositor.bypass(STREAM_MODE);
+    show = pixelStream.takeFrame();
+  } else if (settings.mode == PLAYBACK_MODE) {
+    compositor.bypass(PLAYBACK_MODE);
+    show = animationPlayer.advance(leds, micros());
   } else {
-    if (WiFi.status() != WL_CONNECTED) {
-      Serial.println("WiFi disconnected!");
-      Serial.print("Reconnecting");
-      WiFi.disconnect();
-      stopServer();
-      startPlumbob();
-    }
+    uint8_t mode = settings.mode;
+    uint32_t renderStart = micros();
+    TRACE_BEGIN(TRACK_LOOP, effectRegistry[mode].name);
+    compositor.render(dt);
+    TRACE_END(TRACK_LOOP, effectRegistry[mode].name);
+    metrics.render[mode].observe(micros() - renderStart);
+  }
 
-    if (ledEnabled) {
-      switch (mode) {
-        case 0:
-          staticRainbow();
-          break;
-        case 1:
-          fullRainbow();
-          break;
-        case 2:
-          animatedRainbow();
-          break;
-        case 3:
-          randomSingleColor();
-          break;
-        case 4:
-          staticPalette(cyanPalette);
-          break;
-        case 5:
-          animatedPalette(cyanPalette);
-          break;
-        case 6:
-          fadeToBlack(cyanPalette);
-          break;
-        case 7:
-          beatRGB();
-          break;
-        case 8:
-          beatPalette(cyanPalette);
-          break;
-        case 9:
-          fire();
-          break;
-        case 10:
-          staticRGB(staticRGBColor);
-          break;
-      }
-    } else {
-      FastLED.clear();
-      FastLED.show();
-    }
+  if (show) {
+    uint32_t showStart = micros();
+    TRACE_BEGIN(TRACK_LOOP, "show");
+    if (showFrame()) metrics.show.observe(micros() - showStart);
+    TRACE_END(TRACK_LOOP, "show");
   }
+  if (configured) sendPreview(millis());
+  scheduler.endFrame(micros());
+  TRACE_END(TRACK_LOOP, "loop");
 }
@@ -0,0 +1,277 @@
+#include <string.h>
+
+#include "metrics.h"
+#include "window_writer.h"
+
+Metrics metrics;
+
+struct EndpointDef {
+  const char* method;
+  const char* path;
+  const char* name;
+};
+
+static const EndpointDef endpoints[ENDPOINT_COUNT] = {
+  {"POST", "/enable", "POST /enable"},
+  {"POST", "/brightness", "POST /brightness"},
+  {"POST", "/settings", "POST /settings"},
+  {"POST", "/save", "POST /save"},
+  {"GET", "/get_settings", "GET /get_settings"},
+  {"POST", "/layout", "POST /layout"},
+  {"GET", "/layout", "GET /layout"},
+  {"GET", "/status", "GET /status"},
+  {"GET", "/metrics", "GET /metrics"},
+  {"POST", "/configuration", "POST /configuration"},
+  {"GET", "/trace", "GET /trace"},
+  {"POST", "/animation", "POST /animation"},
+  {"POST", "/mqtt", "POST /mqtt"},
+  {"POST", "/update", "POST /update"},
+  {"POST", "/update_password", "POST /update_password"},
+  {"POST", "/map_points", "POST /map_points"}
+};
+
+const char* endpointName(Endpoint endpoint) {
+  return endpoints[endpoint].name;
+}
+
+void Histogram::observe(uint32_t micros) {
+  uint8_t bucket = 0;
+  if (micros > HISTOGRAM_FIRST_BOUND) {
+    // Index of the smallest power of two bound holding micros.
+    bucket = 32 - __builtin_clz(micros - 1) - 6;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+  }
+
+  counts[bucket]++;
+  count++;
+  sumMicros += micros;
+}
+
+Metrics::Metrics() {
+  memset(this, 0, sizeof(*this));
+}
+
+struct Label {
+  const char* name;
+  const char* value;
+};
+
+// Prometheus samples and histograms on top of a WindowWriter.
+class MetricsWriter : public WindowWriter {
+public:
+  MetricsWriter(char* buffer, size_t size, size_t offset) : WindowWriter(buffer, size, offset) {
+  }
+
+  void family(const char* name, const char* type, const char* help) {
+    append("# HELP ");
+    append(name);
+    append(' ');
+    append(help);
+    append("\n# TYPE ");
+    append(name);
+    append(' ');
+    append(type);
+    append('\n');
+  }
+
+  void sample(const char* name, uint32_t value, const Label* labels = nullptr, uint8_t labelCount = 0) {
+    append(name);
+    appendLabelSet(labels, labelCount);
+    append(' ');
+    appendNumber(value);
+    append('\n');
+  }
+
+  void signedSample(const char* name, int32_t value) {
+    append(name);
+    append(' ');
+    if (value < 0) append('-');
+    appendNumber(value < 0 ? -value : value);
+    append('\n');
+  }
+
+  void histogram(const char* name, const Histogram& h, const Label* labels, uint8_t labelCount) {
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      cumulative += h.counts[i];
+      append(name);
+      append("_bucket{");
+      appendLabels(labels, labelCount);
+      append("le=\"");
+      if (i + 1 < HISTOGRAM_BUCKETS) appendSeconds(HISTOGRAM_FIRST_BOUND << i);
+      else append("+Inf");
+      append("\"} ");
+      appendNumber(cumulative);
+      append('\n');
+    }
+
+    append(name);
+    append("_sum");
+    appendLabelSet(labels, labelCount);
+    append(' ');
+    appendSeconds(h.sumMicros);
+    append('\n');
+
+    append(name);
+    append("_count");
+    appendLabelSet(labels, labelCount);
+    append(' ');
+    appendNumber(h.count);
+    append('\n');
+  }
+
+private:
+  void appendSeconds(uint64_t micros) {
+    appendNumber(micros / 1000000);
+    append('.');
+
+    uint32_t fraction = micros % 1000000;
+    for (uint32_t digit = 100000; digit > 0; digit /= 10) append('0' + fraction / digit % 10);
+  }
+
+  void appendLabels(const Label* labels, uint8_t labelCount) {
+    for (uint8_t i = 0; i < labelCount; i++) {
+      append(labels[i].name);
+      append("=\"");
+      append(labels[i].value);
+      append("\",");
+    }
+  }
+
+  void appendLabelSet(const Label* labels, uint8_t labelCount) {
+    if (labelCount == 0) return;
+
+    append('{');
+    for (uint8_t i = 0; i < labelCount; i++) {
+      if (i > 0) append(',');
+      append(labels[i].name);
+      append("=\"");
+      append(labels[i].value);
+      append('"');
+    }
+    append('}');
+  }
+};
+
+size_t writeMetrics(const Metrics& m, char* buffer, size_t size, size_t offset) {
+  MetricsWriter out(buffer, size, offset);
+
+  out.family("plumbob_uptime_seconds", "gauge", "Time since boot.");
+  out.sample("plumbob_uptime_seconds", m.uptimeMillis / 1000);
+
+  out.family("plumbob_render_seconds", "histogram", "Time to render a frame, by base mode.");
+  for (uint8_t mode = 0; mode < STREAM_MODE; mode++) {
+    if (m.render[mode].count == 0) continue;
+
+    Label label = {"mode", effectRegistry[mode].name};
+    out.histogram("plumbob_render_seconds", m.render[mode], &label, 1);
+    if (out.full()) return out.length();
+  }
+
+  out.family("plumbob_show_seconds", "histogram", "Time FastLED.show() takes to push a frame.");
+  out.histogram("plumbob_show_seconds", m.show, nullptr, 0);
+
+  out.family("plumbob_frame_lag_seconds", "histogram", "How late frames start after their deadline.");
+  out.histogram("plumbob_frame_lag_seconds", m.lag, nullptr, 0);
+
+  out.family("plumbob_audio_analysis_seconds", "histogram", "Time to analyze a window of microphone samples.");
+  out.histogram("plumbob_audio_analysis_seconds", m.audio, nullptr, 0);
+
+  out.family("plumbob_playback_read_seconds", "histogram", "Time to read an animation frame ahead.");
+  out.histogram("plumbob_playback_read_seconds", m.playbackRead, nullptr, 0);
+  if (out.full()) return out.length();
+
+  out.family("plumbob_fps", "gauge", "Frames rendered in the last full second.");
+  out.sample("plumbob_fps", m.frames.frames);
+  out.family("plumbob_target_fps", "gauge", "Frame rate the scheduler aims for.");
+  out.sample("plumbob_target_fps", m.targetFps);
+  out.family("plumbob_frames_late", "gauge", "Frames that started a timestep or more late in the last full second.");
+  out.sample("plumbob_frames_late", m.frames.late);
+  out.family("plumbob_frames_skipped", "gauge", "Timesteps folded into later frames in the last full second.");
+  out.sample("plumbob_frames_skipped", m.frames.skipped);
+  out.family("plumbob_frames_shown_total", "counter", "Frames pushed to the strip.");
+  out.sample("plumbob_frames_shown_total", m.shown.pushed);
+  out.family("plumbob_frames_unchanged_total", "counter", "Frames not pushed because they matched the last one.");
+  out.sample("plumbob_frames_unchanged_total", m.shown.skipped);
+
+  out.family("plumbob_playback_fps", "gauge", "Animation frames played in the last full second.");
+  out.sample("plumbob_playback_fps", m.playback.fps);
+  out.family("plumbob_playback_frames_total", "counter", "Animation frames played.");
+  out.sample("plumbob_playback_frames_total", m.playback.frames);
+  out.family("plumbob_playback_stalls_total", "counter", "Animation frames that fell due before they were read ahead.");
+  out.sample("plumbob_playback_stalls_total", m.playback.stalls);
+  out.family("plumbob_playback_late_total", "counter", "Animation frames played a frame interval or more late.");
+  out.sample("plumbob_playback_late_total", m.playback.late);
+
+  out.family("plumbob_audio_samples_total", "counter", "Microphone samples taken, held ones included.");
+  out.sample("plumbob_audio_samples_total", m.audioSampling.samples);
+  out.family("plumbob_audio_samples_held_total", "counter", "Samples that repeated a reading because the loop was busy.");
+  out.sample("plumbob_audio_samples_held_total", m.audioSampling.held);
+  out.family("plumbob_audio_held_percent", "gauge", "Share of the samples in the last full second that were held.");
+  out.sample("plumbob_audio_held_percent", m.audioSampling.heldPercent);
+  out.family("plumbob_audio_overruns_total", "counter", "Windows of samples dropped because the last was not yet analyzed.");
+  out.sample("plumbob_audio_overruns_total", m.audioOverruns);
+
+  out.family("plumbob_heap_free_bytes", "gauge", "Free heap.");
+  out.sample("plumbob_heap_free_bytes", m.freeHeap);
+  out.family("plumbob_heap_max_block_bytes", "gauge", "Largest free heap block.");
+  out.sample("plumbob_heap_max_block_bytes", m.maxFreeBlock);
+  out.family("plumbob_heap_fragmentation_percent", "gauge", "Heap fragmentation.");
+  out.sample("plumbob_heap_fragmentation_percent", m.heapFragmentation);
+
+  out.family("plumbob_wifi_rssi_dbm", "gauge", "Station signal strength, 0 while not connected.");
+  out.signedSample("plumbob_wifi_rssi_dbm", m.rssi);
+  out.family("plumbob_wifi_attempts_total", "counter", "Station connection attempts.");
+  out.sample("plumbob_wifi_attempts_total", m.link.attempts);
+  out.family("plumbob_wifi_connects_total", "counter", "Station connections made.");
+  out.sample("plumbob_wifi_connects_total", m.link.connects);
+  out.family("plumbob_wifi_drops_total", "counter", "Station connections lost.");
+  out.sample("plumbob_wifi_drops_total", m.link.drops);
+  if (out.full()) return out.length();
+
+  out.family("plumbob_mqtt_connects_total", "counter", "Broker connections made.");
+  out.sample("plumbob_mqtt_connects_total", m.mqttLink.connects);
+  out.family("plumbob_mqtt_drops_total", "counter", "Broker connections lost.");
+  out.sample("plumbob_mqtt_drops_total", m.mqttLink.drops);
+  out.family("plumbob_mqtt_state_changes_total", "counter", "State changes to publish, including button presses.");
+  out.sample("plumbob_mqtt_state_changes_total", m.mqttState.changes);
+  out.family("plumbob_mqtt_state_published_total", "counter", "Retained state messages published.");
+  out.sample("plumbob_mqtt_state_published_total", m.mqttState.published);
+  out.family("plumbob_mqtt_state_coalesced_total", "counter", "State changes folded into a publish already waiting.");
+  out.sample("plumbob_mqtt_state_coalesced_total", m.mqttState.coalesced);
+  out.family("plumbob_mqtt_commands_total", "counter", "Commands received, by result.");
+  Label applied = {"result", "applied"};
+  out.sample("plumbob_mqtt_commands_total", m.mqttCommands, &applied, 1);
+  Label rejected = {"result", "rejected"};
+  out.sample("plumbob_mqtt_commands_total", m.mqttRejected, &rejected, 1);
+  if (out.full()) return out.length();
+
+  out.family("plumbob_clock_synced", "gauge", "1 while animations run from the clock shared between units.");
+  out.sample("plumbob_clock_synced", m.clockSynced ? 1 : 0);
+  out.family("plumbob_clock_leader", "gauge", "1 while this unit's clock is the one shared.");
+  out.sample("plumbob_clock_leader", m.clockLeading ? 1 : 0);
+  out.family("plumbob_clock_error_microseconds", "gauge", "Offset from the leader's clock found by the last sample used.");
+  out.signedSample("plumbob_clock_error_microseconds", m.clock.errorMicros);
+  out.family("plumbob_clock_round_trip_microseconds", "gauge", "Round trip to the leader of the last sample used.");
+  out.sample("plumbob_clock_round_trip_microseconds", m.clock.delayMicros);
+  out.family("plumbob_clock_drift_ppb", "gauge", "Estimated rate of the leader's clock against this one.");
+  out.signedSample("plumbob_clock_drift_ppb", m.clock.driftPpb);
+  out.family("plumbob_clock_samples_total", "counter", "Round trips to the leader timed.");
+  out.sample("plumbob_clock_samples_total", m.clock.samples);
+  out.family("plumbob_clock_steps_total", "counter", "Times the clock was stepped rather than slewed.");
+  out.sample("plumbob_clock_steps_total", m.clock.steps);
+  out.family("plumbob_clock_leader_changes_total", "counter", "Times a different unit became leader.");
+  out.sample("plumbob_clock_leader_changes_total", m.clock.leaderChanges);
+  if (out.full()) return out.length();
+
+  out.family("plumbob_http_request_seconds", "histogram", "Time spent handling requests, by endpoint.");
+  for (uint8_t i = 0; i < ENDPOINT_COUNT; i++) {
+    if (m.requests[i].count == 0) continue;
+
+    Label labels[] = {{"method", endpoints[i].method}, {"path", endpoints[i].path}};
+    out.histogram("plumbob_http_request_seconds", m.requests[i], labels, 2);
+    if (out.full()) return out.length();
+  }
+
+  return out.length();
+}
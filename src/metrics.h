@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "animation.h"
+#include "audio.h"
+#include "clock_sync.h"
+#include "mqtt_state.h"
+#include "registry.h"
+#include "renderer.h"
+#include "scheduler.h"
+#include "wifi_link.h"
+
+// Buckets double from 64 us to 32.768 ms; the last one is +Inf.
+const uint8_t HISTOGRAM_BUCKETS = 11;
+const uint32_t HISTOGRAM_FIRST_BOUND = 64;
+
+struct Histogram {
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  uint32_t count;
+  uint64_t sumMicros;
+
+  void observe(uint32_t micros);
+};
+
+enum Endpoint : uint8_t {
+  ENDPOINT_ENABLE,
+  ENDPOINT_BRIGHTNESS,
+  ENDPOINT_SETTINGS,
+  ENDPOINT_SAVE,
+  ENDPOINT_GET_SETTINGS,
+  ENDPOINT_LAYOUT,
+  ENDPOINT_GET_LAYOUT,
+  ENDPOINT_STATUS,
+  ENDPOINT_METRICS,
+  ENDPOINT_CONFIGURATION,
+  ENDPOINT_TRACE,
+  ENDPOINT_ANIMATION,
+  ENDPOINT_MQTT,
+  ENDPOINT_UPDATE,
+  ENDPOINT_UPDATE_PASSWORD,
+  ENDPOINT_MAP_POINTS,
+  ENDPOINT_COUNT
+};
+
+const char* endpointName(Endpoint endpoint);
+
+// Everything /metrics reports. The histograms are fed as the device runs;
+// the remaining fields are read in when a scrape starts.
+struct Metrics {
+  Histogram render[STREAM_MODE];
+  Histogram show;
+  Histogram lag;
+  Histogram audio;
+  Histogram playbackRead;
+  Histogram requests[ENDPOINT_COUNT];
+
+  uint32_t uptimeMillis;
+  uint32_t freeHeap;
+  uint32_t maxFreeBlock;
+  uint8_t heapFragmentation;
+  int8_t rssi;
+  uint16_t targetFps;
+  SchedulerStats frames;
+  FrameStats shown;
+  LinkStats link;
+  LinkStats mqttLink;
+  PublishStats mqttState;
+  uint32_t mqttCommands;
+  uint32_t mqttRejected;
+  ClockStats clock;
+  bool clockSynced;
+  bool clockLeading;
+  AnimationStats playback;
+  SamplingStats audioSampling;
+  uint16_t audioOverruns;
+
+  Metrics();
+};
+
+extern Metrics metrics;
+
+// Renders m in the Prometheus text format and copies the part of it that
+// starts offset bytes in to buffer, so a response can be sent in pieces
+// without holding the whole text. Returns the number of bytes copied;
+// with size 0 it returns the length of the whole text instead.
+size_t writeMetrics(const Metrics& m, char* buffer, size_t size, size_t offset);
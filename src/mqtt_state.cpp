@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mqtt_state.h"
+
+static const size_t HOST_OFFSET = 2;
+static const size_t TOPIC_OFFSET = HOST_OFFSET + sizeof(MqttConfig::host);
+static const size_t USER_OFFSET = TOPIC_OFFSET + sizeof(MqttConfig::topic);
+static const size_t PASSWORD_OFFSET = USER_OFFSET + sizeof(MqttConfig::user);
+
+static_assert(PASSWORD_OFFSET + sizeof(MqttConfig::password) == MQTT_IMAGE_SIZE, "MQTT settings do not fill their image");
+
+static void packString(uint8_t* image, const char* text, size_t size) {
+  memcpy(image, text, strnlen(text, size - 1));
+}
+
+void packMqttConfig(const MqttConfig& config, uint8_t* image) {
+  memset(image, 0, MQTT_IMAGE_SIZE);
+  image[0] = config.port >> 8;
+  image[1] = config.port & 0xff;
+  packString(image + HOST_OFFSET, config.host, sizeof(config.host));
+  packString(image + TOPIC_OFFSET, config.topic, sizeof(config.topic));
+  packString(image + USER_OFFSET, config.user, sizeof(config.user));
+  packString(image + PASSWORD_OFFSET, config.password, sizeof(config.password));
+}
+
+static bool unpackString(char* out, size_t size, const uint8_t* image) {
+  memcpy(out, image, size);
+  return memchr(out, '\0', size) != nullptr;
+}
+
+// Images from before MQTT was added are zero here; anything that is not a
+// set of terminated strings, like erased flash, leaves MQTT off.
+void unpackMqttConfig(MqttConfig& config, const uint8_t* image) {
+  config.port = (image[0] << 8) | image[1];
+  if (config.port == 0) config.port = MQTT_DEFAULT_PORT;
+
+  bool valid = unpackString(config.host, sizeof(config.host), image + HOST_OFFSET) &&
+    unpackString(config.topic, sizeof(config.topic), image + TOPIC_OFFSET) &&
+    unpackString(config.user, sizeof(config.user), image + USER_OFFSET) &&
+    unpackString(config.password, sizeof(config.password), image + PASSWORD_OFFSET);
+
+  if (!valid) {
+    memset(&config, 0, sizeof(config));
+    config.port = MQTT_DEFAULT_PORT;
+  }
+}
+
+static bool applyString(char* out, size_t size, JsonVariantConst value) {
+  if (value.isNull()) return true;
+
+  const char* text = value.as<const char*>();
+  if (!text || strlen(text) >= size) return false;
+
+  strcpy(out, text);
+  return true;
+}
+
+// Only the keys present change; nothing changes unless all of them fit.
+bool applyMqttConfigJson(MqttConfig& config, JsonObjectConst json) {
+  MqttConfig next = config;
+
+  if (!applyString(next.host, sizeof(next.host), json["host"]) ||
+      !applyString(next.topic, sizeof(next.topic), json["topic"]) ||
+      !applyString(next.user, sizeof(next.user), json["user"]) ||
+      !applyString(next.password, sizeof(next.password), json["password"])) return false;
+
+  JsonVariantConst port = json["port"];
+  if (!port.isNull()) {
+    long value = port.as<long>();
+    if (value < 1 || value > 65535) return false;
+    next.port = value;
+  }
+
+  // Commands are subscribed to with a wildcard under the topic.
+  size_t topicLength = strlen(next.topic);
+  if (strpbrk(next.topic, "+#") || (topicLength > 0 && next.topic[topicLength - 1] == '/')) return false;
+
+  config = next;
+  return true;
+}
+
+size_t mqttBaseTopic(const MqttConfig& config, uint32_t chipId, char* out, size_t size) {
+  int length;
+  if (config.topic[0] != '\0') length = snprintf(out, size, "%s", config.topic);
+  else length = snprintf(out, size, "plumbob/%06x", (unsigned) chipId);
+
+  return length > 0 && (size_t) length < size ? length : 0;
+}
+
+MqttCommand parseMqttTopic(const char* base, const char* topic) {
+  size_t length = strlen(base);
+  if (strncmp(topic, base, length) != 0 || topic[length] != '/') return MQTT_COMMAND_NONE;
+
+  const char* command = topic + length + 1;
+  if (strcmp(command, "enable/set") == 0) return MQTT_COMMAND_ENABLE;
+  if (strcmp(command, "brightness/set") == 0) return MQTT_COMMAND_BRIGHTNESS;
+  if (strcmp(command, "settings/set") == 0) return MQTT_COMMAND_SETTINGS;
+  return MQTT_COMMAND_NONE;
+}
+
+static bool matchWord(const char* text, size_t length, const char* word) {
+  if (strlen(word) != length) return false;
+
+  for (size_t i = 0; i < length; i++) {
+    char c = text[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    if (c != word[i]) return false;
+  }
+  return true;
+}
+
+bool parseMqttPayload(MqttCommand command, const char* payload, size_t length, JsonDocument& document) {
+  document.clear();
+
+  while (length > 0 && (*payload == ' ' || *payload == '\t' || *payload == '\r' || *payload == '\n')) {
+    payload++;
+    length--;
+  }
+  while (length > 0 && (payload[length - 1] == ' ' || payload[length - 1] == '\t' ||
+      payload[length - 1] == '\r' || payload[length - 1] == '\n')) length--;
+
+  if (length == 0) return false;
+
+  if (payload[0] == '{') {
+    // The payload is not ours to modify, so its strings are copied in.
+    return !deserializeJson(document, payload, length) && !document.as<JsonObjectConst>().isNull();
+  }
+
+  if (command == MQTT_COMMAND_ENABLE) {
+    if (matchWord(payload, length, "on") || matchWord(payload, length, "true") || matchWord(payload, length, "1")) {
+      document["enabled"] = 1;
+      return true;
+    }
+    if (matchWord(payload, length, "off") || matchWord(payload, length, "false") || matchWord(payload, length, "0")) {
+      document["enabled"] = 0;
+      return true;
+    }
+    return false;
+  }
+
+  if (command == MQTT_COMMAND_BRIGHTNESS) {
+    if (length > 5) return false;
+
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+      if (payload[i] < '0' || payload[i] > '9') return false;
+      value = value * 10 + payload[i] - '0';
+    }
+    document["brightness"] = value;
+    return true;
+  }
+
+  return false;
+}
+
+StatePublisher::StatePublisher(uint32_t interval) : interval(interval), lastPublish(0), pending(false),
+    everPublished(false) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+void StatePublisher::changed() {
+  stats.changes++;
+  if (pending) stats.coalesced++;
+  pending = true;
+}
+
+// The broker keeps the last retained state, but it may have restarted
+// without it, so a new session always gets the current one.
+void StatePublisher::connected() {
+  pending = true;
+}
+
+bool StatePublisher::due(uint32_t now) const {
+  return pending && (!everPublished || now - lastPublish >= interval);
+}
+
+void StatePublisher::published(uint32_t now) {
+  pending = false;
+  everPublished = true;
+  lastPublish = now;
+  stats.published++;
+}
+
+void StatePublisher::failed(uint32_t now) {
+  everPublished = true;
+  lastPublish = now;
+  stats.failed++;
+}
+
+const PublishStats& StatePublisher::getStats() const {
+  return stats;
+}
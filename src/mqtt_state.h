@@ -0,0 +1,77 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+const uint16_t MQTT_IMAGE_SIZE = 160;
+const uint16_t MQTT_DEFAULT_PORT = 1883;
+const size_t MQTT_TOPIC_SIZE = 64;
+const uint32_t MQTT_STATE_INTERVAL = 1000;
+
+// Broker settings as kept in the config image:
+//   port:16 host[48] topic[32] user[32] password[46]
+// Strings are NUL-terminated; an empty host leaves MQTT off.
+struct MqttConfig {
+  uint16_t port;
+  char host[48];
+  char topic[32];
+  char user[32];
+  char password[46];
+};
+
+void packMqttConfig(const MqttConfig& config, uint8_t* image);
+void unpackMqttConfig(MqttConfig& config, const uint8_t* image);
+bool applyMqttConfigJson(MqttConfig& config, JsonObjectConst json);
+
+// Topics hang off the configured topic, or plumbob/<chip id> without one:
+//   <base>/state            retained settings and button presses
+//   <base>/status           "online", or "offline" as the will
+//   <base>/enable/set       ON, OFF or the JSON POST /enable takes
+//   <base>/brightness/set   a number or the JSON POST /brightness takes
+//   <base>/settings/set     the JSON POST /settings takes
+size_t mqttBaseTopic(const MqttConfig& config, uint32_t chipId, char* out, size_t size);
+
+enum MqttCommand : uint8_t {
+  MQTT_COMMAND_NONE,
+  MQTT_COMMAND_ENABLE,
+  MQTT_COMMAND_BRIGHTNESS,
+  MQTT_COMMAND_SETTINGS
+};
+
+MqttCommand parseMqttTopic(const char* base, const char* topic);
+
+// Turns a command payload into the JSON object its HTTP handler takes.
+bool parseMqttPayload(MqttCommand command, const char* payload, size_t length, JsonDocument& document);
+
+struct PublishStats {
+  uint32_t changes;
+  uint32_t published;
+  uint32_t coalesced;
+  uint32_t failed;
+};
+
+// Folds state changes into at most one publish per interval. The first
+// change after a quiet interval goes out straight away; later ones wait
+// for the interval to pass and go out together as the latest state. A
+// failed publish takes its slot too, so a full send queue is not retried
+// on every loop.
+class StatePublisher {
+public:
+  explicit StatePublisher(uint32_t interval);
+
+  void changed();
+  void connected();
+  bool due(uint32_t now) const;
+  void published(uint32_t now);
+  void failed(uint32_t now);
+
+  const PublishStats& getStats() const;
+
+private:
+  uint32_t interval;
+  uint32_t lastPublish;
+  bool pending;
+  bool everPublished;
+  PublishStats stats;
+};
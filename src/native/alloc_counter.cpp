@@ -0,0 +1,58 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloc_counter.h"
+
+// Every block carries its size in front so live and peak bytes can be kept.
+static const size_t HEADER = alignof(std::max_align_t);
+
+static size_t allocations = 0;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+size_t allocationCount() {
+  return allocations;
+}
+
+size_t allocatedBytes() {
+  return liveBytes;
+}
+
+size_t peakAllocatedBytes() {
+  return peakBytes;
+}
+
+void* operator new(size_t size) {
+  char* p = (char*) malloc(size + HEADER);
+  if (p == nullptr) throw std::bad_alloc();
+
+  *(size_t*) p = size;
+  allocations++;
+  liveBytes += size;
+  if (liveBytes > peakBytes) peakBytes = liveBytes;
+  return p + HEADER;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  if (p == nullptr) return;
+
+  char* block = (char*) p - HEADER;
+  liveBytes -= *(size_t*) block;
+  free(block);
+}
+
+void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  operator delete(p);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+size_t allocationCount();
+size_t allocatedBytes();
+size_t peakAllocatedBytes();
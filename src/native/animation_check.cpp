@@ -0,0 +1,296 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../animation.h"
+#include "../registry.h"
+#include "alloc_counter.h"
+
+static const uint16_t ANIMATION_LEDS = 300;
+static const uint16_t ANIMATION_FPS = 60;
+static const uint16_t KEYFRAME_INTERVAL = 60;
+
+// A rough model of reading SPIFFS on the device: a fixed cost per call, a
+// rate per byte and now and then a long hold-up, as WiFi or a settings
+// commit can cause. Showing a frame costs what WS2812 data takes to send.
+static const uint32_t READ_MICROS = 60;
+static const uint32_t READ_NANOS_PER_BYTE = 2000;
+static const uint32_t HOLDUP_EVERY = 97;
+static const uint32_t HOLDUP_MICROS = 25000;
+static const uint32_t SHOW_MICROS_PER_LED = 30;
+
+// Reads from memory, moving a simulated clock on by what the read would
+// take on the device when one is given.
+class MemorySource : public AnimationSource {
+public:
+  MemorySource(const std::vector<uint8_t>& data, uint32_t* clock) : data(data), clock(clock), position(0), reads(0) {
+  }
+
+  size_t read(uint8_t* out, size_t length) override {
+    if (position >= data.size()) return 0;
+    if (length > data.size() - position) length = data.size() - position;
+    memcpy(out, &data[position], length);
+    position += length;
+
+    if (clock) {
+      *clock += READ_MICROS + length * READ_NANOS_PER_BYTE / 1000;
+      if (++reads % HOLDUP_EVERY == 0) *clock += HOLDUP_MICROS;
+    }
+    return length;
+  }
+
+  bool seek(uint32_t to) override {
+    if (to > data.size()) return false;
+    position = to;
+    if (clock) *clock += READ_MICROS;
+    return true;
+  }
+
+private:
+  const std::vector<uint8_t>& data;
+  uint32_t* clock;
+  size_t position;
+  uint32_t reads;
+};
+
+static std::vector<uint8_t> encodeAnimation(const std::vector<CRGB>& frames, uint16_t pixels, uint16_t fps88,
+    uint16_t keyframeInterval) {
+  AnimationHeader header = {pixels, fps88, (uint32_t) (frames.size() / pixels), keyframeInterval};
+  std::vector<uint8_t> out(ANIMATION_HEADER_SIZE);
+  writeAnimationHeader(header, &out[0]);
+
+  std::vector<CRGB> last(pixels);
+  std::vector<uint8_t> record(animationRecordSize(pixels));
+  for (uint32_t frame = 0; frame < header.frames; frame++) {
+    bool keyframe = keyframeInterval == 0 ? frame == 0 : frame % keyframeInterval == 0;
+    size_t size = encodeAnimationFrame(&frames[frame * pixels], &last[0], pixels, keyframe, &record[0], record.size());
+    out.insert(out.end(), record.begin(), record.begin() + size);
+  }
+  return out;
+}
+
+struct Playback {
+  long played;
+  long mismatched;
+  uint32_t elapsed;
+  uint64_t delay;
+  size_t allocations;
+  AnimationStats stats;
+};
+
+// Runs the device loop against the simulated clock: a frame tick at the
+// animation's rate, then, when readAhead is set, reading ahead until the
+// next tick. Every frame shown is compared with the one rendered, and the
+// time from its tick to it being decoded is added up: a read made once the
+// frame is due shows there, as a frame later than the schedule.
+static Playback play(const std::vector<uint8_t>& file, const std::vector<CRGB>& frames, uint16_t pixels, long count,
+    bool readAhead) {
+  static CRGB mirror[MAX_LEDS];
+  uint32_t clock = 0;
+  MemorySource source(file, &clock);
+  AnimationPlayer player;
+
+  Playback result = {};
+  if (!player.begin(&source, MAX_LEDS, clock)) return result;
+
+  uint32_t interval = 1000000 / ANIMATION_FPS;
+  uint32_t nextTick = clock;
+  uint32_t total = frames.size() / pixels;
+  size_t allocsBefore = allocationCount();
+
+  while (result.played < count && player.playing()) {
+    while (readAhead && (int32_t) (clock - nextTick) < 0 && player.prefetch()) {
+    }
+    if ((int32_t) (clock - nextTick) < 0) clock = nextTick;
+    uint32_t tick = clock;
+
+    if (player.advance(mirror, clock)) {
+      result.delay += clock - tick;
+      const CRGB* expected = &frames[(result.played % total) * pixels];
+      if (memcmp(mirror, expected, pixels * sizeof(CRGB)) != 0) result.mismatched++;
+      result.played++;
+      clock += pixels * SHOW_MICROS_PER_LED;
+    }
+
+    nextTick += interval;
+    if ((int32_t) (clock - nextTick) > 0) nextTick = clock;
+  }
+
+  result.elapsed = clock;
+  result.allocations = allocationCount() - allocsBefore;
+  result.stats = player.getStats();
+  return result;
+}
+
+static bool expectRejected(const char* name, std::vector<uint8_t> file, bool atBegin) {
+  static CRGB mirror[MAX_LEDS];
+  MemorySource source(file, nullptr);
+  AnimationPlayer player;
+
+  bool began = player.begin(&source, ANIMATION_LEDS, 0);
+  uint32_t now = 0;
+  for (int i = 0; began && player.playing() && i < 1000; i++) {
+    player.prefetch();
+    player.advance(mirror, now);
+    now += 1000000;
+  }
+
+  bool pass = atBegin ? !began : began && !player.playing() && player.getStats().errors == 1;
+  printf("%-26s %s%s\n", name, atBegin ? "refused" : "stopped", pass ? "" : "  FAIL");
+  return pass;
+}
+
+static bool checkCorruption(const std::vector<uint8_t>& file) {
+  bool pass = true;
+
+  std::vector<uint8_t> corrupt = file;
+  corrupt[0] = 'X';
+  pass = expectRejected("bad magic", corrupt, true) && pass;
+
+  corrupt = file;
+  corrupt[3] = ANIMATION_VERSION + 1;
+  pass = expectRejected("unknown version", corrupt, true) && pass;
+
+  corrupt = file;
+  corrupt[4] = 0xff;
+  pass = expectRejected("more pixels than the strip", corrupt, true) && pass;
+
+  corrupt = file;
+  corrupt.resize(file.size() - 7);
+  pass = expectRejected("truncated", corrupt, false) && pass;
+
+  // The first record is read by begin(), so damage the second.
+  size_t second = ANIMATION_HEADER_SIZE + ANIMATION_FRAME_HEADER_SIZE +
+    ((file[ANIMATION_HEADER_SIZE] << 8) | file[ANIMATION_HEADER_SIZE + 1]);
+  corrupt = file;
+  corrupt[second] = 0xff;
+  pass = expectRejected("oversized record", corrupt, false) && pass;
+
+  corrupt = file;
+  corrupt[ANIMATION_HEADER_SIZE + ANIMATION_FRAME_HEADER_SIZE] = 7;
+  pass = expectRejected("bad frame type", corrupt, false) && pass;
+  return pass;
+}
+
+// Pre-renders every effect into a .pba with keyframes every
+// KEYFRAME_INTERVAL frames and plays it back through two loops with and
+// without reading ahead, against a simulated flash. Playback must match
+// the rendered frames exactly and, reading ahead, never stall; damaged
+// files must be refused or stop playback cleanly.
+int runAnimationCheck(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 150;
+  if (frames < 2) frames = 150;
+
+  uint16_t pixels = ANIMATION_LEDS < MAX_LEDS ? ANIMATION_LEDS : MAX_LEDS;
+  allocateLeds(pixels);
+  uint32_t dt = 1000 / ANIMATION_FPS;
+  bool pass = true;
+
+  printf("%-18s %8s %9s %9s  %-27s  %-27s\n", "", "", "", "", "read ahead", "read when due");
+  printf("%-18s %8s %9s %9s  %5s %7s %5s %7s  %5s %7s %5s %7s\n", "mode", "raw B/fr", "file B/fr", "decode ns",
+    "fps", "stalls", "late", "wait us", "fps", "stalls", "late", "wait us");
+
+  std::vector<uint8_t> sample;
+  for (uint8_t mode = 0; mode < STREAM_MODE; mode++) {
+    effectParams = EffectParams();
+    random16_set_seed(1337);
+    fill_solid(leds, numLeds, CRGB::Black);
+
+    std::vector<CRGB> rendered(frames * pixels);
+    for (long frame = 0; frame < frames; frame++) {
+      animationMillis += dt;
+      renderMode(mode, effectParams, dt);
+      memcpy(&rendered[frame * pixels], leds, pixels * sizeof(CRGB));
+    }
+
+    std::vector<uint8_t> file = encodeAnimation(rendered, pixels, ANIMATION_FPS << 8, KEYFRAME_INTERVAL);
+    if (mode == 0) sample = file;
+
+    // Decoding from memory alone, without the simulated flash.
+    static CRGB mirror[MAX_LEDS];
+    MemorySource memory(file, nullptr);
+    AnimationPlayer player;
+    player.begin(&memory, MAX_LEDS, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (long frame = 0; frame < frames; frame++) player.advance(mirror, frame * (1000000 / ANIMATION_FPS));
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+
+    Playback ahead = play(file, rendered, pixels, frames * 2, true);
+    Playback onDemand = play(file, rendered, pixels, frames * 2, false);
+
+    bool ok = ahead.played == frames * 2 && ahead.mismatched == 0 && onDemand.mismatched == 0 &&
+      ahead.stats.stalls == 0 && ahead.stats.loops >= 1 && ahead.allocations == 0;
+    pass = pass && ok;
+
+    printf("%-18s %8u %9.0f %9.0f  %5.1f %7u %5u %7.0f  %5.1f %7u %5u %7.0f%s\n", effectRegistry[mode].name,
+      (unsigned) (pixels * 3), (double) (file.size() - ANIMATION_HEADER_SIZE) / frames, ns,
+      ahead.played * 1e6 / ahead.elapsed, ahead.stats.stalls, ahead.stats.late, (double) ahead.delay / ahead.played,
+      onDemand.played * 1e6 / onDemand.elapsed, onDemand.stats.stalls, onDemand.stats.late,
+      (double) onDemand.delay / onDemand.played, ok ? "" : "  FAIL");
+  }
+
+  printf("simulated flash: %u us + %u ns/B per read, a %u ms hold-up every %u reads; %u fps target\n",
+    READ_MICROS, READ_NANOS_PER_BYTE, HOLDUP_MICROS / 1000, HOLDUP_EVERY, ANIMATION_FPS);
+
+  pass = checkCorruption(sample) && pass;
+  return pass ? 0 : 1;
+}
+
+// Turns raw RGB frames, as written by "ffmpeg -f rawvideo -pix_fmt rgb24",
+// into a .pba file, a frame at a time.
+int runAnimationEncode(int argc, char** argv) {
+  if (argc < 3) {
+    printf("pba-encode <frames.rgb> <out.pba> <pixels> [fps] [keyframe interval]\n");
+    return 1;
+  }
+
+  long pixels = atol(argv[2]);
+  double fps = argc > 3 ? atof(argv[3]) : ANIMATION_FPS;
+  long keyframeInterval = argc > 4 ? atol(argv[4]) : KEYFRAME_INTERVAL;
+  if (pixels <= 0 || pixels > MAX_LEDS || fps <= 0 || fps * 256 > 65535 || keyframeInterval < 0 ||
+      keyframeInterval > 65535) {
+    printf("pixels must be 1 to %u, fps up to 255 and the keyframe interval up to 65535\n", MAX_LEDS);
+    return 1;
+  }
+
+  FILE* in = fopen(argv[0], "rb");
+  FILE* out = fopen(argv[1], "wb");
+  if (!in || !out) {
+    printf("cannot open %s\n", in ? argv[1] : argv[0]);
+    return 1;
+  }
+
+  AnimationHeader header = {(uint16_t) pixels, (uint16_t) lround(fps * 256), 0, (uint16_t) keyframeInterval};
+  uint8_t headerBytes[ANIMATION_HEADER_SIZE] = {};
+  fwrite(headerBytes, 1, sizeof(headerBytes), out);
+
+  std::vector<CRGB> frame(pixels);
+  std::vector<CRGB> last(pixels);
+  std::vector<uint8_t> record(animationRecordSize(pixels));
+  uint32_t keyframes = 0;
+  uint64_t written = 0;
+
+  while (fread(&frame[0], sizeof(CRGB), pixels, in) == (size_t) pixels) {
+    bool keyframe = header.frames == 0 || (keyframeInterval > 0 && header.frames % keyframeInterval == 0);
+    size_t size = encodeAnimationFrame(&frame[0], &last[0], pixels, keyframe, &record[0], record.size());
+    fwrite(&record[0], 1, size, out);
+
+    if (keyframe) keyframes++;
+    written += size;
+    header.frames++;
+  }
+  fclose(in);
+
+  writeAnimationHeader(header, headerBytes);
+  fseek(out, 0, SEEK_SET);
+  fwrite(headerBytes, 1, sizeof(headerBytes), out);
+  bool ok = fclose(out) == 0 && header.frames > 0;
+
+  printf("%u frames of %ld pixels at %.2f fps, %u keyframes: %llu B of frames, %.0f B/frame against %ld raw\n",
+    header.frames, pixels, header.fps88 / 256.0, keyframes, (unsigned long long) written,
+    header.frames > 0 ? (double) written / header.frames : 0.0, pixels * 3);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstring>
+
+#include "../asset_index.h"
+
+static const char* builtinManifest =
+  "/bootstrap.min.css.gz 3f1c0a9e5d7b2468 immutable\n"
+  "/favicon.png 0a1b2c3d4e5f6789 immutable\r\n"
+  "/index.html.gz 89abcdef01234567 revalidate\n"
+  "\n"
+  "not-a-path 0123456789abcdef immutable\n"
+  "/too-long-etag.js 0123456789abcdef0 immutable\n";
+
+struct MatchCase {
+  const char* ifNoneMatch;
+  bool matches;
+};
+
+static const MatchCase matchCases[] = {
+  {"\"89abcdef01234567\"", true},
+  {"W/\"89abcdef01234567\"", true},
+  {"\"0000000000000000\", \"89abcdef01234567\"", true},
+  {"*", true},
+  {"\"89abcdef0123456\"", false},
+  {"\"89abcdef012345678\"", false},
+  {"89abcdef01234567", false},
+  {"\"89abcdef01234567", false},
+  {"", false},
+};
+
+static bool checkMatching() {
+  bool ok = true;
+  for (const MatchCase& match : matchCases) {
+    if (etagMatches(match.ifNoneMatch, "89abcdef01234567") != match.matches) {
+      printf("If-None-Match: %s should %smatch\n", match.ifNoneMatch, match.matches ? "" : "not ");
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+static bool checkBuiltin() {
+  AssetIndex index;
+  if (index.load(builtinManifest, strlen(builtinManifest)) != 3) {
+    printf("built-in manifest: expected 3 entries, got %u\n", index.count());
+    return false;
+  }
+
+  const AssetEntry* page = index.find("/index.html");
+  const AssetEntry* icon = index.find("/favicon.png");
+  bool ok = page && page -> gzip && !page -> immutable && strcmp(page -> etag, "89abcdef01234567") == 0 &&
+    icon && !icon -> gzip && icon -> immutable && strcmp(icon -> etag, "0a1b2c3d4e5f6789") == 0 &&
+    index.find("/bootstrap.min.css") && !index.find("/index.html.gz") && !index.find("/missing.js");
+  if (!ok) printf("built-in manifest entries were misread\n");
+  return ok;
+}
+
+// Reads a manifest written by scripts/compress_data.py and checks the asset
+// handler would take every line of it within its fixed table and buffer.
+static bool checkManifest(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    printf("cannot open %s\n", path);
+    return false;
+  }
+
+  static char text[ASSET_MANIFEST_SIZE + 1];
+  size_t length = fread(text, 1, sizeof(text), file);
+  fclose(file);
+  if (length > ASSET_MANIFEST_SIZE) {
+    printf("%s is larger than ASSET_MANIFEST_SIZE (%u B)\n", path, (unsigned) ASSET_MANIFEST_SIZE);
+    return false;
+  }
+
+  text[length] = '\0';
+  uint8_t lines = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] == '\n' || i + 1 == length) lines++;
+  }
+
+  AssetIndex index;
+  uint8_t loaded = index.load(text, length);
+  printf("%s: %u of %u lines loaded, %u of %u B\n", path, loaded, lines, (unsigned) length,
+    (unsigned) ASSET_MANIFEST_SIZE);
+
+  for (const char* line = text; *line; ) {
+    size_t lineLength = strcspn(line, "\n");
+    printf("  %.*s\n", (int) lineLength, line);
+    line += lineLength + (line[lineLength] ? 1 : 0);
+  }
+  return loaded == lines;
+}
+
+// Checks manifest parsing and If-None-Match handling for the asset handler,
+// optionally against a manifest from a built filesystem image.
+int runAssetCheck(int argc, char** argv) {
+  bool ok = checkMatching() && checkBuiltin();
+  if (ok && argc > 0) ok = checkManifest(argv[0]);
+
+  printf("assets: %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
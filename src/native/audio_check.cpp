@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "../audio.h"
+
+static const uint32_t WAV_RATE = 16000;
+static const float TRACK_SECONDS = 16;
+static const float BPM_TOLERANCE = 3;
+
+struct Track {
+  const char* name;
+  std::vector<uint8_t> wav;
+  float bpm;
+};
+
+static void put16(std::vector<uint8_t>& out, uint16_t value) {
+  out.push_back(value);
+  out.push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+  put16(out, value);
+  put16(out, value >> 16);
+}
+
+static uint32_t get32(const uint8_t* in) {
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t) in[3] << 24;
+}
+
+static uint16_t get16(const uint8_t* in) {
+  return in[0] | in[1] << 8;
+}
+
+static std::vector<uint8_t> encodeWav(const std::vector<float>& samples) {
+  std::vector<uint8_t> out;
+  uint32_t dataSize = samples.size() * 2;
+  out.insert(out.end(), {'R', 'I', 'F', 'F'});
+  put32(out, 36 + dataSize);
+  out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+  put32(out, 16);
+  put16(out, 1);
+  put16(out, 1);
+  put32(out, WAV_RATE);
+  put32(out, WAV_RATE * 2);
+  put16(out, 2);
+  put16(out, 16);
+  out.insert(out.end(), {'d', 'a', 't', 'a'});
+  put32(out, dataSize);
+  for (float sample : samples) put16(out, (int16_t) lrintf(fmaxf(-1, fminf(1, sample)) * 32767));
+  return out;
+}
+
+// Reads 16-bit PCM, mixing channels down and resampling by averaging to
+// AUDIO_SAMPLE_RATE, then shifts it to the 10-bit range analogRead gives
+// with the microphone biased to mid-scale.
+static bool decodeWav(const std::vector<uint8_t>& wav, std::vector<uint16_t>& adc) {
+  if (wav.size() < 12 || memcmp(&wav[0], "RIFF", 4) != 0 || memcmp(&wav[8], "WAVE", 4) != 0) return false;
+
+  uint16_t channels = 0;
+  uint32_t rate = 0;
+  size_t offset = 12;
+  while (offset + 8 <= wav.size()) {
+    const uint8_t* chunk = &wav[offset];
+    uint32_t size = get32(chunk + 4);
+    if (offset + 8 + size > wav.size()) size = wav.size() - offset - 8;
+
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      if (get16(chunk + 8) != 1 || get16(chunk + 22) != 16) return false;
+      channels = get16(chunk + 10);
+      rate = get32(chunk + 12);
+    } else if (memcmp(chunk, "data", 4) == 0 && channels > 0 && rate >= AUDIO_SAMPLE_RATE) {
+      const uint8_t* data = chunk + 8;
+      size_t frames = size / (2 * channels);
+      double step = (double) rate / AUDIO_SAMPLE_RATE;
+      adc.clear();
+
+      for (double start = 0; start + step <= frames; start += step) {
+        int64_t sum = 0;
+        size_t from = (size_t) start;
+        size_t to = (size_t) (start + step);
+        for (size_t frame = from; frame < to; frame++) {
+          for (uint16_t channel = 0; channel < channels; channel++) {
+            sum += (int16_t) get16(data + (frame * channels + channel) * 2);
+          }
+        }
+        int32_t sample = sum / (int64_t) ((to - from) * channels);
+        adc.push_back(sample / 64 + 512);
+      }
+      return true;
+    }
+    offset += 8 + size + (size & 1);
+  }
+  return false;
+}
+
+static float noise() {
+  return (rand() / (float) RAND_MAX - 0.5f) * 2;
+}
+
+// Beats of a given sound over low background noise.
+static std::vector<uint8_t> beatTrack(float bpm, bool kick) {
+  std::vector<float> samples(TRACK_SECONDS * WAV_RATE);
+  float interval = 60 * WAV_RATE / bpm;
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    float sinceBeat = fmodf(i, interval) / WAV_RATE;
+    float sound;
+    if (kick) {
+      // A falling 120 to 50 Hz thump.
+      float frequency = 50 + 70 * expf(-sinceBeat * 30);
+      sound = sinf(2 * M_PI * frequency * sinceBeat) * expf(-sinceBeat * 12) * 0.8f;
+    } else {
+      sound = noise() * expf(-sinceBeat * 200) * 0.6f;
+    }
+    samples[i] = sound + noise() * 0.02f;
+  }
+  return encodeWav(samples);
+}
+
+static std::vector<uint8_t> steadyTrack(float frequency, float amplitude) {
+  std::vector<float> samples(TRACK_SECONDS * WAV_RATE);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = sinf(2 * M_PI * frequency * i / WAV_RATE) * amplitude + noise() * 0.01f;
+  }
+  return encodeWav(samples);
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+  std::vector<uint8_t> content;
+  FILE* file = fopen(path, "rb");
+  if (!file) return content;
+
+  uint8_t block[4096];
+  size_t length;
+  while ((length = fread(block, 1, sizeof(block), file)) > 0) content.insert(content.end(), block, block + length);
+  fclose(file);
+  return content;
+}
+
+// A sine in one bin must come out of the FFT there at half its amplitude,
+// scaled down by the window length, with little leaking elsewhere.
+static bool checkFft() {
+  static const uint8_t BIN = 10;
+  int16_t real[AUDIO_WINDOW];
+  int16_t imag[AUDIO_WINDOW];
+  for (uint16_t i = 0; i < AUDIO_WINDOW; i++) {
+    real[i] = lrint(16384 * sin(2 * M_PI * BIN * i / AUDIO_WINDOW));
+    imag[i] = 0;
+  }
+  fixedFft(real, imag, AUDIO_WINDOW_BITS);
+
+  float expected = 16384.0f / 2;
+  float peak = hypotf(real[BIN], imag[BIN]);
+  float leak = 0;
+  for (uint16_t bin = 1; bin < AUDIO_WINDOW / 2; bin++) {
+    if (bin != BIN) leak = fmaxf(leak, hypotf(real[bin], imag[bin]));
+  }
+
+  bool pass = fabsf(peak - expected) <= expected * 0.02f && leak <= expected * 0.01f;
+  printf("fft: bin %u magnitude %.0f (expected %.0f), largest other bin %.0f%s\n", BIN, peak, expected, leak,
+    pass ? "" : "  FAIL");
+  return pass;
+}
+
+struct Result {
+  AudioFeatures features;
+  uint16_t overruns;
+  double ns;
+  double cycles;
+};
+
+// Pushes the samples through the double buffer as the loop would and
+// analyzes each window, timing the analysis alone.
+static Result analyzeTrack(const std::vector<uint16_t>& adc) {
+  static SampleBuffer samples;
+  static AudioAnalyzer analyzer;
+  samples = SampleBuffer();
+  analyzer.reset();
+
+  Result result = {};
+  double ns = 0;
+  uint64_t cycles = 0;
+  for (uint16_t sample : adc) {
+    samples.push(sample);
+    const int16_t* window = samples.take();
+    if (!window) continue;
+
+    auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+    uint64_t startCycles = __rdtsc();
+#endif
+    analyzer.analyze(window, result.features);
+#ifdef HAVE_TSC
+    cycles += __rdtsc() - startCycles;
+#endif
+    ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    samples.release();
+  }
+
+  result.overruns = samples.getOverruns();
+  uint32_t windows = result.features.windows > 0 ? result.features.windows : 1;
+  result.ns = ns / windows;
+  result.cycles = (double) cycles / windows;
+  return result;
+}
+
+// Samples the track as the loop does, through a SampleClock polled every
+// POLL_MICROS except while a frame of length pixels is being shown.
+static Result sampleTrack(const std::vector<uint16_t>& adc, uint16_t length, uint16_t fps, SamplingStats& sampling) {
+  static const uint32_t POLL_MICROS = 20;
+  uint32_t showMicros = (uint32_t) length * SHOW_MICROS_PER_PIXEL;
+  // A frame rate the strip cannot be shown at slows the loop to what it can.
+  uint32_t frameMicros = std::max(1000000UL / fps, (unsigned long) showMicros + POLL_MICROS);
+  uint64_t endMicros = (uint64_t) adc.size() * 1000000 / AUDIO_SAMPLE_RATE;
+
+  std::vector<uint16_t> sampled;
+  SampleClock clock;
+  clock.start(0);
+  for (uint32_t now = 0; now < endMicros; now += POLL_MICROS) {
+    if (now % frameMicros < showMicros) continue;
+
+    uint32_t due = clock.due(now);
+    if (due == 0) continue;
+    uint16_t sample = adc[(uint64_t) now * AUDIO_SAMPLE_RATE / 1000000];
+    for (uint32_t i = 0; i < due; i++) sampled.push_back(sample);
+  }
+
+  sampling = clock.getStats();
+  return analyzeTrack(sampled);
+}
+
+static bool report(const Track& track, const Result& result) {
+  const AudioFeatures& f = result.features;
+  float bpm = f.bpm88 / 256.0f;
+  float seconds = (float) f.windows * AUDIO_WINDOW / AUDIO_SAMPLE_RATE;
+  bool pass;
+  if (track.bpm > 0) {
+    // Every beat should be found; the odd extra onset is tolerated.
+    float beats = seconds * track.bpm / 60;
+    pass = fabsf(bpm - track.bpm) <= BPM_TOLERANCE && f.onsets >= beats * 0.9f && f.onsets <= beats * 1.2f;
+  } else {
+    pass = f.onsets == 0;
+  }
+
+  printf("%-16s %6.1f %8s %7u %6u %6u %8.0f", track.name, bpm,
+    track.bpm > 0 ? std::to_string((int) track.bpm).c_str() : "-", f.onsets, f.level, result.overruns, result.ns);
+#ifdef HAVE_TSC
+  printf(" %9.0f", result.cycles);
+#endif
+  printf("%s\n", pass ? "" : "  FAIL");
+  return pass;
+}
+
+// Checks the FFT, then runs synthesized click and kick tracks at several
+// tempos, silence and a steady tone through the WAV reader and analyzer:
+// tempo must land within BPM_TOLERANCE and steady sound must give no
+// onsets. Further "<file.wav>[:<bpm>]" arguments are analyzed the same way.
+int runAudioCheck(int argc, char** argv) {
+  srand(1);
+  bool pass = checkFft();
+
+  std::vector<Track> tracks;
+  static const float clickTempos[] = {90, 120, 150};
+  static const float kickTempos[] = {72, 100, 128, 174};
+  static char names[16][16];
+  uint8_t named = 0;
+  for (float bpm : clickTempos) {
+    snprintf(names[named], sizeof(names[named]), "clicks %.0f", bpm);
+    tracks.push_back({names[named++], beatTrack(bpm, false), bpm});
+  }
+  for (float bpm : kickTempos) {
+    snprintf(names[named], sizeof(names[named]), "kicks %.0f", bpm);
+    tracks.push_back({names[named++], beatTrack(bpm, true), bpm});
+  }
+  tracks.push_back({"silence", steadyTrack(0, 0), 0});
+  tracks.push_back({"tone 440 Hz", steadyTrack(440, 0.5f), 0});
+
+  for (int i = 0; i < argc; i++) {
+    char* colon = strrchr(argv[i], ':');
+    float bpm = 0;
+    if (colon) {
+      *colon = '\0';
+      bpm = atof(colon + 1);
+    }
+    tracks.push_back({argv[i], readFile(argv[i]), bpm});
+  }
+
+  printf("%-16s %6s %8s %7s %6s %6s %8s", "track", "bpm", "expected", "onsets", "level", "drops", "ns/win");
+#ifdef HAVE_TSC
+  printf(" %9s", "tsc/win");
+#endif
+  printf("\n");
+
+  double ns = 0;
+  for (const Track& track : tracks) {
+    std::vector<uint16_t> adc;
+    if (!decodeWav(track.wav, adc)) {
+      printf("%-16s is not 16-bit PCM WAV at %u Hz or more  FAIL\n", track.name, AUDIO_SAMPLE_RATE);
+      pass = false;
+      continue;
+    }
+
+    Result result = analyzeTrack(adc);
+    pass = report(track, result) && pass;
+    ns = fmax(ns, result.ns);
+  }
+
+  // Every kick track must keep its tempo on a strip of AUDIO_MAX_LEDS at
+  // any frame rate; the rows are where it was not, the longer strips
+  // showing what is lost past it.
+  static const uint16_t heldLengths[] = {AUDIO_MAX_LEDS, 300, 600};
+  static const uint16_t heldRates[] = {24, 30, 45, 60, 90, 120};
+  printf("\n%-16s %5s %4s %6s %6s %8s\n", "tempo missed", "leds", "fps", "held", "bpm", "expected");
+  for (const Track& track : tracks) {
+    if (strncmp(track.name, "kicks", 5) != 0) continue;
+
+    std::vector<uint16_t> adc;
+    decodeWav(track.wav, adc);
+    for (uint16_t length : heldLengths) {
+      for (uint16_t fps : heldRates) {
+        SamplingStats sampling;
+        Result result = sampleTrack(adc, length, fps, sampling);
+        float bpm = result.features.bpm88 / 256.0f;
+        bool found = fabsf(bpm - track.bpm) <= BPM_TOLERANCE;
+        if (length <= AUDIO_MAX_LEDS) pass = found && pass;
+        if (found) continue;
+
+        printf("%-16s %5u %4u %5u%% %6.1f %8.0f%s\n", track.name, length, fps,
+          (unsigned) ((uint64_t) sampling.held * 100 / std::max(sampling.samples, 1U)), bpm, track.bpm,
+          found ? "" : length <= AUDIO_MAX_LEDS ? "  FAIL" : "  missed");
+      }
+    }
+  }
+  printf("\n");
+
+  printf("a window is %u ms of audio; the slowest analysis took %.2f%% of it on this host\n",
+    AUDIO_WINDOW * 1000 / AUDIO_SAMPLE_RATE, 100.0 * ns * AUDIO_SAMPLE_RATE / (AUDIO_WINDOW * 1e9));
+  printf("device cycles per window come from plumbob_audio_analysis_seconds at /metrics\n");
+  return pass ? 0 : 1;
+}
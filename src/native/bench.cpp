@@ -0,0 +1,75 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../registry.h"
+#include "../renderer.h"
+#include "alloc_counter.h"
+
+static const uint16_t benchLengths[] = {72, 300, 1000};
+
+static const uint32_t benchDelta = 1000 / DEFAULT_FPS;
+
+static void renderFrame(uint8_t mode) {
+  renderMode(mode, effectParams, benchDelta);
+  showFrame();
+}
+
+static void resetEffects() {
+  // Zero periods make every effect take exactly one simulation step per
+  // frame, so the numbers below are the worst case an effect can cost.
+  effectParams = EffectParams();
+  effectParams.fullRainbowSpeed = 0;
+  effectParams.animatedRainbowSpeed = 0;
+  effectParams.randomSColorSpeed = 0;
+  effectParams.animatedPaletteSpeed = 0;
+  effectParams.fadeToBlackSpeed = 0;
+  effectParams.fireSpeed = 0;
+
+  random16_set_seed(1337);
+  fill_solid(leds, numLeds, CRGB::Black);
+  invalidateFrame();
+}
+
+static void benchMode(uint8_t mode, uint16_t length, long frames) {
+  allocateLeds(length);
+  allocateFrame(length);
+  resetEffects();
+
+  for (int i = 0; i < 16; i++) renderFrame(mode);
+
+  FrameStats statsBefore = frameStats;
+  size_t allocsBefore = allocationCount();
+  auto start = std::chrono::steady_clock::now();
+
+  for (long i = 0; i < frames; i++) renderFrame(mode);
+
+  auto end = std::chrono::steady_clock::now();
+  size_t allocs = allocationCount() - allocsBefore;
+  uint32_t pushed = frameStats.pushed - statsBefore.pushed;
+  uint32_t skipped = frameStats.skipped - statsBefore.skipped;
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  double nsPerFrame = ns / frames;
+
+  printf("%-18s %5u %12.1f %10.2f %10.3f %8u %8u\n", effectRegistry[mode].name, length, nsPerFrame, nsPerFrame / length,
+    (double) allocs / frames, pushed, skipped);
+}
+
+int runBench(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 5000;
+  if (frames <= 0) frames = 5000;
+
+  printf("%-18s %5s %12s %10s %10s %8s %8s\n", "mode", "leds", "ns/frame", "ns/led", "allocs/fr", "pushed",
+    "skipped");
+
+  for (uint16_t length : benchLengths) {
+    if (length > MAX_LEDS) continue;
+
+    for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+      benchMode(mode, length, frames);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstring>
+
+#include "../button.h"
+
+struct Trace {
+  const char* name;
+  ButtonEdge edges[12];
+  uint8_t edgeCount;
+  ButtonEvent expected[4];
+  uint8_t expectedCount;
+};
+
+// Edge times are in ms; the button idles LOW and reads HIGH while pressed.
+static const Trace traces[] = {
+  {"click", {{1000, 1}, {1100, 0}}, 2, {BUTTON_CLICK}, 1},
+  {"bouncy click", {{1000, 1}, {1002, 0}, {1004, 1}, {1100, 0}, {1101, 1}, {1103, 0}}, 6, {BUTTON_CLICK}, 1},
+  {"glitch", {{1000, 1}, {1010, 0}}, 2, {}, 0},
+  {"double click", {{1000, 1}, {1100, 0}, {1250, 1}, {1350, 0}}, 4, {BUTTON_DOUBLE_CLICK}, 1},
+  {"two clicks", {{1000, 1}, {1100, 0}, {1500, 1}, {1600, 0}}, 4, {BUTTON_CLICK, BUTTON_CLICK}, 2},
+  {"long press", {{1000, 1}, {2500, 0}}, 2, {BUTTON_LONG_PRESS}, 1},
+  {"very long press", {{1000, 1}, {7000, 0}}, 2, {BUTTON_VERY_LONG_PRESS}, 1},
+  {"click then long", {{1000, 1}, {1100, 0}, {1200, 1}, {2400, 0}}, 4, {BUTTON_CLICK, BUTTON_LONG_PRESS}, 2},
+  {"bouncy long release", {{1000, 1}, {2100, 0}, {2103, 1}, {2105, 0}}, 4, {BUTTON_LONG_PRESS}, 1},
+};
+
+// Replays edges the way the firmware sees them: the ISR queues each edge at
+// its own time, while loop() only drains the queue every loopPeriod ms.
+static uint8_t classify(const ButtonEdge* edges, uint8_t count, uint32_t loopPeriod, ButtonEvent* out, uint8_t maxOut) {
+  EdgeQueue queue;
+  ButtonClassifier button(0);
+  uint8_t next = 0;
+  uint8_t found = 0;
+
+  uint32_t end = edges[count - 1].time + VERY_LONG_PRESS_TIME;
+  for (uint32_t now = edges[0].time; now <= end; now += loopPeriod) {
+    while (next < count && edges[next].time <= now) {
+      queue.push(edges[next].time, edges[next].level);
+      next++;
+    }
+
+    ButtonEdge edge;
+    while (queue.pop(edge)) button.feed(edge);
+
+    ButtonEvent event;
+    while ((event = button.poll(now)) != BUTTON_NONE) {
+      if (found < maxOut) out[found] = event;
+      found++;
+    }
+  }
+
+  return found;
+}
+
+static int loadTrace(const char* path, ButtonEdge* edges, uint8_t maxEdges) {
+  FILE* file = fopen(path, "r");
+  if (!file) return -1;
+
+  unsigned long time;
+  unsigned level;
+  int count = 0;
+  while (count < maxEdges && fscanf(file, "%lu %u", &time, &level) == 2) {
+    edges[count].time = time;
+    edges[count].level = level ? 1 : 0;
+    count++;
+  }
+
+  fclose(file);
+  return count;
+}
+
+// Without arguments, checks the classifier against the built-in traces,
+// both with a 1 ms loop and with one stalled 250 ms behind slow frames. With a file of "<ms> <level>" lines, prints the events it produces.
+int runButtonTrace(int argc, char** argv) {
+  ButtonEvent events[8];
+
+  if (argc > 0) {
+    static ButtonEdge edges[255];
+    int count = loadTrace(argv[0], edges, 255);
+    if (count <= 0) {
+      printf("could not read edges from %s\n", argv[0]);
+      return 1;
+    }
+
+    uint8_t found = classify(edges, count, 1, events, 8);
+    for (uint8_t i = 0; i < found && i < 8; i++) printf("%s\n", buttonEventName(events[i]));
+    return 0;
+  }
+
+  const uint32_t loopPeriods[] = {1, 250};
+  int failures = 0;
+
+  for (const Trace& trace : traces) {
+    for (uint32_t loopPeriod : loopPeriods) {
+      uint8_t found = classify(trace.edges, trace.edgeCount, loopPeriod, events, 8);
+      bool ok = found == trace.expectedCount && memcmp(events, trace.expected, found * sizeof(ButtonEvent)) == 0;
+
+      printf("%-20s loop every %3u ms  %s", trace.name, loopPeriod, ok ? "ok  " : "FAIL");
+      for (uint8_t i = 0; i < found && i < 8; i++) printf(" %s", buttonEventName(events[i]));
+      printf("\n");
+
+      if (!ok) failures++;
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
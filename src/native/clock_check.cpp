@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../clock_sync.h"
+
+static const uint64_t SECOND = 1000000;
+static const uint64_t SIM_STEP = 250;
+static const uint64_t FRAME = 16750;
+static const uint64_t IDLE_SLICE = 1000;
+static const uint64_t MEASURE_INTERVAL = 100000;
+static const int64_t MAX_ERROR = 3000;
+
+// A simulated unit: its crystal runs drift fast and its micros() started
+// at boot. Like the firmware, its loop reads the network every
+// millisecond between frames, but not while it renders and shows one, so
+// a packet can wait in the socket for a few milliseconds.
+struct SimUnit {
+  const char* name;
+  uint32_t id;
+  double drift;
+  uint32_t boot;
+  uint64_t start;
+  uint64_t stop;
+  ClockSync* sync;
+  uint64_t nextPoll;
+  uint64_t nextFrame;
+  uint64_t lastShared;
+  uint32_t lastSteps;
+  bool running;
+};
+
+struct SimPacket {
+  uint64_t arrival;
+  size_t to;
+  uint8_t data[CLOCK_PACKET_SIZE];
+};
+
+static uint32_t localAt(const SimUnit& unit, uint64_t t) {
+  return unit.boot + (uint32_t) (uint64_t) llround((t - unit.start) * (1 + unit.drift));
+}
+
+static double uniform(double low, double high) {
+  return low + (high - low) * rand() / (double) RAND_MAX;
+}
+
+// WiFi-like delivery: a few hundred microseconds to a few milliseconds,
+// now and then a retry burst of tens of milliseconds, and some loss.
+static void broadcast(std::vector<SimUnit>& units, size_t from, const uint8_t* data, uint64_t t,
+    std::vector<SimPacket>& inFlight) {
+  for (size_t i = 0; i < units.size(); i++) {
+    if (i == from || !units[i].running || rand() % 100 < 2) continue;
+
+    SimPacket packet;
+    packet.arrival = t + (uint64_t) uniform(300, 2500) + (rand() % 100 < 3 ? (uint64_t) uniform(5000, 30000) : 0);
+    packet.to = i;
+    memcpy(packet.data, data, CLOCK_PACKET_SIZE);
+    inFlight.push_back(packet);
+  }
+}
+
+static bool checkPackets() {
+  ClockPacket packet = {CLOCK_REPLY, CLOCK_FLAG_LEADER, 0xabcdef, 0x123456, 1ULL << 40, 5, 0xfedcba9876543210ULL};
+  uint8_t data[CLOCK_PACKET_SIZE];
+  ClockPacket parsed;
+  bool pass = writeClockPacket(packet, data) == CLOCK_PACKET_SIZE && parseClockPacket(data, sizeof(data), parsed) &&
+    parsed.type == packet.type && parsed.from == packet.from && parsed.to == packet.to && parsed.t1 == packet.t1 &&
+    parsed.t3 == packet.t3;
+
+  data[4]++;
+  pass = pass && !parseClockPacket(data, sizeof(data), parsed);
+  data[4]--;
+  pass = pass && !parseClockPacket(data, sizeof(data) - 1, parsed);
+
+  printf("packets: %s\n", pass ? "ok" : "FAIL");
+  return pass;
+}
+
+struct Window {
+  const char* name;
+  uint64_t from;
+  uint64_t to;
+  std::vector<int64_t> errors;
+  std::vector<int64_t> reported;
+};
+
+static int64_t percentile(std::vector<int64_t> values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t) (values.size() * fraction))];
+}
+
+// Four units boot a few seconds apart, the leader is switched off at 40 s
+// and a unit with a lower id than any joins at 60 s. Followers must track
+// the leader's clock within MAX_ERROR, the group's clock must run on
+// without a jump when the leader goes and when the newcomer joins, and the
+// newcomer must follow rather than lead.
+int runClockCheck(int argc, char** argv) {
+  long seconds = argc > 0 ? atol(argv[0]) : 90;
+  if (seconds < 90) seconds = 90;
+  srand(7);
+
+  bool pass = checkPackets();
+
+  std::vector<SimUnit> units = {
+    {"A", 0x1a2b3c, 40e-6, 123456789, 0, 0},
+    {"B", 0x0f0f0f, -35e-6, 5000, SECOND / 2, 0},
+    {"C", 0x33cc33, 12e-6, 2000000000, 2 * SECOND, 0},
+    {"D", 0x2b2b2b, -60e-6, 4294000000u, 5 * SECOND, 0},
+    {"E", 0x0a0a0a, 25e-6, 77, 60 * SECOND, 0}
+  };
+  for (SimUnit& unit : units) unit.sync = new ClockSync(unit.id);
+
+  std::vector<Window> windows = {
+    {"settled", 20 * SECOND, 40 * SECOND},
+    {"after leader loss", 50 * SECOND, 60 * SECOND},
+    {"after join", 70 * SECOND, (uint64_t) seconds * SECOND}
+  };
+
+  std::vector<SimPacket> inFlight;
+  uint8_t out[CLOCK_PACKET_SIZE];
+  uint32_t groupJumps = 0;
+  int64_t largestJump = 0;
+  size_t firstLeader = units.size();
+  uint64_t leaderLost = 0;
+  uint64_t newLeaderAt = 0;
+  uint64_t end = (uint64_t) seconds * SECOND;
+
+  for (uint64_t t = 0; t <= end; t += SIM_STEP) {
+    if (t == 40 * SECOND) {
+      for (size_t i = 0; i < units.size(); i++) {
+        if (units[i].running && units[i].sync->leading()) {
+          units[i].running = false;
+          units[i].stop = t;
+          firstLeader = i;
+          leaderLost = t;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < units.size(); i++) {
+      SimUnit& unit = units[i];
+      if (!unit.running && unit.stop == 0 && t >= unit.start) {
+        unit.running = true;
+        unit.sync->begin(localAt(unit, t));
+        unit.nextPoll = t;
+        unit.nextFrame = t + (uint64_t) uniform(0, FRAME);
+      }
+      if (!unit.running || t < unit.nextPoll) continue;
+
+      uint32_t now = localAt(unit, t);
+      for (size_t p = 0; p < inFlight.size(); ) {
+        if (inFlight[p].to != i || inFlight[p].arrival > t) {
+          p++;
+          continue;
+        }
+        size_t length = unit.sync->receive(inFlight[p].data, CLOCK_PACKET_SIZE, now, out);
+        inFlight.erase(inFlight.begin() + p);
+        if (length > 0) broadcast(units, i, out, t, inFlight);
+      }
+      while (unit.sync->poll(now, out) > 0) broadcast(units, i, out, t, inFlight);
+      if (t >= unit.nextFrame) {
+        unit.nextPoll = t + (uint64_t) uniform(2000, 7000);
+        unit.nextFrame += FRAME;
+      } else {
+        unit.nextPoll = t + IDLE_SLICE;
+      }
+    }
+
+    if (t % MEASURE_INTERVAL != 0) continue;
+
+    const SimUnit* leader = nullptr;
+    for (const SimUnit& unit : units) {
+      if (unit.running && unit.sync->leading()) leader = &unit;
+    }
+    if (leaderLost && !newLeaderAt && leader) newLeaderAt = t;
+
+    uint64_t leaderShared = leader ? leader->sync->sharedMicros(localAt(*leader, t)) : 0;
+    for (SimUnit& unit : units) {
+      if (!unit.running) continue;
+
+      uint64_t shared = unit.sync->sharedMicros(localAt(unit, t));
+      uint32_t steps = unit.sync->getStats().steps;
+      // Past the first sync a unit's clock should only ever be slewed.
+      if (unit.lastShared != 0 && steps == unit.lastSteps && t > 10 * SECOND) {
+        int64_t jump = (int64_t) (shared - unit.lastShared) - (int64_t) MEASURE_INTERVAL;
+        largestJump = std::max(largestJump, std::abs(jump));
+      }
+      if (unit.lastShared != 0 && steps != unit.lastSteps && t > 10 * SECOND && unit.start < 10 * SECOND) {
+        groupJumps++;
+      }
+      unit.lastShared = shared;
+      unit.lastSteps = steps;
+
+      if (!leader || &unit == leader || !unit.sync->synced()) continue;
+      for (Window& window : windows) {
+        if (t < window.from || t >= window.to) continue;
+        window.errors.push_back(std::abs((int64_t) (shared - leaderShared)));
+        window.reported.push_back(std::abs((int64_t) unit.sync->getStats().errorMicros));
+      }
+    }
+  }
+
+  printf("%-18s %8s %8s %8s %10s\n", "window", "p50 us", "p99 us", "max us", "reported");
+  for (const Window& window : windows) {
+    int64_t worst = percentile(window.errors, 1.0);
+    bool ok = !window.errors.empty() && worst <= MAX_ERROR;
+    printf("%-18s %8lld %8lld %8lld %10lld%s\n", window.name, (long long) percentile(window.errors, 0.5),
+      (long long) percentile(window.errors, 0.99), (long long) worst, (long long) percentile(window.reported, 0.99),
+      ok ? "" : "  FAIL");
+    pass = ok && pass;
+  }
+
+  for (const SimUnit& unit : units) {
+    const ClockStats& stats = unit.sync->getStats();
+    printf("%s %06x %+4.0f ppm  %-8s samples %4u  steps %u  leader changes %u  drift estimate %+6.1f ppm\n",
+      unit.name, unit.id, unit.drift * 1e6, unit.running ? (unit.sync->leading() ? "leader" : "follower") : "off",
+      stats.samples, stats.steps, stats.leaderChanges, stats.driftPpb / 1000.0);
+  }
+
+  const SimUnit& joiner = units.back();
+  bool took = newLeaderAt > 0 && newLeaderAt - leaderLost <= 6 * SECOND;
+  printf("leader %s switched off at 40 s, replaced after %.1f s%s\n", firstLeader < units.size() ? units[firstLeader].name : "-",
+    newLeaderAt ? (newLeaderAt - leaderLost) / 1e6 : 0.0, took ? "" : "  FAIL");
+  printf("largest slew between 100 ms measurements: %lld us, group clock steps after 10 s: %u%s\n",
+    (long long) largestJump, groupJumps, groupJumps == 0 && largestJump <= MAX_ERROR ? "" : "  FAIL");
+  printf("newcomer with the lowest id: %s\n", joiner.sync->leading() ? "took over  FAIL" : "follows");
+
+  pass = pass && took && groupJumps == 0 && largestJump <= MAX_ERROR && !joiner.sync->leading();
+  for (SimUnit& unit : units) delete unit.sync;
+  return pass ? 0 : 1;
+}
+
+static uint64_t monotonicMicros() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * SECOND + now.tv_nsec / 1000;
+}
+
+static int openGroupSocket() {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(CLOCK_SYNC_PORT);
+
+  ip_mreq membership;
+  memcpy(&membership.imr_multiaddr, CLOCK_SYNC_GROUP, 4);
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  in_addr loopback;
+  loopback.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(fd, (sockaddr*) &address, sizeof(address)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// One unit on the loopback multicast group, with a clock running drift
+// ppm fast from a start picked by its id. Each second of CLOCK_MONOTONIC
+// it prints its shared clock, so the lines of several instances started
+// side by side can be compared second by second.
+int runClockNode(int argc, char** argv) {
+  uint32_t id = argc > 0 ? strtoul(argv[0], nullptr, 0) : 0;
+  double drift = argc > 1 ? atof(argv[1]) * 1e-6 : 0;
+  long seconds = argc > 2 ? atol(argv[2]) : 60;
+  if (id == 0 || seconds <= 0) {
+    printf("clock-node needs a non-zero id\n");
+    return 1;
+  }
+
+  int fd = openGroupSocket();
+  if (fd < 0) {
+    printf("could not join the clock group on the loopback interface\n");
+    return 1;
+  }
+
+  sockaddr_in group;
+  memset(&group, 0, sizeof(group));
+  group.sin_family = AF_INET;
+  memcpy(&group.sin_addr, CLOCK_SYNC_GROUP, 4);
+  group.sin_port = htons(CLOCK_SYNC_PORT);
+
+  uint64_t begun = monotonicMicros();
+  uint32_t boot = id * 2654435761u;
+  auto localNow = [&] () -> uint32_t {
+    uint64_t elapsed = monotonicMicros() - begun;
+    return boot + (uint32_t) (uint64_t) llround(elapsed * (1 + drift));
+  };
+
+  ClockSync sync(id);
+  sync.begin(localNow());
+  uint8_t packet[1500];
+  uint8_t out[CLOCK_PACKET_SIZE];
+  uint64_t nextReport = (begun / SECOND + 1) * SECOND;
+
+  printf("%-10s %16s %8s %6s %8s %8s %9s\n", "second", "shared us", "leader", "synced", "err us", "rtt us", "drift ppm");
+  while (monotonicMicros() - begun < (uint64_t) seconds * SECOND) {
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(fd, &ready);
+    timeval wait = {0, 1000};
+    if (select(fd + 1, &ready, nullptr, nullptr, &wait) > 0) {
+      ssize_t length = recv(fd, packet, sizeof(packet), 0);
+      size_t reply = length > 0 ? sync.receive(packet, length, localNow(), out) : 0;
+      if (reply > 0) sendto(fd, out, reply, 0, (sockaddr*) &group, sizeof(group));
+    }
+
+    size_t length;
+    while ((length = sync.poll(localNow(), out)) > 0) sendto(fd, out, length, 0, (sockaddr*) &group, sizeof(group));
+
+    if (monotonicMicros() >= nextReport) {
+      const ClockStats& stats = sync.getStats();
+      printf("%-10llu %16llu %8x %6s %8d %8u %+9.1f\n", (unsigned long long) (nextReport / SECOND),
+        (unsigned long long) sync.sharedMicros(localNow()), sync.getLeader(), sync.synced() ? "yes" : "no",
+        stats.errorMicros, stats.delayMicros, stats.driftPpb / 1000.0);
+      fflush(stdout);
+      nextReport += SECOND;
+    }
+  }
+
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,198 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../color_cache.h"
+#include "../registry.h"
+
+// The effects as they were before the color cache, kept as the reference
+// the cached versions must match bit for bit.
+namespace legacy {
+
+static uint8_t fullRainbowHue = 0;
+static uint8_t animatedRainbowHue = 0;
+static uint8_t animatedPaletteIdx = 0;
+static uint8_t heat[MAX_LEDS];
+
+static void reset() {
+  fullRainbowHue = 0;
+  animatedRainbowHue = 0;
+  animatedPaletteIdx = 0;
+  memset(heat, 0, sizeof(heat));
+}
+
+static uint16_t randomLed() {
+  if (numLeds <= 256) return random8(0, numLeds - 1);
+  return random16(0, numLeds - 1);
+}
+
+static void fullRainbow(uint32_t dt) {
+  fullRainbowHue += 1;
+  for (int i = 0; i < numLeds; i++) leds[i] = CHSV(fullRainbowHue, 255, 255);
+}
+
+static void animatedRainbow(uint32_t dt) {
+  animatedRainbowHue += 1;
+  for (int i = 0; i < numLeds; i++) leds[i] = CHSV(animatedRainbowHue + (i), 255, 255);
+}
+
+static void randomSingleColor(const EffectParams& p) {
+  leds[0] = CHSV(p.randomSColor, random8(), random8(100, 255));
+  for (int i = numLeds - 1; i > 0; i--) leds[i] = leds[i - 1];
+}
+
+static void staticPalette(const CRGBPalette16& palette) {
+  fill_palette(leds, numLeds, 0, 255 / numLeds, palette, 255, LINEARBLEND);
+}
+
+static void animatedPalette(const CRGBPalette16& palette) {
+  animatedPaletteIdx += 1;
+  fill_palette(leds, numLeds, animatedPaletteIdx, 255 / numLeds, palette, 255, LINEARBLEND);
+}
+
+static void fadeToBlack(const CRGBPalette16& palette, const EffectParams& p) {
+  leds[randomLed()] = ColorFromPalette(palette, random8(), 255, LINEARBLEND);
+  fadeToBlackBy(leds, numLeds, p.fadeToBlackFadeSpeed);
+}
+
+static void fire(const EffectParams& p) {
+  for (int i = 0; i < numLeds; i++) heat[i] = qsub8(heat[i], random8(0, ((p.fireCooling * 10) / numLeds) + 2));
+  for (int k = numLeds - 1; k >= 2; k--) heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2]) / 3;
+  if (random8() < p.fireSparks) {
+    int y = random8(7);
+    heat[y] = qadd8(heat[y], random8(160, 255));
+  }
+
+  for (int j = 0; j < numLeds; j++) leds[p.fireReverse ? (numLeds - 1) - j : j] = HeatColor(heat[j]);
+}
+
+// Past 255 pixels the rainbow and palettes are spread with a fractional
+// step, where these stopped at a step of zero and filled one color.
+static bool supports(uint8_t mode, uint16_t length) {
+  if ((mode == 0 || mode == 4 || mode == 5) && length > 255) return false;
+  return mode <= 6 || mode == 9;
+}
+
+static void render(uint8_t mode, const EffectParams& p, uint32_t dt) {
+  switch (mode) {
+    case 0: fill_rainbow(leds, numLeds, 0, 255 / numLeds); break;
+    case 1: legacy::fullRainbow(dt); break;
+    case 2: legacy::animatedRainbow(dt); break;
+    case 3: legacy::randomSingleColor(p); break;
+    case 4: legacy::staticPalette(cyanPalette); break;
+    case 5: legacy::animatedPalette(cyanPalette); break;
+    case 6: legacy::fadeToBlack(cyanPalette, p); break;
+    case 9: legacy::fire(p); break;
+  }
+}
+
+}
+
+static const uint16_t colorLengths[] = {72, 300, 1000};
+
+static void resetEffects() {
+  // Zero periods step every effect once per frame, matching the
+  // reference, which steps unconditionally.
+  effectParams = EffectParams();
+  effectParams.fullRainbowSpeed = 0;
+  effectParams.animatedRainbowSpeed = 0;
+  effectParams.randomSColorSpeed = 0;
+  effectParams.animatedPaletteSpeed = 0;
+  effectParams.fadeToBlackSpeed = 0;
+  effectParams.fireSpeed = 0;
+  fill_solid(leds, numLeds, CRGB::Black);
+  resetEffectState(*effectState, ledHeat, numLeds);
+  legacy::reset();
+}
+
+static bool checkTables() {
+  const CRGB* rainbow = rainbowColors();
+  const CRGB* heat = heatColors();
+  const CRGBPalette16* palettes[] = {&cyanPalette, &configPalette};
+
+  for (uint16_t i = 0; i < 256; i++) {
+    if (rainbow[i] != CRGB(CHSV(i, 255, 255)) || heat[i] != HeatColor(i)) return false;
+
+    for (const CRGBPalette16* palette : palettes) {
+      if (paletteColors(*palette)[i] != ColorFromPalette(*palette, i, 255, LINEARBLEND)) return false;
+    }
+  }
+
+  static CRGB expected[MAX_LEDS];
+  static CRGB actual[MAX_LEDS];
+  for (uint16_t start = 0; start < 256; start += 17) {
+    for (uint16_t increment = 0; increment < 256; increment += 5) {
+      fill_palette(expected, MAX_LEDS, start, increment, configPalette, 255, LINEARBLEND);
+      fillPaletteColors(actual, MAX_LEDS, start, increment, paletteColors(configPalette));
+      if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+      fillPaletteSpread(actual, MAX_LEDS, start << 8, increment << 8, paletteColors(configPalette));
+      if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+    }
+  }
+
+  return true;
+}
+
+// Runs each cached effect against its reference with the same random seed
+// every frame, checks the frames are identical, and reports the CPU cost
+// per frame of both.
+int runColorCheck(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 2000;
+  if (frames <= 0) frames = 2000;
+
+  if (!checkTables()) {
+    printf("lookup tables differ from the FastLED calls they replace\n");
+    return 1;
+  }
+
+  static CRGB previous[MAX_LEDS];
+  static CRGB reference[MAX_LEDS];
+  uint32_t dt = 1000 / DEFAULT_FPS;
+  int failures = 0;
+
+  printf("%-18s %5s %14s %14s %8s %s\n", "mode", "leds", "before ns/fr", "after ns/fr", "speedup", "output");
+
+  for (uint16_t length : colorLengths) {
+    if (length > MAX_LEDS) continue;
+    allocateLeds(length);
+
+    for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+      if (!legacy::supports(mode, length)) continue;
+      resetEffects();
+
+      bool exact = true;
+      double beforeNs = 0;
+      double afterNs = 0;
+
+      for (long frame = 0; frame < frames; frame++) {
+        // Both versions start from the same previous frame, since several
+        // effects fade or shift what is already in leds[].
+        memcpy(previous, leds, length * sizeof(CRGB));
+
+        random16_set_seed(frame);
+        auto start = std::chrono::steady_clock::now();
+        legacy::render(mode, effectParams, dt);
+        auto middle = std::chrono::steady_clock::now();
+        memcpy(reference, leds, length * sizeof(CRGB));
+        memcpy(leds, previous, length * sizeof(CRGB));
+
+        random16_set_seed(frame);
+        auto resume = std::chrono::steady_clock::now();
+        renderMode(mode, effectParams, dt);
+        auto end = std::chrono::steady_clock::now();
+
+        beforeNs += std::chrono::duration<double, std::nano>(middle - start).count();
+        afterNs += std::chrono::duration<double, std::nano>(end - resume).count();
+        if (memcmp(reference, leds, length * sizeof(CRGB)) != 0) exact = false;
+      }
+
+      if (!exact) failures++;
+      printf("%-18s %5u %14.1f %14.1f %7.2fx %s\n", effectRegistry[mode].name, length, beforeNs / frames, afterNs / frames,
+        beforeNs / afterNs, exact ? "exact" : "DIFFERS");
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include <cstdio>
+#include <cstring>
+
+int runAnimationCheck(int argc, char** argv);
+int runAnimationEncode(int argc, char** argv);
+int runAssetCheck(int argc, char** argv);
+int runAudioCheck(int argc, char** argv);
+int runBench(int argc, char** argv);
+int runButtonTrace(int argc, char** argv);
+int runClockCheck(int argc, char** argv);
+int runClockNode(int argc, char** argv);
+int runColorCheck(int argc, char** argv);
+int runKernelCheck(int argc, char** argv);
+int runLayers(int argc, char** argv);
+int runMetricsCheck(int argc, char** argv);
+int runMqttCheck(int argc, char** argv);
+int runOtaCheck(int argc, char** argv);
+int runPanelCheck(int argc, char** argv);
+int runPreviewCheck(int argc, char** argv);
+int runScaling(int argc, char** argv);
+int runSettingsJson(int argc, char** argv);
+int runStoreFuzz(int argc, char** argv);
+int runStreamListen(int argc, char** argv);
+int runStreamSend(int argc, char** argv);
+int runTraceCheck(int argc, char** argv);
+
+static void usage(const char* name) {
+  printf("Usage: %s <command> [args]\n", name);
+  printf("  animation [frames]          pre-render every mode as .pba, play it back against simulated flash, check damaged files\n");
+  printf("  assets [manifest]           check ETag matching and manifest parsing, optionally of a built image\n");
+  printf("  audio [file.wav[:bpm] ...]   check the FFT, tempo and onsets on synthesized or given tracks, time analysis\n");
+  printf("  bench [frames]              render every mode and report ns/frame, ns/led and allocations\n");
+  printf("  button [trace]              classify built-in or recorded \"<ms> <level>\" button edge traces\n");
+  printf("  clock-node <id> [ppm] [s]   run one clock sync unit on the loopback multicast group, print its clock every second\n");
+  printf("  clock-sync [seconds]        simulate drifting units electing a leader, losing it and gaining one, check the shared clock\n");
+  printf("  colors [frames]             compare cached color effects with the originals for speed and exact output\n");
+  printf("  kernels [iterations]        check the SWAR pixel kernels against FastLED and time both\n");
+  printf("  layers [frames]             time overlay and crossfade compositing and check hidden layers are skipped\n");
+  printf("  metrics [frames]            fill every /metrics series, check the text and its chunking, time recording\n");
+  printf("  mqtt                        check broker settings, command topics and payloads, and state publish coalescing\n");
+  printf("  ota [seed]                  stream firmware and filesystem images into mock flash, check pacing, hashes and failures\n");
+  printf("  panels [frames]             check matrix, ring and point maps and time 2D modes on 16x16 and 32x8 panels\n");
+  printf("  pba-encode <rgb> <pba> <pixels> [fps] [keyframe interval]  encode raw RGB24 frames as a .pba animation\n");
+  printf("  preview [frames]            encode every mode as preview deltas, check they decode and report sizes\n");
+  printf("  scaling [frames]            check layouts persist and time every mode per led from 30 to 600 leds\n");
+  printf("  settings-json [requests]    render /get_settings repeatedly and check it never allocates\n");
+  printf("  store-fuzz [cycles]         cut power at random points in config commits and check recovery\n");
+  printf("  stream-listen [s] [leds]    decode DDP/E1.31 packets sent to this host and report loss counters\n");
+  printf("  stream-send [n] [ddp|e131] [leds]  send n frames to a local stream-listen\n");
+  printf("  trace [events]              record past the trace ring, check the Chrome trace dump and time events\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char* command = argv[1];
+  if (strcmp(command, "animation") == 0) return runAnimationCheck(argc - 2, argv + 2);
+  if (strcmp(command, "assets") == 0) return runAssetCheck(argc - 2, argv + 2);
+  if (strcmp(command, "audio") == 0) return runAudioCheck(argc - 2, argv + 2);
+  if (strcmp(command, "bench") == 0) return runBench(argc - 2, argv + 2);
+  if (strcmp(command, "button") == 0) return runButtonTrace(argc - 2, argv + 2);
+  if (strcmp(command, "clock-node") == 0) return runClockNode(argc - 2, argv + 2);
+  if (strcmp(command, "clock-sync") == 0) return runClockCheck(argc - 2, argv + 2);
+  if (strcmp(command, "colors") == 0) return runColorCheck(argc - 2, argv + 2);
+  if (strcmp(command, "kernels") == 0) return runKernelCheck(argc - 2, argv + 2);
+  if (strcmp(command, "layers") == 0) return runLayers(argc - 2, argv + 2);
+  if (strcmp(command, "metrics") == 0) return runMetricsCheck(argc - 2, argv + 2);
+  if (strcmp(command, "mqtt") == 0) return runMqttCheck(argc - 2, argv + 2);
+  if (strcmp(command, "ota") == 0) return runOtaCheck(argc - 2, argv + 2);
+  if (strcmp(command, "panels") == 0) return runPanelCheck(argc - 2, argv + 2);
+  if (strcmp(command, "pba-encode") == 0) return runAnimationEncode(argc - 2, argv + 2);
+  if (strcmp(command, "preview") == 0) return runPreviewCheck(argc - 2, argv + 2);
+  if (strcmp(command, "scaling") == 0) return runScaling(argc - 2, argv + 2);
+  if (strcmp(command, "settings-json") == 0) return runSettingsJson(argc - 2, argv + 2);
+  if (strcmp(command, "store-fuzz") == 0) return runStoreFuzz(argc - 2, argv + 2);
+  if (strcmp(command, "stream-listen") == 0) return runStreamListen(argc - 2, argv + 2);
+  if (strcmp(command, "stream-send") == 0) return runStreamSend(argc - 2, argv + 2);
+  if (strcmp(command, "trace") == 0) return runTraceCheck(argc - 2, argv + 2);
+
+  usage(argv[0]);
+  return 1;
+}
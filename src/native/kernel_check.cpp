@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../effects.h"
+#include "../pixel_kernels.h"
+
+static const uint16_t kernelLengths[] = {72, 300, 1000};
+static const uint16_t CHECK_LEDS = 67;
+
+alignas(4) static CRGB target[MAX_LEDS + 4];
+alignas(4) static CRGB source[MAX_LEDS + 4];
+alignas(4) static CRGB expected[MAX_LEDS + 4];
+
+static void randomize(CRGB* pixels, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    // Bias towards the extremes, where saturation and rounding go wrong.
+    uint8_t pick = random8(4);
+    pixels[i] = CRGB(pick == 0 ? 0 : pick == 1 ? 255 : random8(), random8(), random8());
+  }
+}
+
+// Compares every kernel with FastLED on all 256 factors, every length up to
+// CHECK_LEDS and every byte alignment of both buffers.
+static bool checkExact() {
+  uint8_t* targetBytes = (uint8_t*) target;
+  uint8_t* sourceBytes = (uint8_t*) source;
+  uint8_t* expectedBytes = (uint8_t*) expected;
+
+  for (uint16_t factor = 0; factor < 256; factor++) {
+    for (uint16_t count = 0; count <= CHECK_LEDS; count += 1 + count / 8) {
+      for (uint8_t targetOffset = 0; targetOffset < 4; targetOffset++) {
+        for (uint8_t sourceOffset = 0; sourceOffset < 4; sourceOffset++) {
+          CRGB* t = (CRGB*) (targetBytes + targetOffset);
+          CRGB* s = (CRGB*) (sourceBytes + sourceOffset);
+          CRGB* e = (CRGB*) (expectedBytes + targetOffset);
+
+          randomize(t, count);
+          randomize(s, count);
+
+          memcpy(e, t, count * sizeof(CRGB));
+          nscale8(e, count, factor);
+          scalePixels(t, count, factor);
+          if (memcmp(e, t, count * sizeof(CRGB)) != 0) {
+            printf("scalePixels differs: scale %u, %u leds, offset %u\n", factor, count, targetOffset);
+            return false;
+          }
+
+          memcpy(e, t, count * sizeof(CRGB));
+          fadeToBlackBy(e, count, factor);
+          fadePixels(t, count, factor);
+          if (memcmp(e, t, count * sizeof(CRGB)) != 0) {
+            printf("fadePixels differs: fade %u, %u leds, offset %u\n", factor, count, targetOffset);
+            return false;
+          }
+
+          randomize(t, count);
+          memcpy(e, t, count * sizeof(CRGB));
+          for (uint16_t i = 0; i < count; i++) e[i] += s[i];
+          addPixels(t, s, count);
+          if (memcmp(e, t, count * sizeof(CRGB)) != 0) {
+            printf("addPixels differs: %u leds, offsets %u/%u\n", count, targetOffset, sourceOffset);
+            return false;
+          }
+
+          memcpy(e, t, count * sizeof(CRGB));
+          for (uint16_t i = 0; i < count; i++) e[i] += CRGB(s[i]).nscale8(factor);
+          addScaledPixels(t, s, count, factor);
+          if (memcmp(e, t, count * sizeof(CRGB)) != 0) {
+            printf("addScaledPixels differs: scale %u, %u leds, offsets %u/%u\n", factor, count, targetOffset, sourceOffset);
+            return false;
+          }
+
+          memcpy(e, t, count * sizeof(CRGB));
+          for (uint16_t i = 0; i < count; i++) nblend(e[i], s[i], factor);
+          blendPixels(t, s, count, factor);
+          if (memcmp(e, t, count * sizeof(CRGB)) != 0) {
+            printf("blendPixels differs: amount %u, %u leds, offsets %u/%u\n", factor, count, targetOffset, sourceOffset);
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+template <typename Op>
+static double timeOp(long iterations, Op op) {
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) op(i);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static void report(const char* name, uint16_t length, double scalar, double swar) {
+  printf("%-10s %5u %12.1f %12.1f %8.2fx\n", name, length, scalar, swar, scalar / swar);
+}
+
+int runKernelCheck(int argc, char** argv) {
+  long iterations = argc > 0 ? atol(argv[0]) : 20000;
+  if (iterations <= 0) iterations = 20000;
+
+  random16_set_seed(1337);
+  if (!checkExact()) return 1;
+  printf("all kernels match FastLED bit for bit\n\n");
+
+  printf("%-10s %5s %12s %12s %9s\n", "kernel", "leds", "FastLED ns", "SWAR ns", "speedup");
+
+  for (uint16_t length : kernelLengths) {
+    if (length > MAX_LEDS) continue;
+
+    randomize(target, length);
+    randomize(source, length);
+
+    // Alternate factors so the compiler cannot hoist the work out of the loop.
+    report("fade", length,
+      timeOp(iterations, [&] (long i) { fadeToBlackBy(target, length, 1 + (i & 7)); }),
+      timeOp(iterations, [&] (long i) { fadePixels(target, length, 1 + (i & 7)); }));
+    report("scale", length,
+      timeOp(iterations, [&] (long i) { nscale8(target, length, 250 + (i & 3)); }),
+      timeOp(iterations, [&] (long i) { scalePixels(target, length, 250 + (i & 3)); }));
+    report("add", length,
+      timeOp(iterations, [&] (long i) { for (uint16_t j = 0; j < length; j++) target[j] += source[j]; }),
+      timeOp(iterations, [&] (long i) { addPixels(target, source, length); }));
+    report("blend", length,
+      timeOp(iterations, [&] (long i) { for (uint16_t j = 0; j < length; j++) nblend(target[j], source[j], 64 + (i & 63)); }),
+      timeOp(iterations, [&] (long i) { blendPixels(target, source, length, 64 + (i & 63)); }));
+  }
+
+  return 0;
+}
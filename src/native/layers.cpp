@@ -0,0 +1,231 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../compositor.h"
+#include "../layout.h"
+#include "../pixel_kernels.h"
+#include "../registry.h"
+
+static const uint16_t layerLengths[] = {72, 300, 1000};
+
+struct LayerCase {
+  const char* name;
+  bool overlay;
+  uint8_t blend;
+  uint8_t alpha;
+  uint32_t renderedPerFrame;
+};
+
+// Palette background with a beat layer on top, the combination the
+// compositor was built for.
+static const uint8_t BASE_MODE = 5;
+static const uint8_t OVERLAY_MODE = 7;
+
+static const LayerCase layerCases[] = {
+  {"base only", false, BLEND_ADD, 255, 1},
+  {"add overlay", true, BLEND_ADD, 255, 2},
+  {"blend overlay", true, BLEND_NORMAL, 128, 2},
+  {"opaque overlay", true, BLEND_NORMAL, 255, 1},
+  {"clear overlay", true, BLEND_ADD, 0, 1},
+};
+
+static void resetSettings(const LayerCase& layer) {
+  settings = GlobalSettings();
+  settings.mode = BASE_MODE;
+  settings.overlayEnabled = layer.overlay;
+  settings.overlayMode = OVERLAY_MODE;
+  settings.overlayBlend = layer.blend;
+  settings.overlayAlpha = layer.alpha;
+  effectParams = EffectParams();
+  fill_solid(leds, numLeds, CRGB::Black);
+}
+
+// A single output and segment covering length pixels.
+static void useStrip(uint16_t length) {
+  allocateLeds(length);
+  defaultLayout(layout);
+  layout.outputs[0].length = length;
+  layout.segments[0].length = length;
+  attachSegments(layout);
+}
+
+// A crossfade must start from the outgoing frame and end on exactly what
+// the new mode renders alone.
+static bool checkCrossfade() {
+  static CRGB outgoing[MAX_LEDS];
+  static CRGB alone[MAX_LEDS];
+  uint32_t dt = 1000 / DEFAULT_FPS;
+
+  useStrip(DEFAULT_NUM_LEDS);
+  resetSettings(layerCases[0]);
+  settings.mode = 10;
+  effectParams.staticRGBColor = CRGB(200, 10, 10);
+
+  Compositor compositor;
+  compositor.begin(numLeds);
+  compositor.render(dt);
+  memcpy(outgoing, leds, numLeds * sizeof(CRGB));
+
+  settings.mode = 0;
+  renderMode(0, effectParams, dt);
+  memcpy(alone, leds, numLeds * sizeof(CRGB));
+  memcpy(leds, outgoing, numLeds * sizeof(CRGB));
+
+  compositor.render(1);
+  if (!compositor.transitioning() || memcmp(leds, alone, numLeds * sizeof(CRGB)) == 0) {
+    printf("crossfade did not start from the outgoing frame\n");
+    return false;
+  }
+
+  for (uint32_t t = 0; t < settings.transitionTime; t += dt) compositor.render(dt);
+  if (compositor.transitioning() || memcmp(leds, alone, numLeds * sizeof(CRGB)) != 0) {
+    printf("crossfade did not end on the new mode\n");
+    return false;
+  }
+
+  // Stream frames never go through render(); coming back from one cuts over.
+  compositor.bypass(STREAM_MODE);
+  fill_solid(leds, numLeds, CRGB(0, 0, 255));
+  compositor.render(dt);
+  if (compositor.transitioning()) {
+    printf("leaving stream mode crossfaded from the streamed frame\n");
+    return false;
+  }
+  return true;
+}
+
+struct FeedbackCase {
+  const char* name;
+  uint8_t mode;
+  uint8_t blend;
+  uint8_t alpha;
+};
+
+// Effects that build on their last frame, fire stepping only some frames.
+static const FeedbackCase feedbackCases[] = {
+  {"fire under add", 9, BLEND_ADD, 40},
+  {"fire under blend", 9, BLEND_NORMAL, 128},
+  {"fadeToBlack under add", 6, BLEND_ADD, 40},
+  {"beatRGB under blend", 7, BLEND_NORMAL, 64},
+};
+
+static const uint8_t FEEDBACK_FRAMES = 60;
+static const CRGB OVERLAY_COLOR = CRGB(10, 20, 200);
+
+// Renders frames of the base mode, with the staticRGB overlay or without
+// it; the overlay takes no random numbers, so both see the same base.
+static void renderFeedback(const FeedbackCase& feedback, bool overlay, CRGB frames[][DEFAULT_NUM_LEDS]) {
+  uint32_t dt = 16;
+
+  useStrip(DEFAULT_NUM_LEDS);
+  resetSettings(layerCases[0]);
+  settings.mode = feedback.mode;
+  settings.overlayEnabled = overlay;
+  settings.overlayMode = 10;
+  settings.overlayBlend = feedback.blend;
+  settings.overlayAlpha = feedback.alpha;
+  effectParams.staticRGBColor = OVERLAY_COLOR;
+  random16_set_seed(1337);
+
+  Compositor compositor;
+  compositor.begin(numLeds);
+  for (uint8_t i = 0; i < FEEDBACK_FRAMES; i++) {
+    compositor.render(dt);
+    memcpy(frames[i], leds, numLeds * sizeof(CRGB));
+  }
+}
+
+// Under a constant overlay, every frame must be the base as it renders
+// alone with the overlay composited once, however the base feeds back.
+static bool checkFeedback() {
+  static CRGB alone[FEEDBACK_FRAMES][DEFAULT_NUM_LEDS];
+  static CRGB layered[FEEDBACK_FRAMES][DEFAULT_NUM_LEDS];
+  static CRGB overlay[DEFAULT_NUM_LEDS];
+  fill_solid(overlay, DEFAULT_NUM_LEDS, OVERLAY_COLOR);
+
+  for (const FeedbackCase& feedback : feedbackCases) {
+    renderFeedback(feedback, false, alone);
+    renderFeedback(feedback, true, layered);
+
+    for (uint8_t i = 0; i < FEEDBACK_FRAMES; i++) {
+      if (feedback.blend == BLEND_ADD) addScaledPixels(alone[i], overlay, DEFAULT_NUM_LEDS, feedback.alpha);
+      else blendPixels(alone[i], overlay, DEFAULT_NUM_LEDS, feedback.alpha);
+
+      if (memcmp(alone[i], layered[i], sizeof(alone[i])) != 0) {
+        printf("%s: frame %u is not the base with the overlay composited once\n", feedback.name, i);
+        return false;
+      }
+    }
+  }
+
+  // A crossfade into an effect that builds on its last frame must not
+  // leave the outgoing frame in it.
+  static CRGB fresh[DEFAULT_NUM_LEDS];
+  uint32_t dt = 16;
+  useStrip(DEFAULT_NUM_LEDS);
+  resetSettings(layerCases[0]);
+  settings.mode = 9;
+  random16_set_seed(1337);
+  Compositor compositor;
+  compositor.begin(numLeds);
+  for (uint32_t t = 0; t < settings.transitionTime + 200U; t += dt) compositor.render(dt);
+  memcpy(fresh, leds, sizeof(fresh));
+
+  useStrip(DEFAULT_NUM_LEDS);
+  resetSettings(layerCases[0]);
+  settings.mode = 10;
+  effectParams.staticRGBColor = CRGB(255, 255, 255);
+  Compositor switched;
+  switched.begin(numLeds);
+  switched.render(dt);
+  settings.mode = 9;
+  random16_set_seed(1337);
+  for (uint32_t t = 0; t < settings.transitionTime + 200U; t += dt) switched.render(dt);
+  if (switched.transitioning() || memcmp(fresh, leds, sizeof(fresh)) != 0) {
+    printf("fire kept the outgoing frame after a crossfade\n");
+    return false;
+  }
+  return true;
+}
+
+// Times the compositor with and without an overlay and checks that layers
+// nobody can see are not rendered.
+int runLayers(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 5000;
+  if (frames <= 0) frames = 5000;
+
+  if (!checkCrossfade() || !checkFeedback()) return 1;
+
+  uint32_t dt = 1000 / DEFAULT_FPS;
+  int failures = 0;
+
+  printf("%-16s %5s %12s %10s\n", "layers", "leds", "ns/frame", "rendered");
+
+  for (uint16_t length : layerLengths) {
+    if (length > MAX_LEDS) continue;
+    useStrip(length);
+
+    for (const LayerCase& layer : layerCases) {
+      resetSettings(layer);
+      Compositor compositor;
+      compositor.begin(length);
+      compositor.render(dt);
+
+      uint32_t before = compositor.getStats().layersRendered;
+      auto start = std::chrono::steady_clock::now();
+      for (long i = 0; i < frames; i++) compositor.render(dt);
+      auto end = std::chrono::steady_clock::now();
+
+      double perFrame = (double) (compositor.getStats().layersRendered - before) / frames;
+      double ns = std::chrono::duration<double, std::nano>(end - start).count() / frames;
+      bool ok = perFrame == layer.renderedPerFrame;
+      if (!ok) failures++;
+
+      printf("%-16s %5u %12.1f %10.2f%s\n", layer.name, length, ns, perFrame, ok ? "" : "  UNEXPECTED");
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../compositor.h"
+#include "../layout.h"
+#include "../metrics.h"
+#include "alloc_counter.h"
+
+struct BucketCase {
+  uint32_t micros;
+  uint8_t bucket;
+};
+
+static const BucketCase bucketCases[] = {
+  {0, 0}, {64, 0}, {65, 1}, {128, 1}, {129, 2}, {16384, 8}, {16385, 9}, {32768, 9}, {32769, 10}, {0xffffffff, 10}
+};
+
+// Chunk sizes a response might be asked to fill, down to single bytes.
+static const size_t chunkSizes[] = {1, 7, 536, 1436};
+
+static const size_t TEXT_SIZE = 49152;
+
+static uint32_t elapsedMicros(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool checkBuckets() {
+  for (const BucketCase& bucket : bucketCases) {
+    Histogram h;
+    memset(&h, 0, sizeof(h));
+    h.observe(bucket.micros);
+    if (h.counts[bucket.bucket] != 1 || h.count != 1 || h.sumMicros != bucket.micros) {
+      printf("%u us did not land in bucket %u\n", bucket.micros, bucket.bucket);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Fills every series the way a busy device would: every mode rendered on a
+// full strip, every endpoint requested.
+static void record(Metrics& m, long frames) {
+  uint16_t length = MAX_LEDS < 600 ? MAX_LEDS : 600;
+  allocateLeds(length);
+  allocateFrame(length);
+  defaultLayout(layout);
+  layout.outputs[0].length = length;
+  layout.segments[0].length = length;
+  attachSegments(layout);
+
+  uint32_t dt = 1000 / DEFAULT_FPS;
+  for (uint8_t mode = 0; mode < STREAM_MODE; mode++) {
+    settings = GlobalSettings();
+    settings.mode = mode;
+    effectParams = EffectParams();
+
+    Compositor compositor;
+    compositor.begin(length);
+    for (long i = 0; i < frames; i++) {
+      auto start = std::chrono::steady_clock::now();
+      compositor.render(dt);
+      m.render[mode].observe(elapsedMicros(start));
+
+      start = std::chrono::steady_clock::now();
+      if (showFrame()) m.show.observe(elapsedMicros(start));
+      m.lag.observe(i * 37 % 20000);
+      m.audio.observe(i * 13 % 8000);
+      m.playbackRead.observe(i * 29 % 12000);
+    }
+  }
+
+  for (uint8_t i = 0; i < ENDPOINT_COUNT; i++) {
+    for (uint32_t j = 0; j < 100; j++) m.requests[i].observe(j * j * (i + 1));
+  }
+
+  m.uptimeMillis = 4000000000UL;
+  m.freeHeap = 81920;
+  m.maxFreeBlock = 40960;
+  m.heapFragmentation = 50;
+  m.rssi = -67;
+  m.targetFps = DEFAULT_FPS;
+  m.frames.frames = DEFAULT_FPS;
+  m.shown = frameStats;
+  m.link.attempts = 3;
+  m.link.connects = 2;
+  m.link.drops = 1;
+  m.mqttLink.connects = 2;
+  m.mqttLink.drops = 1;
+  m.mqttState.changes = 150;
+  m.mqttState.published = 9;
+  m.mqttState.coalesced = 141;
+  m.mqttCommands = 12;
+  m.mqttRejected = 1;
+  m.clock.samples = 3600;
+  m.clock.steps = 1;
+  m.clock.leaderChanges = 2;
+  m.clock.errorMicros = -412;
+  m.clock.delayMicros = 2150;
+  m.clock.driftPpb = -37500;
+  m.clockSynced = true;
+  m.playback.fps = 30;
+  m.playback.frames = 123456;
+  m.playback.stalls = 12;
+  m.playback.late = 3;
+  m.audioSampling.samples = 14400000;
+  m.audioSampling.held = 2160000;
+  m.audioSampling.heldPercent = 15;
+  m.audioOverruns = 2;
+}
+
+// Every line is a comment or "<name>[{labels}] <number>".
+static bool checkFormat(const char* text, size_t length) {
+  const char* end = text + length;
+  for (const char* line = text; line < end; ) {
+    const char* lineEnd = (const char*) memchr(line, '\n', end - line);
+    if (!lineEnd) {
+      printf("text does not end with a newline\n");
+      return false;
+    }
+
+    if (line[0] != '#') {
+      const char* cursor = line;
+      while (cursor < lineEnd && (*cursor == '_' || (*cursor >= 'a' && *cursor <= 'z'))) cursor++;
+      if (cursor < lineEnd && *cursor == '{') cursor = (const char*) memchr(cursor, '}', lineEnd - cursor) + 1;
+      bool ok = cursor > line && cursor < lineEnd && *cursor == ' ' && cursor + 1 < lineEnd;
+      for (const char* c = cursor + 1; ok && c < lineEnd; c++) ok = (*c >= '0' && *c <= '9') || *c == '.' || *c == '-';
+      if (!ok) {
+        printf("malformed sample: %.*s\n", (int) (lineEnd - line), line);
+        return false;
+      }
+    }
+    line = lineEnd + 1;
+  }
+  return true;
+}
+
+// Checks the histogram buckets, fills every series and renders /metrics
+// whole and in chunks, checking the chunks add up to the whole text and
+// that neither recording nor rendering touches the heap.
+int runMetricsCheck(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 200;
+  if (frames <= 0) frames = 200;
+
+  if (!checkBuckets()) return 1;
+
+  static Metrics m;
+  record(m, frames);
+
+  static char text[TEXT_SIZE];
+  static char chunked[TEXT_SIZE];
+  size_t length = writeMetrics(m, nullptr, 0, 0);
+  if (length > TEXT_SIZE || writeMetrics(m, text, sizeof(text), 0) != length) {
+    printf("text is %u bytes, more than the check holds\n", (unsigned) length);
+    return 1;
+  }
+  if (!checkFormat(text, length)) return 1;
+
+  size_t allocsBefore = allocationCount();
+  for (size_t chunk : chunkSizes) {
+    size_t sent = 0;
+    size_t calls = 0;
+    size_t filled;
+    while ((filled = writeMetrics(m, chunked + sent, chunk, sent)) > 0) {
+      sent += filled;
+      calls++;
+    }
+
+    if (sent != length || memcmp(text, chunked, length) != 0) {
+      printf("%u byte chunks do not add up to the whole text\n", (unsigned) chunk);
+      return 1;
+    }
+    if (chunk > 1) printf("%4u byte chunks: %u calls\n", (unsigned) chunk, (unsigned) calls);
+  }
+
+  const long observations = 10000000;
+  Histogram h;
+  memset(&h, 0, sizeof(h));
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < observations; i++) h.observe((uint32_t) i * 2654435761u >> 17);
+  double observeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / observations;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; i++) writeMetrics(m, text, sizeof(text), 0);
+  double renderUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / 100;
+  size_t allocations = allocationCount() - allocsBefore;
+
+  printf("text with every series: %u bytes, %.1f us to render\n", (unsigned) length, renderUs);
+  printf("observe: %.2f ns over %u samples, %u bytes of metrics\n", observeNs, (unsigned) h.count,
+    (unsigned) sizeof(Metrics));
+  printf("allocations while rendering: %u\n", (unsigned) allocations);
+
+  return allocations == 0 ? 0 : 1;
+}
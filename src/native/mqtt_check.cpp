@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../mqtt_state.h"
+#include "../registry.h"
+
+static bool check(bool pass, const char* what) {
+  if (!pass) printf("%s  FAIL\n", what);
+  return pass;
+}
+
+static bool checkConfig() {
+  bool pass = true;
+  uint8_t image[MQTT_IMAGE_SIZE];
+
+  MqttConfig config;
+  memset(image, 0, sizeof(image));
+  unpackMqttConfig(config, image);
+  pass = check(config.host[0] == '\0' && config.port == MQTT_DEFAULT_PORT, "a zeroed image leaves MQTT off") && pass;
+
+  memset(image, 0xFF, sizeof(image));
+  unpackMqttConfig(config, image);
+  pass = check(config.host[0] == '\0' && config.port == MQTT_DEFAULT_PORT, "erased flash leaves MQTT off") && pass;
+
+  StaticJsonDocument<256> document;
+  deserializeJson(document, "{\"host\":\"broker.lan\",\"port\":8883,\"user\":\"plumbob\",\"password\":\"secret\"}");
+  pass = check(applyMqttConfigJson(config, document.as<JsonObjectConst>()), "config JSON is accepted") && pass;
+
+  packMqttConfig(config, image);
+  MqttConfig unpacked;
+  unpackMqttConfig(unpacked, image);
+  pass = check(strcmp(unpacked.host, "broker.lan") == 0 && unpacked.port == 8883 && unpacked.topic[0] == '\0' &&
+    strcmp(unpacked.user, "plumbob") == 0 && strcmp(unpacked.password, "secret") == 0, "config round trips") && pass;
+
+  static const char* rejected[] = {
+    "{\"host\":\"a-host-name-that-is-far-too-long-to-fit-in-its-field.example\"}",
+    "{\"topic\":\"lights/#\"}",
+    "{\"topic\":\"lights/\"}",
+    "{\"port\":0}",
+    "{\"port\":70000}",
+    "{\"host\":\"other\",\"port\":-1}"
+  };
+  for (const char* json : rejected) {
+    MqttConfig before = unpacked;
+    deserializeJson(document, json);
+    bool applied = applyMqttConfigJson(unpacked, document.as<JsonObjectConst>());
+    pass = check(!applied && memcmp(&before, &unpacked, sizeof(before)) == 0, json) && pass;
+  }
+
+  char base[MQTT_TOPIC_SIZE];
+  mqttBaseTopic(unpacked, 0xabcd, base, sizeof(base));
+  pass = check(strcmp(base, "plumbob/00abcd") == 0, "the default topic names the chip") && pass;
+
+  deserializeJson(document, "{\"topic\":\"home/hall/plumbob\"}");
+  applyMqttConfigJson(unpacked, document.as<JsonObjectConst>());
+  mqttBaseTopic(unpacked, 0xabcd, base, sizeof(base));
+  pass = check(strcmp(base, "home/hall/plumbob") == 0 && strcmp(unpacked.host, "broker.lan") == 0,
+    "a configured topic replaces the default and leaves the rest") && pass;
+
+  printf("config: %s\n", pass ? "ok" : "FAIL");
+  return pass;
+}
+
+struct TopicCase {
+  const char* topic;
+  MqttCommand command;
+};
+
+static const TopicCase topicCases[] = {
+  {"plumbob/00abcd/enable/set", MQTT_COMMAND_ENABLE},
+  {"plumbob/00abcd/brightness/set", MQTT_COMMAND_BRIGHTNESS},
+  {"plumbob/00abcd/settings/set", MQTT_COMMAND_SETTINGS},
+  {"plumbob/00abcd/state", MQTT_COMMAND_NONE},
+  {"plumbob/00abcd/enable", MQTT_COMMAND_NONE},
+  {"plumbob/00abcdef/enable/set", MQTT_COMMAND_NONE},
+  {"plumbob/enable/set", MQTT_COMMAND_NONE}
+};
+
+struct PayloadCase {
+  MqttCommand command;
+  const char* payload;
+  bool accepted;
+  bool enabled;
+  uint16_t brightness;
+};
+
+static const PayloadCase payloadCases[] = {
+  {MQTT_COMMAND_ENABLE, "OFF", true, false, 100},
+  {MQTT_COMMAND_ENABLE, " on\r\n", true, true, 100},
+  {MQTT_COMMAND_ENABLE, "false", true, false, 100},
+  {MQTT_COMMAND_ENABLE, "{\"enabled\":1}", true, true, 100},
+  {MQTT_COMMAND_ENABLE, "maybe", false, true, 100},
+  {MQTT_COMMAND_BRIGHTNESS, "42", true, true, 42},
+  {MQTT_COMMAND_BRIGHTNESS, "{\"brightness\":200}", true, true, 200},
+  {MQTT_COMMAND_BRIGHTNESS, "-1", false, true, 200},
+  {MQTT_COMMAND_BRIGHTNESS, "1000000", false, true, 200},
+  {MQTT_COMMAND_SETTINGS, "{\"brightness\":7,\"enabled\":0}", true, false, 7},
+  {MQTT_COMMAND_SETTINGS, "{\"brightness\":", false, false, 7},
+  {MQTT_COMMAND_SETTINGS, "ON", false, false, 7},
+  {MQTT_COMMAND_SETTINGS, "", false, false, 7}
+};
+
+// Payloads are applied as the firmware does, through applySettingsJson.
+static bool checkCommands() {
+  bool pass = true;
+  for (const TopicCase& c : topicCases) {
+    pass = check(parseMqttTopic("plumbob/00abcd", c.topic) == c.command, c.topic) && pass;
+  }
+
+  settings = GlobalSettings();
+  settings.ledEnabled = true;
+  settings.brightness = 100;
+
+  StaticJsonDocument<512> document;
+  for (const PayloadCase& c : payloadCases) {
+    bool accepted = parseMqttPayload(c.command, c.payload, strlen(c.payload), document);
+    if (accepted) applySettingsJson(document.as<JsonObjectConst>());
+
+    pass = check(accepted == c.accepted && settings.ledEnabled == c.enabled && settings.brightness == c.brightness,
+      c.payload) && pass;
+  }
+
+  printf("commands: %s\n", pass ? "ok" : "FAIL");
+  return pass;
+}
+
+// Runs a minute of 1 ms loop iterations: a slider dragged for three
+// seconds, button presses, single changes and a broker restart. Every
+// publish must be at least an interval after the one before, and the last
+// state must always get out.
+static bool checkCoalescing() {
+  StatePublisher publisher(MQTT_STATE_INTERVAL);
+  bool connected = true;
+  uint32_t state = 0;
+  uint32_t publishedState = 0;
+  uint32_t lastPublish = 0;
+  uint32_t publishes = 0;
+  uint32_t tooSoon = 0;
+  uint32_t stale = 0;
+  uint32_t sinceConnect = 0;
+  bool pass = true;
+
+  for (uint32_t now = 1; now <= 60000; now++) {
+    bool change = (now >= 5000 && now < 8000 && now % 20 == 0) || now == 20000 || now == 20150 || now == 20400 ||
+      now == 30000 || now == 45000;
+    if (change) {
+      state++;
+      publisher.changed();
+    }
+
+    if (now == 40000) connected = false;
+    if (now == 42000) {
+      connected = true;
+      publisher.connected();
+      sinceConnect = publishes;
+    }
+
+    if (connected && publisher.due(now)) {
+      if (publishes > 0 && now - lastPublish < MQTT_STATE_INTERVAL) tooSoon++;
+      publisher.published(now);
+      publishedState = state;
+      lastPublish = now;
+      publishes++;
+    }
+
+    // A change is out within an interval, unless the broker is gone.
+    if (connected && now % 1000 == 999 && publishedState != state && now - lastPublish >= MQTT_STATE_INTERVAL) stale++;
+  }
+
+  const PublishStats& stats = publisher.getStats();
+  pass = check(tooSoon == 0, "publishes are at least an interval apart") && pass;
+  pass = check(stale == 0 && publishedState == state, "the last state is published") && pass;
+  pass = check(publishes > sinceConnect, "a reconnect publishes the state again") && pass;
+  pass = check(stats.changes == state, "every change is counted") && pass;
+
+  printf("coalescing: %u changes, %u published, %u coalesced over a minute%s\n", (unsigned) stats.changes,
+    (unsigned) stats.published, (unsigned) stats.coalesced, pass ? "" : "  FAIL");
+  return pass;
+}
+
+// Checks the broker settings image and JSON, command topics and payloads,
+// and that a burst of state changes goes out as at most one retained
+// message per MQTT_STATE_INTERVAL.
+int runMqttCheck(int argc, char** argv) {
+  bool pass = checkConfig();
+  pass = checkCommands() && pass;
+  pass = checkCoalescing() && pass;
+  return pass ? 0 : 1;
+}
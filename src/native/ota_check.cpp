@@ -0,0 +1,289 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../ota.h"
+
+static const uint16_t STAGING_SECTORS = 16;
+static const uint16_t FILESYSTEM_SECTORS = 40;
+static const size_t RECEIVE_WINDOW = 5840;
+static const size_t MAX_SEGMENT = 1460;
+
+// RAM-backed flash with NOR semantics that counts operations and can be
+// told to fail an erase or to flip a bit as a sector is written.
+class SectorFlash : public FlashBackend {
+public:
+  explicit SectorFlash(uint16_t sectors) : memory(sectors * OTA_SECTOR_SIZE, 0xFF), sectors(sectors),
+      failErase(-1), corruptWrite(-1), erases(0), writes(0) {}
+
+  uint16_t sectorCount() const override {
+    return sectors;
+  }
+
+  bool erase(uint16_t sector) override {
+    if (sector >= sectors || sector == failErase) return false;
+    memset(&memory[sector * OTA_SECTOR_SIZE], 0xFF, OTA_SECTOR_SIZE);
+    erases++;
+    return true;
+  }
+
+  bool write(uint32_t address, const uint32_t* data, size_t len) override {
+    if (address + len > memory.size()) return false;
+
+    const uint8_t* bytes = (const uint8_t*) data;
+    for (size_t i = 0; i < len; i++) memory[address + i] &= bytes[i];
+    if ((long) (address / OTA_SECTOR_SIZE) == corruptWrite) memory[address + 100] ^= 0x10;
+    writes++;
+    return true;
+  }
+
+  bool read(uint32_t address, uint32_t* data, size_t len) override {
+    if (address + len > memory.size()) return false;
+    memcpy(data, &memory[address], len);
+    return true;
+  }
+
+  std::vector<uint8_t> memory;
+  uint16_t sectors;
+  long failErase;
+  long corruptWrite;
+  uint32_t erases;
+  uint32_t writes;
+};
+
+static bool check(bool pass, const char* what) {
+  if (!pass) printf("%s  FAIL\n", what);
+  return pass;
+}
+
+static void digestOf(const std::vector<uint8_t>& data, uint8_t digest[SHA256_SIZE]) {
+  Sha256 sha;
+  sha.update(data.data(), data.size());
+  sha.finish(digest);
+}
+
+static bool checkSha256() {
+  static const char* abc = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  static const char* empty = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+  static const char* twoBlocks = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+
+  uint8_t expected[SHA256_SIZE];
+  uint8_t digest[SHA256_SIZE];
+  Sha256 sha;
+  bool pass = true;
+
+  sha.update((const uint8_t*) "abc", 3);
+  sha.finish(digest);
+  pass = check(parseSha256(abc, expected) && memcmp(digest, expected, SHA256_SIZE) == 0, "sha256 of abc") && pass;
+
+  sha.finish(digest);
+  pass = check(parseSha256(empty, expected) && memcmp(digest, expected, SHA256_SIZE) == 0, "sha256 of nothing") && pass;
+
+  // Fed a byte at a time, across the padding boundary.
+  const char* message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  for (const char* c = message; *c; c++) sha.update((const uint8_t*) c, 1);
+  sha.finish(digest);
+  pass = check(parseSha256(twoBlocks, expected) && memcmp(digest, expected, SHA256_SIZE) == 0, "sha256 in pieces") && pass;
+
+  std::vector<uint8_t> data(100000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = rand();
+  digestOf(data, expected);
+  for (size_t done = 0; done < data.size(); ) {
+    size_t take = std::min(data.size() - done, (size_t) (rand() % 300));
+    sha.update(&data[done], take);
+    done += take;
+  }
+  sha.finish(digest);
+  pass = check(memcmp(digest, expected, SHA256_SIZE) == 0, "sha256 in random pieces") && pass;
+
+  pass = check(!parseSha256("ba7816bf", expected) && !parseSha256(nullptr, expected), "short digests are refused") && pass;
+
+  printf("sha256: %s\n", pass ? "ok" : "FAIL");
+  return pass;
+}
+
+struct Upload {
+  uint32_t millis;
+  uint32_t maxOpsPerStep;
+  uint32_t tooSoon;
+  bool overrun;
+};
+
+// Sends the image as TCP would with a RECEIVE_WINDOW, one loop iteration a
+// millisecond: segments arrive while the window allows, the loop acks
+// what the writer allows, then steps it.
+static Upload upload(OtaWriter& ota, SectorFlash& staging, SectorFlash& filesystem, const std::vector<uint8_t>& data,
+    size_t stopAt = SIZE_MAX) {
+  Upload result = {0, 0, 0, false};
+  size_t sent = 0;
+  size_t unacked = 0;
+  uint32_t lastWork = 0;
+  bool worked = false;
+
+  for (uint32_t now = 1; now < 600000 && ota.active(); now++) {
+    for (int segments = rand() % 4; segments > 0 && sent < data.size() && sent < stopAt; segments--) {
+      size_t take = std::min(std::min(data.size() - sent, (size_t) (1 + rand() % MAX_SEGMENT)), stopAt - sent);
+      if (unacked + take > RECEIVE_WINDOW) break;
+
+      if (ota.write(&data[sent], take) != take) {
+        result.overrun = true;
+        return result;
+      }
+      sent += take;
+      unacked += take;
+      if (sent == data.size() || sent == stopAt) ota.end();
+    }
+
+    unacked -= ota.ackable(unacked, RECEIVE_WINDOW);
+
+    uint32_t before = staging.erases + staging.writes + filesystem.erases + filesystem.writes;
+    if (ota.step(now)) {
+      if (worked && now - lastWork < OTA_STEP_INTERVAL) result.tooSoon++;
+      worked = true;
+      lastWork = now;
+    }
+    uint32_t ops = staging.erases + staging.writes + filesystem.erases + filesystem.writes - before;
+    if (ops > result.maxOpsPerStep) result.maxOpsPerStep = ops;
+    result.millis = now;
+  }
+  return result;
+}
+
+static std::vector<uint8_t> randomImage(size_t size, size_t dataSize) {
+  std::vector<uint8_t> image(size, 0xFF);
+  for (size_t i = 0; i < dataSize; i++) image[i] = rand();
+  return image;
+}
+
+static bool checkFirmware() {
+  SectorFlash staging(STAGING_SECTORS);
+  SectorFlash filesystem(FILESYSTEM_SECTORS);
+  OtaWriter ota(staging, filesystem);
+  bool pass = true;
+
+  std::vector<uint8_t> image = randomImage(45000, 45000);
+  image[0] = OTA_FIRMWARE_MAGIC;
+  uint8_t digest[SHA256_SIZE];
+  digestOf(image, digest);
+
+  pass = check(ota.begin(OTA_FIRMWARE, image.size(), digest, 0), "a firmware upload starts") && pass;
+  Upload result = upload(ota, staging, filesystem, image);
+
+  pass = check(!result.overrun, "the window never overruns the queue") && pass;
+  pass = check(ota.getState() == OTA_READY && ota.stagedLength() == image.size(), "the firmware verifies") && pass;
+  pass = check(memcmp(staging.memory.data(), image.data(), image.size()) == 0, "staging holds the image") && pass;
+  pass = check(filesystem.erases == 0 && filesystem.writes == 0, "the filesystem is not touched") && pass;
+  pass = check(result.maxOpsPerStep <= 1 && result.tooSoon == 0, "one paced flash operation at a time") && pass;
+
+  const OtaStats& stats = ota.getStats();
+  printf("firmware: %u bytes staged and verified in %.2f s of 1 ms loops, %u flash steps, at most %u operation a step%s\n",
+    (unsigned) image.size(), result.millis / 1000.0, (unsigned) stats.flashOps, (unsigned) result.maxOpsPerStep,
+    pass ? "" : "  FAIL");
+  return pass;
+}
+
+// Old filesystem contents are junk everywhere; the new image has data in
+// its first sectors and is erased flash after that, past the end of the
+// staging sectors.
+static bool checkFilesystem() {
+  SectorFlash staging(STAGING_SECTORS);
+  SectorFlash filesystem(FILESYSTEM_SECTORS);
+  for (size_t i = 0; i < filesystem.memory.size(); i++) filesystem.memory[i] = rand();
+  OtaWriter ota(staging, filesystem);
+  bool pass = true;
+
+  std::vector<uint8_t> image = randomImage(FILESYSTEM_SECTORS * OTA_SECTOR_SIZE, 10 * OTA_SECTOR_SIZE - 123);
+  uint8_t digest[SHA256_SIZE];
+  digestOf(image, digest);
+
+  pass = check(ota.begin(OTA_FILESYSTEM, image.size(), digest, 0), "a filesystem upload starts") && pass;
+  Upload result = upload(ota, staging, filesystem, image);
+  const OtaStats& stats = ota.getStats();
+
+  pass = check(!result.overrun && ota.getState() == OTA_READY, "the filesystem verifies") && pass;
+  pass = check(ota.stagedLength() == 10 * OTA_SECTOR_SIZE, "only the sectors with data are staged") && pass;
+  pass = check(stats.skipped == FILESYSTEM_SECTORS - STAGING_SECTORS, "erased sectors past staging are skipped") && pass;
+  pass = check(filesystem.memory == image, "the installed filesystem matches the image") && pass;
+  pass = check(result.maxOpsPerStep <= 1 && result.tooSoon == 0, "one paced flash operation at a time") && pass;
+
+  printf("filesystem: %u byte image, %u sectors staged, %u skipped, %u installed, %u old sectors cleared in %.2f s%s\n",
+    (unsigned) image.size(), (unsigned) (ota.stagedLength() / OTA_SECTOR_SIZE), (unsigned) stats.skipped,
+    (unsigned) stats.installed, (unsigned) stats.cleared, result.millis / 1000.0, pass ? "" : "  FAIL");
+  return pass;
+}
+
+struct FailureCase {
+  const char* name;
+  OtaImage image;
+  OtaError expected;
+};
+
+static bool checkFailure(const FailureCase& c) {
+  SectorFlash staging(STAGING_SECTORS);
+  SectorFlash filesystem(FILESYSTEM_SECTORS);
+  for (size_t i = 0; i < filesystem.memory.size(); i++) filesystem.memory[i] = rand();
+  std::vector<uint8_t> before = filesystem.memory;
+  OtaWriter ota(staging, filesystem);
+
+  size_t size = c.image == OTA_FIRMWARE ? 30000 : FILESYSTEM_SECTORS * OTA_SECTOR_SIZE;
+  size_t dataSize = c.expected == OTA_TOO_LARGE ? (STAGING_SECTORS + 2) * OTA_SECTOR_SIZE : 30000;
+  std::vector<uint8_t> image = randomImage(size, dataSize);
+  if (c.image == OTA_FIRMWARE && c.expected != OTA_NOT_FIRMWARE) image[0] = OTA_FIRMWARE_MAGIC;
+
+  uint8_t digest[SHA256_SIZE];
+  digestOf(image, digest);
+  if (c.expected == OTA_HASH_MISMATCH) digest[5] ^= 1;
+  if (c.expected == OTA_FLASH_ERROR) staging.failErase = 3;
+  if (c.expected == OTA_OK) staging.corruptWrite = 4;
+
+  ota.begin(c.image, image.size(), digest, 0);
+  Upload result;
+  if (c.expected == OTA_OVERRUN) {
+    std::vector<uint8_t> flood(OTA_QUEUE_SIZE + 1, 0);
+    flood[0] = OTA_FIRMWARE_MAGIC;
+    ota.write(flood.data(), flood.size());
+  } else {
+    result = upload(ota, staging, filesystem, image, c.expected == OTA_SHORT ? image.size() / 2 : SIZE_MAX);
+  }
+
+  // A flipped bit in flash shows up as a mismatch at verification.
+  OtaError expected = c.expected == OTA_OK ? OTA_HASH_MISMATCH : c.expected;
+  bool pass = ota.getState() == OTA_FAILED && ota.getError() == expected && filesystem.memory == before;
+  printf("%-28s %-34s %s\n", c.name, otaErrorName(ota.getError()), pass ? "ok" : "FAIL");
+  return pass;
+}
+
+static const FailureCase failureCases[] = {
+  {"wrong hash", OTA_FIRMWARE, OTA_HASH_MISMATCH},
+  {"bit flipped writing flash", OTA_FIRMWARE, OTA_OK},
+  {"erase fails", OTA_FIRMWARE, OTA_FLASH_ERROR},
+  {"connection dropped", OTA_FIRMWARE, OTA_SHORT},
+  {"not a firmware image", OTA_FIRMWARE, OTA_NOT_FIRMWARE},
+  {"sender ignores the window", OTA_FIRMWARE, OTA_OVERRUN},
+  {"filesystem past staging", OTA_FILESYSTEM, OTA_TOO_LARGE},
+  {"wrong filesystem hash", OTA_FILESYSTEM, OTA_HASH_MISMATCH}
+};
+
+// Streams firmware and filesystem images through the OTA writer into RAM
+// flash under TCP-like flow control, checking every flash operation is
+// paced, images verify and install, and that any failure before an image
+// verifies leaves the running filesystem as it was.
+int runOtaCheck(int argc, char** argv) {
+  srand(argc > 0 ? atoi(argv[0]) : 1);
+
+  bool pass = checkSha256();
+  pass = checkFirmware() && pass;
+  pass = checkFilesystem() && pass;
+  for (const FailureCase& c : failureCases) pass = checkFailure(c) && pass;
+
+  SectorFlash staging(STAGING_SECTORS);
+  SectorFlash filesystem(FILESYSTEM_SECTORS);
+  OtaWriter ota(staging, filesystem);
+  uint8_t digest[SHA256_SIZE] = {0};
+  bool refused = !ota.begin(OTA_FIRMWARE, (STAGING_SECTORS + 1) * OTA_SECTOR_SIZE, digest, 0) &&
+    ota.getError() == OTA_TOO_LARGE;
+  printf("%-28s %-34s %s\n", "firmware larger than staging", otaErrorName(ota.getError()), refused ? "ok" : "FAIL");
+
+  return pass && refused ? 0 : 1;
+}
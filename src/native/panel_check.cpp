@@ -0,0 +1,362 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../color_cache.h"
+#include "../layout.h"
+#include "../pixel_map.h"
+#include "../registry.h"
+#include "alloc_counter.h"
+
+struct Panel {
+  const char* name;
+  uint8_t width;
+  uint8_t height;
+  uint8_t flags;
+};
+
+static const Panel panels[] = {
+  {"16x16", 16, 16, MAP_SERPENTINE},
+  {"32x8", 32, 8, MAP_SERPENTINE | MAP_COLUMNS}
+};
+
+// The modes with a 2D version.
+static const uint8_t panelModes[] = {0, 2, 4, 5, 9};
+
+static const uint16_t discRings[] = {60, 48, 40, 32, 24, 16, 12, 8, 1};
+static const uint8_t DISC_RINGS = sizeof(discRings) / sizeof(discRings[0]);
+
+static const uint32_t panelDelta = 1000 / DEFAULT_FPS;
+
+static MapDef matrixMap(uint8_t width, uint8_t height, uint8_t flags) {
+  MapDef map;
+  defaultMap(map);
+  map.shape = MAP_MATRIX;
+  map.width = width;
+  map.height = height;
+  map.flags = flags;
+  return map;
+}
+
+// The pixel a matrix map puts at x, y, worked out the long way.
+static uint16_t matrixPixel(const MapDef& map, uint8_t x, uint8_t y) {
+  if (map.flags & MAP_FLIP_X) x = map.width - 1 - x;
+  if (map.flags & MAP_FLIP_Y) y = map.height - 1 - y;
+
+  if (map.flags & MAP_COLUMNS) {
+    uint8_t along = (map.flags & MAP_SERPENTINE) && (x & 1) ? map.height - 1 - y : y;
+    return x * map.height + along;
+  }
+  uint8_t along = (map.flags & MAP_SERPENTINE) && (y & 1) ? map.width - 1 - x : x;
+  return y * map.width + along;
+}
+
+static bool checkMatrix(uint8_t width, uint8_t height, uint8_t flags) {
+  MapDef map = matrixMap(width, height, flags);
+  uint16_t length = width * height;
+
+  PixelMap compiled;
+  if (!compiled.build(map, length, nullptr)) {
+    printf("%ux%u flags %u did not build\n", width, height, flags);
+    return false;
+  }
+
+  const uint16_t* order = compiled.order();
+  const uint16_t* below = compiled.below();
+  for (uint16_t r = 0; r < length; r++) {
+    uint8_t x = r % width;
+    uint8_t y = r / width;
+    uint16_t under = y == 0 ? MAP_NONE : r - width;
+    if (order[r] != matrixPixel(map, x, y) || below[r] != under) {
+      printf("%ux%u flags %u: rank %u is pixel %u below %u, expected %u below %u\n", width, height, flags, r,
+        order[r], below[r], matrixPixel(map, x, y), under);
+      return false;
+    }
+  }
+
+  if (compiled.bottomCount() != width || compiled.rows() != height ||
+      compiled.phase()[matrixPixel(map, 0, 0)] != 0 || compiled.phase()[matrixPixel(map, width - 1, height - 1)] != 255) {
+    printf("%ux%u flags %u: bottom %u, rows %u\n", width, height, flags, compiled.bottomCount(), compiled.rows());
+    return false;
+  }
+  return true;
+}
+
+// Every pixel has one rank, and the pixel under each is ranked before it.
+static bool checkTables(const char* name, const PixelMap& compiled, uint16_t length) {
+  static bool seen[MAX_LEDS];
+  memset(seen, 0, sizeof(seen));
+
+  for (uint16_t r = 0; r < length; r++) {
+    uint16_t pixel = compiled.order()[r];
+    uint16_t under = compiled.below()[r];
+    if (pixel >= length || seen[pixel] || (r < compiled.bottomCount()) != (under == MAP_NONE) ||
+        (under != MAP_NONE && under >= r)) {
+      printf("%s: rank %u is broken\n", name, r);
+      return false;
+    }
+    seen[pixel] = true;
+  }
+  return true;
+}
+
+static bool checkShapes() {
+  for (uint8_t flags = 0; flags < 16; flags++) {
+    if (!checkMatrix(5, 3, flags) || !checkMatrix(3, 5, flags)) return false;
+  }
+  for (const Panel& panel : panels) {
+    if (!checkMatrix(panel.width, panel.height, panel.flags)) return false;
+  }
+
+  MapDef disc;
+  defaultMap(disc);
+  disc.shape = MAP_RINGS;
+  disc.ringCount = DISC_RINGS;
+  uint16_t discLength = 0;
+  for (uint8_t i = 0; i < DISC_RINGS; i++) {
+    disc.rings[i] = discRings[i];
+    discLength += discRings[i];
+  }
+
+  PixelMap compiled;
+  if (!compiled.build(disc, discLength, nullptr) || !checkTables("disc", compiled, discLength)) return false;
+
+  // The bottom of a disc is on the outer ring, around its pixel three
+  // quarters of the way round, and the centre is half way along the diagonal.
+  bool lowest = false;
+  bool outer = true;
+  for (uint16_t r = 0; r < compiled.bottomCount(); r++) {
+    lowest = lowest || compiled.order()[r] == 45;
+    outer = outer && compiled.order()[r] < discRings[0];
+  }
+  uint8_t centre = compiled.phase()[discLength - 1];
+  if (!lowest || !outer || centre < 120 || centre > 135) {
+    printf("disc: bottom of %u pixels from pixel %u, centre phase %u\n", compiled.bottomCount(), compiled.order()[0],
+      centre);
+    return false;
+  }
+  printf("disc of %u rings: %u pixels, %u stacked\n", DISC_RINGS, discLength, compiled.rows());
+
+  MapDef points;
+  defaultMap(points);
+  points.shape = MAP_POINTS;
+  uint8_t coordinates[2 * 40];
+  for (uint8_t i = 0; i < 40; i++) {
+    coordinates[2 * i] = random8();
+    coordinates[2 * i + 1] = random8();
+  }
+  if (compiled.build(points, 40, nullptr) || compiled.size() != 0) {
+    printf("points map built without points\n");
+    return false;
+  }
+  if (!compiled.build(points, 40, coordinates) || !checkTables("points", compiled, 40)) return false;
+
+  MapDef strip;
+  defaultMap(strip);
+  if (!compiled.build(strip, 40, nullptr) || compiled.size() != 0) {
+    printf("strip map was compiled\n");
+    return false;
+  }
+
+  MapDef wrong = matrixMap(16, 16, 0);
+  disc.rings[0]--;
+  if (compiled.build(wrong, 255, nullptr) || validMap(wrong, 255) || validMap(disc, discLength)) {
+    printf("a map that does not fit the strip was taken\n");
+    return false;
+  }
+  return true;
+}
+
+// The map goes through /layout and the config image with the rest of the
+// layout, and the largest one still fits GET /layout's buffer.
+static bool checkPersistence() {
+  StaticJsonDocument<1024> document;
+  const char* body = "{\"outputs\": [{\"pin\": 15, \"leds\": 256}], \"map\": {\"shape\": \"matrix\", \"width\": 16,"
+    " \"height\": 16, \"serpentine\": true}}";
+  if (deserializeJson(document, body)) return false;
+
+  StripLayout strip;
+  defaultLayout(strip);
+  bool outputsChanged;
+  if (!applyLayoutJson(strip, document.as<JsonObjectConst>(), outputsChanged) || strip.map.shape != MAP_MATRIX ||
+      strip.map.flags != MAP_SERPENTINE) {
+    printf("matrix layout body was rejected\n");
+    return false;
+  }
+
+  document.clear();
+  deserializeJson(document, "{\"map\": {\"width\": 15}}");
+  if (applyLayoutJson(strip, document.as<JsonObjectConst>(), outputsChanged)) {
+    printf("a matrix that does not cover the strip was taken\n");
+    return false;
+  }
+
+  document.clear();
+  deserializeJson(document, "{\"outputs\": [{\"pin\": 15, \"leds\": 300}]}");
+  if (!applyLayoutJson(strip, document.as<JsonObjectConst>(), outputsChanged) || strip.map.shape != MAP_STRIP) {
+    printf("a new strip length kept a map that no longer fits\n");
+    return false;
+  }
+
+  MapDef largest;
+  defaultMap(largest);
+  largest.shape = MAP_RINGS;
+  largest.width = 255;
+  largest.height = 255;
+  largest.flags = MAP_SERPENTINE | MAP_COLUMNS | MAP_FLIP_X | MAP_FLIP_Y;
+  largest.ringCount = MAX_RINGS;
+  for (uint8_t i = 0; i < MAX_RINGS; i++) largest.rings[i] = 10000 + i;
+
+  uint8_t image[MAP_IMAGE_SIZE];
+  packMap(largest, image);
+  MapDef restored;
+  if (!unpackMap(restored, image) || restored.ringCount != MAX_RINGS || restored.rings[MAX_RINGS - 1] != 10011 ||
+      restored.flags != largest.flags || restored.width != 255) {
+    printf("map changed on its way through the config image\n");
+    return false;
+  }
+
+  uint8_t blank[MAP_IMAGE_SIZE];
+  memset(blank, 0xff, sizeof(blank));
+  bool erased = unpackMap(restored, blank);
+  memset(blank, 0, sizeof(blank));
+  if (erased || unpackMap(restored, blank)) {
+    printf("erased or zeroed flash was taken for a map\n");
+    return false;
+  }
+
+  // The largest /layout the scaling check sends, with the largest map.
+  document.clear();
+  deserializeJson(document,
+    "{\"outputs\": [{\"pin\": 15, \"leds\": 150}, {\"pin\": 4, \"leds\": 150}, {\"pin\": 13, \"leds\": 150}, {\"pin\": 14, \"leds\": 150}],"
+    " \"segments\": [{\"leds\": 150}, {\"leds\": 150, \"mode\": 7}, {\"leds\": 150, \"mode\": 7}, {\"leds\": 150, \"mode\": 9}]}");
+  defaultLayout(strip);
+  applyLayoutJson(strip, document.as<JsonObjectConst>(), outputsChanged);
+  strip.map = largest;
+
+  static char json[LAYOUT_JSON_SIZE];
+  size_t length = writeLayoutJson(strip, json, sizeof(json));
+  if (length == 0) {
+    printf("largest layout and map do not fit LAYOUT_JSON_SIZE\n");
+    return false;
+  }
+  printf("largest layout with a map: %u of %u json bytes\n", (unsigned) length, (unsigned) LAYOUT_JSON_SIZE);
+  return true;
+}
+
+static void resetEffects() {
+  effectParams = EffectParams();
+  effectParams.fullRainbowSpeed = 0;
+  effectParams.animatedRainbowSpeed = 0;
+  effectParams.animatedPaletteSpeed = 0;
+  effectParams.fireSpeed = 0;
+  animationMillis = 0;
+  random16_set_seed(1337);
+  resetEffectState(*effectState, effectState->heat, canvasLength);
+  fill_solid(leds, numLeds, CRGB::Black);
+}
+
+// The palette draws through the phase table exactly, and fire burns from
+// the bottom row up.
+static bool checkOutput(const Panel& panel) {
+  MapDef map = matrixMap(panel.width, panel.height, panel.flags);
+  uint16_t length = panel.width * panel.height;
+  allocateLeds(length);
+  pixelMap.build(map, length, nullptr);
+  resetEffects();
+
+  renderMode(5, effectParams, panelDelta);
+  const CRGB* colors = paletteColors(cyanPalette);
+  for (uint16_t i = 0; i < length; i++) {
+    if (leds[i] != colors[(uint8_t) (effectState->position + pixelMap.phase()[i])]) {
+      printf("%s: animatedPalette pixel %u is not its phase's color\n", panel.name, i);
+      return false;
+    }
+  }
+
+  uint32_t bottomLight = 0;
+  uint32_t topLight = 0;
+  for (int frame = 0; frame < 200; frame++) {
+    renderMode(9, effectParams, panelDelta);
+    for (uint8_t x = 0; x < panel.width; x++) {
+      CRGB low = leds[matrixPixel(map, x, 0)];
+      CRGB high = leds[matrixPixel(map, x, panel.height - 1)];
+      bottomLight += low.r + low.g + low.b;
+      topLight += high.r + high.g + high.b;
+    }
+  }
+  if (bottomLight <= 2 * topLight) {
+    printf("%s: fire is no brighter at the bottom (%u) than the top (%u)\n", panel.name, bottomLight, topLight);
+    return false;
+  }
+  return true;
+}
+
+static double timeMode(uint8_t mode, long frames, size_t& allocs) {
+  resetEffects();
+  for (int i = 0; i < 16; i++) renderMode(mode, effectParams, panelDelta);
+
+  size_t allocsBefore = allocationCount();
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < frames; i++) {
+    animationMillis += panelDelta;
+    renderMode(mode, effectParams, panelDelta);
+  }
+  auto end = std::chrono::steady_clock::now();
+  allocs = allocationCount() - allocsBefore;
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+// Times each 2D mode on the panel against the same mode drawn along an
+// unmapped strip of as many pixels, and the map's compile at boot.
+static bool benchPanel(const Panel& panel, long frames) {
+  MapDef map = matrixMap(panel.width, panel.height, panel.flags);
+  uint16_t length = panel.width * panel.height;
+  allocateLeds(length);
+
+  const int builds = 200;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < builds; i++) pixelMap.build(map, length, nullptr);
+  auto end = std::chrono::steady_clock::now();
+  printf("%s panel, %u leds: map compiled in %.1f us\n", panel.name, length,
+    std::chrono::duration<double, std::micro>(end - start).count() / builds);
+
+  bool clean = true;
+  for (uint8_t mode : panelModes) {
+    size_t stripAllocs;
+    size_t panelAllocs;
+    pixelMap.clear();
+    double strip = timeMode(mode, frames, stripAllocs);
+    pixelMap.build(map, length, nullptr);
+    double mapped = timeMode(mode, frames, panelAllocs);
+
+    printf("  %-18s %10.1f %10.1f %8.2f %8.2f %7.2fx\n", effectRegistry[mode].name, strip, mapped, strip / length,
+      mapped / length, mapped / strip);
+    if (stripAllocs > 0 || panelAllocs > 0) {
+      printf("  %s allocated while rendering\n", effectRegistry[mode].name);
+      clean = false;
+    }
+  }
+
+  pixelMap.clear();
+  return clean;
+}
+
+int runPanelCheck(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 20000;
+  if (frames <= 0) frames = 20000;
+
+  bool pass = checkShapes() && checkPersistence();
+  for (const Panel& panel : panels) pass = pass && checkOutput(panel);
+  pixelMap.clear();
+  if (!pass) return 1;
+
+  printf("%-20s %10s %10s %8s %8s %8s\n", "ns/frame", "strip", "panel", "strip/led", "panel/led", "ratio");
+  for (const Panel& panel : panels) {
+    if (!benchPanel(panel, frames)) pass = false;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../preview.h"
+#include "../registry.h"
+
+static const uint16_t previewLengths[] = {72, 300, 1000};
+static const uint32_t previewFps = 10;
+
+// Renders each mode at DEFAULT_FPS with default settings, encodes every
+// frame a client at previewFps would be sent, decodes it into a mirror
+// and checks the mirror matches leds[]. Reports the average frame size.
+int runPreviewCheck(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 600;
+  if (frames <= 0) frames = 600;
+
+  static CRGB last[MAX_LEDS];
+  static CRGB mirror[MAX_LEDS];
+  static uint8_t buffer[PREVIEW_HEADER_SIZE + MAX_LEDS * 4];
+  uint32_t dt = 1000 / DEFAULT_FPS;
+  uint32_t every = DEFAULT_FPS / previewFps;
+
+  printf("%-18s %5s %10s %10s %8s\n", "mode", "leds", "raw B/fr", "sent B/fr", "ratio");
+
+  for (uint16_t length : previewLengths) {
+    if (length > MAX_LEDS) continue;
+    allocateLeds(length);
+
+    for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+      effectParams = EffectParams();
+      random16_set_seed(1337);
+      fill_solid(leds, numLeds, CRGB::Black);
+
+      uint64_t sent = 0;
+      long samples = 0;
+      bool keyframe = true;
+
+      for (long frame = 0; frame < frames; frame++) {
+        animationMillis += dt;
+        renderMode(mode, effectParams, dt);
+        if (frame % every != 0) continue;
+
+        size_t size = encodePreview(leds, last, length, keyframe, buffer, sizeof(buffer));
+        keyframe = false;
+        samples++;
+        sent += size;
+
+        if (size > 0 && !decodePreview(buffer, size, mirror, length)) {
+          printf("%s: frame %ld does not decode\n", effectRegistry[mode].name, frame);
+          return 1;
+        }
+        if (memcmp(mirror, leds, length * sizeof(CRGB)) != 0) {
+          printf("%s: frame %ld decodes to a different frame\n", effectRegistry[mode].name, frame);
+          return 1;
+        }
+      }
+
+      double average = (double) sent / samples;
+      printf("%-18s %5u %10u %10.1f %8.2f\n", effectRegistry[mode].name, length, (unsigned) previewFrameSize(length),
+        average, average / previewFrameSize(length));
+    }
+  }
+
+  return 0;
+}
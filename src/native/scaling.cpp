@@ -0,0 +1,175 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../compositor.h"
+#include "../layout.h"
+#include "../registry.h"
+#include "../renderer.h"
+
+static const uint16_t scalingLengths[] = {30, 72, 150, 300, 600};
+static const uint8_t SCALING_POINTS = sizeof(scalingLengths) / sizeof(scalingLengths[0]);
+
+// Per-pixel cost may fall as fixed costs spread over more pixels, but must
+// not rise by more than timing noise between the middle and the longest strip.
+static const uint16_t REFERENCE_LENGTH = 150;
+static const double MAX_GROWTH = 1.3;
+
+// Modes given to the further segments of the multi-segment layout.
+static const uint8_t segmentModes[] = {5, 6, 9};
+
+static const char* layoutBody =
+  "{\"outputs\": [{\"pin\": 15, \"leds\": 150}, {\"pin\": 4, \"leds\": 150}, {\"pin\": 13, \"leds\": 150}, {\"pin\": 14, \"leds\": 150}],"
+  " \"segments\": [{\"leds\": 150}, {\"leds\": 150, \"mode\": 7, \"bpm\": 255, \"fade\": 255, \"red\": 255, \"green\": 255, \"blue\": 255},"
+  " {\"leds\": 150, \"mode\": 7, \"bpm\": 255, \"fade\": 255, \"red\": 255, \"green\": 255, \"blue\": 255},"
+  " {\"leds\": 150, \"mode\": 9, \"speed\": 65535, \"cooling\": 255, \"sparks\": 255, \"reverse\": true}]}";
+
+static void useLayout(uint16_t length, uint8_t segments) {
+  defaultLayout(layout);
+  layout.outputs[0].length = length;
+  layout.segmentCount = segments;
+
+  uint16_t start = 0;
+  for (uint8_t i = 0; i < segments; i++) {
+    Segment& segment = layout.segments[i];
+    segment.start = start;
+    segment.length = i + 1 < segments ? length / segments : length - start;
+    segment.mode = i > 0 ? segmentModes[(i - 1) % sizeof(segmentModes)] : 0;
+    segment.params.fadeToBlackSpeed = 0;
+    segment.params.animatedPaletteSpeed = 0;
+    segment.params.fireSpeed = 0;
+    start += segment.length;
+  }
+
+  allocateLeds(length);
+  allocateFrame(length);
+  attachSegments(layout);
+}
+
+// The largest layout /layout accepts must survive the settings image and
+// fit the buffer GET /layout renders into.
+static bool checkLayout() {
+  StaticJsonDocument<768> document;
+  if (deserializeJson(document, layoutBody)) return false;
+
+  StripLayout strip;
+  defaultLayout(strip);
+  bool outputsChanged;
+  if (!applyLayoutJson(strip, document.as<JsonObjectConst>(), outputsChanged) || !outputsChanged) {
+    printf("layout body was rejected\n");
+    return false;
+  }
+
+  uint8_t image[LAYOUT_IMAGE_SIZE];
+  packLayout(strip, image);
+
+  StripLayout restored;
+  if (!unpackLayout(restored, image)) {
+    printf("packed layout did not unpack\n");
+    return false;
+  }
+
+  uint8_t repacked[LAYOUT_IMAGE_SIZE];
+  packLayout(restored, repacked);
+  if (memcmp(image, repacked, sizeof(image)) != 0 || layoutLength(restored) != 600 || restored.segments[3].start != 450) {
+    printf("layout changed on its way through the settings image\n");
+    return false;
+  }
+
+  static char json[LAYOUT_JSON_SIZE];
+  size_t length = writeLayoutJson(restored, json, sizeof(json));
+  if (length == 0) {
+    printf("largest layout does not fit LAYOUT_JSON_SIZE\n");
+    return false;
+  }
+
+  uint8_t blank[LAYOUT_IMAGE_SIZE];
+  memset(blank, 0xff, sizeof(blank));
+  if (unpackLayout(restored, blank)) {
+    printf("erased flash was taken for a layout\n");
+    return false;
+  }
+
+  printf("largest layout: %u of %u image bytes, %u of %u json bytes\n", LAYOUT_PACKED_SIZE, LAYOUT_IMAGE_SIZE,
+    (unsigned) length, (unsigned) LAYOUT_JSON_SIZE);
+  return true;
+}
+
+static double nsPerLed(uint8_t mode, uint16_t length, uint8_t segments, long frames) {
+  uint32_t dt = 1000 / DEFAULT_FPS;
+
+  settings = GlobalSettings();
+  settings.mode = mode;
+  effectParams = EffectParams();
+  effectParams.fullRainbowSpeed = 0;
+  effectParams.animatedRainbowSpeed = 0;
+  effectParams.randomSColorSpeed = 0;
+  effectParams.animatedPaletteSpeed = 0;
+  effectParams.fadeToBlackSpeed = 0;
+  effectParams.fireSpeed = 0;
+  random16_set_seed(1337);
+
+  useLayout(length, segments);
+
+  Compositor compositor;
+  compositor.begin(length);
+  for (int i = 0; i < 16; i++) compositor.render(dt);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < frames; i++) {
+    compositor.render(dt);
+    showFrame();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / frames / length;
+}
+
+static bool reportRow(const char* name, uint8_t mode, uint8_t segments, long frames) {
+  double cost[SCALING_POINTS];
+  double reference = 0;
+  double longest = 0;
+
+  printf("%-18s", name);
+  for (uint8_t i = 0; i < SCALING_POINTS; i++) {
+    uint16_t length = scalingLengths[i];
+    if (length > MAX_LEDS) {
+      printf(" %8s", "-");
+      continue;
+    }
+
+    // Fewer frames on longer strips keep every point at a similar runtime.
+    cost[i] = nsPerLed(mode, length, segments, frames * scalingLengths[0] / length + 1);
+    if (length == REFERENCE_LENGTH) reference = cost[i];
+    longest = cost[i];
+    printf(" %8.2f", cost[i]);
+  }
+
+  double growth = reference > 0 ? longest / reference : 0;
+  bool flat = growth <= MAX_GROWTH;
+  printf(" %7.2fx%s\n", growth, flat ? "" : "  GROWS");
+  return flat;
+}
+
+// Renders every mode through the compositor at strip lengths from 30 to
+// 600 pixels, alone and split into segments, and checks the cost per pixel
+// does not grow with the length.
+int runScaling(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 20000;
+  if (frames <= 0) frames = 20000;
+
+  if (!checkLayout()) return 1;
+
+  int failures = 0;
+  printf("%-18s", "ns/led");
+  for (uint16_t length : scalingLengths) printf(" %8u", length);
+  printf(" %8s\n", "growth");
+
+  for (uint8_t mode = 0; mode < STREAM_MODE; mode++) {
+    if (!reportRow(effectRegistry[mode].name, mode, 1, frames)) failures++;
+  }
+  if (!reportRow("4 segments", 1, 4, frames)) failures++;
+
+  return failures == 0 ? 0 : 1;
+}
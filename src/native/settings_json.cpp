@@ -0,0 +1,75 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../registry.h"
+#include "alloc_counter.h"
+
+static void randomizeSettings(long request) {
+  for (uint8_t i = 0; i < globalParamCount; i++) {
+    setParam(globalParams[i], &settings, random16());
+  }
+  settings.mode = request % NUM_MODES;
+
+  for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+    const EffectDef& effect = effectRegistry[mode];
+
+    for (uint8_t i = 0; i < effect.paramCount; i++) {
+      const ParamDef& def = effect.params[i];
+      if (def.type == PARAM_RGB) setColorParam(def, &effectParams, CRGB(random8(), random8(), random8()));
+      else setParam(def, &effectParams, random16());
+    }
+  }
+}
+
+// Renders /get_settings repeatedly with changing values and checks that the
+// responses stay valid JSON and that rendering them never touches the heap.
+int runSettingsJson(int argc, char** argv) {
+  long requests = argc > 0 ? atol(argv[0]) : 10000;
+  if (requests <= 0) requests = 10000;
+
+  static char buffer[SETTINGS_JSON_SIZE];
+  StaticJsonDocument<1024> parsed;
+
+  random16_set_seed(1337);
+
+  size_t peakBefore = peakAllocatedBytes();
+  size_t allocations = 0;
+  size_t longest = 0;
+  double ns = 0;
+
+  for (long i = 0; i < requests; i++) {
+    randomizeSettings(i);
+
+    size_t allocsBefore = allocationCount();
+    auto start = std::chrono::steady_clock::now();
+
+    size_t length = writeSettingsJson(buffer, sizeof(buffer));
+
+    auto end = std::chrono::steady_clock::now();
+    allocations += allocationCount() - allocsBefore;
+    ns += std::chrono::duration<double, std::nano>(end - start).count();
+
+    if (length == 0) {
+      printf("request %ld: response does not fit in %u bytes\n", i, (unsigned) sizeof(buffer));
+      return 1;
+    }
+
+    DeserializationError error = deserializeJson(parsed, (const char*) buffer, length);
+    if (error) {
+      printf("request %ld: invalid JSON (%s): %s\n", i, error.c_str(), buffer);
+      return 1;
+    }
+
+    if (length > longest) longest = length;
+  }
+
+  size_t peakAfter = peakAllocatedBytes();
+
+  printf("%ld requests, longest response %u/%u bytes, %.1f ns/request\n", requests, (unsigned) longest,
+    (unsigned) sizeof(buffer), ns / requests);
+  printf("allocations while rendering: %u, heap peak %u -> %u bytes\n", (unsigned) allocations,
+    (unsigned) peakBefore, (unsigned) peakAfter);
+
+  return allocations == 0 && peakAfter == peakBefore ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../config_store.h"
+
+static const uint16_t FUZZ_SECTORS = 4;
+
+// RAM-backed flash with NOR semantics and a byte budget: once the budget is
+// spent the operation in progress is torn and everything after it fails, as
+// if the power had been cut.
+class RamFlash : public FlashBackend {
+public:
+  RamFlash() : budget(-1), powerCut(false) {
+    memset(memory, 0xFF, sizeof(memory));
+  }
+
+  void powerOn(long bytes) {
+    budget = bytes;
+    powerCut = false;
+  }
+
+  bool cut() const {
+    return powerCut;
+  }
+
+  uint16_t sectorCount() const override {
+    return FUZZ_SECTORS;
+  }
+
+  bool erase(uint16_t sector) override {
+    if (powerCut) return false;
+
+    uint8_t* start = memory + (uint32_t) sector * CONFIG_SECTOR_SIZE;
+    size_t done = consume(CONFIG_SECTOR_SIZE);
+
+    // A torn erase leaves the rest of the sector in an unknown state.
+    memset(start, 0xFF, done);
+    for (size_t i = done; i < CONFIG_SECTOR_SIZE && powerCut; i++) start[i] &= rand();
+
+    return !powerCut;
+  }
+
+  bool write(uint32_t address, const uint32_t* data, size_t len) override {
+    const uint8_t* bytes = (const uint8_t*) data;
+    size_t done = consume(len);
+
+    for (size_t i = 0; i < done; i++) memory[address + i] &= bytes[i];
+    return !powerCut;
+  }
+
+  bool read(uint32_t address, uint32_t* data, size_t len) override {
+    if (powerCut) return false;
+
+    memcpy(data, memory + address, len);
+    return true;
+  }
+
+private:
+  size_t consume(size_t len) {
+    if (powerCut) return 0;
+    if (budget < 0 || (size_t) budget >= len) {
+      if (budget >= 0) budget -= len;
+      return len;
+    }
+
+    size_t done = budget;
+    budget = 0;
+    powerCut = true;
+    return done;
+  }
+
+  uint8_t memory[FUZZ_SECTORS * CONFIG_SECTOR_SIZE];
+  long budget;
+  bool powerCut;
+};
+
+static void mutate(uint8_t* image) {
+  uint16_t changes = rand() % 100 < 5 ? CONFIG_IMAGE_SIZE : 1 + rand() % 8;
+
+  for (uint16_t i = 0; i < changes; i++) {
+    image[rand() % CONFIG_IMAGE_SIZE] = rand();
+  }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+  uint32_t crc = ~0U;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// A snapshot from firmware with a smaller image must load as it was, with
+// the bytes it did not have zeroed, and keep taking patches.
+static bool checkShortSnapshot() {
+  static const uint16_t SHORT_IMAGE_SIZE = 256;
+  static RamFlash flash;
+
+  uint32_t words[(16 + SHORT_IMAGE_SIZE) / 4];
+  uint8_t* record = (uint8_t*) words;
+  memset(words, 0, sizeof(words));
+  record[0] = 0xF1;
+  record[1] = 0xC0;
+  record[2] = 1;
+  record[3] = 0xFF;
+  record[4] = SHORT_IMAGE_SIZE & 0xff;
+  record[5] = SHORT_IMAGE_SIZE >> 8;
+  record[6] = 0xFF;
+  record[7] = 0xFF;
+  record[8] = 1;
+  for (uint16_t i = 0; i < SHORT_IMAGE_SIZE; i++) record[16 + i] = i + 1;
+
+  uint32_t crc = crc32(record, sizeof(words));
+  memcpy(record + 12, &crc, sizeof(crc));
+  flash.write(0, words, sizeof(words));
+
+  ConfigStore store(flash);
+  bool pass = store.begin();
+  for (uint16_t i = 0; pass && i < CONFIG_IMAGE_SIZE; i++) {
+    pass = store.constData()[i] == (i < SHORT_IMAGE_SIZE ? (uint8_t) (i + 1) : 0);
+  }
+
+  store.data()[CONFIG_IMAGE_SIZE - 1] = 42;
+  pass = pass && store.commit();
+
+  ConfigStore reloaded(flash);
+  pass = pass && reloaded.begin() && memcmp(reloaded.constData(), store.constData(), CONFIG_IMAGE_SIZE) == 0;
+
+  printf("%u byte snapshot in a %u byte image: %s\n", SHORT_IMAGE_SIZE, CONFIG_IMAGE_SIZE, pass ? "loaded" : "FAIL");
+  return pass;
+}
+
+// Commits random edits until a simulated power cut, reboots and checks that
+// the recovered image is either the last completed commit or the one that
+// was interrupted.
+int runStoreFuzz(int argc, char** argv) {
+  long cycles = argc > 0 ? atol(argv[0]) : 2000;
+  if (cycles <= 0) cycles = 2000;
+
+  if (!checkShortSnapshot()) return 1;
+
+  srand(1337);
+
+  static RamFlash flash;
+  uint8_t stable[CONFIG_IMAGE_SIZE];
+  uint8_t pending[CONFIG_IMAGE_SIZE];
+  bool hasPending = false;
+  bool everCommitted = false;
+
+  memset(stable, 0, sizeof(stable));
+
+  long commits = 0;
+  long recoveredPending = 0;
+  uint32_t erases = 0;
+  double recoveryNs = 0;
+
+  for (long cycle = 0; cycle < cycles; cycle++) {
+    flash.powerOn(rand() % (3 * CONFIG_SECTOR_SIZE));
+
+    ConfigStore store(flash);
+
+    auto start = std::chrono::steady_clock::now();
+    bool found = store.begin();
+    auto end = std::chrono::steady_clock::now();
+    recoveryNs += std::chrono::duration<double, std::nano>(end - start).count();
+
+    if (everCommitted && !found) {
+      printf("cycle %ld: no valid record recovered\n", cycle);
+      return 1;
+    }
+
+    if (memcmp(store.constData(), stable, CONFIG_IMAGE_SIZE) != 0) {
+      if (!hasPending || memcmp(store.constData(), pending, CONFIG_IMAGE_SIZE) != 0) {
+        printf("cycle %ld: recovered image matches neither the last nor the interrupted commit\n", cycle);
+        return 1;
+      }
+      recoveredPending++;
+    }
+
+    memcpy(stable, store.constData(), CONFIG_IMAGE_SIZE);
+    hasPending = false;
+
+    while (!flash.cut()) {
+      mutate(store.data());
+      memcpy(pending, store.constData(), CONFIG_IMAGE_SIZE);
+
+      if (!store.commit() || flash.cut()) {
+        hasPending = true;
+        break;
+      }
+
+      memcpy(stable, pending, CONFIG_IMAGE_SIZE);
+      everCommitted = true;
+      commits++;
+    }
+
+    erases += store.getStats().erases;
+  }
+
+  printf("%ld power cuts, %ld completed commits, %ld interrupted commits recovered as new\n", cycles, commits,
+    recoveredPending);
+  printf("%.2f sector erases per commit, %.1f us average recovery\n", commits ? (double) erases / commits : 0.0,
+    recoveryNs / cycles / 1000);
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../effects.h"
+#include "../renderer.h"
+#include "../scheduler.h"
+#include "../stream.h"
+
+static const size_t DDP_MAX_DATA = 1440;
+
+static uint32_t elapsedMillis(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int openSocket(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+
+  if (bind(fd, (sockaddr*) &address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static uint16_t parseLength(int argc, char** argv, int index) {
+  long length = argc > index ? atol(argv[index]) : DEFAULT_NUM_LEDS;
+  if (length <= 0 || length > MAX_LEDS) length = DEFAULT_NUM_LEDS;
+  return length;
+}
+
+static void printStats(const PixelStream& stream) {
+  const StreamStats& stats = stream.getStats();
+  printf("packets %u, frames %u (%u overwritten before display), lost %u, out of order %u, invalid %u, pushed %u\n",
+    stats.packets, stats.frames, stats.framesOverwritten, stats.lost, stats.outOfOrder, stats.invalid, frameStats.pushed);
+}
+
+// Receives DDP and E1.31 on their standard ports and decodes into leds[],
+// displaying complete frames the way the stream mode does. Stops once a
+// stream has timed out, or after the given number of seconds.
+int runStreamListen(int argc, char** argv) {
+  long seconds = argc > 0 ? atol(argv[0]) : 30;
+  if (seconds <= 0) seconds = 30;
+  allocateLeds(parseLength(argc, argv, 1));
+
+  int ddp = openSocket(DDP_PORT);
+  int e131 = openSocket(E131_PORT);
+  if (ddp < 0 || e131 < 0) {
+    printf("could not bind UDP ports %u and %u\n", DDP_PORT, E131_PORT);
+    return 1;
+  }
+
+  printf("listening for DDP on %u and E1.31 on %u, %u leds\n", DDP_PORT, E131_PORT, numLeds);
+
+  static PixelStream stream;
+  static uint8_t packet[1500];
+  auto start = std::chrono::steady_clock::now();
+  bool wasActive = false;
+
+  while (elapsedMillis(start) < (uint32_t) seconds * 1000) {
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(ddp, &ready);
+    FD_SET(e131, &ready);
+    timeval timeout = {0, 10000};
+
+    if (select((ddp > e131 ? ddp : e131) + 1, &ready, nullptr, nullptr, &timeout) > 0) {
+      uint32_t now = elapsedMillis(start);
+      if (FD_ISSET(ddp, &ready)) {
+        ssize_t length = recv(ddp, packet, sizeof(packet), 0);
+        if (length > 0) stream.handleDdp(packet, length, now);
+      }
+      if (FD_ISSET(e131, &ready)) {
+        ssize_t length = recv(e131, packet, sizeof(packet), 0);
+        if (length > 0) stream.handleE131(packet, length, now);
+      }
+    }
+
+    if (stream.takeFrame()) showFrame();
+
+    bool isActive = stream.active(elapsedMillis(start));
+    if (wasActive && !isActive) {
+      printf("stream timed out\n");
+      break;
+    }
+    wasActive = isActive;
+  }
+
+  printStats(stream);
+  close(ddp);
+  close(e131);
+  return 0;
+}
+
+static size_t buildDdp(uint8_t* packet, uint8_t sequence, uint32_t offset, const uint8_t* data, uint16_t length, bool push) {
+  packet[0] = 0x40 | (push ? 0x01 : 0);
+  packet[1] = sequence;
+  packet[2] = 0x0B;
+  packet[3] = 1;
+  packet[4] = offset >> 24;
+  packet[5] = offset >> 16;
+  packet[6] = offset >> 8;
+  packet[7] = offset;
+  packet[8] = length >> 8;
+  packet[9] = length;
+  memcpy(packet + DDP_HEADER_SIZE, data, length);
+  return DDP_HEADER_SIZE + length;
+}
+
+static size_t buildE131(uint8_t* packet, uint8_t sequence, uint16_t universe, const uint8_t* data, uint16_t length) {
+  static const uint8_t acnId[12] = {'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0};
+
+  memset(packet, 0, E131_HEADER_SIZE);
+  packet[1] = 0x10;
+  memcpy(packet + 4, acnId, sizeof(acnId));
+  packet[21] = 0x04;
+  packet[43] = 0x02;
+  strcpy((char*) packet + 44, "plumbob host");
+  packet[108] = 100;
+  packet[111] = sequence;
+  packet[113] = universe >> 8;
+  packet[114] = universe;
+  packet[117] = 0x02;
+  packet[118] = 0xA1;
+  packet[122] = 1;
+  packet[123] = (length + 1) >> 8;
+  packet[124] = length + 1;
+  memcpy(packet + E131_HEADER_SIZE, data, length);
+  return E131_HEADER_SIZE + length;
+}
+
+// Streams a moving rainbow to the local listener. Every 50th frame sends two
+// packets in reverse order and every 97th drops one, so the loss and
+// reordering counters have something to report.
+int runStreamSend(int argc, char** argv) {
+  long frames = argc > 0 ? atol(argv[0]) : 600;
+  if (frames <= 0) frames = 600;
+  bool useE131 = argc > 1 && strcmp(argv[1], "e131") == 0;
+  uint16_t length = parseLength(argc, argv, 2);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(useE131 ? E131_PORT : DDP_PORT);
+
+  size_t chunk = useE131 ? E131_CHANNELS_PER_UNIVERSE : DDP_MAX_DATA;
+  size_t bytes = (size_t) length * 3;
+  size_t packetsPerFrame = (bytes + chunk - 1) / chunk;
+
+  static CRGB pixels[MAX_LEDS];
+  static uint8_t packets[16][1500];
+  size_t sizes[16];
+  uint8_t ddpSequence = 0;
+  uint8_t universeSequence[16] = {0};
+  long sent = 0;
+
+  for (long frame = 0; frame < frames; frame++) {
+    fill_rainbow(pixels, length, frame * 3, 255 / length);
+    const uint8_t* data = (const uint8_t*) pixels;
+
+    for (size_t i = 0; i < packetsPerFrame && i < 16; i++) {
+      size_t offset = i * chunk;
+      uint16_t size = bytes - offset < chunk ? bytes - offset : chunk;
+
+      if (useE131) {
+        sizes[i] = buildE131(packets[i], ++universeSequence[i], E131_FIRST_UNIVERSE + i, data + offset, size);
+      } else {
+        ddpSequence = ddpSequence % 15 + 1;
+        sizes[i] = buildDdp(packets[i], ddpSequence, offset, data + offset, size, i + 1 == packetsPerFrame);
+      }
+    }
+
+    for (size_t i = 0; i < packetsPerFrame && i < 16; i++) {
+      size_t index = i;
+      if (frame % 50 == 49 && packetsPerFrame > 1 && i < 2) index = 1 - i;
+      if (frame % 97 == 96 && i == 0) continue;
+
+      sendto(fd, packets[index], sizes[index], 0, (sockaddr*) &address, sizeof(address));
+      sent++;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000 / DEFAULT_FPS));
+  }
+
+  printf("sent %ld %s packets, %ld frames of %u leds\n", sent, useE131 ? "E1.31" : "DDP", frames, length);
+  close(fd);
+  return 0;
+}
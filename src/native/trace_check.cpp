@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <ArduinoJson.h>
+
+#include "../trace.h"
+#include "alloc_counter.h"
+
+struct PatternEvent {
+  uint8_t track;
+  char phase;
+  const char* name;
+};
+
+// A frame on the loop with a button edge inside it and a WiFi event after.
+static const PatternEvent pattern[] = {
+  {TRACK_LOOP, TRACE_PHASE_BEGIN, "frame"},
+  {TRACK_ISR, TRACE_PHASE_INSTANT, "edge"},
+  {TRACK_LOOP, TRACE_PHASE_END, "frame"},
+  {TRACK_WIFI, TRACE_PHASE_INSTANT, "got IP"},
+};
+static const uint8_t PATTERN_LENGTH = sizeof(pattern) / sizeof(pattern[0]);
+
+static const size_t chunkSizes[] = {1, 7, 1436};
+static const size_t TEXT_SIZE = TRACE_EVENTS * 96 + 1024;
+
+static void writePattern(long events) {
+  for (long i = 0; i < events; i++) {
+    const PatternEvent& event = pattern[i % PATTERN_LENGTH];
+    traceEvent(event.track, event.phase, event.name);
+  }
+}
+
+// The ring must hold the last TRACE_EVENTS events in order, with
+// timestamps that never go backwards and start at 0.
+static bool checkEvents(const char* text, size_t length) {
+  DynamicJsonDocument document(TEXT_SIZE * 2);
+  DeserializationError error = deserializeJson(document, text, length);
+  if (error) {
+    printf("trace is not valid JSON (%s)\n", error.c_str());
+    return false;
+  }
+
+  JsonArrayConst events = document.as<JsonObjectConst>()["traceEvents"].as<JsonArrayConst>();
+  if (events.size() != TRACK_COUNT + TRACE_EVENTS) {
+    printf("trace has %u events, expected %u\n", (unsigned) events.size(), (unsigned) (TRACK_COUNT + TRACE_EVENTS));
+    return false;
+  }
+
+  long index = 0;
+  uint32_t lastTs = 0;
+  for (JsonVariantConst event : events) {
+    if (index++ < TRACK_COUNT) continue;
+
+    const PatternEvent& expected = pattern[(index - 1 - TRACK_COUNT) % PATTERN_LENGTH];
+    const char* name = event["name"];
+    const char* phase = event["ph"];
+    uint32_t ts = event["ts"];
+    uint8_t tid = event["tid"];
+
+    if (!name || !phase || strcmp(name, expected.name) != 0 || phase[0] != expected.phase || tid != expected.track) {
+      printf("event %ld is %s/%s on %u, expected %s/%c on %u\n", index, name ? name : "?", phase ? phase : "?", tid,
+        expected.name, expected.phase, expected.track);
+      return false;
+    }
+    if ((index == TRACK_COUNT + 1 && ts != 0) || ts < lastTs) {
+      printf("event %ld has timestamp %u after %u\n", index, ts, lastTs);
+      return false;
+    }
+    lastTs = ts;
+  }
+  return true;
+}
+
+// Fills the ring past wrapping, checks the dump holds exactly the newest
+// events whole and in chunks, that pausing drops events, and times
+// recording an event.
+int runTraceCheck(int argc, char** argv) {
+  long events = argc > 0 ? atol(argv[0]) : 1000000;
+  if (events < 3 * TRACE_EVENTS) events = 3 * TRACE_EVENTS;
+
+  // Start the ring on a pattern boundary, whatever ran before.
+  writePattern(3 * TRACE_EVENTS);
+
+  size_t allocsBefore = allocationCount();
+  auto start = std::chrono::steady_clock::now();
+  writePattern(events - events % PATTERN_LENGTH);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / events;
+
+  pauseTrace(true);
+  traceEvent(TRACK_LOOP, TRACE_PHASE_INSTANT, "dropped");
+
+  static char text[TEXT_SIZE];
+  static char chunked[TEXT_SIZE];
+  size_t length = writeTraceJson(nullptr, 0, 0);
+  if (length > TEXT_SIZE || writeTraceJson(text, sizeof(text), 0) != length) {
+    printf("trace is %u bytes, more than the check holds\n", (unsigned) length);
+    return 1;
+  }
+
+  for (size_t chunk : chunkSizes) {
+    size_t sent = 0;
+    size_t filled;
+    while ((filled = writeTraceJson(chunked + sent, chunk, sent)) > 0) sent += filled;
+
+    if (sent != length || memcmp(text, chunked, length) != 0) {
+      printf("%u byte chunks do not add up to the whole trace\n", (unsigned) chunk);
+      return 1;
+    }
+  }
+  size_t allocations = allocationCount() - allocsBefore;
+  pauseTrace(false);
+
+  if (!checkEvents(text, length)) return 1;
+
+  printf("%ld events, %.1f ns/event, %u bytes of JSON for %u kept\n", events, ns, (unsigned) length,
+    (unsigned) TRACE_EVENTS);
+  printf("allocations while recording and dumping: %u\n", (unsigned) allocations);
+  return allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota.h"
+
+const char* otaStateName(OtaState state) {
+  switch (state) {
+    case OTA_IDLE: return "idle";
+    case OTA_RECEIVING: return "receiving";
+    case OTA_VERIFYING: return "verifying";
+    case OTA_INSTALLING: return "installing";
+    case OTA_READY: return "ready";
+    case OTA_FAILED: return "failed";
+  }
+  return "unknown";
+}
+
+const char* otaErrorName(OtaError error) {
+  switch (error) {
+    case OTA_OK: return "ok";
+    case OTA_TOO_LARGE: return "image too large";
+    case OTA_NOT_FIRMWARE: return "not a firmware image";
+    case OTA_OVERRUN: return "more data than announced or queued";
+    case OTA_SHORT: return "upload ended early";
+    case OTA_FLASH_ERROR: return "flash error";
+    case OTA_HASH_MISMATCH: return "SHA-256 mismatch";
+    case OTA_ABORTED: return "aborted";
+  }
+  return "unknown";
+}
+
+OtaWriter::OtaWriter(FlashBackend& staging, FlashBackend& filesystem) : staging(staging), filesystem(filesystem),
+    image(OTA_FIRMWARE), state(OTA_IDLE), error(OTA_OK), size(0), ended(false), lastStep(0), stepped(false),
+    queue(nullptr), received(0), sector(0), sectorErased(false), lastDataSector(0), cursor(0),
+    installed(false) {
+  memset(expected, 0, sizeof(expected));
+  memset(&stats, 0, sizeof(stats));
+}
+
+OtaWriter::~OtaWriter() {
+  release();
+}
+
+bool OtaWriter::begin(OtaImage kind, uint32_t length, const uint8_t digest[SHA256_SIZE], uint32_t now) {
+  if (active()) return false;
+
+  image = kind;
+  size = length;
+  memcpy(expected, digest, SHA256_SIZE);
+  memset(&stats, 0, sizeof(stats));
+  received = 0;
+  sector = 0;
+  sectorErased = false;
+  lastDataSector = 0;
+  cursor = 0;
+  installed = false;
+  ended = false;
+  stepped = false;
+  lastStep = now;
+  hash.reset();
+  state = OTA_RECEIVING;
+  error = OTA_OK;
+
+  uint32_t limit = (image == OTA_FIRMWARE ? staging.sectorCount() : filesystem.sectorCount()) * OTA_SECTOR_SIZE;
+  if (size == 0 || size > limit) {
+    fail(OTA_TOO_LARGE);
+    return false;
+  }
+
+  queue = (uint32_t*) malloc(OTA_QUEUE_SIZE);
+  if (!queue) {
+    fail(OTA_ABORTED);
+    return false;
+  }
+  return true;
+}
+
+size_t OtaWriter::space() const {
+  if (state != OTA_RECEIVING) return 0;
+  return OTA_QUEUE_SIZE - (received - sector * OTA_SECTOR_SIZE);
+}
+
+// Of unacked bytes already in the queue, how many can be acked so that the
+// window the sender may then have in flight still fits. Acking in part
+// keeps data moving when a sector is half full.
+size_t OtaWriter::ackable(size_t unacked, size_t window) const {
+  size_t room = space() + unacked;
+  if (room <= window) return 0;
+  return room - window < unacked ? room - window : unacked;
+}
+
+size_t OtaWriter::write(const uint8_t* data, size_t len) {
+  if (state != OTA_RECEIVING || len == 0) return 0;
+  if (len > space() || len > size - received) {
+    fail(OTA_OVERRUN);
+    return 0;
+  }
+  if (received == 0 && image == OTA_FIRMWARE && data[0] != OTA_FIRMWARE_MAGIC) {
+    fail(OTA_NOT_FIRMWARE);
+    return 0;
+  }
+
+  uint8_t* bytes = (uint8_t*) queue;
+  for (size_t done = 0; done < len; ) {
+    uint32_t offset = received % OTA_QUEUE_SIZE;
+    size_t take = OTA_QUEUE_SIZE - offset;
+    if (take > len - done) take = len - done;
+
+    memcpy(bytes + offset, data + done, take);
+    received += take;
+    done += take;
+  }
+  stats.received = received;
+  return len;
+}
+
+void OtaWriter::end() {
+  if (state != OTA_RECEIVING) return;
+
+  ended = true;
+  if (received < size) fail(OTA_SHORT);
+}
+
+void OtaWriter::abort() {
+  if (active()) fail(OTA_ABORTED);
+}
+
+void OtaWriter::fail(OtaError reason) {
+  state = OTA_FAILED;
+  error = reason;
+  release();
+}
+
+void OtaWriter::release() {
+  free(queue);
+  queue = nullptr;
+}
+
+bool OtaWriter::erased(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+bool OtaWriter::step(uint32_t now) {
+  if (!active()) return false;
+  if (stepped && now - lastStep < OTA_STEP_INTERVAL) return false;
+
+  bool worked;
+  if (state == OTA_RECEIVING) worked = stepReceiving();
+  else if (state == OTA_VERIFYING) worked = stepVerifying();
+  else worked = stepInstalling();
+
+  if (worked) {
+    stepped = true;
+    lastStep = now;
+    stats.flashOps++;
+  }
+  return worked;
+}
+
+// Erases the next sector's staging, or writes it once it is erased and
+// its data has all arrived.
+bool OtaWriter::stepReceiving() {
+  uint32_t start = sector * OTA_SECTOR_SIZE;
+  if (start >= size) {
+    if (!ended) return false;
+
+    state = OTA_VERIFYING;
+    cursor = 0;
+    return false;
+  }
+
+  uint32_t length = size - start < OTA_SECTOR_SIZE ? size - start : OTA_SECTOR_SIZE;
+  bool arrived = received >= start + length;
+
+  if (sector >= staging.sectorCount()) {
+    if (!arrived) return false;
+
+    uint8_t* data = (uint8_t*) queue + start % OTA_QUEUE_SIZE;
+    if (!erased(data, length)) {
+      fail(OTA_TOO_LARGE);
+      return false;
+    }
+    stats.skipped++;
+    sector++;
+    return false;
+  }
+
+  if (!sectorErased) {
+    if (!staging.erase(sector)) {
+      fail(OTA_FLASH_ERROR);
+      return false;
+    }
+    sectorErased = true;
+    return true;
+  }
+
+  if (!arrived) return false;
+
+  uint8_t* data = (uint8_t*) queue + start % OTA_QUEUE_SIZE;
+  memset(data + length, 0xFF, OTA_SECTOR_SIZE - length);
+
+  bool worked = false;
+  if (!erased(data, OTA_SECTOR_SIZE)) {
+    if (!staging.write(start, (const uint32_t*) data, OTA_SECTOR_SIZE)) {
+      fail(OTA_FLASH_ERROR);
+      return false;
+    }
+    lastDataSector = sector + 1;
+    worked = true;
+  }
+
+  stats.staged++;
+  sector++;
+  sectorErased = false;
+  return worked;
+}
+
+// Hashes the image back out of staging a sector at a time, sectors that
+// were skipped as erased hashing as erased, or once it is installed, out
+// of the filesystem.
+bool OtaWriter::stepVerifying() {
+  uint32_t start = cursor * OTA_SECTOR_SIZE;
+  if (start >= size) {
+    uint8_t digest[SHA256_SIZE];
+    hash.finish(digest);
+    if (memcmp(digest, expected, SHA256_SIZE) != 0) {
+      fail(OTA_HASH_MISMATCH);
+      return false;
+    }
+
+    if (image == OTA_FILESYSTEM && !installed) {
+      state = OTA_INSTALLING;
+      cursor = 0;
+      sectorErased = false;
+    } else {
+      state = OTA_READY;
+      release();
+    }
+    return false;
+  }
+
+  uint32_t length = size - start < OTA_SECTOR_SIZE ? size - start : OTA_SECTOR_SIZE;
+  bool stored = installed || cursor < staging.sectorCount();
+  if (stored) {
+    FlashBackend& source = installed ? filesystem : staging;
+    if (!source.read(start, queue, OTA_SECTOR_SIZE)) {
+      fail(OTA_FLASH_ERROR);
+      return false;
+    }
+  } else {
+    memset(queue, 0xFF, OTA_SECTOR_SIZE);
+  }
+
+  hash.update((const uint8_t*) queue, length);
+  stats.verified += length;
+  cursor++;
+  return stored;
+}
+
+// Copies a staged sector over the filesystem in two steps, an erase and a
+// write, then erases whatever the old filesystem left past the staged
+// part, reading ahead over sectors that are already erased.
+bool OtaWriter::stepInstalling() {
+  uint8_t* data = (uint8_t*) queue;
+
+  if (cursor < lastDataSector) {
+    uint32_t start = cursor * OTA_SECTOR_SIZE;
+    if (!sectorErased) {
+      if (!filesystem.erase(cursor)) {
+        fail(OTA_FLASH_ERROR);
+        return false;
+      }
+      sectorErased = true;
+      return true;
+    }
+
+    if (!staging.read(start, queue, OTA_SECTOR_SIZE) ||
+        (!erased(data, OTA_SECTOR_SIZE) && !filesystem.write(start, queue, OTA_SECTOR_SIZE))) {
+      fail(OTA_FLASH_ERROR);
+      return false;
+    }
+    stats.installed++;
+    sectorErased = false;
+    cursor++;
+    return true;
+  }
+
+  for (uint8_t reads = 0; reads < OTA_CLEAR_READS; reads++) {
+    if (cursor >= filesystem.sectorCount()) {
+      state = OTA_VERIFYING;
+      installed = true;
+      cursor = 0;
+      hash.reset();
+      return reads > 0;
+    }
+
+    if (!filesystem.read(cursor * OTA_SECTOR_SIZE, queue, OTA_SECTOR_SIZE)) {
+      fail(OTA_FLASH_ERROR);
+      return false;
+    }
+    if (!erased(data, OTA_SECTOR_SIZE)) {
+      if (!filesystem.erase(cursor)) {
+        fail(OTA_FLASH_ERROR);
+        return false;
+      }
+      stats.cleared++;
+      cursor++;
+      return true;
+    }
+    cursor++;
+  }
+  return true;
+}
+
+OtaState OtaWriter::getState() const {
+  return state;
+}
+
+OtaError OtaWriter::getError() const {
+  return error;
+}
+
+OtaImage OtaWriter::getImage() const {
+  return image;
+}
+
+uint32_t OtaWriter::getSize() const {
+  return size;
+}
+
+bool OtaWriter::active() const {
+  return state == OTA_RECEIVING || state == OTA_VERIFYING || state == OTA_INSTALLING;
+}
+
+uint32_t OtaWriter::stagedLength() const {
+  return image == OTA_FIRMWARE ? size : lastDataSector * OTA_SECTOR_SIZE;
+}
+
+const OtaStats& OtaWriter::getStats() const {
+  return stats;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_store.h"
+#include "sha256.h"
+
+const uint32_t OTA_SECTOR_SIZE = 4096;
+const uint8_t OTA_QUEUE_SECTORS = 2;
+const uint32_t OTA_QUEUE_SIZE = OTA_QUEUE_SECTORS * OTA_SECTOR_SIZE;
+const uint32_t OTA_STEP_INTERVAL = 25;
+const uint8_t OTA_FIRMWARE_MAGIC = 0xE9;
+const uint8_t OTA_CLEAR_READS = 8;
+
+enum OtaImage : uint8_t {
+  OTA_FIRMWARE,
+  OTA_FILESYSTEM
+};
+
+enum OtaState : uint8_t {
+  OTA_IDLE,
+  OTA_RECEIVING,
+  OTA_VERIFYING,
+  OTA_INSTALLING,
+  OTA_READY,
+  OTA_FAILED
+};
+
+enum OtaError : uint8_t {
+  OTA_OK,
+  OTA_TOO_LARGE,
+  OTA_NOT_FIRMWARE,
+  OTA_OVERRUN,
+  OTA_SHORT,
+  OTA_FLASH_ERROR,
+  OTA_HASH_MISMATCH,
+  OTA_ABORTED
+};
+
+struct OtaStats {
+  uint32_t received;
+  uint32_t staged;
+  uint32_t skipped;
+  uint32_t verified;
+  uint32_t installed;
+  uint32_t cleared;
+  uint32_t flashOps;
+};
+
+const char* otaStateName(OtaState state);
+const char* otaErrorName(OtaError error);
+
+// Streams an image into the staging sectors, the free flash between the
+// running sketch and the filesystem, without ever stalling the frame loop
+// for long: write() only copies into a two sector queue, and step() does
+// at most one erase or one sector write at a time, no more often than
+// OTA_STEP_INTERVAL. The caller holds back TCP acks and acks only what
+// ackable() allows, so the sender can never overrun the queue.
+//
+// Once all of it is in, the staged copy is read back and hashed, so a bad
+// write is caught as well as a bad upload. Until an image matches the
+// expected SHA-256, and on any failure before that, the running firmware
+// and filesystem are untouched.
+//
+// Verified firmware is OTA_READY for the boot loader to copy into place.
+// A filesystem image is as large as the filesystem, more than the staging
+// sectors hold, but its tail is erased flash: sectors past the staging
+// area are hashed but not stored if they are erased. A verified one is
+// installed here, in OTA_INSTALLING, at the same pace: the staged sectors
+// are copied over the filesystem, whatever the old one left past them is
+// erased, and the result is hashed again before it is OTA_READY. The
+// filesystem must be unmounted from OTA_INSTALLING on.
+class OtaWriter {
+public:
+  OtaWriter(FlashBackend& staging, FlashBackend& filesystem);
+  ~OtaWriter();
+
+  bool begin(OtaImage image, uint32_t size, const uint8_t digest[SHA256_SIZE], uint32_t now);
+  size_t write(const uint8_t* data, size_t len);
+  size_t space() const;
+  size_t ackable(size_t unacked, size_t window) const;
+  void end();
+  void abort();
+
+  // Does one paced piece of flash work; true if it did any.
+  bool step(uint32_t now);
+
+  OtaState getState() const;
+  OtaError getError() const;
+  OtaImage getImage() const;
+  uint32_t getSize() const;
+  bool active() const;
+  // The bytes to copy from the start of staging.
+  uint32_t stagedLength() const;
+  const OtaStats& getStats() const;
+
+private:
+  void fail(OtaError error);
+  void release();
+  bool stepReceiving();
+  bool stepVerifying();
+  bool stepInstalling();
+  static bool erased(const uint8_t* data, size_t len);
+
+  FlashBackend& staging;
+  FlashBackend& filesystem;
+
+  OtaImage image;
+  OtaState state;
+  OtaError error;
+  uint32_t size;
+  uint8_t expected[SHA256_SIZE];
+  Sha256 hash;
+  bool ended;
+  uint32_t lastStep;
+  bool stepped;
+
+  // Sector n of the image lives in queue slot n % OTA_QUEUE_SECTORS.
+  uint32_t* queue;
+  uint32_t received;
+  uint32_t sector;
+  bool sectorErased;
+  uint32_t lastDataSector;
+  uint32_t cursor;
+  bool installed;
+
+  OtaStats stats;
+};
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+static const uint32_t EVEN_LANES = 0x00FF00FF;
+static const uint32_t ODD_LANES = 0xFF00FF00;
+static const uint32_t LOW_BITS = 0x7F7F7F7F;
+static const uint32_t HIGH_BITS = 0x80808080;
+
+static inline uint32_t load32(const uint8_t* p) {
+  uint32_t word;
+  memcpy(&word, __builtin_assume_aligned(p, 4), sizeof(word));
+  return word;
+}
+
+static inline void store32(uint8_t* p, uint32_t word) {
+  memcpy(__builtin_assume_aligned(p, 4), &word, sizeof(word));
+}
+
+static inline bool aligned(const void* p) {
+  return ((uintptr_t) p & 3) == 0;
+}
+
+// scale8 with FASTLED_SCALE8_FIXED: (c * (1 + s)) >> 8, on four channels.
+static inline uint32_t scaleWord(uint32_t word, uint16_t factor) {
+  uint32_t even = ((word & EVEN_LANES) * factor >> 8) & EVEN_LANES;
+  uint32_t odd = ((word >> 8) & EVEN_LANES) * factor & ODD_LANES;
+  return even | odd;
+}
+
+// blend8 with FASTLED_BLEND_FIXED: (a * (256 - t) + b * (1 + t)) >> 8. The
+// lane sum peaks at 255 * 257, so it still fits in 16 bits.
+static inline uint32_t blendWord(uint32_t a, uint32_t b, uint16_t keep, uint16_t take) {
+  uint32_t even = (((a & EVEN_LANES) * keep + (b & EVEN_LANES) * take) >> 8) & EVEN_LANES;
+  uint32_t odd = (((a >> 8) & EVEN_LANES) * keep + ((b >> 8) & EVEN_LANES) * take) & ODD_LANES;
+  return even | odd;
+}
+
+// qadd8 on four channels: add the low seven bits, fold the top bits back
+// in, and saturate every byte whose top bit carried out.
+static inline uint32_t addWord(uint32_t a, uint32_t b) {
+  uint32_t sum = ((a & LOW_BITS) + (b & LOW_BITS)) ^ ((a ^ b) & HIGH_BITS);
+  uint32_t carry = ((a & b) | ((a | b) & ~sum)) & HIGH_BITS;
+  return sum | (carry >> 7) * 0xFF;
+}
+
+void scalePixels(CRGB* pixels, uint16_t count, uint8_t scale) {
+  uint8_t* p = (uint8_t*) pixels;
+  uint8_t* end = p + count * 3;
+  uint16_t factor = scale + 1;
+
+  for (; p < end && !aligned(p); p++) *p = (*p * factor) >> 8;
+
+  for (; end - p >= 4; p += 4) store32(p, scaleWord(load32(p), factor));
+
+  for (; p < end; p++) *p = (*p * factor) >> 8;
+}
+
+void fadePixels(CRGB* pixels, uint16_t count, uint8_t fade) {
+  scalePixels(pixels, count, 255 - fade);
+}
+
+void addPixels(CRGB* target, const CRGB* source, uint16_t count) {
+  uint8_t* p = (uint8_t*) target;
+  const uint8_t* q = (const uint8_t*) source;
+  uint8_t* end = p + count * 3;
+
+  for (; p < end && !aligned(p); p++, q++) *p = qadd8(*p, *q);
+
+  if (aligned(q)) {
+    for (; end - p >= 4; p += 4, q += 4) store32(p, addWord(load32(p), load32(q)));
+  }
+
+  for (; p < end; p++, q++) *p = qadd8(*p, *q);
+}
+
+void addScaledPixels(CRGB* target, const CRGB* source, uint16_t count, uint8_t scale) {
+  uint8_t* p = (uint8_t*) target;
+  const uint8_t* q = (const uint8_t*) source;
+  uint8_t* end = p + count * 3;
+  uint16_t factor = scale + 1;
+
+  for (; p < end && !aligned(p); p++, q++) *p = qadd8(*p, (*q * factor) >> 8);
+
+  if (aligned(q)) {
+    for (; end - p >= 4; p += 4, q += 4) store32(p, addWord(load32(p), scaleWord(load32(q), factor)));
+  }
+
+  for (; p < end; p++, q++) *p = qadd8(*p, (*q * factor) >> 8);
+}
+
+void blendPixels(CRGB* target, const CRGB* source, uint16_t count, uint8_t amount) {
+  if (amount == 0) return;
+  if (amount == 255) {
+    memmove(target, source, count * sizeof(CRGB));
+    return;
+  }
+
+  uint8_t* p = (uint8_t*) target;
+  const uint8_t* q = (const uint8_t*) source;
+  uint8_t* end = p + count * 3;
+  uint16_t keep = 256 - amount;
+  uint16_t take = 1 + amount;
+
+  for (; p < end && !aligned(p); p++, q++) *p = (*p * keep + *q * take) >> 8;
+
+  if (aligned(q)) {
+    for (; end - p >= 4; p += 4, q += 4) store32(p, blendWord(load32(p), load32(q), keep, take));
+  }
+
+  for (; p < end; p++, q++) *p = (*p * keep + *q * take) >> 8;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <FastLED.h>
+#include <stdint.h>
+
+// Buffer-wide pixel operations that work on four channel bytes per 32-bit
+// word, split into two 16-bit lanes so products cannot carry across
+// channels. Each matches its FastLED counterpart bit for bit:
+//   scalePixels  == nscale8(pixels, count, scale)
+//   fadePixels   == fadeToBlackBy(pixels, count, fade)
+//   addPixels    == target[i] += source[i]
+//   addScaledPixels == target[i] += CRGB(source[i]).nscale8(scale)
+//   blendPixels  == nblend(target[i], source[i], amount)
+// Words are only used where the buffers are 4-byte aligned, so keep the
+// buffers passed here alignas(4).
+void scalePixels(CRGB* pixels, uint16_t count, uint8_t scale);
+void fadePixels(CRGB* pixels, uint16_t count, uint8_t fade);
+void addPixels(CRGB* target, const CRGB* source, uint16_t count);
+void addScaledPixels(CRGB* target, const CRGB* source, uint16_t count, uint8_t scale);
+void blendPixels(CRGB* target, const CRGB* source, uint16_t count, uint8_t amount);
@@ -0,0 +1,328 @@
+#include <FastLED.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixel_map.h"
+
+PixelMap pixelMap;
+
+static const uint8_t MAP_VERSION = 1;
+static const uint16_t MAP_RINGS_START = 6;
+static const uint8_t MAP_SHAPES = 4;
+static const char* const shapeNames[MAP_SHAPES] = {"strip", "matrix", "rings", "points"};
+
+static_assert(MAP_RINGS_START + 2 * MAX_RINGS <= MAP_IMAGE_SIZE, "map no longer fits MAP_IMAGE_SIZE");
+
+void defaultMap(MapDef& map) {
+  memset(&map, 0, sizeof(map));
+  map.shape = MAP_STRIP;
+}
+
+bool validMap(const MapDef& map, uint16_t length) {
+  switch (map.shape) {
+    case MAP_STRIP:
+    case MAP_POINTS:
+      return true;
+    case MAP_MATRIX:
+      return map.width > 0 && map.height > 0 && (uint32_t) map.width * map.height == length;
+    case MAP_RINGS: {
+      if (map.ringCount == 0 || map.ringCount > MAX_RINGS) return false;
+
+      uint32_t total = 0;
+      for (uint8_t i = 0; i < map.ringCount; i++) {
+        if (map.rings[i] == 0) return false;
+        total += map.rings[i];
+      }
+      return total == length;
+    }
+  }
+  return false;
+}
+
+const char* mapShapeName(uint8_t shape) {
+  return shape < MAP_SHAPES ? shapeNames[shape] : "unknown";
+}
+
+void packMap(const MapDef& map, uint8_t* image) {
+  memset(image, 0, MAP_IMAGE_SIZE);
+  image[0] = MAP_VERSION;
+  image[1] = map.shape;
+  image[2] = map.width;
+  image[3] = map.height;
+  image[4] = map.flags;
+  image[5] = map.ringCount;
+
+  for (uint8_t i = 0; i < map.ringCount; i++) {
+    image[MAP_RINGS_START + 2 * i] = map.rings[i] >> 8;
+    image[MAP_RINGS_START + 2 * i + 1] = map.rings[i] & 0xff;
+  }
+}
+
+// Images from before maps were added are zero here, and erased flash is
+// all ones; neither is a version, so both leave the strip a strip.
+bool unpackMap(MapDef& map, const uint8_t* image) {
+  if (image[0] != MAP_VERSION || image[1] >= MAP_SHAPES || image[5] > MAX_RINGS) return false;
+
+  MapDef next;
+  defaultMap(next);
+  next.shape = image[1];
+  next.width = image[2];
+  next.height = image[3];
+  next.flags = image[4];
+  next.ringCount = image[5];
+
+  for (uint8_t i = 0; i < next.ringCount; i++) {
+    next.rings[i] = (image[MAP_RINGS_START + 2 * i] << 8) + image[MAP_RINGS_START + 2 * i + 1];
+  }
+
+  map = next;
+  return true;
+}
+
+static bool applySide(uint8_t& side, JsonVariantConst value) {
+  if (value.isNull()) return true;
+
+  long length = value.as<long>();
+  if (length < 1 || length > 255) return false;
+  side = length;
+  return true;
+}
+
+static void applyFlag(uint8_t& flags, uint8_t flag, JsonVariantConst value) {
+  if (value.isNull()) return;
+
+  if (value.as<bool>()) flags |= flag;
+  else flags &= ~flag;
+}
+
+bool applyMapJson(MapDef& map, JsonObjectConst json) {
+  MapDef next = map;
+
+  JsonVariantConst shape = json["shape"];
+  if (!shape.isNull()) {
+    const char* name = shape.as<const char*>();
+    uint8_t i = 0;
+    while (i < MAP_SHAPES && !(name && strcmp(name, shapeNames[i]) == 0)) i++;
+    if (i == MAP_SHAPES) return false;
+    next.shape = i;
+  }
+
+  if (!applySide(next.width, json["width"]) || !applySide(next.height, json["height"])) return false;
+
+  applyFlag(next.flags, MAP_SERPENTINE, json["serpentine"]);
+  applyFlag(next.flags, MAP_COLUMNS, json["columns"]);
+  applyFlag(next.flags, MAP_FLIP_X, json["flip_x"]);
+  applyFlag(next.flags, MAP_FLIP_Y, json["flip_y"]);
+
+  JsonArrayConst rings = json["rings"];
+  if (!rings.isNull()) {
+    if (rings.size() == 0 || rings.size() > MAX_RINGS) return false;
+
+    next.ringCount = 0;
+    for (JsonVariantConst ring : rings) {
+      long count = ring | 0L;
+      if (count < 1 || count > 0xffff) return false;
+      next.rings[next.ringCount++] = count;
+    }
+  }
+
+  map = next;
+  return true;
+}
+
+void writeMapJson(const MapDef& map, JsonWriter& json) {
+  json.beginObject();
+  json.key("shape");
+  json.value(mapShapeName(map.shape));
+  json.key("width");
+  json.value(map.width);
+  json.key("height");
+  json.value(map.height);
+  json.key("serpentine");
+  json.value((map.flags & MAP_SERPENTINE) ? 1 : 0);
+  json.key("columns");
+  json.value((map.flags & MAP_COLUMNS) ? 1 : 0);
+  json.key("flip_x");
+  json.value((map.flags & MAP_FLIP_X) ? 1 : 0);
+  json.key("flip_y");
+  json.value((map.flags & MAP_FLIP_Y) ? 1 : 0);
+
+  json.key("rings");
+  json.beginArray();
+  for (uint8_t i = 0; i < map.ringCount; i++) json.value(map.rings[i]);
+  json.endArray();
+  json.endObject();
+}
+
+static void placeMatrix(const MapDef& map, uint16_t length, uint8_t* xs, uint8_t* ys) {
+  bool columns = map.flags & MAP_COLUMNS;
+  uint8_t run = columns ? map.height : map.width;
+
+  for (uint16_t i = 0; i < length; i++) {
+    uint8_t line = i / run;
+    uint8_t along = i % run;
+    if ((map.flags & MAP_SERPENTINE) && (line & 1)) along = run - 1 - along;
+
+    uint8_t x = columns ? line : along;
+    uint8_t y = columns ? along : line;
+    xs[i] = (map.flags & MAP_FLIP_X) ? map.width - 1 - x : x;
+    ys[i] = (map.flags & MAP_FLIP_Y) ? map.height - 1 - y : y;
+  }
+}
+
+// Rings are spread evenly out to the edge of a 256 by 256 square, the
+// outermost touching it; a single pixel ring sits at the centre.
+static void placeRings(const MapDef& map, uint8_t* xs, uint8_t* ys) {
+  uint16_t i = 0;
+  for (uint8_t r = 0; r < map.ringCount; r++) {
+    uint16_t count = map.rings[r];
+    int32_t radius = count == 1 ? 0 : 127 * (map.ringCount - r) / map.ringCount;
+
+    for (uint16_t j = 0; j < count; j++, i++) {
+      uint16_t angle = (uint32_t) j * 65536 / count;
+      xs[i] = 128 + cos16(angle) * radius / 32768;
+      ys[i] = 128 + sin16(angle) * radius / 32768;
+    }
+  }
+}
+
+PixelMap::PixelMap() : orderTable(nullptr), belowTable(nullptr), phaseTable(nullptr), capacity(0), length(0),
+    bottom(0), depth(0) {
+}
+
+PixelMap::~PixelMap() {
+  free(orderTable);
+  free(belowTable);
+  free(phaseTable);
+}
+
+bool PixelMap::allocate(uint16_t count) {
+  if (count <= capacity) return true;
+
+  free(orderTable);
+  free(belowTable);
+  free(phaseTable);
+  orderTable = (uint16_t*) malloc(count * sizeof(uint16_t));
+  belowTable = (uint16_t*) malloc(count * sizeof(uint16_t));
+  phaseTable = (uint8_t*) malloc(count);
+  capacity = orderTable && belowTable && phaseTable ? count : 0;
+  return capacity > 0;
+}
+
+void PixelMap::clear() {
+  length = 0;
+  bottom = 0;
+  depth = 0;
+}
+
+// All the coordinate math happens here, once: the pixels are placed,
+// sorted into ranks, and each is given its diagonal phase and the pixel
+// under it. Below is the nearest lower pixel, where a step to the side
+// costs as much as two down, so a column's pixel wins over a diagonal.
+bool PixelMap::build(const MapDef& map, uint16_t count, const uint8_t* points) {
+  clear();
+  if (map.shape == MAP_STRIP) return true;
+  if (count == 0 || !validMap(map, count) || (map.shape == MAP_POINTS && !points)) return false;
+  if (!allocate(count)) return false;
+
+  uint8_t* xs = (uint8_t*) malloc(2 * count);
+  if (!xs) return false;
+  uint8_t* ys = xs + count;
+
+  if (map.shape == MAP_MATRIX) {
+    placeMatrix(map, count, xs, ys);
+  } else if (map.shape == MAP_RINGS) {
+    placeRings(map, xs, ys);
+  } else {
+    for (uint16_t i = 0; i < count; i++) {
+      xs[i] = points[2 * i];
+      ys[i] = points[2 * i + 1];
+    }
+  }
+
+  // Insertion sort keeps pixels at the same spot in wiring order, and is
+  // quick on panels, which arrive nearly sorted.
+  for (uint16_t r = 0; r < count; r++) {
+    uint16_t pixel = r;
+    uint16_t key = (ys[pixel] << 8) | xs[pixel];
+    uint16_t q = r;
+    while (q > 0 && ((ys[orderTable[q - 1]] << 8) | xs[orderTable[q - 1]]) > key) {
+      orderTable[q] = orderTable[q - 1];
+      q--;
+    }
+    orderTable[q] = pixel;
+  }
+
+  uint16_t low = 0xffff;
+  uint16_t high = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t sum = xs[i] + ys[i];
+    if (sum < low) low = sum;
+    if (sum > high) high = sum;
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    phaseTable[i] = high > low ? (uint32_t) (xs[i] + ys[i] - low) * 255 / (high - low) : 0;
+  }
+
+  // Ranks below come before, the nearest rows first, so the search stops
+  // once a row is further down than the best found.
+  for (uint16_t r = 0; r < count; r++) {
+    uint16_t pixel = orderTable[r];
+    uint32_t best = 0xffffffff;
+    uint16_t found = MAP_NONE;
+
+    for (uint16_t q = r; q-- > 0; ) {
+      uint16_t other = orderTable[q];
+      if (ys[other] == ys[pixel]) continue;
+
+      uint32_t dy = ys[pixel] - ys[other];
+      if (dy * dy >= best) break;
+
+      int32_t dx = xs[pixel] - xs[other];
+      uint32_t cost = 4 * dx * dx + dy * dy;
+      if (cost < best) {
+        best = cost;
+        found = q;
+      }
+    }
+
+    belowTable[r] = found;
+    if (found == MAP_NONE) bottom++;
+  }
+
+  // The coordinates are done with; count how high the pixels stack.
+  uint8_t* levels = xs;
+  for (uint16_t r = 0; r < count; r++) {
+    uint16_t under = belowTable[r];
+    levels[r] = under == MAP_NONE ? 1 : qadd8(levels[under], 1);
+    if (levels[r] > depth) depth = levels[r];
+  }
+
+  free(xs);
+  length = count;
+  return true;
+}
+
+uint16_t PixelMap::size() const {
+  return length;
+}
+
+const uint16_t* PixelMap::order() const {
+  return orderTable;
+}
+
+const uint16_t* PixelMap::below() const {
+  return belowTable;
+}
+
+const uint8_t* PixelMap::phase() const {
+  return phaseTable;
+}
+
+uint16_t PixelMap::bottomCount() const {
+  return bottom;
+}
+
+uint16_t PixelMap::rows() const {
+  return depth;
+}
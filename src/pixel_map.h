@@ -0,0 +1,94 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_writer.h"
+
+const uint16_t MAP_IMAGE_SIZE = 32;
+const uint8_t MAX_RINGS = 12;
+const uint16_t MAP_NONE = 0xffff;
+
+enum MapShape : uint8_t {
+  MAP_STRIP,
+  MAP_MATRIX,
+  MAP_RINGS,
+  MAP_POINTS
+};
+
+enum MapFlags : uint8_t {
+  MAP_SERPENTINE = 1,
+  MAP_COLUMNS = 2,
+  MAP_FLIP_X = 4,
+  MAP_FLIP_Y = 8
+};
+
+// Where the pixels of leds[] sit on a panel. A matrix is width by height
+// pixels wired a row at a time from the bottom left, or a column at a time
+// with MAP_COLUMNS, turning back at each end with MAP_SERPENTINE; the
+// flips mirror it. Rings are concentric, given outermost first with their
+// pixel counts, each wired from its rightmost pixel counterclockwise.
+// Points take an x and y byte per pixel from a file. A strip is not a
+// panel, and every effect draws along it.
+struct MapDef {
+  uint8_t shape;
+  uint8_t width;
+  uint8_t height;
+  uint8_t flags;
+  uint8_t ringCount;
+  uint16_t rings[MAX_RINGS];
+};
+
+void defaultMap(MapDef& map);
+bool validMap(const MapDef& map, uint16_t length);
+const char* mapShapeName(uint8_t shape);
+
+// Image layout: [version][shape][width][height][flags][rings], then a
+// big-endian 16-bit count for each of MAX_RINGS rings.
+void packMap(const MapDef& map, uint8_t* image);
+bool unpackMap(MapDef& map, const uint8_t* image);
+
+// Applies the keys of a layout's "map" object; only those present change.
+// Whether the result fits the strip is left to validMap().
+bool applyMapJson(MapDef& map, JsonObjectConst json);
+void writeMapJson(const MapDef& map, JsonWriter& json);
+
+// A map compiled into flat tables, so the 2D effects render with lookups
+// instead of coordinate math per pixel. Pixels are ranked bottom row first
+// and left to right along each row:
+//   order()[rank]  the pixel at that rank
+//   below()[rank]  the rank of the nearest pixel under it, or MAP_NONE on
+//                  the bottom row, which takes the first bottomCount() ranks
+//   phase()[pixel] how far along the panel's diagonal the pixel is, 0-255
+// rows() is the most pixels stacked above one another. Tables are
+// allocated once for the strip length; a strip map leaves size() at zero.
+class PixelMap {
+public:
+  PixelMap();
+  ~PixelMap();
+
+  // points holds an x and y byte for each pixel of a points map.
+  bool build(const MapDef& map, uint16_t length, const uint8_t* points);
+  void clear();
+
+  uint16_t size() const;
+  const uint16_t* order() const;
+  const uint16_t* below() const;
+  const uint8_t* phase() const;
+  uint16_t bottomCount() const;
+  uint16_t rows() const;
+
+private:
+  bool allocate(uint16_t length);
+
+  uint16_t* orderTable;
+  uint16_t* belowTable;
+  uint8_t* phaseTable;
+  uint16_t capacity;
+  uint16_t length;
+  uint16_t bottom;
+  uint16_t depth;
+};
+
+extern PixelMap pixelMap;
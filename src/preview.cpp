@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "preview.h"
+
+static uint8_t* writeRun(uint8_t* out, const CRGB* frame, uint16_t start, uint8_t length) {
+  out[0] = start >> 8;
+  out[1] = start & 0xff;
+  out[2] = length;
+  memcpy(out + PREVIEW_RUN_HEADER_SIZE, frame + start, length * 3);
+  return out + PREVIEW_RUN_HEADER_SIZE + length * 3;
+}
+
+static void writeHeader(uint8_t* out, uint8_t type, uint16_t count) {
+  out[0] = type;
+  out[1] = count >> 8;
+  out[2] = count & 0xff;
+}
+
+size_t previewFrameSize(uint16_t count) {
+  uint16_t runs = (count + PREVIEW_MAX_RUN - 1) / PREVIEW_MAX_RUN;
+  return PREVIEW_HEADER_SIZE + runs * PREVIEW_RUN_HEADER_SIZE + count * 3;
+}
+
+static size_t encodeKeyframe(const CRGB* frame, uint16_t count, uint8_t* out) {
+  writeHeader(out, PREVIEW_KEYFRAME, count);
+  uint8_t* p = out + PREVIEW_HEADER_SIZE;
+
+  for (uint16_t start = 0; start < count; start += PREVIEW_MAX_RUN) {
+    uint16_t length = count - start < PREVIEW_MAX_RUN ? count - start : PREVIEW_MAX_RUN;
+    p = writeRun(p, frame, start, length);
+  }
+
+  return p - out;
+}
+
+// Returns the encoded size, or 0 when a delta would carry nothing. A delta
+// that would outgrow a keyframe is sent as a keyframe instead.
+size_t encodePreview(const CRGB* frame, CRGB* last, uint16_t count, bool keyframe, uint8_t* out, size_t size) {
+  size_t limit = previewFrameSize(count);
+  if (size < limit) return 0;
+
+  size_t length = 0;
+
+  if (!keyframe) {
+    writeHeader(out, PREVIEW_DELTA, count);
+    uint8_t* p = out + PREVIEW_HEADER_SIZE;
+    uint8_t* end = out + limit;
+    uint16_t i = 0;
+
+    while (i < count && p) {
+      if (frame[i] == last[i]) {
+        i++;
+        continue;
+      }
+
+      uint16_t start = i;
+      uint16_t stop = i + 1;
+      while (stop < count && stop - start < PREVIEW_MAX_RUN) {
+        if (frame[stop] != last[stop]) stop++;
+        else if (stop + 1 < count && stop + 1 - start < PREVIEW_MAX_RUN && frame[stop + 1] != last[stop + 1]) stop += 2;
+        else break;
+      }
+
+      if (p + PREVIEW_RUN_HEADER_SIZE + (stop - start) * 3 > end) p = nullptr;
+      else p = writeRun(p, frame, start, stop - start);
+      i = stop;
+    }
+
+    if (p) length = p - out;
+    if (length == PREVIEW_HEADER_SIZE) return 0;
+  }
+
+  if (length == 0) length = encodeKeyframe(frame, count, out);
+
+  memcpy(last, frame, count * sizeof(CRGB));
+  return length;
+}
+
+bool decodePreview(const uint8_t* data, size_t length, CRGB* frame, uint16_t count) {
+  if (length < PREVIEW_HEADER_SIZE || (data[0] != PREVIEW_KEYFRAME && data[0] != PREVIEW_DELTA)) return false;
+  if (((data[1] << 8) | data[2]) != count) return false;
+
+  size_t i = PREVIEW_HEADER_SIZE;
+  while (i < length) {
+    if (length - i < PREVIEW_RUN_HEADER_SIZE) return false;
+
+    uint16_t start = (data[i] << 8) | data[i + 1];
+    uint8_t run = data[i + 2];
+    i += PREVIEW_RUN_HEADER_SIZE;
+
+    if (start + run > count || length - i < (size_t) run * 3) return false;
+    memcpy(frame + start, data + i, run * 3);
+    i += run * 3;
+  }
+
+  return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <FastLED.h>
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t PREVIEW_KEYFRAME = 0;
+const uint8_t PREVIEW_DELTA = 1;
+const size_t PREVIEW_HEADER_SIZE = 3;
+const size_t PREVIEW_RUN_HEADER_SIZE = 3;
+const uint8_t PREVIEW_MAX_RUN = 255;
+
+// Preview frames are [type][count:16] followed by runs of
+// [start:16][length:8][length RGB triplets], all big-endian. A keyframe
+// covers every pixel; a delta only the runs that changed since the last
+// frame sent. Unchanged gaps of one pixel are folded into the run around
+// them, since a new run header costs as much as the pixel.
+size_t previewFrameSize(uint16_t count);
+size_t encodePreview(const CRGB* frame, CRGB* last, uint16_t count, bool keyframe, uint8_t* out, size_t size);
+bool decodePreview(const uint8_t* data, size_t length, CRGB* frame, uint16_t count);
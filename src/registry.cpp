@@ -0,0 +1,423 @@
+#include <string.h>
+
+#include "registry.h"
+
+GlobalSettings settings;
+
+#define EFFECT_PARAM(key, stateKey, type, min, max, field, storage) \
+  { key, stateKey, type, min, max, offsetof(EffectParams, field), storage }
+#define GLOBAL_PARAM(key, stateKey, type, min, max, field, storage) \
+  { key, stateKey, type, min, max, offsetof(GlobalSettings, field), storage }
+
+constexpr ParamDef globalParams[] = {
+  GLOBAL_PARAM("brightness", "brightness", PARAM_U16, 0, 255, brightness, 0),
+  GLOBAL_PARAM("mode", "mode", PARAM_U8, 0, 255, mode, 2),
+  GLOBAL_PARAM("enabled", "led_enabled", PARAM_BOOL, 0, 1, ledEnabled, 3),
+  GLOBAL_PARAM("fps", "target_fps", PARAM_U16, 1, MAX_FPS, targetFps, 41),
+  GLOBAL_PARAM("overlay", "overlay_enabled", PARAM_BOOL, 0, 1, overlayEnabled, 43),
+  GLOBAL_PARAM("overlay_mode", "overlay_mode", PARAM_U8, 0, STREAM_MODE - 1, overlayMode, 44),
+  GLOBAL_PARAM("overlay_blend", "overlay_blend", PARAM_U8, BLEND_NORMAL, BLEND_ADD, overlayBlend, 45),
+  GLOBAL_PARAM("overlay_alpha", "overlay_alpha", PARAM_U8, 0, 255, overlayAlpha, 46),
+  GLOBAL_PARAM("transition", "transition_ms", PARAM_U16, 0, 10000, transitionTime, 47)
+};
+
+constexpr ParamDef fullRainbowParams[] = {
+  EFFECT_PARAM("speed", "full_rainbow_speed", PARAM_U16, 1, 65535, fullRainbowSpeed, 4)
+};
+
+constexpr ParamDef animatedRainbowParams[] = {
+  EFFECT_PARAM("speed", "animated_rainbow_speed", PARAM_U16, 1, 65535, animatedRainbowSpeed, 6)
+};
+
+constexpr ParamDef randomSingleColorParams[] = {
+  EFFECT_PARAM("color", "random_static_color", PARAM_U16, 0, 255, randomSColor, 8),
+  EFFECT_PARAM("speed", "random_static_color_speed", PARAM_U16, 1, 65535, randomSColorSpeed, 10)
+};
+
+constexpr ParamDef animatedPaletteParams[] = {
+  EFFECT_PARAM("speed", "animated_palette_speed", PARAM_U16, 1, 65535, animatedPaletteSpeed, 12)
+};
+
+constexpr ParamDef fadeToBlackParams[] = {
+  EFFECT_PARAM("speed", "fade_to_black_speed", PARAM_U16, 1, 65535, fadeToBlackSpeed, 14),
+  EFFECT_PARAM("fade", "fade_to_black_fade_speed", PARAM_U16, 0, 255, fadeToBlackFadeSpeed, 16)
+};
+
+constexpr ParamDef beatRGBParams[] = {
+  EFFECT_PARAM("bpm", "bpm_color", PARAM_U16, 1, 255, bpmColor, 18),
+  EFFECT_PARAM("fade", "fade_color_speed", PARAM_U16, 0, 255, fadeColorSpeed, 20),
+  EFFECT_PARAM(nullptr, "b_rgb_color", PARAM_RGB, 0, 255, rgbColor, 22)
+};
+
+constexpr ParamDef fireParams[] = {
+  EFFECT_PARAM("speed", "fire_speed", PARAM_U16, 1, 65535, fireSpeed, 28),
+  EFFECT_PARAM("cooling", "fire_cooling", PARAM_U16, 0, 255, fireCooling, 30),
+  EFFECT_PARAM("sparks", "fire_sparks", PARAM_U16, 0, 255, fireSparks, 32),
+  EFFECT_PARAM("reverse", "fire_reverse", PARAM_BOOL, 0, 1, fireReverse, 34)
+};
+
+constexpr ParamDef audioBeatParams[] = {
+  EFFECT_PARAM("gain", "audio_gain", PARAM_U8, 1, 255, audioGain, 49),
+  EFFECT_PARAM("fade", "audio_fade", PARAM_U8, 0, 255, audioFade, 50)
+};
+
+constexpr ParamDef staticRGBParams[] = {
+  EFFECT_PARAM(nullptr, "s_rgb_color", PARAM_RGB, 0, 255, staticRGBColor, 35)
+};
+
+static void renderStaticRainbow(const EffectParams& p, uint32_t dt) {
+  staticRainbow();
+}
+
+static void renderStaticPalette(const EffectParams& p, uint32_t dt) {
+  staticPalette(cyanPalette);
+}
+
+static void renderAnimatedPalette(const EffectParams& p, uint32_t dt) {
+  animatedPalette(cyanPalette, p, dt);
+}
+
+static void renderFadeToBlack(const EffectParams& p, uint32_t dt) {
+  fadeToBlack(cyanPalette, p, dt);
+}
+
+static void renderBeatRGB(const EffectParams& p, uint32_t dt) {
+  beatRGB(p);
+}
+
+static void renderBeatPalette(const EffectParams& p, uint32_t dt) {
+  beatPalette(cyanPalette);
+}
+
+static void renderStaticRGB(const EffectParams& p, uint32_t dt) {
+  staticRGB(p.staticRGBColor);
+}
+
+// Pixels for this mode arrive over UDP and are decoded straight into leds[].
+static void renderStream(const EffectParams& p, uint32_t dt) {
+}
+
+// Frames for this mode are read from ANIMATION_FILE straight into leds[].
+static void renderPlayback(const EffectParams& p, uint32_t dt) {
+}
+
+#define EFFECT(name, render) { name, render, nullptr, 0 }
+#define EFFECT_WITH(name, render, params) { name, render, params, sizeof(params) / sizeof(params[0]) }
+
+constexpr EffectDef effectRegistry[] = {
+  EFFECT("staticRainbow", renderStaticRainbow),
+  EFFECT_WITH("fullRainbow", fullRainbow, fullRainbowParams),
+  EFFECT_WITH("animatedRainbow", animatedRainbow, animatedRainbowParams),
+  EFFECT_WITH("randomSingleColor", randomSingleColor, randomSingleColorParams),
+  EFFECT("staticPalette", renderStaticPalette),
+  EFFECT_WITH("animatedPalette", renderAnimatedPalette, animatedPaletteParams),
+  EFFECT_WITH("fadeToBlack", renderFadeToBlack, fadeToBlackParams),
+  EFFECT_WITH("beatRGB", renderBeatRGB, beatRGBParams),
+  EFFECT("beatPalette", renderBeatPalette),
+  EFFECT_WITH("fire", fire, fireParams),
+  EFFECT_WITH("staticRGB", renderStaticRGB, staticRGBParams),
+  EFFECT_WITH("audioBeat", audioBeat, audioBeatParams),
+  EFFECT("stream", renderStream),
+  EFFECT("playback", renderPlayback)
+};
+
+const uint8_t NUM_MODES = sizeof(effectRegistry) / sizeof(effectRegistry[0]);
+
+static_assert(effectRegistry[STREAM_MODE].render == renderStream, "STREAM_MODE must index the stream entry");
+static_assert(effectRegistry[PLAYBACK_MODE].render == renderPlayback, "PLAYBACK_MODE must index the playback entry");
+const uint8_t globalParamCount = sizeof(globalParams) / sizeof(globalParams[0]);
+
+constexpr uint16_t widthOf(ParamType type) {
+  return type == PARAM_RGB ? 6 : type == PARAM_U16 ? 2 : 1;
+}
+
+constexpr uint16_t imageEnd(const ParamDef* defs, size_t count) {
+  return count == 0 ? 0 :
+    (defs[0].storage + widthOf(defs[0].type) > imageEnd(defs + 1, count - 1) ?
+      defs[0].storage + widthOf(defs[0].type) : imageEnd(defs + 1, count - 1));
+}
+
+constexpr uint16_t effectImageEnd(const EffectDef* effects, size_t count) {
+  return count == 0 ? 0 :
+    (imageEnd(effects[0].params, effects[0].paramCount) > effectImageEnd(effects + 1, count - 1) ?
+      imageEnd(effects[0].params, effects[0].paramCount) : effectImageEnd(effects + 1, count - 1));
+}
+
+constexpr uint16_t settingsImageSize() {
+  return imageEnd(globalParams, sizeof(globalParams) / sizeof(globalParams[0])) >
+      effectImageEnd(effectRegistry, sizeof(effectRegistry) / sizeof(effectRegistry[0])) ?
+    imageEnd(globalParams, sizeof(globalParams) / sizeof(globalParams[0])) :
+    effectImageEnd(effectRegistry, sizeof(effectRegistry) / sizeof(effectRegistry[0]));
+}
+
+const uint16_t SETTINGS_IMAGE_SIZE = settingsImageSize();
+
+static_assert(settingsImageSize() == 51, "settings image layout changed; stored settings would be misread");
+
+constexpr uint16_t imageStart(const ParamDef* defs, size_t count) {
+  return count == 0 ? 0xffff :
+    (defs[0].storage < imageStart(defs + 1, count - 1) ? defs[0].storage : imageStart(defs + 1, count - 1));
+}
+
+constexpr uint16_t paramSpan(const EffectDef& effect) {
+  return effect.paramCount == 0 ? 0 : imageEnd(effect.params, effect.paramCount) - imageStart(effect.params, effect.paramCount);
+}
+
+constexpr uint16_t maxParamSpan(const EffectDef* effects, size_t count) {
+  return count == 0 ? 0 :
+    (paramSpan(effects[0]) > maxParamSpan(effects + 1, count - 1) ? paramSpan(effects[0]) : maxParamSpan(effects + 1, count - 1));
+}
+
+static_assert(maxParamSpan(effectRegistry, sizeof(effectRegistry) / sizeof(effectRegistry[0])) <= MODE_PARAMS_SIZE,
+  "a mode's parameters no longer fit MODE_PARAMS_SIZE");
+
+uint16_t paramWidth(ParamType type) {
+  return widthOf(type);
+}
+
+uint16_t getParam(const ParamDef& def, const void* base) {
+  const uint8_t* field = (const uint8_t*) base + def.offset;
+
+  switch (def.type) {
+    case PARAM_U8:
+      return *field;
+    case PARAM_U16:
+      return *(const uint16_t*) field;
+    case PARAM_BOOL:
+      return *(const bool*) field ? 1 : 0;
+    default:
+      return 0;
+  }
+}
+
+void setParam(const ParamDef& def, void* base, uint16_t value) {
+  uint8_t* field = (uint8_t*) base + def.offset;
+
+  if (value < def.min) value = def.min;
+  if (value > def.max) value = def.max;
+
+  switch (def.type) {
+    case PARAM_U8:
+      *field = value;
+      break;
+    case PARAM_U16:
+      *(uint16_t*) field = value;
+      break;
+    case PARAM_BOOL:
+      *(bool*) field = value != 0;
+      break;
+    default:
+      break;
+  }
+}
+
+CRGB getColorParam(const ParamDef& def, const void* base) {
+  return *(const CRGB*) ((const uint8_t*) base + def.offset);
+}
+
+void setColorParam(const ParamDef& def, void* base, CRGB color) {
+  *(CRGB*) ((uint8_t*) base + def.offset) = color;
+}
+
+static uint16_t clampJson(JsonVariantConst value) {
+  long v = value.is<bool>() ? (value.as<bool>() ? 1 : 0) : value.as<long>();
+
+  if (v < 0) return 0;
+  if (v > 65535) return 65535;
+  return v;
+}
+
+uint8_t applyJson(const ParamDef* defs, uint8_t count, void* base, JsonObjectConst json) {
+  uint8_t changed = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    const ParamDef& def = defs[i];
+
+    if (def.type == PARAM_RGB) {
+      JsonVariantConst red = json["red"];
+      JsonVariantConst green = json["green"];
+      JsonVariantConst blue = json["blue"];
+      if (red.isNull() || green.isNull() || blue.isNull()) continue;
+
+      setColorParam(def, base, CRGB(clampJson(red), clampJson(green), clampJson(blue)));
+      changed++;
+      continue;
+    }
+
+    JsonVariantConst value = json[def.key];
+    if (value.isNull()) continue;
+
+    setParam(def, base, clampJson(value));
+    changed++;
+  }
+
+  return changed;
+}
+
+void writeJson(const ParamDef* defs, uint8_t count, const void* base, JsonWriter& json) {
+  for (uint8_t i = 0; i < count; i++) {
+    const ParamDef& def = defs[i];
+    json.key(def.stateKey);
+
+    if (def.type == PARAM_RGB) {
+      CRGB color = getColorParam(def, base);
+      json.rgbValue(color.red, color.green, color.blue);
+    } else {
+      json.value(getParam(def, base));
+    }
+  }
+}
+
+static void writeWord(uint8_t* image, uint16_t value) {
+  image[0] = value >> 8;
+  image[1] = value & 0xff;
+}
+
+static uint16_t readWord(const uint8_t* image) {
+  return (image[0] << 8) + image[1];
+}
+
+void packParams(const ParamDef* defs, uint8_t count, const void* base, uint8_t* image) {
+  for (uint8_t i = 0; i < count; i++) {
+    const ParamDef& def = defs[i];
+    uint8_t* out = image + def.storage;
+
+    switch (def.type) {
+      case PARAM_U8:
+      case PARAM_BOOL:
+        out[0] = getParam(def, base);
+        break;
+      case PARAM_U16:
+        writeWord(out, getParam(def, base));
+        break;
+      case PARAM_RGB: {
+        CRGB color = getColorParam(def, base);
+        writeWord(out, color.red);
+        writeWord(out + 2, color.green);
+        writeWord(out + 4, color.blue);
+        break;
+      }
+    }
+  }
+}
+
+void unpackParams(const ParamDef* defs, uint8_t count, void* base, const uint8_t* image) {
+  for (uint8_t i = 0; i < count; i++) {
+    const ParamDef& def = defs[i];
+    const uint8_t* in = image + def.storage;
+
+    switch (def.type) {
+      case PARAM_U8:
+      case PARAM_BOOL:
+        setParam(def, base, in[0]);
+        break;
+      case PARAM_U16:
+        setParam(def, base, readWord(in));
+        break;
+      case PARAM_RGB:
+        setColorParam(def, base, CRGB(readWord(in), readWord(in + 2), readWord(in + 4)));
+        break;
+    }
+  }
+}
+
+// A mode's parameters keep their order and spacing from the settings image,
+// shifted down to start at the beginning of image.
+void packModeParams(uint8_t mode, const EffectParams& params, uint8_t* image) {
+  memset(image, 0, MODE_PARAMS_SIZE);
+  if (mode >= NUM_MODES || effectRegistry[mode].paramCount == 0) return;
+
+  const EffectDef& effect = effectRegistry[mode];
+  uint8_t settingsImage[settingsImageSize()];
+  packParams(effect.params, effect.paramCount, &params, settingsImage);
+
+  uint16_t start = imageStart(effect.params, effect.paramCount);
+  memcpy(image, settingsImage + start, paramSpan(effect));
+}
+
+void unpackModeParams(uint8_t mode, EffectParams& params, const uint8_t* image) {
+  if (mode >= NUM_MODES || effectRegistry[mode].paramCount == 0) return;
+
+  const EffectDef& effect = effectRegistry[mode];
+  uint8_t settingsImage[settingsImageSize()];
+  uint16_t start = imageStart(effect.params, effect.paramCount);
+  memcpy(settingsImage + start, image, paramSpan(effect));
+
+  unpackParams(effect.params, effect.paramCount, &params, settingsImage);
+}
+
+static bool keyMatches(const char* stateKey, const char* key, size_t length) {
+  return strncmp(stateKey, key, length) == 0 && stateKey[length] == '\0';
+}
+
+const ParamDef* findParam(const char* key, size_t length, void** base) {
+  for (uint8_t i = 0; i < globalParamCount; i++) {
+    if (!keyMatches(globalParams[i].stateKey, key, length)) continue;
+    *base = &settings;
+    return &globalParams[i];
+  }
+
+  for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+    const EffectDef& effect = effectRegistry[mode];
+
+    for (uint8_t i = 0; i < effect.paramCount; i++) {
+      if (!keyMatches(effect.params[i].stateKey, key, length)) continue;
+      *base = &effectParams;
+      return &effect.params[i];
+    }
+  }
+
+  return nullptr;
+}
+
+uint8_t applySettingsJson(JsonObjectConst json) {
+  uint8_t changed = applyJson(globalParams, globalParamCount, &settings, json);
+
+  if (settings.mode >= NUM_MODES) settings.mode = 0;
+  if (json["mode"].isNull()) return changed;
+
+  const EffectDef& effect = effectRegistry[settings.mode];
+  return changed + applyJson(effect.params, effect.paramCount, &effectParams, json);
+}
+
+void writeSettingsFields(JsonWriter& json) {
+  writeJson(globalParams, globalParamCount, &settings, json);
+
+  for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+    const EffectDef& effect = effectRegistry[mode];
+    writeJson(effect.params, effect.paramCount, &effectParams, json);
+  }
+}
+
+size_t writeSettingsJson(char* buffer, size_t size) {
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  writeSettingsFields(json);
+  json.endObject();
+  return json.overflowed() ? 0 : json.length();
+}
+
+void packSettings(uint8_t* image) {
+  memset(image, 0, SETTINGS_IMAGE_SIZE);
+  packParams(globalParams, globalParamCount, &settings, image);
+
+  for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+    const EffectDef& effect = effectRegistry[mode];
+    packParams(effect.params, effect.paramCount, &effectParams, image);
+  }
+}
+
+void unpackSettings(const uint8_t* image) {
+  unpackParams(globalParams, globalParamCount, &settings, image);
+  if (settings.mode >= NUM_MODES) settings.mode = 0;
+
+  for (uint8_t mode = 0; mode < NUM_MODES; mode++) {
+    const EffectDef& effect = effectRegistry[mode];
+    unpackParams(effect.params, effect.paramCount, &effectParams, image);
+  }
+}
+
+void renderMode(uint8_t mode, const EffectParams& params, uint32_t dt) {
+  if (mode >= NUM_MODES) return;
+  effectRegistry[mode].render(params, dt);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "effects.h"
+#include "json_writer.h"
+#include "scheduler.h"
+
+enum ParamType : uint8_t {
+  PARAM_U8,
+  PARAM_U16,
+  PARAM_BOOL,
+  PARAM_RGB
+};
+
+// One persisted, remotely settable value. key is the name accepted in
+// request bodies, stateKey the name reported by /get_settings. offset is the
+// field's position in the owning struct, storage its byte offset in the
+// settings image (big-endian; RGB is three 16-bit channels).
+struct ParamDef {
+  const char* key;
+  const char* stateKey;
+  ParamType type;
+  uint16_t min;
+  uint16_t max;
+  uint16_t offset;
+  uint16_t storage;
+};
+
+typedef void (*RenderFn)(const EffectParams& p, uint32_t dt);
+
+struct EffectDef {
+  const char* name;
+  RenderFn render;
+  const ParamDef* params;
+  uint8_t paramCount;
+};
+
+enum BlendMode : uint8_t {
+  BLEND_NORMAL,
+  BLEND_ADD
+};
+
+struct GlobalSettings {
+  uint16_t brightness = 5;
+  uint8_t mode = 0;
+  bool ledEnabled = false;
+  uint16_t targetFps = DEFAULT_FPS;
+  bool overlayEnabled = false;
+  uint8_t overlayMode = 7;
+  uint8_t overlayBlend = BLEND_ADD;
+  uint8_t overlayAlpha = 255;
+  uint16_t transitionTime = 800;
+};
+
+extern GlobalSettings settings;
+
+extern const EffectDef effectRegistry[];
+extern const uint8_t NUM_MODES;
+const uint8_t AUDIO_MODE = 11;
+const uint8_t STREAM_MODE = 12;
+const uint8_t PLAYBACK_MODE = 13;
+
+extern const ParamDef globalParams[];
+extern const uint8_t globalParamCount;
+
+extern const uint16_t SETTINGS_IMAGE_SIZE;
+const size_t SETTINGS_JSON_SIZE = 768;
+// Room for one mode's parameters packed on their own, as segments keep them.
+const uint16_t MODE_PARAMS_SIZE = 10;
+
+uint16_t paramWidth(ParamType type);
+
+uint16_t getParam(const ParamDef& def, const void* base);
+void setParam(const ParamDef& def, void* base, uint16_t value);
+CRGB getColorParam(const ParamDef& def, const void* base);
+void setColorParam(const ParamDef& def, void* base, CRGB color);
+
+uint8_t applyJson(const ParamDef* defs, uint8_t count, void* base, JsonObjectConst json);
+void writeJson(const ParamDef* defs, uint8_t count, const void* base, JsonWriter& json);
+
+void packParams(const ParamDef* defs, uint8_t count, const void* base, uint8_t* image);
+void unpackParams(const ParamDef* defs, uint8_t count, void* base, const uint8_t* image);
+
+void packModeParams(uint8_t mode, const EffectParams& params, uint8_t* image);
+void unpackModeParams(uint8_t mode, EffectParams& params, const uint8_t* image);
+
+const ParamDef* findParam(const char* stateKey, size_t length, void** base);
+
+uint8_t applySettingsJson(JsonObjectConst json);
+// Writes every setting as keys of an object the caller has begun.
+void writeSettingsFields(JsonWriter& json);
+size_t writeSettingsJson(char* buffer, size_t size);
+void packSettings(uint8_t* image);
+void unpackSettings(const uint8_t* image);
+
+void renderMode(uint8_t mode, const EffectParams& params, uint32_t dt);
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "effects.h"
+#include "renderer.h"
+
+FrameStats frameStats = {0, 0};
+
+static CRGB* lastFrame = nullptr;
+static uint16_t capacity = 0;
+static uint16_t lastLength = 0;
+static uint8_t lastBrightness = 0;
+static CRGB correction = CRGB(255, 255, 255);
+static bool frameValid = false;
+
+bool allocateFrame(uint16_t length) {
+  if (length > capacity) {
+    free(lastFrame);
+    lastFrame = (CRGB*) calloc(length, sizeof(CRGB));
+    capacity = lastFrame ? length : 0;
+    if (capacity == 0) return false;
+  }
+
+  frameValid = false;
+  return true;
+}
+
+bool showFrame() {
+  uint8_t brightness = FastLED.getBrightness();
+
+  if (numLeds > capacity) {
+    FastLED.show();
+    frameStats.pushed++;
+    return true;
+  }
+
+  if (frameValid && lastLength == numLeds && lastBrightness == brightness &&
+      memcmp(lastFrame, leds, numLeds * sizeof(CRGB)) == 0) {
+    frameStats.skipped++;
+    return false;
+  }
+
+  FastLED.show();
+
+  memcpy(lastFrame, leds, numLeds * sizeof(CRGB));
+  lastLength = numLeds;
+  lastBrightness = brightness;
+  frameValid = true;
+  frameStats.pushed++;
+  return true;
+}
+
+void invalidateFrame() {
+  frameValid = false;
+}
+
+void setFrameCorrection(CRGB c) {
+  if (c == correction && frameValid) return;
+
+  correction = c;
+  FastLED.setCorrection(c);
+  frameValid = false;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <FastLED.h>
+
+struct FrameStats {
+  uint32_t pushed;
+  uint32_t skipped;
+};
+
+extern FrameStats frameStats;
+
+bool allocateFrame(uint16_t length);
+bool showFrame();
+void invalidateFrame();
+void setFrameCorrection(CRGB correction);
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "scheduler.h"
+
+FrameScheduler::FrameScheduler(uint16_t fps) : lag(0), started(false) {
+  memset(&window, 0, sizeof(window));
+  memset(&stats, 0, sizeof(stats));
+  setTargetFps(fps);
+}
+
+void FrameScheduler::setTargetFps(uint16_t f) {
+  if (f == 0 || f > MAX_FPS) f = DEFAULT_FPS;
+
+  fps = f;
+  timestep = 1000000UL / fps;
+  started = false;
+}
+
+uint16_t FrameScheduler::getTargetFps() const {
+  return fps;
+}
+
+bool FrameScheduler::beginFrame(uint32_t now) {
+  if (!started) {
+    nextDeadline = now;
+    windowStart = now;
+    subMillis = 0;
+    started = true;
+  }
+
+  if ((int32_t) (now - nextDeadline) < 0) return false;
+
+  lag = now - nextDeadline;
+  uint32_t steps = 1 + lag / timestep;
+
+  if (steps > 1) {
+    window.late++;
+    window.skipped += steps - 1;
+  }
+
+  if (steps > MAX_CATCH_UP_STEPS) {
+    steps = MAX_CATCH_UP_STEPS;
+    nextDeadline = now + timestep;
+  } else {
+    nextDeadline += steps * timestep;
+  }
+
+  subMillis += steps * timestep;
+  delta = subMillis / 1000;
+  subMillis %= 1000;
+
+  if (now - windowStart >= 1000000UL) {
+    stats = window;
+    memset(&window, 0, sizeof(window));
+    windowStart = now;
+  }
+
+  frameStart = now;
+  window.frames++;
+  return true;
+}
+
+void FrameScheduler::endFrame(uint32_t now) {
+  window.busyMicros += now - frameStart;
+}
+
+uint32_t FrameScheduler::frameDelta() const {
+  return delta;
+}
+
+uint32_t FrameScheduler::frameLag() const {
+  return lag;
+}
+
+uint32_t FrameScheduler::idleBudget(uint32_t now) const {
+  if (!started || (int32_t) (nextDeadline - now) <= 0) return 0;
+  return nextDeadline - now;
+}
+
+void FrameScheduler::addIdle(uint32_t micros) {
+  window.idleMicros += micros;
+}
+
+const SchedulerStats& FrameScheduler::getStats() const {
+  return stats;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+const uint16_t DEFAULT_FPS = 60;
+const uint16_t MAX_FPS = 240;
+
+struct SchedulerStats {
+  uint16_t frames;
+  uint16_t late;
+  uint16_t skipped;
+  uint32_t busyMicros;
+  uint32_t idleMicros;
+};
+
+// Drives rendering at a fixed target rate. The simulation advances in whole
+// timesteps; when the loop falls behind, missed steps are folded into the
+// next frame's dt (up to MAX_CATCH_UP_STEPS) and reported as skipped.
+class FrameScheduler {
+public:
+  explicit FrameScheduler(uint16_t fps);
+
+  void setTargetFps(uint16_t fps);
+  uint16_t getTargetFps() const;
+
+  bool beginFrame(uint32_t now);
+  void endFrame(uint32_t now);
+  uint32_t frameDelta() const;
+  uint32_t frameLag() const;
+
+  uint32_t idleBudget(uint32_t now) const;
+  void addIdle(uint32_t micros);
+
+  const SchedulerStats& getStats() const;
+
+private:
+  static const uint16_t MAX_CATCH_UP_STEPS = 4;
+
+  uint16_t fps;
+  uint32_t timestep;
+  uint32_t nextDeadline;
+  uint32_t frameStart;
+  uint32_t subMillis;
+  uint32_t delta;
+  uint32_t lag;
+  bool started;
+
+  uint32_t windowStart;
+  SchedulerStats window;
+  SchedulerStats stats;
+};
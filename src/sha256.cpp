@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "sha256.h"
+
+static const uint32_t ROUND_CONSTANTS[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotate(uint32_t value, uint8_t bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+Sha256::Sha256() {
+  reset();
+}
+
+void Sha256::reset() {
+  static const uint32_t initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(state, initial, sizeof(state));
+  used = 0;
+  length = 0;
+}
+
+void Sha256::compress(const uint8_t* in) {
+  uint32_t w[64];
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = ((uint32_t) in[i * 4] << 24) | ((uint32_t) in[i * 4 + 1] << 16) | (in[i * 4 + 2] << 8) | in[i * 4 + 3];
+  }
+  for (uint8_t i = 16; i < 64; i++) {
+    uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (uint8_t i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + ROUND_CONSTANTS[i] + w[i];
+    uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void Sha256::update(const uint8_t* data, size_t len) {
+  length += len;
+
+  while (len > 0) {
+    size_t take = sizeof(block) - used;
+    if (take > len) take = len;
+
+    // Whole blocks are compressed straight from the input.
+    if (used == 0 && take == sizeof(block)) {
+      compress(data);
+    } else {
+      memcpy(block + used, data, take);
+      used += take;
+      if (used == sizeof(block)) {
+        compress(block);
+        used = 0;
+      }
+    }
+    data += take;
+    len -= take;
+  }
+}
+
+void Sha256::finish(uint8_t digest[SHA256_SIZE]) {
+  uint64_t bits = length * 8;
+
+  block[used++] = 0x80;
+  if (used > 56) {
+    memset(block + used, 0, sizeof(block) - used);
+    compress(block);
+    used = 0;
+  }
+  memset(block + used, 0, 56 - used);
+  for (uint8_t i = 0; i < 8; i++) block[56 + i] = bits >> (56 - i * 8);
+  compress(block);
+
+  for (uint8_t i = 0; i < 8; i++) {
+    digest[i * 4] = state[i] >> 24;
+    digest[i * 4 + 1] = state[i] >> 16;
+    digest[i * 4 + 2] = state[i] >> 8;
+    digest[i * 4 + 3] = state[i];
+  }
+  reset();
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool parseSha256(const char* hex, uint8_t digest[SHA256_SIZE]) {
+  if (!hex || strlen(hex) != SHA256_SIZE * 2) return false;
+
+  for (size_t i = 0; i < SHA256_SIZE; i++) {
+    int high = hexDigit(hex[i * 2]);
+    int low = hexDigit(hex[i * 2 + 1]);
+    if (high < 0 || low < 0) return false;
+    digest[i] = (high << 4) | low;
+  }
+  return true;
+}
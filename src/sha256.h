@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t SHA256_SIZE = 32;
+
+// FIPS 180-4 SHA-256, fed in pieces of any size.
+class Sha256 {
+public:
+  Sha256();
+
+  void reset();
+  void update(const uint8_t* data, size_t len);
+  void finish(uint8_t digest[SHA256_SIZE]);
+
+private:
+  void compress(const uint8_t* block);
+
+  uint32_t state[8];
+  uint8_t block[64];
+  uint8_t used;
+  uint64_t length;
+};
+
+// Reads 64 hex digits, either case, into a digest.
+bool parseSha256(const char* hex, uint8_t digest[SHA256_SIZE]);
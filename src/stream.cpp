@@ -0,0 +1,184 @@
+#include <string.h>
+
+#include "effects.h"
+#include "stream.h"
+
+static const uint8_t DDP_FLAG_VERSION = 0x40;
+static const uint8_t DDP_FLAG_VERSION_MASK = 0xC0;
+static const uint8_t DDP_FLAG_TIMECODE = 0x10;
+static const uint8_t DDP_FLAG_QUERY = 0x08;
+static const uint8_t DDP_FLAG_PUSH = 0x01;
+static const uint8_t DDP_ID_DISPLAY = 1;
+static const uint8_t DDP_ID_ALL = 255;
+
+static const uint8_t E131_ACN_ID[12] = {'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0};
+static const uint32_t E131_ROOT_VECTOR = 0x00000004;
+static const uint32_t E131_FRAME_VECTOR = 0x00000002;
+static const uint8_t E131_DMP_VECTOR = 0x02;
+static const uint8_t E131_OPTION_PREVIEW = 0x80;
+static const uint8_t E131_OPTION_TERMINATED = 0x40;
+
+static uint16_t read16(const uint8_t* p) {
+  return (uint16_t) p[0] << 8 | p[1];
+}
+
+static uint32_t read32(const uint8_t* p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+PixelStream::PixelStream() : ddpSequence(0), lastPacket(0), receiving(false), frameReady(false) {
+  memset(universeSequence, 0, sizeof(universeSequence));
+  memset(&stats, 0, sizeof(stats));
+  resetSequences();
+}
+
+size_t PixelStream::ddpHeaderSize(const uint8_t* header, size_t length) const {
+  if (length < 1) return DDP_HEADER_SIZE;
+  return header[0] & DDP_FLAG_TIMECODE ? DDP_HEADER_SIZE + DDP_TIMECODE_SIZE : DDP_HEADER_SIZE;
+}
+
+bool PixelStream::beginDdp(const uint8_t* header, size_t headerLength, size_t packetLength, uint32_t now, StreamSpan& span) {
+  stats.packets++;
+  if (!active(now)) resetSequences();
+
+  size_t size = ddpHeaderSize(header, headerLength);
+  if (headerLength < size || (header[0] & DDP_FLAG_VERSION_MASK) != DDP_FLAG_VERSION ||
+      (header[0] & DDP_FLAG_QUERY) || (header[3] != DDP_ID_DISPLAY && header[3] != DDP_ID_ALL)) {
+    stats.invalid++;
+    return false;
+  }
+
+  // Sequence numbers run 1..15; 0 means the sender does not use them.
+  uint8_t sequence = header[1] & 0x0F;
+  if (sequence != 0 && !acceptSequence(ddpSequence, ddpSeen, sequence - 1, 15)) return false;
+
+  size_t length = read16(header + 8);
+  if (length > packetLength - size) {
+    stats.invalid++;
+    return false;
+  }
+
+  return place(read32(header + 4), length, header[0] & DDP_FLAG_PUSH, now, span);
+}
+
+bool PixelStream::beginE131(const uint8_t* header, size_t headerLength, size_t packetLength, uint32_t now, StreamSpan& span) {
+  stats.packets++;
+  if (!active(now)) resetSequences();
+
+  if (headerLength < E131_HEADER_SIZE || read16(header) != 0x0010 || memcmp(header + 4, E131_ACN_ID, sizeof(E131_ACN_ID)) != 0 ||
+      read32(header + 18) != E131_ROOT_VECTOR || read32(header + 40) != E131_FRAME_VECTOR ||
+      header[117] != E131_DMP_VECTOR || header[125] != 0) {
+    stats.invalid++;
+    return false;
+  }
+
+  uint8_t options = header[112];
+  if (options & (E131_OPTION_PREVIEW | E131_OPTION_TERMINATED)) return false;
+
+  uint16_t universe = read16(header + 113);
+  if (universe < E131_FIRST_UNIVERSE || universe - E131_FIRST_UNIVERSE >= MAX_UNIVERSES) return false;
+  uint16_t index = universe - E131_FIRST_UNIVERSE;
+
+  if (!acceptSequence(universeSequence[index], universeSeen[index], header[111], 0)) return false;
+
+  // The property count includes the start code.
+  size_t length = read16(header + 123);
+  if (length == 0 || length - 1 > packetLength - E131_HEADER_SIZE) {
+    stats.invalid++;
+    return false;
+  }
+  length--;
+  if (length > E131_CHANNELS_PER_UNIVERSE) length = E131_CHANNELS_PER_UNIVERSE;
+
+  size_t offset = (size_t) index * E131_CHANNELS_PER_UNIVERSE;
+  return place(offset, length, offset + E131_CHANNELS_PER_UNIVERSE >= (size_t) numLeds * 3, now, span);
+}
+
+void PixelStream::endPacket(const StreamSpan& span) {
+  if (!span.push) return;
+
+  if (frameReady) stats.framesOverwritten++;
+  frameReady = true;
+  stats.frames++;
+}
+
+bool PixelStream::handleDdp(const uint8_t* packet, size_t length, uint32_t now) {
+  StreamSpan span;
+  size_t size = ddpHeaderSize(packet, length);
+  if (!beginDdp(packet, length, length, now, span)) return false;
+
+  memcpy(span.target, packet + size, span.length);
+  endPacket(span);
+  return true;
+}
+
+bool PixelStream::handleE131(const uint8_t* packet, size_t length, uint32_t now) {
+  StreamSpan span;
+  if (!beginE131(packet, length, length, now, span)) return false;
+
+  memcpy(span.target, packet + E131_HEADER_SIZE, span.length);
+  endPacket(span);
+  return true;
+}
+
+bool PixelStream::takeFrame() {
+  if (!frameReady) return false;
+
+  frameReady = false;
+  return true;
+}
+
+bool PixelStream::active(uint32_t now) const {
+  return receiving && now - lastPacket < STREAM_TIMEOUT;
+}
+
+const StreamStats& PixelStream::getStats() const {
+  return stats;
+}
+
+void PixelStream::resetSequences() {
+  ddpSeen = false;
+  memset(universeSeen, 0, sizeof(universeSeen));
+}
+
+// modulus 0 means a plain 8-bit counter, compared as E1.31 does: anything
+// from 19 behind up to the last value is stale, anything else moves on.
+bool PixelStream::acceptSequence(uint8_t& last, bool& seen, uint8_t sequence, uint8_t modulus) {
+  int16_t diff;
+  if (modulus == 0) diff = (int8_t) (sequence - last);
+  else diff = (sequence + modulus - last) % modulus;
+
+  if (!seen) {
+    diff = 1;
+    seen = true;
+  }
+
+  bool stale = modulus == 0 ? diff <= 0 && diff > -20 : diff == 0 || diff > modulus / 2;
+  if (stale) {
+    stats.outOfOrder++;
+    return false;
+  }
+
+  if (diff > 1) stats.lost += diff - 1;
+  last = sequence;
+  return true;
+}
+
+bool PixelStream::place(size_t offset, size_t length, bool push, uint32_t now, StreamSpan& span) {
+  size_t capacity = (size_t) numLeds * 3;
+
+  if (offset >= capacity) {
+    length = 0;
+    offset = capacity;
+  } else if (length > capacity - offset) {
+    length = capacity - offset;
+  }
+
+  span.target = (uint8_t*) leds + offset;
+  span.length = length;
+  span.push = push || (length > 0 && offset + length == capacity);
+
+  receiving = true;
+  lastPacket = now;
+  return true;
+}
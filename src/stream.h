@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint16_t DDP_PORT = 4048;
+const uint16_t E131_PORT = 5568;
+const uint16_t E131_FIRST_UNIVERSE = 1;
+const uint16_t E131_CHANNELS_PER_UNIVERSE = 510;
+
+const size_t DDP_HEADER_SIZE = 10;
+const size_t DDP_TIMECODE_SIZE = 4;
+const size_t E131_HEADER_SIZE = 126;
+
+const uint32_t STREAM_TIMEOUT = 2500;
+
+struct StreamStats {
+  uint32_t packets;
+  uint32_t frames;
+  uint32_t framesOverwritten;
+  uint32_t lost;
+  uint32_t outOfOrder;
+  uint32_t invalid;
+};
+
+// Where a packet's pixel bytes go: straight into leds[], so the receiver
+// can read the payload in place after the header.
+struct StreamSpan {
+  uint8_t* target;
+  size_t length;
+  bool push;
+};
+
+// Decodes DDP and E1.31 (sACN) pixel packets into leds[]. Headers are
+// parsed separately from the payload; the caller reads the payload into
+// span.target and then calls endPacket(). Packets that arrive behind the
+// sender's sequence are dropped; gaps are counted as lost.
+class PixelStream {
+public:
+  PixelStream();
+
+  size_t ddpHeaderSize(const uint8_t* header, size_t length) const;
+  bool beginDdp(const uint8_t* header, size_t headerLength, size_t packetLength, uint32_t now, StreamSpan& span);
+  bool beginE131(const uint8_t* header, size_t headerLength, size_t packetLength, uint32_t now, StreamSpan& span);
+  void endPacket(const StreamSpan& span);
+
+  bool handleDdp(const uint8_t* packet, size_t length, uint32_t now);
+  bool handleE131(const uint8_t* packet, size_t length, uint32_t now);
+
+  bool takeFrame();
+  bool active(uint32_t now) const;
+  const StreamStats& getStats() const;
+
+private:
+  static const uint8_t MAX_UNIVERSES = 8;
+
+  void resetSequences();
+  bool acceptSequence(uint8_t& last, bool& seen, uint8_t sequence, uint8_t modulus);
+  bool place(size_t offset, size_t length, bool push, uint32_t now, StreamSpan& span);
+
+  uint8_t ddpSequence;
+  bool ddpSeen;
+  uint8_t universeSequence[MAX_UNIVERSES];
+  bool universeSeen[MAX_UNIVERSES];
+  uint32_t lastPacket;
+  bool receiving;
+  bool frameReady;
+  StreamStats stats;
+};
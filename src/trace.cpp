@@ -0,0 +1,120 @@
+#ifdef PLUMBOB_TRACE
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#define IRAM_ATTR
+#endif
+
+#include "trace.h"
+#include "window_writer.h"
+
+struct TraceEvent {
+  uint32_t micros;
+  const char* name;
+  uint16_t tag;
+  char phase;
+  uint8_t track;
+};
+
+static const char* const trackNames[TRACK_COUNT] = {"loop", "http", "wifi", "isr"};
+
+static TraceEvent ring[TRACE_EVENTS];
+static volatile uint32_t head = 0;
+static volatile bool paused = false;
+
+static inline uint32_t IRAM_ATTR now() {
+#ifdef ARDUINO
+  return micros();
+#else
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+}
+
+// Taking a slot is the only step writers share. The ESP8266 has no atomic
+// read-modify-write, so interrupts are held off for those few instructions.
+static inline uint32_t IRAM_ATTR takeSlot() {
+#ifdef ARDUINO
+  uint32_t state = xt_rsil(15);
+  uint32_t slot = head++;
+  xt_wsr_ps(state);
+  return slot;
+#else
+  return __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// Never 0, so a slot being written can be told from a finished one.
+static inline uint16_t slotTag(uint32_t slot) {
+  return (uint16_t) (slot | 0x8000);
+}
+
+void IRAM_ATTR traceEvent(uint8_t track, char phase, const char* name) {
+  if (paused) return;
+
+  uint32_t slot = takeSlot();
+  TraceEvent& event = ring[slot % TRACE_EVENTS];
+  event.tag = 0;
+  __asm__ __volatile__("" ::: "memory");
+
+  event.micros = now();
+  event.name = name;
+  event.phase = phase;
+  event.track = track;
+  __asm__ __volatile__("" ::: "memory");
+
+  event.tag = slotTag(slot);
+}
+
+void pauseTrace(bool p) {
+  paused = p;
+}
+
+size_t writeTraceJson(char* buffer, size_t size, size_t offset) {
+  WindowWriter out(buffer, size, offset);
+  out.append("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+  for (uint8_t track = 0; track < TRACK_COUNT; track++) {
+    if (track > 0) out.append(',');
+    out.append("\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": ");
+    out.appendNumber(track);
+    out.append(", \"args\": {\"name\": \"");
+    out.append(trackNames[track]);
+    out.append("\"}}");
+  }
+
+  uint32_t end = head;
+  uint32_t start = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+  bool first = true;
+  uint32_t base = 0;
+
+  for (uint32_t slot = start; slot < end && !out.full(); slot++) {
+    const TraceEvent& event = ring[slot % TRACE_EVENTS];
+    if (event.tag != slotTag(slot)) continue;
+
+    // Timestamps count from the oldest event, which also hides micros()
+    // wrapping around.
+    if (first) {
+      base = event.micros;
+      first = false;
+    }
+
+    out.append(",\n{\"name\": \"");
+    out.append(event.name);
+    out.append("\", \"ph\": \"");
+    out.append(event.phase);
+    out.append("\", \"ts\": ");
+    out.appendNumber(event.micros - base);
+    out.append(", \"pid\": 1, \"tid\": ");
+    out.appendNumber(event.track);
+    if (event.phase == TRACE_PHASE_INSTANT) out.append(", \"s\": \"t\"");
+    out.append('}');
+  }
+
+  out.append("\n]}\n");
+  return out.length();
+}
+
+#endif
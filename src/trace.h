@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 512
+#endif
+
+enum TraceTrack : uint8_t {
+  TRACK_LOOP,
+  TRACK_HTTP,
+  TRACK_WIFI,
+  TRACK_ISR,
+  TRACK_COUNT
+};
+
+enum TracePhase : char {
+  TRACE_PHASE_BEGIN = 'B',
+  TRACE_PHASE_END = 'E',
+  TRACE_PHASE_INSTANT = 'i'
+};
+
+// A ring of the last TRACE_EVENTS begin, end and instant events, built with
+// PLUMBOB_TRACE only. Writers never wait: each takes the next slot, fills it
+// and tags it last, so traceEvent() is safe from interrupts and async
+// callbacks, and a slot caught half written is left out of the dump. Names
+// must be string literals or otherwise outlive the ring.
+void traceEvent(uint8_t track, char phase, const char* name);
+
+// Stops recording so the ring holds still while it is dumped.
+void pauseTrace(bool paused);
+
+// Renders the ring as Chrome trace_event JSON, viewable in Perfetto or
+// chrome://tracing, windowed like writeMetrics(): it copies the part
+// starting offset bytes in and returns its length, or with size 0 the
+// length of the whole text. Only consistent while paused.
+size_t writeTraceJson(char* buffer, size_t size, size_t offset);
+
+#ifdef PLUMBOB_TRACE
+#define TRACE_BEGIN(track, name) traceEvent(track, TRACE_PHASE_BEGIN, name)
+#define TRACE_END(track, name) traceEvent(track, TRACE_PHASE_END, name)
+#define TRACE_INSTANT(track, name) traceEvent(track, TRACE_PHASE_INSTANT, name)
+#else
+#define TRACE_BEGIN(track, name) do {} while (0)
+#define TRACE_END(track, name) do {} while (0)
+#define TRACE_INSTANT(track, name) do {} while (0)
+#endif
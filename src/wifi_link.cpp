@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "wifi_link.h"
+
+WifiLink::WifiLink() : state(LINK_IDLE), attemptStart(0), retryAt(0), backoff(MIN_BACKOFF), downSince(0), everUp(false) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+void WifiLink::start(uint32_t now) {
+  downSince = now;
+  retryIn(now, 0);
+}
+
+bool WifiLink::poll(uint32_t now) {
+  if (state == LINK_CONNECTING && now - attemptStart >= CONNECT_TIMEOUT) {
+    retryIn(now, backoff);
+    return false;
+  }
+
+  if (state != LINK_BACKOFF || (int32_t) (now - retryAt) < 0) return false;
+
+  state = LINK_CONNECTING;
+  attemptStart = now;
+  stats.attempts++;
+  return true;
+}
+
+void WifiLink::linkUp(uint32_t now) {
+  if (state == LINK_UP) return;
+
+  if (everUp) {
+    stats.lastReconnectMillis = now - downSince;
+    if (stats.lastReconnectMillis > stats.maxReconnectMillis) stats.maxReconnectMillis = stats.lastReconnectMillis;
+  }
+
+  state = LINK_UP;
+  backoff = MIN_BACKOFF;
+  everUp = true;
+  stats.connects++;
+}
+
+void WifiLink::linkDown(uint32_t now) {
+  if (state == LINK_UP) {
+    stats.drops++;
+    downSince = now;
+    retryIn(now, 0);
+  } else if (state == LINK_CONNECTING) {
+    retryIn(now, backoff);
+  }
+}
+
+LinkState WifiLink::getState() const {
+  return state;
+}
+
+const char* WifiLink::stateName() const {
+  switch (state) {
+    case LINK_CONNECTING: return "connecting";
+    case LINK_UP: return "up";
+    case LINK_BACKOFF: return "backoff";
+    default: return "idle";
+  }
+}
+
+uint32_t WifiLink::downMillis(uint32_t now) const {
+  if (state == LINK_UP || state == LINK_IDLE) return 0;
+  return now - downSince;
+}
+
+const LinkStats& WifiLink::getStats() const {
+  return stats;
+}
+
+void WifiLink::retryIn(uint32_t now, uint32_t wait) {
+  state = LINK_BACKOFF;
+  retryAt = now + wait;
+
+  if (wait > 0) {
+    backoff *= 2;
+    if (backoff > MAX_BACKOFF) backoff = MAX_BACKOFF;
+  }
+}
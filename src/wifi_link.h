@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+enum LinkState : uint8_t {
+  LINK_IDLE,
+  LINK_CONNECTING,
+  LINK_UP,
+  LINK_BACKOFF
+};
+
+struct LinkStats {
+  uint32_t attempts;
+  uint32_t connects;
+  uint32_t drops;
+  uint32_t lastReconnectMillis;
+  uint32_t maxReconnectMillis;
+};
+
+// Station connection state machine. It never blocks: the radio reports
+// linkUp/linkDown events, and poll() says when to issue the next
+// connection attempt. Failed attempts back off exponentially up to
+// MAX_BACKOFF; a dropped link is retried immediately.
+class WifiLink {
+public:
+  WifiLink();
+
+  void start(uint32_t now);
+  bool poll(uint32_t now);
+
+  void linkUp(uint32_t now);
+  void linkDown(uint32_t now);
+
+  LinkState getState() const;
+  const char* stateName() const;
+  uint32_t downMillis(uint32_t now) const;
+  const LinkStats& getStats() const;
+
+private:
+  static const uint32_t CONNECT_TIMEOUT = 15000;
+  static const uint32_t MIN_BACKOFF = 500;
+  static const uint32_t MAX_BACKOFF = 30000;
+
+  void retryIn(uint32_t now, uint32_t wait);
+
+  LinkState state;
+  uint32_t attemptStart;
+  uint32_t retryAt;
+  uint32_t backoff;
+  uint32_t downSince;
+  bool everUp;
+  LinkStats stats;
+};
@@ -0,0 +1,29 @@
+#include "window_writer.h"
+
+WindowWriter::WindowWriter(char* buffer, size_t size, size_t offset) :
+  buffer(buffer), size(size), offset(offset), position(0), used(0) {
+}
+
+void WindowWriter::append(const char* text) {
+  while (*text) append(*text++);
+}
+
+void WindowWriter::appendNumber(uint64_t number) {
+  char digits[20];
+  uint8_t count = 0;
+
+  do {
+    digits[count++] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+
+  while (count > 0) append(digits[--count]);
+}
+
+bool WindowWriter::full() const {
+  return size > 0 && used == size;
+}
+
+size_t WindowWriter::length() const {
+  return size > 0 ? used : position;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Appends text into a window of a longer output: bytes before offset are
+// counted but dropped, and so is everything once the buffer is full.
+// Rendering the same output again from the next offset continues where the
+// last window stopped, so a response can be sent in pieces without holding
+// the whole text. With size 0 only the length is counted.
+class WindowWriter {
+public:
+  WindowWriter(char* buffer, size_t size, size_t offset);
+
+  void append(char c) {
+    if (position++ < offset || used == size) return;
+    buffer[used++] = c;
+  }
+
+  void append(const char* text);
+  void appendNumber(uint64_t number);
+
+  bool full() const;
+  size_t length() const;
+
+private:
+  char* buffer;
+  size_t size;
+  size_t offset;
+  size_t position;
+  size_t used;
+};